@@ -0,0 +1,138 @@
+//
+// SPDX-FileCopyrightText: 2024 Stephen F. Booth <contact@sbooth.dev>
+// SPDX-License-Identifier: MIT
+//
+// Part of https://github.com/sbooth/cio
+//
+
+// Measures the compression ratio and throughput of the cio::lz77 codec and of cio::compressed_writer and
+// cio::compressed_reader on synthetic data.
+//
+// Run with `swift run -c release compression-benchmark`.
+
+#import <algorithm>
+#import <chrono>
+#import <cstdint>
+#import <cstdio>
+#import <cstring>
+#import <random>
+#import <string>
+#import <vector>
+
+#import "compressed_stream.hpp"
+
+namespace {
+
+/// Returns log-like text of `size` bytes.
+std::vector<unsigned char> make_text(std::size_t size) {
+    static const char *const levels[] = {"INFO", "WARN", "DEBUG", "ERROR"};
+    std::mt19937 rng{1};
+    std::string text;
+    while (text.size() < size) {
+        text += "2024-06-22T22:26:" + std::to_string(10 + rng() % 50) + "Z " + levels[rng() % 4] +
+                " request id=" + std::to_string(rng() % 1000000) + " path=/api/v1/items/" +
+                std::to_string(rng() % 5000) + " status=200 duration_ms=" + std::to_string(rng() % 300) + "\n";
+    }
+    return {text.begin(), text.begin() + static_cast<std::ptrdiff_t>(size)};
+}
+
+/// Returns little-endian records of slowly varying integers totalling `size` bytes.
+std::vector<unsigned char> make_records(std::size_t size) {
+    std::mt19937 rng{2};
+    std::vector<unsigned char> data(size);
+    std::uint32_t timestamp = 1'700'000'000, value = 5000;
+    for (std::size_t i = 0; i + 8 <= size; i += 8) {
+        timestamp += 1 + rng() % 2;
+        value += rng() % 7 - 3;
+        std::memcpy(&data[i], &timestamp, 4);
+        std::memcpy(&data[i + 4], &value, 4);
+    }
+    return data;
+}
+
+/// Returns `size` random bytes.
+std::vector<unsigned char> make_random(std::size_t size) {
+    std::mt19937 rng{3};
+    std::vector<unsigned char> data(size);
+    for (auto &byte : data) {
+        byte = static_cast<unsigned char>(rng());
+    }
+    return data;
+}
+
+/// Returns the seconds taken by the fastest of `runs` calls to `f`.
+template <typename F> double time_best(int runs, F f) {
+    auto best = 1e30;
+    for (int i = 0; i < runs; ++i) {
+        auto start = std::chrono::steady_clock::now();
+        f();
+        best = std::min(best, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+    }
+    return best;
+}
+
+/// Benchmarks the block codec and the stream classes on `data`.
+void run(const char *name, const std::vector<unsigned char> &data) {
+    const double gb = static_cast<double>(data.size()) / 1e9;
+    constexpr std::size_t block_size = cio::compressed_format::default_block_size;
+
+    // Block codec
+    std::vector<unsigned char> compressed(cio::lz77::compress_bound(block_size));
+    std::vector<unsigned char> decompressed(block_size);
+    std::vector<std::pair<std::size_t, std::vector<unsigned char>>> blocks;
+    std::size_t compressed_size = 0;
+    auto compress_seconds = time_best(3, [&] {
+        blocks.clear();
+        compressed_size = 0;
+        for (std::size_t offset = 0; offset < data.size(); offset += block_size) {
+            auto length = std::min(block_size, data.size() - offset);
+            auto n = cio::lz77::compress(&data[offset], length, compressed.data(), compressed.size());
+            blocks.emplace_back(length, std::vector<unsigned char>(compressed.begin(), compressed.begin() + n));
+            compressed_size += n;
+        }
+    });
+    auto decompress_seconds = time_best(3, [&] {
+        for (const auto &[length, block] : blocks) {
+            if (cio::lz77::decompress(block.data(), block.size(), decompressed.data(), decompressed.size()) != length) {
+                std::fprintf(stderr, "%s: decompression failed\n", name);
+            }
+        }
+    });
+
+    // Streams over an in-memory file
+    auto file = cio::cstream::memfd("compression-benchmark");
+    auto write_seconds = time_best(3, [&] {
+        file.rewind();
+        cio::compressed_writer writer{file};
+        writer.fwrite(data.data(), 1, data.size());
+        writer.finish();
+        file.fflush();
+    });
+    std::vector<unsigned char> output(64 * 1024);
+    auto read = [&](bool background) {
+        return time_best(3, [&] {
+            file.rewind();
+            cio::compressed_reader reader{file, background};
+            while (reader.fread(output.data(), 1, output.size()) > 0) {
+            }
+        });
+    };
+    auto read_inline_seconds = read(false);
+    auto read_background_seconds = read(true);
+
+    std::printf("%-8s %6.3f %10.2f %10.2f %10.2f %10.2f %10.2f\n", name,
+                static_cast<double>(compressed_size) / static_cast<double>(data.size()), gb / compress_seconds,
+                gb / decompress_seconds, gb / write_seconds, gb / read_inline_seconds, gb / read_background_seconds);
+}
+
+} /* namespace */
+
+int main() {
+    constexpr std::size_t size = 64 * 1024 * 1024;
+    std::printf("%-8s %6s %10s %10s %10s %10s %10s\n", "data", "ratio", "comp GB/s", "dec GB/s", "write GB/s",
+                "read GB/s", "read bg");
+    run("text", make_text(size));
+    run("records", make_records(size));
+    run("random", make_random(size));
+    return 0;
+}
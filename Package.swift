@@ -20,10 +20,27 @@ let package = Package(
     targets: [
         .target(
             name: "cio"),
+        .executableTarget(
+            name: "compression-benchmark",
+            dependencies: [
+                "cio",
+            ],
+            path: "Benchmarks/compression"),
+        .target(
+            name: "cioTestSupport",
+            dependencies: [
+                "cio",
+            ],
+            path: "Tests/cioTestSupport",
+            cxxSettings: [
+                // cio::generator requires coroutines
+                .unsafeFlags(["-std=c++20"]),
+            ]),
         .testTarget(
             name: "cioTests",
             dependencies: [
                 "cio",
+                "cioTestSupport",
             ],
             swiftSettings: [
                 .interoperabilityMode(.Cxx),
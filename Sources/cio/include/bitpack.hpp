@@ -0,0 +1,435 @@
+//
+// SPDX-FileCopyrightText: 2024 Stephen F. Booth <contact@sbooth.dev>
+// SPDX-License-Identifier: MIT
+//
+// Part of https://github.com/sbooth/cio
+//
+
+#import <algorithm>
+#import <array>
+#import <cstddef>
+#import <cstdint>
+#import <cstring>
+#import <utility>
+#import <vector>
+
+#if defined(__SSE2__)
+#import <emmintrin.h>
+#endif
+#if defined(__ARM_NEON)
+#import <arm_neon.h>
+#endif
+
+namespace cio {
+
+/// Integer codecs combining delta coding, zigzag coding and frame-of-reference bit-packing.
+///
+/// Unsigned 32-bit integers are coded in blocks of `block_size` values. A block stores the differences between
+/// consecutive values less their minimum, packed at the bit width of the largest. Sorted values with small gaps, such
+/// as posting lists and offset tables, take a few bits each; any sequence round-trips.
+///
+/// An encoded block is a width byte, the minimum difference as a little-endian `uint32_t` and `16 * width` bytes of
+/// packed values. Packing interleaves four lanes, so that value `i` is in lane `i % 4`, and each lane fills
+/// little-endian 32-bit words from the least significant bit. Decoding unpacks four values per instruction with SSE2
+/// or NEON and restores them with a vector prefix sum; the layout is the same on every target.
+namespace bitpack {
+
+/// The number of values in a block.
+constexpr std::size_t block_size = 128;
+
+/// The size of an encoded block header in bytes.
+constexpr std::size_t block_header_size = 5;
+
+/// The largest size of an encoded block in bytes.
+constexpr std::size_t max_block_bytes = block_header_size + block_size * 4;
+
+/// The value returned by `decode()` for malformed or truncated input.
+constexpr std::size_t error = static_cast<std::size_t>(-1);
+
+/// Returns the largest encoded size of `count` values.
+[[nodiscard]]
+constexpr std::size_t encoded_bound(std::size_t count) noexcept {
+    return (count + block_size - 1) / block_size * max_block_bytes;
+}
+
+/// Returns the size of an encoded block whose header starts with `width`, or `0` if `width` is invalid.
+[[nodiscard]]
+constexpr std::size_t block_bytes(unsigned width) noexcept {
+    return width <= 32 ? block_header_size + 16 * width : 0;
+}
+
+/// Maps a signed integer to an unsigned integer so that values near zero have few significant bits.
+[[nodiscard]]
+constexpr std::uint32_t zigzag_encode(std::int32_t value) noexcept {
+    auto bits = static_cast<std::uint32_t>(value);
+    return (bits << 1) ^ (0u - (bits >> 31));
+}
+
+/// Reverses `zigzag_encode()`.
+[[nodiscard]]
+constexpr std::int32_t zigzag_decode(std::uint32_t value) noexcept {
+    return static_cast<std::int32_t>((value >> 1) ^ (0u - (value & 1)));
+}
+
+namespace detail {
+
+#if defined(__SSE2__)
+/// Four 32-bit lanes.
+using lanes = __m128i;
+
+inline lanes load(const void *p) noexcept { return _mm_loadu_si128(static_cast<const __m128i *>(p)); }
+inline void store(void *p, lanes v) noexcept { _mm_storeu_si128(static_cast<__m128i *>(p), v); }
+inline lanes splat(std::uint32_t x) noexcept { return _mm_set1_epi32(static_cast<int>(x)); }
+inline lanes add(lanes a, lanes b) noexcept { return _mm_add_epi32(a, b); }
+inline lanes bit_or(lanes a, lanes b) noexcept { return _mm_or_si128(a, b); }
+inline lanes bit_and(lanes a, lanes b) noexcept { return _mm_and_si128(a, b); }
+inline lanes shift_left(lanes v, unsigned n) noexcept { return _mm_slli_epi32(v, static_cast<int>(n)); }
+inline lanes shift_right(lanes v, unsigned n) noexcept { return _mm_srli_epi32(v, static_cast<int>(n)); }
+
+/// Returns the running sums of the lanes of `v` added to the last lane of `previous`.
+inline lanes prefix_sum(lanes v, lanes previous) noexcept {
+    v = add(v, _mm_slli_si128(v, 4));
+    v = add(v, _mm_slli_si128(v, 8));
+    return add(v, _mm_shuffle_epi32(previous, 0xff));
+}
+#elif defined(__ARM_NEON)
+/// Four 32-bit lanes.
+using lanes = uint32x4_t;
+
+inline lanes load(const void *p) noexcept {
+    return vreinterpretq_u32_u8(vld1q_u8(static_cast<const std::uint8_t *>(p)));
+}
+inline void store(void *p, lanes v) noexcept { vst1q_u8(static_cast<std::uint8_t *>(p), vreinterpretq_u8_u32(v)); }
+inline lanes splat(std::uint32_t x) noexcept { return vdupq_n_u32(x); }
+inline lanes add(lanes a, lanes b) noexcept { return vaddq_u32(a, b); }
+inline lanes bit_or(lanes a, lanes b) noexcept { return vorrq_u32(a, b); }
+inline lanes bit_and(lanes a, lanes b) noexcept { return vandq_u32(a, b); }
+inline lanes shift_left(lanes v, unsigned n) noexcept { return vshlq_u32(v, vdupq_n_s32(static_cast<int>(n))); }
+inline lanes shift_right(lanes v, unsigned n) noexcept { return vshlq_u32(v, vdupq_n_s32(-static_cast<int>(n))); }
+
+/// Returns the running sums of the lanes of `v` added to the last lane of `previous`.
+inline lanes prefix_sum(lanes v, lanes previous) noexcept {
+    auto zero = vdupq_n_u32(0);
+    v = add(v, vextq_u32(zero, v, 3));
+    v = add(v, vextq_u32(zero, v, 2));
+    return add(v, vdupq_n_u32(vgetq_lane_u32(previous, 3)));
+}
+#else
+/// Four 32-bit lanes.
+struct lanes {
+    std::uint32_t v[4];
+};
+
+inline lanes load(const void *p) noexcept {
+    lanes r;
+    std::memcpy(r.v, p, sizeof r.v);
+    return r;
+}
+inline void store(void *p, lanes v) noexcept { std::memcpy(p, v.v, sizeof v.v); }
+inline lanes splat(std::uint32_t x) noexcept { return {{x, x, x, x}}; }
+inline lanes add(lanes a, lanes b) noexcept {
+    return {{a.v[0] + b.v[0], a.v[1] + b.v[1], a.v[2] + b.v[2], a.v[3] + b.v[3]}};
+}
+inline lanes bit_or(lanes a, lanes b) noexcept {
+    return {{a.v[0] | b.v[0], a.v[1] | b.v[1], a.v[2] | b.v[2], a.v[3] | b.v[3]}};
+}
+inline lanes bit_and(lanes a, lanes b) noexcept {
+    return {{a.v[0] & b.v[0], a.v[1] & b.v[1], a.v[2] & b.v[2], a.v[3] & b.v[3]}};
+}
+inline lanes shift_left(lanes v, unsigned n) noexcept {
+    return {{v.v[0] << n, v.v[1] << n, v.v[2] << n, v.v[3] << n}};
+}
+inline lanes shift_right(lanes v, unsigned n) noexcept {
+    return {{v.v[0] >> n, v.v[1] >> n, v.v[2] >> n, v.v[3] >> n}};
+}
+
+/// Returns the running sums of the lanes of `v` added to the last lane of `previous`.
+inline lanes prefix_sum(lanes v, lanes previous) noexcept {
+    v.v[0] += previous.v[3];
+    v.v[1] += v.v[0];
+    v.v[2] += v.v[1];
+    v.v[3] += v.v[2];
+    return v;
+}
+#endif
+
+// Packed words are addressed as bytes so that blocks need not be aligned. Lanes are loaded and stored in host byte
+// order, which on big-endian targets is corrected by swapping the packed words.
+
+/// Packs rows `Rows` of `block_size` values of at most `Width` bits from `in` into `4 * Width` words at `out`.
+template <unsigned Width, std::size_t... Rows>
+void pack_rows(const std::uint32_t *in, unsigned char *out, std::index_sequence<Rows...>) noexcept {
+    // Every row's word and shift are known at compile time, so the words stay in registers
+    lanes words[Width];
+    for (auto &word : words) {
+        word = splat(0);
+    }
+    auto pack_row = [&](auto row) noexcept {
+        constexpr auto word = decltype(row)::value * Width / 32;
+        constexpr auto shift = static_cast<unsigned>(decltype(row)::value * Width % 32);
+        auto v = load(in + 4 * decltype(row)::value);
+        words[word] = bit_or(words[word], shift_left(v, shift));
+        if constexpr (shift + Width > 32) {
+            words[word + 1] = bit_or(words[word + 1], shift_right(v, 32 - shift));
+        }
+    };
+    (pack_row(std::integral_constant<std::size_t, Rows>{}), ...);
+    for (unsigned i = 0; i < Width; ++i) {
+        store(out + 16 * i, words[i]);
+    }
+}
+
+/// Packs `block_size` values of at most `Width` bits from `in` into `4 * Width` words at `out`.
+template <unsigned Width> void pack(const std::uint32_t *in, unsigned char *out) noexcept {
+    if constexpr (Width > 0) {
+        pack_rows<Width>(in, out, std::make_index_sequence<block_size / 4>{});
+    }
+}
+
+/// Unpacks rows `Rows` of `block_size` values of `Width` bits from `4 * Width` words at `in`, adds `base` to each and
+/// stores their running sums following `previous` to `out`.
+template <unsigned Width, std::size_t... Rows>
+void unpack_rows(const unsigned char *in, std::uint32_t base, std::uint32_t previous, std::uint32_t *out,
+                 std::index_sequence<Rows...>) noexcept {
+    const auto mask = splat(Width == 32 ? ~std::uint32_t{0} : (std::uint32_t{1} << Width) - 1);
+    const auto offset = splat(base);
+    auto running = splat(previous);
+    auto unpack_row = [&](auto row) noexcept {
+        constexpr auto word = decltype(row)::value * Width / 32;
+        constexpr auto shift = static_cast<unsigned>(decltype(row)::value * Width % 32);
+        auto v = splat(0);
+        if constexpr (Width > 0) {
+            v = shift_right(load(in + 16 * word), shift);
+            if constexpr (shift + Width > 32) {
+                v = bit_or(v, shift_left(load(in + 16 * (word + 1)), 32 - shift));
+            }
+        }
+        running = prefix_sum(add(bit_and(v, mask), offset), running);
+        store(out + 4 * decltype(row)::value, running);
+    };
+    (unpack_row(std::integral_constant<std::size_t, Rows>{}), ...);
+}
+
+/// Unpacks and restores `block_size` values of `Width` bits from `4 * Width` words at `in`.
+template <unsigned Width>
+void unpack(const unsigned char *in, std::uint32_t base, std::uint32_t previous, std::uint32_t *out) noexcept {
+    unpack_rows<Width>(in, base, previous, out, std::make_index_sequence<block_size / 4>{});
+}
+
+/// A function packing a block at one width.
+using pack_function = void (*)(const std::uint32_t *, unsigned char *) noexcept;
+
+/// A function unpacking and restoring a block at one width.
+using unpack_function = void (*)(const unsigned char *, std::uint32_t, std::uint32_t, std::uint32_t *) noexcept;
+
+/// Returns the packing functions for widths `0` through `32`.
+template <std::size_t... Widths> constexpr auto make_packers(std::index_sequence<Widths...>) noexcept {
+    return std::array<pack_function, sizeof...(Widths)>{&pack<Widths>...};
+}
+
+/// Returns the unpacking functions for widths `0` through `32`.
+template <std::size_t... Widths> constexpr auto make_unpackers(std::index_sequence<Widths...>) noexcept {
+    return std::array<unpack_function, sizeof...(Widths)>{&unpack<Widths>...};
+}
+
+// The tables are variable templates so that the kernels are instantiated only where they are used
+
+/// The packing function for each width.
+template <typename = void> inline constexpr auto packers = make_packers(std::make_index_sequence<33>{});
+
+/// The unpacking function for each width.
+template <typename = void> inline constexpr auto unpackers = make_unpackers(std::make_index_sequence<33>{});
+
+/// Converts `count` 32-bit words at `words` between host and little-endian byte order.
+inline void swap_words(unsigned char *words, std::size_t count) noexcept {
+#if __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+    for (std::size_t i = 0; i < count; ++i) {
+        std::uint32_t w;
+        std::memcpy(&w, words + 4 * i, 4);
+        w = __builtin_bswap32(w);
+        std::memcpy(words + 4 * i, &w, 4);
+    }
+#else
+    (void)words;
+    (void)count;
+#endif
+}
+
+} /* namespace detail */
+
+/// Encodes up to `block_size` values as one block.
+/// - parameter values: The values to encode.
+/// - parameter count: The number of values, at most `block_size`. A short block is padded with its last value.
+/// - parameter previous: The value preceding `values[0]`, or `0` for the first block.
+/// - parameter out: The destination, with room for at least `max_block_bytes` bytes.
+/// - returns: The number of bytes written.
+inline std::size_t encode_block(const std::uint32_t *values, std::size_t count, std::uint32_t previous,
+                                unsigned char *out) noexcept {
+    alignas(16) std::uint32_t deltas[block_size];
+    if (count == block_size) {
+        deltas[0] = values[0] - previous;
+        for (std::size_t i = 1; i < block_size; ++i) {
+            deltas[i] = values[i] - values[i - 1];
+        }
+    } else {
+        for (std::size_t i = 0; i < block_size; ++i) {
+            auto value = i < count ? values[i] : previous;
+            deltas[i] = value - previous;
+            previous = value;
+        }
+    }
+    auto base = deltas[0];
+    for (auto delta : deltas) {
+        base = delta < base ? delta : base;
+    }
+    std::uint32_t bits = 0;
+    for (auto &delta : deltas) {
+        delta -= base;
+        bits |= delta;
+    }
+    auto width = bits == 0 ? 0u : 32u - static_cast<unsigned>(__builtin_clz(bits));
+
+    out[0] = static_cast<unsigned char>(width);
+    std::memcpy(out + 1, &base, 4);
+    detail::swap_words(out + 1, 1);
+    detail::packers<>[width](deltas, out + block_header_size);
+    detail::swap_words(out + block_header_size, 4 * width);
+    return block_bytes(width);
+}
+
+/// Decodes one block.
+/// - parameter in: The encoded block.
+/// - parameter size: The number of bytes available at `in`.
+/// - parameter previous: The value preceding the block, or `0` for the first block.
+/// - parameter out: The destination, with room for `block_size` values.
+/// - returns: The number of bytes consumed, or `0` if the block is malformed or truncated.
+inline std::size_t decode_block(const unsigned char *in, std::size_t size, std::uint32_t previous,
+                                std::uint32_t *out) noexcept {
+    if (size < block_header_size || in[0] > 32 || size < block_bytes(in[0])) {
+        return 0;
+    }
+    unsigned width = in[0];
+    std::uint32_t base;
+    std::memcpy(&base, in + 1, 4);
+#if __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+    base = __builtin_bswap32(base);
+    unsigned char packed[block_size * 4];
+    std::memcpy(packed, in + block_header_size, 16 * width);
+    detail::swap_words(packed, 4 * width);
+    detail::unpackers<>[width](packed, base, previous, out);
+#else
+    detail::unpackers<>[width](in + block_header_size, base, previous, out);
+#endif
+    return block_bytes(width);
+}
+
+/// Encodes `count` values.
+/// - parameter out: The destination, with room for at least `encoded_bound(count)` bytes.
+/// - returns: The number of bytes written.
+inline std::size_t encode(const std::uint32_t *values, std::size_t count, unsigned char *out) noexcept {
+    std::size_t size = 0;
+    std::uint32_t previous = 0;
+    for (std::size_t i = 0; i < count; i += block_size) {
+        auto n = count - i < block_size ? count - i : block_size;
+        size += encode_block(values + i, n, previous, out + size);
+        previous = values[i + n - 1];
+    }
+    return size;
+}
+
+/// Decodes `count` values.
+/// - parameter in: The encoded values.
+/// - parameter size: The number of bytes available at `in`.
+/// - parameter out: The destination, with room for `count` values.
+/// - returns: The number of bytes consumed, which is `0` for no values, or `cio::bitpack::error` if the input is
+/// malformed or truncated.
+inline std::size_t decode(const unsigned char *in, std::size_t size, std::size_t count, std::uint32_t *out) noexcept {
+    std::size_t consumed = 0;
+    std::uint32_t previous = 0;
+    for (std::size_t i = 0; i < count; i += block_size) {
+        std::size_t n;
+        if (count - i >= block_size) {
+            n = decode_block(in + consumed, size - consumed, previous, out + i);
+        } else {
+            // Decode the padded final block aside
+            std::uint32_t tail[block_size];
+            n = decode_block(in + consumed, size - consumed, previous, tail);
+            if (n != 0) {
+                std::memcpy(out + i, tail, (count - i) * 4);
+            }
+        }
+        if (n == 0) {
+            return error;
+        }
+        consumed += n;
+        previous = out[i + (count - i < block_size ? count - i : block_size) - 1];
+    }
+    return consumed;
+}
+
+/// Writes `count` values to `stream` as a little-endian `uint64_t` count followed by the encoded blocks.
+/// - parameter stream: A `cio::cstream` or any class with a compatible `fwrite`.
+/// - parameter values: The values to write.
+/// - parameter count: The number of values.
+/// - returns: `true` on success, `false` otherwise.
+template <typename Stream> bool write(Stream &stream, const std::uint32_t *values, std::size_t count) noexcept {
+    unsigned char header[8];
+    for (std::size_t i = 0; i < sizeof header; ++i) {
+        header[i] = static_cast<unsigned char>(static_cast<std::uint64_t>(count) >> (8 * i));
+    }
+    if (stream.fwrite(header, 1, sizeof header) != sizeof header) {
+        return false;
+    }
+    unsigned char block[max_block_bytes];
+    std::uint32_t previous = 0;
+    for (std::size_t i = 0; i < count; i += block_size) {
+        auto n = std::min(count - i, block_size);
+        auto size = encode_block(values + i, n, previous, block);
+        if (stream.fwrite(block, 1, size) != size) {
+            return false;
+        }
+        previous = values[i + n - 1];
+    }
+    return true;
+}
+
+/// Reads values written by `write()` from `stream`.
+/// - parameter stream: A `cio::cstream` or any class with a compatible `fread`.
+/// - parameter v: A `std::vector` to receive the values.
+/// - returns: `true` on success, `false` if the data is malformed or truncated or a read failed.
+/// - throws: Any exception thrown by `Allocator::allocate()` (typically `std::bad_alloc`)
+/// - throws: `std::length_error`
+template <typename Stream> bool read(Stream &stream, std::vector<std::uint32_t> &v) {
+    v.clear();
+    unsigned char header[8];
+    if (stream.fread(header, 1, sizeof header) != sizeof header) {
+        return false;
+    }
+    std::uint64_t count = 0;
+    for (std::size_t i = 0; i < sizeof header; ++i) {
+        count |= static_cast<std::uint64_t>(header[i]) << (8 * i);
+    }
+    unsigned char block[max_block_bytes];
+    std::uint32_t values[block_size];
+    std::uint32_t previous = 0;
+    // Grow as blocks arrive so that a corrupt count cannot force a huge allocation
+    v.reserve(static_cast<std::size_t>(std::min<std::uint64_t>(count, 1024 * 1024)));
+    while (v.size() < count) {
+        if (stream.fread(block, 1, block_header_size) != block_header_size || block[0] > 32) {
+            return false;
+        }
+        auto size = block_bytes(block[0]);
+        if (stream.fread(block + block_header_size, 1, size - block_header_size) != size - block_header_size ||
+            decode_block(block, size, previous, values) != size) {
+            return false;
+        }
+        auto n = static_cast<std::size_t>(std::min<std::uint64_t>(count - v.size(), block_size));
+        v.insert(v.end(), values, values + n);
+        previous = values[n - 1];
+    }
+    return true;
+}
+
+} /* namespace bitpack */
+
+} /* namespace cio */
@@ -0,0 +1,398 @@
+//
+// SPDX-FileCopyrightText: 2024 Stephen F. Booth <contact@sbooth.dev>
+// SPDX-License-Identifier: MIT
+//
+// Part of https://github.com/sbooth/cio
+//
+
+#import <array>
+#import <atomic>
+#import <cstddef>
+#import <cstdint>
+#import <cstdlib>
+#import <mutex>
+#import <utility>
+#import <vector>
+
+#import "memory_governor.hpp"
+
+namespace cio {
+
+class buffer_pool;
+
+/// A buffer borrowed from `cio::buffer_pool` and returned to it on destruction.
+class pooled_buffer {
+  public:
+    // MARK: Standard Six
+
+    /// Initializes an empty `cio::pooled_buffer` object.
+    pooled_buffer() noexcept = default;
+
+    // This class is non-copyable.
+    pooled_buffer(const pooled_buffer &rhs) = delete;
+
+    // This class is non-assignable.
+    pooled_buffer &operator=(const pooled_buffer &rhs) = delete;
+
+    /// Initializes a `cio::pooled_buffer` object with the buffer from `rhs` and leaves `rhs` empty.
+    pooled_buffer(pooled_buffer &&rhs) noexcept
+        : data_{std::exchange(rhs.data_, nullptr)}, size_{std::exchange(rhs.size_, 0)} {}
+
+    /// Returns the current buffer to the pool and replaces it with the buffer from `rhs`, then leaves `rhs` empty.
+    pooled_buffer &operator=(pooled_buffer &&rhs) noexcept {
+        if (this != &rhs) {
+            reset();
+            data_ = std::exchange(rhs.data_, nullptr);
+            size_ = std::exchange(rhs.size_, 0);
+        }
+        return *this;
+    }
+
+    /// Returns the buffer to the pool.
+    ~pooled_buffer() noexcept { reset(); }
+
+    // MARK: Buffer Handling
+
+    /// Returns `true` if a buffer is held.
+    [[nodiscard]]
+    explicit operator bool() const noexcept {
+        return data_ != nullptr;
+    }
+
+    /// Returns the buffer.
+    [[nodiscard]]
+    unsigned char *data() const noexcept {
+        return data_;
+    }
+
+    /// Returns the size of the buffer in bytes, which may exceed the size requested.
+    [[nodiscard]]
+    std::size_t size() const noexcept {
+        return size_;
+    }
+
+    /// Returns the buffer to the pool.
+    inline void reset() noexcept;
+
+  private:
+    friend class buffer_pool;
+
+    /// Initializes a `cio::pooled_buffer` object holding `size` bytes at `data`.
+    pooled_buffer(unsigned char *data, std::size_t size) noexcept : data_{data}, size_{size} {}
+
+    /// The buffer.
+    unsigned char *data_{nullptr};
+    /// The size of the buffer in bytes.
+    std::size_t size_{0};
+};
+
+/// A process-wide pool of I/O buffers in power-of-two size classes.
+///
+/// Streams that borrow a buffer only while they have buffered data, and return it when drained or flushed, let
+/// thousands of mostly idle streams share a working set of buffers sized to the streams actually doing I/O.
+///
+/// Each thread keeps a small cache per size class so that the common borrow-and-return cycle takes no lock. Buffers
+/// overflowing a thread cache go to a shared cache bounded by `cache_limit()`, and beyond that are freed. A thread's
+/// cache returns its buffers to the shared cache when the thread exits.
+///
+/// Allocated buffers, whether borrowed or cached, are reserved from `cio::memory_governor::shared()`. When an
+/// allocation would exceed the budget the caches are freed and the allocation retried, and under memory pressure
+/// returned buffers are freed rather than cached.
+class buffer_pool {
+  public:
+    /// The smallest buffer size in bytes.
+    static constexpr std::size_t min_buffer_size = 4 * 1024;
+
+    /// The largest pooled buffer size in bytes. Larger requests are allocated and freed individually.
+    static constexpr std::size_t max_buffer_size = 1024 * 1024;
+
+    /// The number of buffers of each size class kept by each thread.
+    static constexpr std::size_t thread_cache_depth = 4;
+
+    /// Pool occupancy and activity counters.
+    struct statistics {
+        /// The number of buffers currently borrowed.
+        std::size_t outstanding_buffers;
+        /// The number of bytes currently borrowed.
+        std::size_t outstanding_bytes;
+        /// The largest number of bytes borrowed at once.
+        std::size_t peak_outstanding_bytes;
+        /// The number of bytes held in the shared cache.
+        std::size_t cached_bytes;
+        /// The number of bytes held in the caches of all threads.
+        std::size_t thread_cached_bytes;
+        /// The number of buffers borrowed.
+        std::uint64_t acquisitions;
+        /// The number of buffers borrowed from a thread cache.
+        std::uint64_t thread_cache_hits;
+        /// The number of buffers allocated.
+        std::uint64_t allocations;
+    };
+
+    // This class is non-copyable.
+    buffer_pool(const buffer_pool &rhs) = delete;
+
+    // This class is non-assignable.
+    buffer_pool &operator=(const buffer_pool &rhs) = delete;
+
+    /// Returns the process-wide pool.
+    static buffer_pool &shared() noexcept {
+        static buffer_pool pool;
+        return pool;
+    }
+
+    /// Borrows a buffer of at least `size` bytes.
+    /// - returns: The buffer, which is empty if allocation failed.
+    [[nodiscard]]
+    pooled_buffer acquire(std::size_t size) noexcept {
+        auto index = class_index(size);
+        auto rounded = index < class_count ? min_buffer_size << index : size;
+        acquisitions_.fetch_add(1, std::memory_order_relaxed);
+
+        unsigned char *data = nullptr;
+        if (index < class_count) {
+            if (auto &slot = current_cache().classes[index]; slot.count > 0) {
+                data = slot.buffers[--slot.count];
+                thread_cached_bytes_.fetch_sub(rounded, std::memory_order_relaxed);
+                thread_cache_hits_.fetch_add(1, std::memory_order_relaxed);
+            } else {
+                std::lock_guard<std::mutex> lock{mutex_};
+                if (auto &free = free_[index]; !free.empty()) {
+                    data = free.back();
+                    free.pop_back();
+                    cached_bytes_ -= rounded;
+                }
+            }
+        }
+        if (!data) {
+            if (!governor_.try_reserve(rounded)) {
+                // Cached buffers are the first memory to give up
+                trim();
+                if (!governor_.try_reserve(rounded)) {
+                    return {};
+                }
+            }
+            data = static_cast<unsigned char *>(std::malloc(rounded));
+            if (!data) {
+                governor_.release(rounded);
+                return {};
+            }
+            allocations_.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        outstanding_buffers_.fetch_add(1, std::memory_order_relaxed);
+        auto outstanding = outstanding_bytes_.fetch_add(rounded, std::memory_order_relaxed) + rounded;
+        for (auto peak = peak_outstanding_bytes_.load(std::memory_order_relaxed);
+             outstanding > peak &&
+             !peak_outstanding_bytes_.compare_exchange_weak(peak, outstanding, std::memory_order_relaxed);) {
+        }
+        return {data, rounded};
+    }
+
+    /// Returns the current occupancy and activity counters.
+    [[nodiscard]]
+    statistics stats() const noexcept {
+        std::size_t cached;
+        {
+            std::lock_guard<std::mutex> lock{mutex_};
+            cached = cached_bytes_;
+        }
+        return {outstanding_buffers_.load(std::memory_order_relaxed),
+                outstanding_bytes_.load(std::memory_order_relaxed),
+                peak_outstanding_bytes_.load(std::memory_order_relaxed),
+                cached,
+                thread_cached_bytes_.load(std::memory_order_relaxed),
+                acquisitions_.load(std::memory_order_relaxed),
+                thread_cache_hits_.load(std::memory_order_relaxed),
+                allocations_.load(std::memory_order_relaxed)};
+    }
+
+    /// Returns the largest number of bytes held in the shared cache.
+    [[nodiscard]]
+    std::size_t cache_limit() const noexcept {
+        std::lock_guard<std::mutex> lock{mutex_};
+        return cache_limit_;
+    }
+
+    /// Sets the largest number of bytes held in the shared cache and frees any excess.
+    void set_cache_limit(std::size_t limit) noexcept {
+        std::lock_guard<std::mutex> lock{mutex_};
+        cache_limit_ = limit;
+        trim_locked(limit);
+    }
+
+    /// Frees the buffers in the shared cache and the calling thread's cache.
+    ///
+    /// Other threads' caches cannot be reached without a lock on their fast path, so each is freed the next time its
+    /// thread borrows or returns a buffer; the cache of a thread that never does so again is returned to the shared
+    /// cache when the thread exits. `stats()` reports the bytes still held in thread caches.
+    void trim() noexcept {
+        trim_epoch_.fetch_add(1, std::memory_order_relaxed);
+        current_cache().flush(true);
+        std::lock_guard<std::mutex> lock{mutex_};
+        trim_locked(0);
+    }
+
+  private:
+    friend class pooled_buffer;
+
+    /// The number of pooled size classes.
+    static constexpr std::size_t class_count = 9;
+
+    static_assert(min_buffer_size << (class_count - 1) == max_buffer_size, "Size classes must span the pooled sizes");
+
+    /// A thread's cached buffers.
+    struct thread_cache {
+        /// The cached buffers of one size class.
+        struct slot {
+            /// The buffers.
+            std::array<unsigned char *, thread_cache_depth> buffers;
+            /// The number of valid entries in `buffers`.
+            std::size_t count{0};
+        };
+
+        /// Returns the cached buffers to the shared cache.
+        ~thread_cache() { flush(false); }
+
+        /// Returns the cached buffers to the shared cache, or frees them if `free` is `true`.
+        void flush(bool free) noexcept {
+            auto &pool = shared();
+            for (std::size_t index = 0; index < class_count; ++index) {
+                while (classes[index].count > 0) {
+                    auto data = classes[index].buffers[--classes[index].count];
+                    pool.thread_cached_bytes_.fetch_sub(min_buffer_size << index, std::memory_order_relaxed);
+                    if (free) {
+                        std::free(data);
+                        pool.governor_.release(min_buffer_size << index);
+                    } else {
+                        pool.release_shared(data, index);
+                    }
+                }
+            }
+        }
+
+        /// The cached buffers for each size class.
+        std::array<slot, class_count> classes;
+        /// The value of `trim_epoch_` when the cache was last flushed.
+        std::uint64_t epoch{0};
+    };
+
+    /// Initializes the pool.
+    buffer_pool() noexcept : governor_{memory_governor::shared()} {}
+
+    /// Frees the buffers in the shared cache.
+    ~buffer_pool() noexcept {
+        std::lock_guard<std::mutex> lock{mutex_};
+        trim_locked(0);
+    }
+
+    /// Returns the calling thread's cache.
+    static thread_cache &local_cache() noexcept {
+        thread_local thread_cache cache;
+        return cache;
+    }
+
+    /// Returns the calling thread's cache, first freeing its buffers if `trim()` has been called since it was last
+    /// used.
+    thread_cache &current_cache() noexcept {
+        auto &cache = local_cache();
+        if (auto epoch = trim_epoch_.load(std::memory_order_relaxed); cache.epoch != epoch) {
+            cache.epoch = epoch;
+            cache.flush(true);
+        }
+        return cache;
+    }
+
+    /// Returns the size class for `size`, or `class_count` if `size` is not pooled.
+    static std::size_t class_index(std::size_t size) noexcept {
+        std::size_t index = 0;
+        while (index < class_count && (min_buffer_size << index) < size) {
+            ++index;
+        }
+        return index;
+    }
+
+    /// Returns a borrowed buffer of `size` bytes to the pool.
+    void release(unsigned char *data, std::size_t size) noexcept {
+        outstanding_buffers_.fetch_sub(1, std::memory_order_relaxed);
+        outstanding_bytes_.fetch_sub(size, std::memory_order_relaxed);
+        auto index = class_index(size);
+        if (index == class_count || governor_.under_pressure()) {
+            std::free(data);
+            governor_.release(size);
+            return;
+        }
+        if (auto &slot = current_cache().classes[index]; slot.count < thread_cache_depth) {
+            slot.buffers[slot.count++] = data;
+            thread_cached_bytes_.fetch_add(size, std::memory_order_relaxed);
+            return;
+        }
+        release_shared(data, index);
+    }
+
+    /// Returns a buffer of size class `index` to the shared cache, or frees it if the cache is full.
+    void release_shared(unsigned char *data, std::size_t index) noexcept {
+        auto size = min_buffer_size << index;
+        {
+            std::lock_guard<std::mutex> lock{mutex_};
+            if (cached_bytes_ + size <= cache_limit_) {
+                try {
+                    free_[index].push_back(data);
+                    cached_bytes_ += size;
+                    return;
+                } catch (...) {
+                }
+            }
+        }
+        std::free(data);
+        governor_.release(size);
+    }
+
+    /// Frees cached buffers, largest first, until at most `limit` bytes remain cached.
+    void trim_locked(std::size_t limit) noexcept {
+        for (auto index = class_count; index-- > 0 && cached_bytes_ > limit;) {
+            auto &free = free_[index];
+            while (!free.empty() && cached_bytes_ > limit) {
+                std::free(free.back());
+                free.pop_back();
+                cached_bytes_ -= min_buffer_size << index;
+                governor_.release(min_buffer_size << index);
+            }
+        }
+    }
+
+    /// The governor from which allocated buffers are reserved, which must outlive the pool.
+    memory_governor &governor_;
+    /// Guards the shared cache.
+    mutable std::mutex mutex_;
+    /// The shared cache for each size class.
+    std::array<std::vector<unsigned char *>, class_count> free_;
+    /// The number of bytes in the shared cache.
+    std::size_t cached_bytes_{0};
+    /// The largest number of bytes held in the shared cache.
+    std::size_t cache_limit_{64 * 1024 * 1024};
+    /// The number of bytes held in thread caches.
+    std::atomic<std::size_t> thread_cached_bytes_{0};
+    /// Incremented by `trim()` so that each thread frees its cache on its next use.
+    std::atomic<std::uint64_t> trim_epoch_{0};
+    /// The number of buffers currently borrowed.
+    std::atomic<std::size_t> outstanding_buffers_{0};
+    /// The number of bytes currently borrowed.
+    std::atomic<std::size_t> outstanding_bytes_{0};
+    /// The largest number of bytes borrowed at once.
+    std::atomic<std::size_t> peak_outstanding_bytes_{0};
+    /// The number of buffers borrowed.
+    std::atomic<std::uint64_t> acquisitions_{0};
+    /// The number of buffers borrowed from a thread cache.
+    std::atomic<std::uint64_t> thread_cache_hits_{0};
+    /// The number of buffers allocated.
+    std::atomic<std::uint64_t> allocations_{0};
+};
+
+inline void pooled_buffer::reset() noexcept {
+    if (auto data = std::exchange(data_, nullptr); data) {
+        buffer_pool::shared().release(data, std::exchange(size_, 0));
+    }
+}
+
+} /* namespace cio */
@@ -0,0 +1,250 @@
+//
+// SPDX-FileCopyrightText: 2024 Stephen F. Booth <contact@sbooth.dev>
+// SPDX-License-Identifier: MIT
+//
+// Part of https://github.com/sbooth/cio
+//
+
+#import <algorithm>
+#import <array>
+#import <cstdint>
+#import <cstring>
+#import <vector>
+
+#import "cstream.hpp"
+#import "memory_governor.hpp"
+#import "sha256.hpp"
+
+namespace cio {
+
+/// A content-defined chunker splitting a stream into chunks with the FastCDC algorithm.
+///
+/// A gear rolling hash is computed over the data and a chunk ends where the hash matches a mask, so boundaries depend
+/// only on nearby content: an insertion or deletion changes the chunks around it and leaves the rest identical, which
+/// is what makes the chunks useful for deduplication. Chunks are never shorter than the minimum size, except at the
+/// end of the stream, or longer than the maximum. Normalized chunking uses a stricter mask before the average size
+/// and a looser one after it, which keeps most chunk sizes close to the average.
+///
+/// The stream is read in large blocks and each chunk is hashed with SHA-256 while it is still in cache, so boundaries
+/// and hashes come from a single pass. The buffer is reserved from `cio::memory_governor::shared()`; when the budget
+/// cannot cover the usual size the stream is read one maximum chunk at a time instead, and a chunker whose budget
+/// cannot cover even that is invalid.
+class cdc_chunker {
+  public:
+    /// The default minimum chunk size in bytes.
+    static constexpr std::size_t default_min_size = 2 * 1024;
+
+    /// The default average chunk size in bytes.
+    static constexpr std::size_t default_avg_size = 8 * 1024;
+
+    /// The default maximum chunk size in bytes.
+    static constexpr std::size_t default_max_size = 64 * 1024;
+
+    /// The largest chunk size in bytes, which keeps the masks derived from the average size within 64 bits.
+    static constexpr std::size_t max_chunk_size = std::size_t{1} << 30;
+
+    /// A chunk of the stream.
+    struct chunk {
+        /// The offset of the chunk in the stream.
+        std::uint64_t offset;
+        /// The size of the chunk in bytes.
+        std::size_t size;
+        /// The SHA-256 digest of the chunk.
+        sha256::digest hash;
+        /// The chunk data, valid until the next call to `next()`.
+        const unsigned char *data;
+    };
+
+    // This class is non-copyable.
+    cdc_chunker(const cdc_chunker &rhs) = delete;
+
+    // This class is non-assignable.
+    cdc_chunker &operator=(const cdc_chunker &rhs) = delete;
+
+    /// Initializes a `cio::cdc_chunker` object that reads from `stream`.
+    /// - parameter stream: The stream to read.
+    /// - parameter min_size: The minimum chunk size, between 64 bytes and `max_chunk_size`.
+    /// - parameter avg_size: The average chunk size, rounded up to a power of two between `min_size` and `max_size`.
+    /// - parameter max_size: The maximum chunk size, between `min_size` and `max_chunk_size`.
+    /// - throws: Any exception thrown by `Allocator::allocate()` (typically `std::bad_alloc`)
+    explicit cdc_chunker(cstream &stream, std::size_t min_size = default_min_size,
+                         std::size_t avg_size = default_avg_size, std::size_t max_size = default_max_size)
+        : stream_{stream}, min_size_{std::clamp<std::size_t>(min_size, 64, max_chunk_size)},
+          max_size_{std::clamp(max_size, min_size_, max_chunk_size)} {
+        unsigned bits = 6;
+        while ((std::size_t{1} << bits) < std::clamp(avg_size, min_size_, max_size_)) {
+            ++bits;
+        }
+        avg_size_ = std::size_t{1} << bits;
+        // Normalization level 2: two more bits before the average and two fewer after it
+        mask_small_ = ~std::uint64_t{0} << (64 - (bits + 2));
+        mask_large_ = ~std::uint64_t{0} << (64 - (bits - 2));
+        // One maximum chunk is the least the buffer can hold and still find every boundary
+        auto size = std::max<std::size_t>(4 * max_size_, 1024 * 1024);
+        if (!reservation_.resize(size)) {
+            size = max_size_;
+            error_ = !reservation_.resize(size);
+        }
+        if (!error_) {
+            buffer_.resize(size);
+        }
+    }
+
+    /// Returns `true` if no error has occurred.
+    [[nodiscard]]
+    explicit operator bool() const noexcept {
+        return !error_;
+    }
+
+    /// Returns the minimum chunk size.
+    [[nodiscard]]
+    std::size_t min_size() const noexcept {
+        return min_size_;
+    }
+
+    /// Returns the average chunk size.
+    [[nodiscard]]
+    std::size_t avg_size() const noexcept {
+        return avg_size_;
+    }
+
+    /// Returns the maximum chunk size.
+    [[nodiscard]]
+    std::size_t max_size() const noexcept {
+        return max_size_;
+    }
+
+    // MARK: Chunking
+
+    /// Finds the next chunk.
+    /// - parameter c: The chunk.
+    /// - returns: `true` on success, `false` at the end of the stream or on error.
+    bool next(chunk &c) noexcept {
+        if (end_ - begin_ < max_size_ && !eof_ && !fill()) {
+            return false;
+        }
+        if (begin_ == end_) {
+            return false;
+        }
+        auto data = buffer_.data() + begin_;
+        auto size = cut(data, end_ - begin_);
+        c.offset = offset_;
+        c.size = size;
+        c.hash = sha256::hash(data, size);
+        c.data = data;
+        begin_ += size;
+        offset_ += size;
+        return true;
+    }
+
+    /// Returns the length of the first chunk of `size` bytes at `data`, treating the data as the end of the stream.
+    [[nodiscard]]
+    std::size_t cut(const unsigned char *data, std::size_t size) const noexcept {
+        if (size <= min_size_) {
+            return size;
+        }
+        size = std::min(size, max_size_);
+        auto normal = std::min(size, avg_size_);
+        const auto &gear = cdc_chunker::gear();
+        std::uint64_t hash = 0;
+        auto i = min_size_;
+        for (; i < normal; ++i) {
+            hash = (hash << 1) + gear[data[i]];
+            if ((hash & mask_small_) == 0) {
+                return i + 1;
+            }
+        }
+        for (; i < size; ++i) {
+            hash = (hash << 1) + gear[data[i]];
+            if ((hash & mask_large_) == 0) {
+                return i + 1;
+            }
+        }
+        return size;
+    }
+
+    // MARK: Error Handling
+
+    /// Returns nonzero if the end of the stream has been reached.
+    [[nodiscard]]
+    int feof() const noexcept {
+        return eof_ && begin_ == end_;
+    }
+
+    /// Returns nonzero if a read failed.
+    [[nodiscard]]
+    int ferror() const noexcept {
+        return error_;
+    }
+
+  private:
+    /// Returns the gear table of 256 pseudorandom values, generated with SplitMix64.
+    static constexpr std::array<std::uint64_t, 256> make_gear() noexcept {
+        std::array<std::uint64_t, 256> table{};
+        std::uint64_t state = 0x6a09e667f3bcc909;
+        for (auto &value : table) {
+            auto z = (state += 0x9e3779b97f4a7c15);
+            z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+            z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+            value = z ^ (z >> 31);
+        }
+        return table;
+    }
+
+    /// Returns the gear table.
+    static const std::array<std::uint64_t, 256> &gear() noexcept {
+        static constexpr auto table = make_gear();
+        return table;
+    }
+
+    /// Moves unread data to the front of the buffer and reads until it is full or the stream ends.
+    bool fill() noexcept {
+        if (begin_ > 0) {
+            std::memmove(buffer_.data(), buffer_.data() + begin_, end_ - begin_);
+            end_ -= begin_;
+            begin_ = 0;
+        }
+        while (end_ < buffer_.size()) {
+            auto n = stream_.fread(buffer_.data() + end_, 1, buffer_.size() - end_);
+            end_ += n;
+            if (n == 0) {
+                if (stream_.ferror()) {
+                    error_ = true;
+                    return false;
+                }
+                eof_ = true;
+                break;
+            }
+        }
+        return true;
+    }
+
+    /// The underlying stream.
+    cstream &stream_;
+    /// The minimum chunk size.
+    std::size_t min_size_;
+    /// The average chunk size.
+    std::size_t avg_size_{0};
+    /// The maximum chunk size.
+    std::size_t max_size_;
+    /// The mask applied before the average chunk size.
+    std::uint64_t mask_small_{0};
+    /// The mask applied after the average chunk size.
+    std::uint64_t mask_large_{0};
+    /// Data read from the stream.
+    std::vector<unsigned char> buffer_;
+    /// The memory reserved from the governor for `buffer_`.
+    memory_reservation reservation_;
+    /// The offset of the first unchunked byte in `buffer_`.
+    std::size_t begin_{0};
+    /// The number of valid bytes in `buffer_`.
+    std::size_t end_{0};
+    /// The offset in the stream of the byte at `begin_`.
+    std::uint64_t offset_{0};
+    /// Whether the end of the stream has been reached.
+    bool eof_{false};
+    /// Whether a read failed.
+    bool error_{false};
+};
+
+} /* namespace cio */
@@ -0,0 +1,570 @@
+//
+// SPDX-FileCopyrightText: 2024 Stephen F. Booth <contact@sbooth.dev>
+// SPDX-License-Identifier: MIT
+//
+// Part of https://github.com/sbooth/cio
+//
+
+#import <algorithm>
+#import <cerrno>
+#import <cstdint>
+#import <cstring>
+#import <initializer_list>
+#import <limits>
+#import <new>
+#import <type_traits>
+#import <vector>
+
+#import <sys/stat.h>
+#import <unistd.h>
+
+#import "cstream.hpp"
+#import "memory_governor.hpp"
+#import "simd.hpp"
+
+namespace cio {
+
+// A columnar file holds a table of unsigned integer columns split into row groups. Each row group stores one
+// contiguous chunk per column, and a footer indexes every chunk's offset, length and value range so a reader can
+// fetch only the columns and row groups it needs. All values are little-endian.
+//
+//     header   "CIOC" u32 version
+//     chunks   row group 0: column 0 values, column 1 values, ...; row group 1: ...
+//     footer   u32 column_count, u8 width[column_count],
+//              u64 row_group_count, per row group: u64 row_count, per column: u64 offset, length, min, max
+//     trailer  u64 footer_offset "CIOC"
+
+/// Statistics for one column chunk of a columnar file.
+struct column_chunk {
+    /// The offset of the chunk in the file.
+    std::uint64_t offset{0};
+    /// The length of the chunk in bytes.
+    std::uint64_t length{0};
+    /// The smallest value in the chunk.
+    std::uint64_t min{0};
+    /// The largest value in the chunk.
+    std::uint64_t max{0};
+};
+
+/// A writer for columnar files.
+///
+/// Rows are buffered per column and written one row group at a time. `finish()` writes the footer; a file without a
+/// footer cannot be read.
+///
+/// The buffered rows are reserved from `cio::memory_governor::shared()`, growing with the row group. When the budget
+/// cannot cover another row, the buffered rows are written early as a smaller row group and their buffers freed.
+class column_writer {
+  public:
+    /// The default number of rows per row group.
+    static constexpr std::size_t default_row_group_size = 64 * 1024;
+
+    /// The file signature.
+    static constexpr char magic[4] = {'C', 'I', 'O', 'C'};
+
+    /// The file format version.
+    static constexpr std::uint32_t version = 1;
+
+    /// The number of rows reserved at first, after which the reservation doubles up to a whole row group.
+    static constexpr std::size_t min_reserved_rows = 1024;
+
+    // This class is non-copyable.
+    column_writer(const column_writer &rhs) = delete;
+
+    // This class is non-assignable.
+    column_writer &operator=(const column_writer &rhs) = delete;
+
+    /// Initializes a `cio::column_writer` object that writes to `stream`.
+    /// - parameter stream: The stream to write, positioned at the start of the file.
+    /// - parameter widths: The width of each column in bytes: 1, 2, 4 or 8.
+    /// - parameter row_group_size: The number of rows per row group.
+    /// - throws: Any exception thrown by `Allocator::allocate()` (typically `std::bad_alloc`)
+    column_writer(cstream &stream, std::vector<std::uint8_t> widths,
+                  std::size_t row_group_size = default_row_group_size)
+        : stream_{stream}, widths_{std::move(widths)}, row_group_size_{std::max<std::size_t>(row_group_size, 1)},
+          buffers_(widths_.size()), stats_(widths_.size()) {
+        std::size_t row_width = 0;
+        for (auto width : widths_) {
+            if (width != 1 && width != 2 && width != 4 && width != 8) {
+                error_ = true;
+            }
+            row_width += width;
+        }
+        row_width_ = std::max<std::size_t>(row_width, 1);
+        error_ = error_ || stream_.fwrite(magic, 1, 4) != 4 || !stream_.write_uint_little(version);
+        position_ = 8;
+    }
+
+    /// Writes the footer if `finish()` has not been called.
+    ~column_writer() noexcept {
+        if (!finished_) {
+            finish();
+        }
+    }
+
+    /// Returns `true` if no error has occurred.
+    [[nodiscard]]
+    explicit operator bool() const noexcept {
+        return !error_;
+    }
+
+    /// Returns the number of columns.
+    [[nodiscard]]
+    std::size_t column_count() const noexcept {
+        return widths_.size();
+    }
+
+    /// Appends a row.
+    /// - parameter values: One value per column, truncated to the column's width.
+    /// - returns: `true` on success, `false` otherwise.
+    /// - throws: Any exception thrown by `Allocator::allocate()` (typically `std::bad_alloc`)
+    bool append_row(const std::uint64_t *values) {
+        if (error_ || finished_ || (rows_ == reserved_rows_ && !reserve_rows())) {
+            return false;
+        }
+        for (std::size_t i = 0; i < widths_.size(); ++i) {
+            auto value = mask(values[i], widths_[i]);
+            auto le = cstream::swap_from_host(value, cstream::byte_order::little_endian);
+            auto &buffer = buffers_[i];
+            auto size = buffer.size();
+            buffer.resize(size + widths_[i]);
+            // The low-order bytes of a little-endian value come first
+            std::memcpy(buffer.data() + size, &le, widths_[i]);
+            update_stats(i, value);
+        }
+        if (++rows_ == row_group_size_) {
+            return flush();
+        }
+        return true;
+    }
+
+    /// Appends a row.
+    /// - parameter values: One value per column, truncated to the column's width.
+    /// - returns: `true` on success, `false` otherwise.
+    /// - throws: Any exception thrown by `Allocator::allocate()` (typically `std::bad_alloc`)
+    bool append_row(std::initializer_list<std::uint64_t> values) {
+        if (values.size() != widths_.size()) {
+            return false;
+        }
+        return append_row(values.begin());
+    }
+
+    /// Writes `rows` rows from column-major buffers as one row group after any buffered rows.
+    ///
+    /// If the budget cannot cover a copy of the rows they are written as several smaller row groups.
+    /// - parameter rows: The number of rows.
+    /// - parameter columns: One buffer per column of `rows` host-order values of the column's width.
+    /// - returns: `true` on success, `false` otherwise.
+    /// - throws: Any exception thrown by `Allocator::allocate()` (typically `std::bad_alloc`)
+    bool write_row_group(std::size_t rows, const void *const *columns) {
+        if (error_ || finished_ || !flush()) {
+            return false;
+        }
+        if (rows == 0) {
+            return true;
+        }
+        if (rows > reserved_rows_) {
+            release_buffers();
+            if (!reservation_.resize(rows * row_width_)) {
+                if (rows == 1) {
+                    error_ = true;
+                    return false;
+                }
+                // Under memory pressure write the rows in halves
+                auto half = rows / 2;
+                std::vector<const void *> rest(widths_.size());
+                for (std::size_t i = 0; i < widths_.size(); ++i) {
+                    rest[i] = static_cast<const unsigned char *>(columns[i]) + half * widths_[i];
+                }
+                return write_row_group(half, columns) && write_row_group(rows - half, rest.data());
+            }
+            reserved_rows_ = rows;
+        }
+        for (std::size_t i = 0; i < widths_.size(); ++i) {
+            auto width = widths_[i];
+            auto &buffer = buffers_[i];
+            buffer.assign(static_cast<const unsigned char *>(columns[i]),
+                          static_cast<const unsigned char *>(columns[i]) + rows * width);
+            switch (width) {
+            case 1:
+                scan_stats<std::uint8_t>(i, buffer.data(), rows);
+                break;
+            case 2:
+                scan_stats<std::uint16_t>(i, buffer.data(), rows);
+                swap_from_host<2>(buffer.data(), rows, cstream::byte_order::little_endian);
+                break;
+            case 4:
+                scan_stats<std::uint32_t>(i, buffer.data(), rows);
+                swap_from_host<4>(buffer.data(), rows, cstream::byte_order::little_endian);
+                break;
+            case 8:
+                scan_stats<std::uint64_t>(i, buffer.data(), rows);
+                swap_from_host<8>(buffer.data(), rows, cstream::byte_order::little_endian);
+                break;
+            }
+        }
+        rows_ = rows;
+        return flush();
+    }
+
+    /// Writes buffered rows and the footer.
+    /// - returns: `true` on success, `false` otherwise.
+    bool finish() noexcept {
+        if (finished_) {
+            return !error_;
+        }
+        finished_ = true;
+        if (error_ || !flush()) {
+            return false;
+        }
+
+        auto footer_offset = position_;
+        auto ok = stream_.write_uint_little(static_cast<std::uint32_t>(widths_.size()));
+        ok = ok && stream_.fwrite(widths_.data(), widths_.size()) == widths_.size();
+        ok = ok && stream_.write_uint_little(static_cast<std::uint64_t>(groups_.size()));
+        for (const auto &group : groups_) {
+            ok = ok && stream_.write_uint_little(group.rows);
+            for (const auto &chunk : group.chunks) {
+                ok = ok && stream_.write_uint_little(chunk.offset) && stream_.write_uint_little(chunk.length) &&
+                     stream_.write_uint_little(chunk.min) && stream_.write_uint_little(chunk.max);
+            }
+        }
+        ok = ok && stream_.write_uint_little(footer_offset) && stream_.fwrite(magic, 1, 4) == 4;
+        ok = ok && stream_.fflush() == 0;
+        error_ = !ok;
+        return ok;
+    }
+
+  private:
+    /// A row group awaiting the footer.
+    struct row_group {
+        /// The number of rows.
+        std::uint64_t rows;
+        /// The column chunks.
+        std::vector<column_chunk> chunks;
+    };
+
+    /// Returns `value` truncated to `width` bytes.
+    static std::uint64_t mask(std::uint64_t value, std::uint8_t width) noexcept {
+        return width == 8 ? value : value & ((std::uint64_t{1} << (width * 8)) - 1);
+    }
+
+    /// Adds `value` to the statistics for column `i`.
+    void update_stats(std::size_t i, std::uint64_t value) noexcept {
+        auto &stats = stats_[i];
+        if (rows_ == 0) {
+            stats.min = stats.max = value;
+        } else {
+            stats.min = std::min(stats.min, value);
+            stats.max = std::max(stats.max, value);
+        }
+    }
+
+    /// Computes the statistics for column `i` from `count` host-order values.
+    template <typename T> void scan_stats(std::size_t i, const unsigned char *data, std::size_t count) noexcept {
+        auto min = std::numeric_limits<T>::max();
+        auto max = std::numeric_limits<T>::min();
+        for (std::size_t j = 0; j < count; ++j) {
+            T value;
+            std::memcpy(&value, data + j * sizeof(T), sizeof(T));
+            min = std::min(min, value);
+            max = std::max(max, value);
+        }
+        stats_[i] = {0, 0, min, max};
+    }
+
+    /// Reserves memory for more buffered rows, growing geometrically up to a whole row group.
+    ///
+    /// When the budget cannot cover another row the buffered rows are written early as a row group and their buffers
+    /// freed.
+    /// - returns: `false` if not even one row fits within the budget or a write failed.
+    /// - throws: Any exception thrown by `Allocator::allocate()` (typically `std::bad_alloc`)
+    bool reserve_rows() {
+        auto wanted = std::min(row_group_size_, std::max(2 * reserved_rows_, min_reserved_rows));
+        auto bytes = reservation_.resize_up_to(wanted * row_width_, (rows_ + 1) * row_width_);
+        if (bytes == 0) {
+            // Under memory pressure write a smaller row group rather than buffer a whole one
+            if (!flush()) {
+                return false;
+            }
+            release_buffers();
+            bytes = reservation_.resize_up_to(std::min(row_group_size_, min_reserved_rows) * row_width_, row_width_);
+            if (bytes == 0) {
+                error_ = true;
+                return false;
+            }
+        }
+        reserved_rows_ = bytes / row_width_;
+        for (std::size_t i = 0; i < widths_.size(); ++i) {
+            buffers_[i].reserve(reserved_rows_ * widths_[i]);
+        }
+        return true;
+    }
+
+    /// Frees the column buffers, which must be empty, and releases their reservation.
+    void release_buffers() noexcept {
+        for (auto &buffer : buffers_) {
+            std::vector<unsigned char>{}.swap(buffer);
+        }
+        reservation_.reset();
+        reserved_rows_ = 0;
+    }
+
+    /// Writes the buffered rows as a row group.
+    bool flush() noexcept {
+        if (rows_ == 0) {
+            return !error_;
+        }
+        try {
+            row_group group{rows_, {}};
+            group.chunks.reserve(widths_.size());
+            for (std::size_t i = 0; i < widths_.size(); ++i) {
+                auto &buffer = buffers_[i];
+                if (stream_.fwrite(buffer.data(), 1, buffer.size()) != buffer.size()) {
+                    error_ = true;
+                    return false;
+                }
+                group.chunks.push_back({position_, buffer.size(), stats_[i].min, stats_[i].max});
+                position_ += buffer.size();
+                buffer.clear();
+            }
+            groups_.push_back(std::move(group));
+        } catch (const std::bad_alloc &) {
+            error_ = true;
+            return false;
+        }
+        rows_ = 0;
+        return true;
+    }
+
+    /// The destination stream.
+    cstream &stream_;
+    /// The width of each column in bytes.
+    std::vector<std::uint8_t> widths_;
+    /// The number of rows per row group.
+    std::size_t row_group_size_;
+    /// The total width of a row in bytes, at least `1`.
+    std::size_t row_width_{1};
+    /// The buffered little-endian values for each column.
+    std::vector<std::vector<unsigned char>> buffers_;
+    /// The memory reserved from the governor for `buffers_`.
+    memory_reservation reservation_;
+    /// The number of rows for which `buffers_` are reserved and allocated.
+    std::size_t reserved_rows_{0};
+    /// The statistics for the buffered values of each column.
+    std::vector<column_chunk> stats_;
+    /// The number of buffered rows.
+    std::uint64_t rows_{0};
+    /// The row groups written so far.
+    std::vector<row_group> groups_;
+    /// The number of bytes written so far.
+    std::uint64_t position_{0};
+    /// Whether the footer has been written.
+    bool finished_{false};
+    /// Whether an error has occurred.
+    bool error_{false};
+};
+
+/// A reader for columnar files that fetches individual column chunks with `pread(2)`.
+///
+/// Because reads are positional, a single reader may be shared by threads fetching different chunks.
+class column_reader {
+  public:
+    /// Initializes an empty `cio::column_reader` object.
+    column_reader() noexcept = default;
+
+    /// Initializes a `cio::column_reader` object and reads the footer of the columnar file open on `fd`.
+    ///
+    /// The reader does not own `fd`, which must remain open while the reader is in use.
+    /// - throws: Any exception thrown by `Allocator::allocate()` (typically `std::bad_alloc`)
+    explicit column_reader(int fd) : fd_{fd} { valid_ = read_footer(); }
+
+    /// Initializes a `cio::column_reader` object and reads the footer of the columnar file underlying `stream`.
+    /// - throws: Any exception thrown by `Allocator::allocate()` (typically `std::bad_alloc`)
+    explicit column_reader(const cstream &stream) : column_reader{stream.fileno()} {}
+
+    /// Returns `true` if the footer was read successfully.
+    [[nodiscard]]
+    explicit operator bool() const noexcept {
+        return valid_;
+    }
+
+    /// Returns the number of columns.
+    [[nodiscard]]
+    std::size_t column_count() const noexcept {
+        return widths_.size();
+    }
+
+    /// Returns the width of column `column` in bytes.
+    [[nodiscard]]
+    std::size_t column_width(std::size_t column) const noexcept {
+        return widths_[column];
+    }
+
+    /// Returns the number of row groups.
+    [[nodiscard]]
+    std::size_t row_group_count() const noexcept {
+        return row_counts_.size();
+    }
+
+    /// Returns the number of rows in row group `group`.
+    [[nodiscard]]
+    std::uint64_t row_count(std::size_t group) const noexcept {
+        return row_counts_[group];
+    }
+
+    /// Returns the total number of rows.
+    [[nodiscard]]
+    std::uint64_t row_count() const noexcept {
+        std::uint64_t total = 0;
+        for (auto rows : row_counts_) {
+            total += rows;
+        }
+        return total;
+    }
+
+    /// Returns the index entry for column `column` of row group `group`.
+    [[nodiscard]]
+    const column_chunk &chunk(std::size_t group, std::size_t column) const noexcept {
+        return chunks_[group * widths_.size() + column];
+    }
+
+    /// Returns the row groups whose values in column `column` may fall within `[min, max]`.
+    /// - throws: Any exception thrown by `Allocator::allocate()` (typically `std::bad_alloc`)
+    [[nodiscard]]
+    std::vector<std::size_t> row_groups_overlapping(std::size_t column, std::uint64_t min, std::uint64_t max) const {
+        std::vector<std::size_t> groups;
+        for (std::size_t group = 0; group < row_counts_.size(); ++group) {
+            const auto &c = chunk(group, column);
+            if (c.max >= min && c.min <= max) {
+                groups.push_back(group);
+            }
+        }
+        return groups;
+    }
+
+    /// Reads column `column` of row group `group` and appends its values in host byte order to `values`.
+    ///
+    /// `T` must be an unsigned integer type as wide as the column.
+    /// - returns: `true` on success, `false` otherwise.
+    /// - throws: Any exception thrown by `Allocator::allocate()` (typically `std::bad_alloc`)
+    template <typename T, typename = std::enable_if_t<std::is_unsigned_v<T>>>
+    bool read_column(std::size_t group, std::size_t column, std::vector<T> &values) const {
+        if (!valid_ || group >= row_counts_.size() || column >= widths_.size() || widths_[column] != sizeof(T)) {
+            return false;
+        }
+        const auto &c = chunk(group, column);
+        auto count = static_cast<std::size_t>(c.length / sizeof(T));
+        auto size = values.size();
+        values.resize(size + count);
+        if (!pread_fully(values.data() + size, count * sizeof(T), c.offset)) {
+            values.resize(size);
+            return false;
+        }
+        swap_to_host<sizeof(T)>(values.data() + size, count, cstream::byte_order::little_endian);
+        return true;
+    }
+
+    /// Reads column `column` of the row groups in `groups` and appends their values to `values`.
+    /// - returns: `true` on success, `false` otherwise.
+    /// - throws: Any exception thrown by `Allocator::allocate()` (typically `std::bad_alloc`)
+    template <typename T, typename = std::enable_if_t<std::is_unsigned_v<T>>>
+    bool read_column(const std::vector<std::size_t> &groups, std::size_t column, std::vector<T> &values) const {
+        for (auto group : groups) {
+            if (!read_column(group, column, values)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+  private:
+    /// Reads `size` bytes at `offset` with `pread(2)`.
+    bool pread_fully(void *buffer, std::size_t size, std::uint64_t offset) const noexcept {
+        auto dst = static_cast<unsigned char *>(buffer);
+        while (size > 0) {
+            auto n = ::pread(fd_, dst, size, static_cast<off_t>(offset));
+            if (n > 0) {
+                dst += n;
+                size -= static_cast<std::size_t>(n);
+                offset += static_cast<std::uint64_t>(n);
+            } else if (n == 0 || errno != EINTR) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /// Reads a little-endian value at `offset` and advances `offset`.
+    template <typename T> bool read_value(std::uint64_t &offset, T &value) const noexcept {
+        if (!pread_fully(&value, sizeof(T), offset)) {
+            return false;
+        }
+        offset += sizeof(T);
+        if constexpr (sizeof(T) > 1) {
+            value = cstream::swap_to_host(value, cstream::byte_order::little_endian);
+        }
+        return true;
+    }
+
+    /// Reads and validates the trailer and footer.
+    bool read_footer() {
+        struct stat st;
+        if (fd_ == -1 || ::fstat(fd_, &st) == -1 || st.st_size < 20) {
+            return false;
+        }
+        auto file_size = static_cast<std::uint64_t>(st.st_size);
+
+        char signature[4];
+        std::uint64_t offset = file_size - 12;
+        std::uint64_t footer_offset;
+        if (!read_value(offset, footer_offset) || !pread_fully(signature, 4, offset) ||
+            std::memcmp(signature, column_writer::magic, 4) != 0 || footer_offset > file_size - 12) {
+            return false;
+        }
+
+        offset = footer_offset;
+        std::uint32_t columns;
+        std::uint64_t groups;
+        if (!read_value(offset, columns) || columns > file_size) {
+            return false;
+        }
+        widths_.resize(columns);
+        if (!pread_fully(widths_.data(), columns, offset)) {
+            return false;
+        }
+        offset += columns;
+        // Each row group entry occupies at least 8 bytes per row count and 32 bytes per column
+        if (!read_value(offset, groups) || groups > (file_size - offset) / (8 + 32 * std::uint64_t{columns})) {
+            return false;
+        }
+        row_counts_.resize(static_cast<std::size_t>(groups));
+        chunks_.resize(static_cast<std::size_t>(groups) * columns);
+        for (std::size_t group = 0; group < groups; ++group) {
+            if (!read_value(offset, row_counts_[group])) {
+                return false;
+            }
+            for (std::size_t column = 0; column < columns; ++column) {
+                auto &c = chunks_[group * columns + column];
+                // Compared without adding, which could wrap for a crafted footer
+                if (!read_value(offset, c.offset) || !read_value(offset, c.length) || !read_value(offset, c.min) ||
+                    !read_value(offset, c.max) || c.length > footer_offset || c.offset > footer_offset - c.length) {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    /// The file descriptor.
+    int fd_{-1};
+    /// Whether the footer was read successfully.
+    bool valid_{false};
+    /// The width of each column in bytes.
+    std::vector<std::uint8_t> widths_;
+    /// The number of rows in each row group.
+    std::vector<std::uint64_t> row_counts_;
+    /// The column chunks, row group major.
+    std::vector<column_chunk> chunks_;
+};
+
+} /* namespace cio */
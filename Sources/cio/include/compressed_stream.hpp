@@ -0,0 +1,487 @@
+//
+// SPDX-FileCopyrightText: 2024 Stephen F. Booth <contact@sbooth.dev>
+// SPDX-License-Identifier: MIT
+//
+// Part of https://github.com/sbooth/cio
+//
+
+#import <algorithm>
+#import <array>
+#import <chrono>
+#import <condition_variable>
+#import <cstdint>
+#import <cstdio>
+#import <cstring>
+#import <mutex>
+#import <thread>
+#import <vector>
+
+#import "cstream.hpp"
+#import "lz77.hpp"
+#import "memory_governor.hpp"
+#import "stream_extensions.hpp"
+
+namespace cio {
+
+/// The framing shared by `cio::compressed_writer` and `cio::compressed_reader`.
+///
+/// A compressed stream starts with the signature "CIOZ", a version byte, the base-2 logarithm of the block size and
+/// two reserved bytes. Each block follows as a little-endian `uint32_t` compressed size, whose high bit marks a block
+/// stored uncompressed, a little-endian `uint32_t` uncompressed size, and the block data. A compressed size of `0`
+/// ends the stream.
+struct compressed_format {
+    /// The stream signature.
+    static constexpr char magic[4] = {'C', 'I', 'O', 'Z'};
+
+    /// The format version.
+    static constexpr std::uint8_t version = 1;
+
+    /// The flag marking a block stored uncompressed.
+    static constexpr std::uint32_t stored_flag = 0x80000000;
+
+    /// The smallest block size in bytes.
+    static constexpr std::size_t min_block_size = 4 * 1024;
+
+    /// The largest block size in bytes.
+    static constexpr std::size_t max_block_size = 4 * 1024 * 1024;
+
+    /// The default block size in bytes.
+    static constexpr std::size_t default_block_size = 256 * 1024;
+};
+
+/// A writer compressing data in independent blocks with the `cio::lz77` codec.
+///
+/// Data is collected into blocks of the configured size, each compressed and written to the underlying stream as a
+/// frame. Blocks that do not shrink are stored as is. `finish()` writes the end marker; a stream without one is
+/// reported as truncated when read.
+///
+/// The block buffers are reserved from `cio::memory_governor::shared()` until `finish()`. A writer created while the
+/// budget is exhausted waits up to `reserve_timeout` for other reservations to be released, and is invalid if they
+/// are not.
+class compressed_writer : public output_extensions<compressed_writer> {
+  public:
+    /// The longest time the constructor waits for the memory budget to admit the block buffers.
+    static constexpr std::chrono::seconds reserve_timeout{1};
+
+    // This class is non-copyable.
+    compressed_writer(const compressed_writer &rhs) = delete;
+
+    // This class is non-assignable.
+    compressed_writer &operator=(const compressed_writer &rhs) = delete;
+
+    /// Initializes a `cio::compressed_writer` object that writes to `stream`.
+    /// - parameter stream: The stream to write.
+    /// - parameter block_size: The uncompressed block size, rounded up to a power of two between
+    /// `compressed_format::min_block_size` and `compressed_format::max_block_size`.
+    /// - throws: Any exception thrown by `Allocator::allocate()` (typically `std::bad_alloc`)
+    explicit compressed_writer(cstream &stream, std::size_t block_size = compressed_format::default_block_size)
+        : stream_{stream} {
+        std::uint8_t shift = 12;
+        while ((std::size_t{1} << shift) < std::min(block_size, compressed_format::max_block_size)) {
+            ++shift;
+        }
+        block_size_ = std::size_t{1} << shift;
+        // Throttle the producer until the budget has room for the block buffers
+        if (!reservation_.resize(block_size_ + lz77::compress_bound(block_size_), reserve_timeout)) {
+            error_ = true;
+            return;
+        }
+        block_.reserve(block_size_);
+        scratch_.resize(lz77::compress_bound(block_size_));
+        const unsigned char header[8] = {'C', 'I', 'O', 'Z', compressed_format::version, shift, 0, 0};
+        error_ = stream_.fwrite(header, 1, sizeof header) != sizeof header;
+        bytes_out_ = sizeof header;
+    }
+
+    /// Writes the end marker if `finish()` has not been called.
+    ~compressed_writer() noexcept {
+        if (!finished_) {
+            finish();
+        }
+    }
+
+    /// Returns `true` if no error has occurred.
+    [[nodiscard]]
+    explicit operator bool() const noexcept {
+        return !error_;
+    }
+
+    /// Returns the uncompressed block size.
+    [[nodiscard]]
+    std::size_t block_size() const noexcept {
+        return block_size_;
+    }
+
+    /// Returns the number of uncompressed bytes written.
+    [[nodiscard]]
+    std::uint64_t bytes_in() const noexcept {
+        return bytes_in_;
+    }
+
+    /// Returns the number of compressed bytes written to the underlying stream, including framing.
+    [[nodiscard]]
+    std::uint64_t bytes_out() const noexcept {
+        return bytes_out_;
+    }
+
+    // MARK: Direct Output
+
+    using output_extensions<compressed_writer>::fwrite;
+
+    /// Writes `count` objects of `size` bytes from `buffer`.
+    /// - returns: The number of objects written.
+    std::size_t fwrite(const void *buffer, std::size_t size, std::size_t count) noexcept {
+        if (error_ || finished_ || size == 0 || count == 0) {
+            return 0;
+        }
+        auto src = static_cast<const unsigned char *>(buffer);
+        auto length = size * count;
+        for (std::size_t written = 0; written < length;) {
+            auto n = std::min(length - written, block_size_ - block_.size());
+            block_.insert(block_.end(), src + written, src + written + n);
+            written += n;
+            if (block_.size() == block_size_ && !write_block()) {
+                return written / size;
+            }
+        }
+        bytes_in_ += length;
+        return count;
+    }
+
+    /// Compresses and writes any partial block, then flushes the underlying stream.
+    ///
+    /// Flushing often produces small blocks and lowers the compression ratio.
+    /// - returns: `0` on success, `EOF` otherwise.
+    int fflush() noexcept {
+        if (error_ || (!block_.empty() && !write_block())) {
+            return EOF;
+        }
+        return stream_.fflush();
+    }
+
+    /// Writes any partial block and the end marker.
+    /// - returns: `true` on success, `false` otherwise.
+    bool finish() noexcept {
+        if (finished_) {
+            return !error_;
+        }
+        finished_ = true;
+        if (error_ || (!block_.empty() && !write_block())) {
+            return false;
+        }
+        error_ = !stream_.write_uint_little(std::uint32_t{0});
+        bytes_out_ += 4;
+        // Nothing more is written, so return the block buffers to the budget
+        std::vector<unsigned char>{}.swap(block_);
+        std::vector<unsigned char>{}.swap(scratch_);
+        reservation_.reset();
+        return !error_;
+    }
+
+  private:
+    /// Compresses and writes the current block.
+    bool write_block() noexcept {
+        auto size = block_.size();
+        auto compressed = lz77::compress(block_.data(), size, scratch_.data(), size - 1);
+        auto stored = compressed == 0;
+        auto data = stored ? block_.data() : scratch_.data();
+        auto length = stored ? size : compressed;
+        error_ = !stream_.write_uint_little(static_cast<std::uint32_t>(length) |
+                                            (stored ? compressed_format::stored_flag : 0)) ||
+                 !stream_.write_uint_little(static_cast<std::uint32_t>(size)) ||
+                 stream_.fwrite(data, 1, length) != length;
+        bytes_out_ += 8 + length;
+        block_.clear();
+        return !error_;
+    }
+
+    /// The underlying stream.
+    cstream &stream_;
+    /// The uncompressed block size.
+    std::size_t block_size_{0};
+    /// The uncompressed data of the current block.
+    std::vector<unsigned char> block_;
+    /// The compressed data of the current block.
+    std::vector<unsigned char> scratch_;
+    /// The memory reserved from the governor for `block_` and `scratch_`.
+    memory_reservation reservation_;
+    /// The number of uncompressed bytes written.
+    std::uint64_t bytes_in_{0};
+    /// The number of compressed bytes written.
+    std::uint64_t bytes_out_{0};
+    /// Whether the end marker has been written.
+    bool finished_{false};
+    /// Whether an error has occurred.
+    bool error_{false};
+};
+
+/// A reader decompressing a stream written by `cio::compressed_writer`.
+///
+/// With `background` set, a worker thread reads and decompresses up to `queue_depth` blocks ahead while the caller
+/// consumes the current one, so decompression overlaps parsing. The underlying stream must not be used by anything
+/// else while the reader exists.
+///
+/// The blocks are reserved from `cio::memory_governor::shared()`. When the budget cannot cover the full queue the
+/// worker reads fewer blocks ahead, or none, in which case blocks are decompressed on the caller's thread. A reader
+/// whose budget cannot cover a single block is invalid.
+class compressed_reader : public input_extensions<compressed_reader> {
+  public:
+    /// The largest number of decompressed blocks the worker thread keeps ready.
+    static constexpr std::size_t queue_depth = 4;
+
+    // This class is non-copyable.
+    compressed_reader(const compressed_reader &rhs) = delete;
+
+    // This class is non-assignable.
+    compressed_reader &operator=(const compressed_reader &rhs) = delete;
+
+    /// Initializes a `cio::compressed_reader` object that reads from `stream`.
+    /// - parameter stream: The stream to read, positioned at the signature.
+    /// - parameter background: Whether to decompress on a worker thread.
+    /// - throws: Any exception thrown by `Allocator::allocate()` (typically `std::bad_alloc`)
+    /// - throws: `std::system_error` if the worker thread could not be started.
+    explicit compressed_reader(cstream &stream, bool background = true) : stream_{stream} {
+        unsigned char header[8];
+        if (stream_.fread(header, 1, sizeof header) != sizeof header ||
+            std::memcmp(header, compressed_format::magic, 4) != 0 || header[4] != compressed_format::version ||
+            header[5] < 12 || (std::size_t{1} << header[5]) > compressed_format::max_block_size) {
+            error_ = true;
+            return;
+        }
+        block_size_ = std::size_t{1} << header[5];
+        auto minimum = lz77::compress_bound(block_size_) + block_size_;
+        if (!reservation_.resize(minimum)) {
+            error_ = true;
+            return;
+        }
+        scratch_.resize(lz77::compress_bound(block_size_));
+        if (background) {
+            // Besides the current block the worker needs the queued blocks and the one it is decoding
+            depth_ = queue_depth;
+            while (depth_ > 0 && !reservation_.resize(minimum + (depth_ + 1) * block_size_)) {
+                --depth_;
+            }
+        }
+        if (depth_ > 0) {
+            // Every block is queued, current, in flight or spare, so recycling never allocates
+            spare_.reserve(depth_ + 2);
+            worker_ = std::thread{[this] { run(); }};
+        }
+    }
+
+    /// Stops the worker thread.
+    ~compressed_reader() noexcept {
+        if (worker_.joinable()) {
+            {
+                std::lock_guard<std::mutex> lock{mutex_};
+                stopping_ = true;
+            }
+            changed_.notify_all();
+            worker_.join();
+        }
+    }
+
+    /// Returns `true` if no error has occurred.
+    [[nodiscard]]
+    explicit operator bool() const noexcept {
+        return !error_;
+    }
+
+    // MARK: Direct Input
+
+    using input_extensions<compressed_reader>::fread;
+
+    /// Reads up to `count` objects of `size` bytes into `buffer`.
+    /// - returns: The number of complete objects read.
+    std::size_t fread(void *buffer, std::size_t size, std::size_t count) noexcept {
+        if (size == 0 || count == 0) {
+            return 0;
+        }
+        auto dst = static_cast<unsigned char *>(buffer);
+        auto wanted = size * count;
+        std::size_t total = 0;
+        while (total < wanted) {
+            if (position_ == current_.size && !next_block()) {
+                break;
+            }
+            auto n = std::min(wanted - total, current_.size - position_);
+            std::memcpy(dst + total, current_.data.data() + position_, n);
+            position_ += n;
+            total += n;
+        }
+        return total / size;
+    }
+
+    /// Returns the next byte as an `unsigned char` converted to `int`, or `EOF`.
+    [[nodiscard]]
+    int fgetc() noexcept {
+        if (position_ < current_.size) {
+            return current_.data[position_++];
+        }
+        unsigned char ch;
+        return fread(&ch, 1, 1) == 1 ? ch : EOF;
+    }
+
+    // MARK: Error Handling
+
+    /// Returns nonzero if the end of the compressed stream has been reached.
+    [[nodiscard]]
+    int feof() const noexcept {
+        return eof_;
+    }
+
+    /// Returns nonzero if the stream is malformed or truncated or a read failed.
+    [[nodiscard]]
+    int ferror() const noexcept {
+        return error_;
+    }
+
+  private:
+    /// A decompressed block.
+    struct block {
+        /// The decompressed data, whose size is at least the block size.
+        std::vector<unsigned char> data;
+        /// The number of valid bytes in `data`.
+        std::size_t size{0};
+        /// Whether this marks the end of the stream.
+        bool end{false};
+        /// Whether this marks an error.
+        bool error{false};
+    };
+
+    /// Reads and decompresses the next block from the underlying stream into `b`.
+    void decode(block &b) noexcept {
+        // A recycled block still holds the state of the block it last decoded
+        b.size = 0;
+        b.end = b.error = false;
+        std::uint32_t length, size;
+        if (!stream_.read_uint_little(length)) {
+            b.error = true;
+            return;
+        }
+        if (length == 0) {
+            b.end = true;
+            return;
+        }
+        auto stored = (length & compressed_format::stored_flag) != 0;
+        length &= ~compressed_format::stored_flag;
+        if (!stream_.read_uint_little(size) || size > block_size_ || length > scratch_.size() ||
+            (stored && length != size)) {
+            b.error = true;
+            return;
+        }
+        try {
+            b.data.resize(block_size_);
+        } catch (const std::bad_alloc &) {
+            b.error = true;
+            return;
+        }
+        if (stored) {
+            b.size = stream_.fread(b.data.data(), 1, length);
+            b.error = b.size != length;
+            return;
+        }
+        if (stream_.fread(scratch_.data(), 1, length) != length ||
+            lz77::decompress(scratch_.data(), length, b.data.data(), b.data.size()) != size) {
+            b.error = true;
+            return;
+        }
+        b.size = size;
+    }
+
+    /// Makes the next block current.
+    /// - returns: `false` at the end of the stream or on error.
+    bool next_block() noexcept {
+        if (eof_ || error_) {
+            return false;
+        }
+        position_ = 0;
+        if (!worker_.joinable()) {
+            decode(current_);
+        } else {
+            std::unique_lock<std::mutex> lock{mutex_};
+            changed_.wait(lock, [this] { return ready_count_ > 0; });
+            // Recycle the consumed block's storage
+            std::swap(current_, ready_[ready_begin_]);
+            spare_.push_back(std::move(ready_[ready_begin_]));
+            ready_begin_ = (ready_begin_ + 1) % queue_depth;
+            --ready_count_;
+            lock.unlock();
+            changed_.notify_all();
+        }
+        eof_ = current_.end;
+        error_ = current_.error;
+        if (eof_ || error_) {
+            // Leave nothing to read so later calls report the end of the stream rather than stale data
+            position_ = current_.size;
+            return false;
+        }
+        return true;
+    }
+
+    /// Decompresses blocks ahead of the consumer until the end of the stream, an error or destruction.
+    void run() noexcept {
+        for (;;) {
+            block b;
+            {
+                std::unique_lock<std::mutex> lock{mutex_};
+                changed_.wait(lock, [this] { return stopping_ || ready_count_ < depth_; });
+                if (stopping_) {
+                    return;
+                }
+                if (!spare_.empty()) {
+                    b = std::move(spare_.back());
+                    spare_.pop_back();
+                }
+            }
+            decode(b);
+            auto last = b.end || b.error;
+            {
+                std::lock_guard<std::mutex> lock{mutex_};
+                ready_[(ready_begin_ + ready_count_) % queue_depth] = std::move(b);
+                ++ready_count_;
+            }
+            changed_.notify_all();
+            if (last) {
+                return;
+            }
+        }
+    }
+
+    /// The underlying stream, read only by the worker thread while it runs.
+    cstream &stream_;
+    /// The uncompressed block size.
+    std::size_t block_size_{0};
+    /// The compressed data of the block being decoded.
+    std::vector<unsigned char> scratch_;
+    /// The memory reserved from the governor for `scratch_` and the blocks.
+    memory_reservation reservation_;
+    /// The number of decompressed blocks the worker thread keeps ready, or `0` without a worker thread.
+    std::size_t depth_{0};
+    /// The block being consumed.
+    block current_;
+    /// The offset of the next unread byte in `current_`.
+    std::size_t position_{0};
+    /// Whether the end of the stream has been reached.
+    bool eof_{false};
+    /// Whether an error has occurred.
+    bool error_{false};
+    /// Guards the queue, `spare_` and `stopping_`.
+    std::mutex mutex_;
+    /// Signaled when the queue changes or the reader is destroyed.
+    std::condition_variable changed_;
+    /// A ring of decompressed blocks waiting to be consumed.
+    std::array<block, queue_depth> ready_;
+    /// The index of the first block in `ready_`.
+    std::size_t ready_begin_{0};
+    /// The number of blocks in `ready_`.
+    std::size_t ready_count_{0};
+    /// Consumed blocks whose storage may be reused.
+    std::vector<block> spare_;
+    /// Whether the worker thread should exit.
+    bool stopping_{false};
+    /// The worker thread.
+    std::thread worker_;
+};
+
+} /* namespace cio */
@@ -0,0 +1,311 @@
+//
+// SPDX-FileCopyrightText: 2024 Stephen F. Booth <contact@sbooth.dev>
+// SPDX-License-Identifier: MIT
+//
+// Part of https://github.com/sbooth/cio
+//
+
+#import <algorithm>
+#import <cstdint>
+#import <cstdio>
+#import <string>
+#import <vector>
+
+#import <fcntl.h>
+#import <sys/stat.h>
+
+#import "cstream.hpp"
+#import "stream_extensions.hpp"
+
+namespace cio {
+
+/// A read-only stream presenting a sequence of files as one logical stream.
+///
+/// Positions are global across all segments. Segments are opened lazily and at most two are open at a time: the
+/// current segment and, once the read position comes within `prefetch_distance()` bytes of its end, the next one,
+/// whose head is requested from the kernel ahead of the crossing.
+class concat_stream : public input_extensions<concat_stream> {
+  public:
+    /// The default distance before a segment boundary at which the next segment is prefetched.
+    static constexpr std::size_t default_prefetch_distance = 1024 * 1024;
+
+    // MARK: Standard Six
+
+    /// Initializes an empty `cio::concat_stream` object.
+    concat_stream() noexcept = default;
+
+    // This class is non-copyable.
+    concat_stream(const concat_stream &rhs) = delete;
+
+    // This class is non-assignable.
+    concat_stream &operator=(const concat_stream &rhs) = delete;
+
+    /// Initializes a `cio::concat_stream` object with the segments of `rhs`.
+    concat_stream(concat_stream &&rhs) noexcept = default;
+
+    /// Replaces the segments of this object with the segments of `rhs`.
+    concat_stream &operator=(concat_stream &&rhs) noexcept = default;
+
+    /// Closes all open segments.
+    ~concat_stream() noexcept = default;
+
+    // MARK: Construction
+
+    /// Initializes a `cio::concat_stream` object with the files in `paths`.
+    ///
+    /// The size of each file is determined immediately; if any file cannot be examined the object is invalid.
+    /// - parameter paths: The files to concatenate, in order.
+    /// - parameter prefetch_distance: The distance before a segment boundary at which to prefetch the next segment.
+    /// - throws: Any exception thrown by `Allocator::allocate()` (typically `std::bad_alloc`)
+    explicit concat_stream(std::vector<std::string> paths,
+                           std::size_t prefetch_distance = default_prefetch_distance)
+        : prefetch_distance_{prefetch_distance} {
+        segments_.reserve(paths.size());
+        std::uint64_t offset = 0;
+        for (auto &path : paths) {
+            struct stat st;
+            if (::stat(path.c_str(), &st) == -1) {
+                segments_.clear();
+                return;
+            }
+            auto size = static_cast<std::uint64_t>(st.st_size);
+            segments_.push_back({std::move(path), offset, size, cstream{}, false, false});
+            offset += size;
+        }
+        size_ = offset;
+        valid_ = true;
+    }
+
+    // MARK: Stream Handling
+
+    /// Returns `true` if all segments were found.
+    [[nodiscard]]
+    explicit operator bool() const noexcept {
+        return valid_;
+    }
+
+    /// Returns the number of segments.
+    [[nodiscard]]
+    std::size_t segment_count() const noexcept {
+        return segments_.size();
+    }
+
+    /// Returns the total size of all segments in bytes.
+    [[nodiscard]]
+    std::uint64_t size() const noexcept {
+        return size_;
+    }
+
+    /// Returns the distance before a segment boundary at which the next segment is prefetched.
+    [[nodiscard]]
+    std::size_t prefetch_distance() const noexcept {
+        return prefetch_distance_;
+    }
+
+    // MARK: Direct Input
+
+    using input_extensions<concat_stream>::fread;
+
+    /// Reads up to `count` objects of `size` bytes into `buffer`, crossing segment boundaries as needed.
+    /// - returns: The number of complete objects read.
+    std::size_t fread(void *buffer, std::size_t size, std::size_t count) noexcept {
+        if (size == 0 || count == 0) {
+            return 0;
+        }
+        auto dst = static_cast<unsigned char *>(buffer);
+        auto remaining = size * count;
+        std::size_t total = 0;
+        while (remaining > 0) {
+            if (position_ >= size_) {
+                eof_ = true;
+                break;
+            }
+            auto stream = current_segment();
+            if (!stream) {
+                error_ = true;
+                break;
+            }
+            auto &segment = segments_[index_];
+            auto in_segment = static_cast<std::size_t>(
+                    std::min<std::uint64_t>(remaining, segment.begin + segment.size - position_));
+            auto read = stream->fread(dst, 1, in_segment);
+            dst += read;
+            total += read;
+            remaining -= read;
+            position_ += read;
+            if (read != in_segment) {
+                // The segment is shorter than when it was examined or a read failed
+                error_ = true;
+                break;
+            }
+            prefetch_next();
+        }
+        return total / size;
+    }
+
+    /// Returns the next byte as an `unsigned char` converted to `int`, or `EOF`.
+    [[nodiscard]]
+    int fgetc() noexcept {
+        unsigned char ch;
+        return fread(&ch, 1, 1) == 1 ? ch : EOF;
+    }
+
+    // MARK: File Positioning
+
+    /// Returns the current global position.
+    [[nodiscard]]
+    long ftell() const noexcept {
+        return static_cast<long>(position_);
+    }
+
+    /// Sets the current global position.
+    /// - returns: `0` on success, `-1` otherwise.
+    int fseek(long offset, int origin) noexcept {
+        long base;
+        switch (origin) {
+        case SEEK_SET:
+            base = 0;
+            break;
+        case SEEK_CUR:
+            base = static_cast<long>(position_);
+            break;
+        case SEEK_END:
+            base = static_cast<long>(size_);
+            break;
+        default:
+            return -1;
+        }
+        if (offset < -base) {
+            return -1;
+        }
+        position_ = static_cast<std::uint64_t>(base + offset);
+        eof_ = false;
+        // Segments passed again after a backward seek are prefetched again
+        for (auto &segment : segments_) {
+            segment.positioned = false;
+            segment.prefetched = false;
+        }
+        return 0;
+    }
+
+    /// Sets the current position to the beginning of the first segment and clears the error indicators.
+    void rewind() noexcept {
+        fseek(0, SEEK_SET);
+        clearerr();
+    }
+
+    // MARK: Error Handling
+
+    /// Clears the end-of-file and error indicators.
+    void clearerr() noexcept {
+        eof_ = false;
+        error_ = false;
+    }
+
+    /// Returns nonzero if a read has reached the end of the last segment.
+    [[nodiscard]]
+    int feof() const noexcept {
+        return eof_;
+    }
+
+    /// Returns nonzero if an error has occurred.
+    [[nodiscard]]
+    int ferror() const noexcept {
+        return error_;
+    }
+
+  private:
+    /// A segment of the logical stream.
+    struct segment {
+        /// The path of the segment's file.
+        std::string path;
+        /// The global offset of the segment's first byte.
+        std::uint64_t begin;
+        /// The size of the segment in bytes.
+        std::uint64_t size;
+        /// The segment's stream, if open.
+        cstream stream;
+        /// Whether the stream's position matches the global position.
+        bool positioned;
+        /// Whether the segment's head has been prefetched.
+        bool prefetched;
+    };
+
+    /// Opens the segment containing the current position if needed and returns its stream positioned for reading.
+    cstream *current_segment() noexcept {
+        auto it = std::upper_bound(segments_.begin(), segments_.end(), position_,
+                                   [](std::uint64_t pos, const segment &s) { return pos < s.begin + s.size; });
+        if (it == segments_.end()) {
+            return nullptr;
+        }
+        auto index = static_cast<std::size_t>(it - segments_.begin());
+        if (index != index_) {
+            // Keep at most the current and next segments open
+            for (std::size_t i = 0; i < segments_.size(); ++i) {
+                if (i != index && i != index + 1 && segments_[i].stream) {
+                    segments_[i].stream.reset();
+                    segments_[i].positioned = false;
+                    segments_[i].prefetched = false;
+                }
+            }
+            index_ = index;
+        }
+        auto &segment = *it;
+        if (!segment.stream && !segment.stream.fopen(segment.path.c_str(), "rb")) {
+            return nullptr;
+        }
+        if (!segment.positioned) {
+            if (segment.stream.fseek(static_cast<long>(position_ - segment.begin), SEEK_SET) != 0) {
+                return nullptr;
+            }
+            segment.positioned = true;
+        }
+        return &segment.stream;
+    }
+
+    /// Opens the next segment and requests its head once the current position is near the current segment's end.
+    void prefetch_next() noexcept {
+        auto next = index_ + 1;
+        if (next >= segments_.size() || segments_[next].prefetched) {
+            return;
+        }
+        auto &current = segments_[index_];
+        if (current.begin + current.size - position_ > prefetch_distance_) {
+            return;
+        }
+        auto &segment = segments_[next];
+        segment.prefetched = true;
+        if (!segment.stream && !segment.stream.fopen(segment.path.c_str(), "rb")) {
+            return;
+        }
+        segment.positioned = false;
+        auto length = static_cast<off_t>(std::min<std::uint64_t>(segment.size, prefetch_distance_));
+#if defined(POSIX_FADV_WILLNEED)
+        ::posix_fadvise(segment.stream.fileno(), 0, length, POSIX_FADV_WILLNEED);
+#elif defined(F_RDADVISE)
+        struct radvisory advice{0, static_cast<int>(length)};
+        ::fcntl(segment.stream.fileno(), F_RDADVISE, &advice);
+#else
+        (void)length;
+#endif
+    }
+
+    /// The segments.
+    std::vector<segment> segments_;
+    /// The total size of all segments.
+    std::uint64_t size_{0};
+    /// The current global position.
+    std::uint64_t position_{0};
+    /// The index of the segment most recently read.
+    std::size_t index_{0};
+    /// The distance before a segment boundary at which the next segment is prefetched.
+    std::size_t prefetch_distance_{default_prefetch_distance};
+    /// Whether all segments were found.
+    bool valid_{false};
+    /// Whether a read has reached the end of the last segment.
+    bool eof_{false};
+    /// Whether an error has occurred.
+    bool error_{false};
+};
+
+} /* namespace cio */
@@ -5,15 +5,24 @@
 // Part of https://github.com/sbooth/cio
 //
 
+#import <algorithm>
 #import <cassert>
+#import <cerrno>
 #import <cstdarg>
 #import <cstdint>
 #import <cstdio>
 #import <optional>
 #import <type_traits>
+#import <utility>
 #import <vector>
 
+#import <fcntl.h>
 #import <libkern/OSByteOrder.h>
+#import <sys/mman.h>
+#import <sys/uio.h>
+#import <unistd.h>
+
+#import "bitpack.hpp"
 
 namespace cio {
 
@@ -313,6 +322,231 @@ class cstream {
 
     // MARK: - Extensions
 
+    /// Returns the file descriptor underlying the managed stream.
+    /// - seealso: [fileno(3)](https://man7.org/linux/man-pages/man3/fileno.3.html)
+    [[nodiscard]]
+    int fileno() const noexcept {
+        return ::fileno(stream_);
+    }
+
+    /// Returns a `cio::cstream` object for an anonymous memory-backed file.
+    ///
+    /// On Linux the file is created with `memfd_create(2)` and never touches a file system. The descriptor is
+    /// close-on-exec; to hand the file to a child process duplicate it onto a known descriptor with `dup2(2)` or
+    /// `posix_spawn_file_actions_adddup2(3)`. Elsewhere this falls back to `std::tmpfile()`.
+    /// - parameter name: A name for the file, used only for debugging.
+    /// - parameter size_hint: The number of bytes to reserve without changing the file size, or `0`.
+    /// - parameter allow_sealing: Whether `add_seals()` may be used on the file.
+    /// - seealso: [memfd_create(2)](https://man7.org/linux/man-pages/man2/memfd_create.2.html)
+    [[nodiscard]]
+    static cstream memfd(const char *name, std::size_t size_hint = 0, bool allow_sealing = false) noexcept {
+#if defined(MFD_CLOEXEC)
+        auto fd = ::memfd_create(name, MFD_CLOEXEC | (allow_sealing ? MFD_ALLOW_SEALING : 0));
+        if (fd == -1) {
+            return cstream{};
+        }
+#if defined(FALLOC_FL_KEEP_SIZE)
+        if (size_hint > 0) {
+            // The hint is advisory so failure is not an error
+            ::fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, static_cast<off_t>(size_hint));
+        }
+#endif
+        auto stream = ::fdopen(fd, "w+b");
+        if (!stream) {
+            auto err = errno;
+            ::close(fd);
+            errno = err;
+        }
+        return cstream{stream};
+#else
+        (void)name;
+        (void)size_hint;
+        (void)allow_sealing;
+        return tmpfile();
+#endif
+    }
+
+    /// Flushes the managed stream and adds `seals` to the seals on its file.
+    ///
+    /// The file must have been created by `memfd()` with `allow_sealing` set.
+    /// - parameter seals: A mask of `F_SEAL_SEAL`, `F_SEAL_SHRINK`, `F_SEAL_GROW`, `F_SEAL_WRITE` and
+    /// `F_SEAL_FUTURE_WRITE`.
+    /// - returns: `0` on success, `-1` otherwise with `errno` set.
+    /// - seealso: [fcntl(2)](https://man7.org/linux/man-pages/man2/fcntl.2.html)
+    int add_seals(int seals) noexcept {
+#if defined(F_ADD_SEALS)
+        if (fflush() != 0) {
+            return -1;
+        }
+        return ::fcntl(fileno(), F_ADD_SEALS, seals);
+#else
+        (void)seals;
+        errno = EINVAL;
+        return -1;
+#endif
+    }
+
+    /// Returns the seals on the file underlying the managed stream, or `-1` with `errno` set on failure.
+    /// - seealso: [fcntl(2)](https://man7.org/linux/man-pages/man2/fcntl.2.html)
+    [[nodiscard]]
+    int seals() const noexcept {
+#if defined(F_GET_SEALS)
+        return ::fcntl(fileno(), F_GET_SEALS);
+#else
+        errno = EINVAL;
+        return -1;
+#endif
+    }
+
+    /// Sets or clears `O_NONBLOCK` on the file descriptor underlying the managed stream.
+    ///
+    /// Once the descriptor is non-blocking, stdio reads that find no data fail with `EAGAIN` and set the error
+    /// indicator; such streams are normally read with `cio::stream_multiplexer` instead.
+    /// - returns: `0` on success, `-1` otherwise with `errno` set.
+    int set_nonblocking(bool nonblocking = true) noexcept {
+        auto fd = fileno();
+        auto flags = ::fcntl(fd, F_GETFL);
+        if (flags == -1) {
+            return -1;
+        }
+        flags = nonblocking ? (flags | O_NONBLOCK) : (flags & ~O_NONBLOCK);
+        return ::fcntl(fd, F_SETFL, flags) == -1 ? -1 : 0;
+    }
+
+    // MARK: Pipes
+
+    /// Returns a pair of `cio::cstream` objects for the read and write ends of a new pipe.
+    ///
+    /// Both descriptors are close-on-exec, set atomically with `pipe2(2)` where available. If either stream could not
+    /// be created both are empty.
+    /// - parameter capacity: The pipe capacity in bytes to request with `set_pipe_capacity()`, or `0` for the default.
+    /// - seealso: [pipe(2)](https://man7.org/linux/man-pages/man2/pipe.2.html)
+    [[nodiscard]]
+    static std::pair<cstream, cstream> pipe(std::size_t capacity = 0) noexcept {
+        int fds[2];
+#if defined(__linux__) || defined(__FreeBSD__) || defined(__NetBSD__) || defined(__OpenBSD__)
+        // Set close-on-exec atomically so a concurrent fork and exec cannot inherit the descriptors
+        if (::pipe2(fds, O_CLOEXEC) == -1) {
+            return {cstream{}, cstream{}};
+        }
+#else
+        if (::pipe(fds) == -1) {
+            return {cstream{}, cstream{}};
+        }
+        ::fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+        ::fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+#endif
+        cstream read_end{::fdopen(fds[0], "rb")};
+        if (!read_end) {
+            ::close(fds[0]);
+            ::close(fds[1]);
+            return {cstream{}, cstream{}};
+        }
+        cstream write_end{::fdopen(fds[1], "wb")};
+        if (!write_end) {
+            ::close(fds[1]);
+            return {cstream{}, cstream{}};
+        }
+        if (capacity > 0) {
+            // The default capacity still works so failure is not an error
+            write_end.set_pipe_capacity(capacity);
+        }
+        return {std::move(read_end), std::move(write_end)};
+    }
+
+    /// Sets the capacity of the pipe underlying the managed stream with `F_SETPIPE_SZ` (Linux only).
+    ///
+    /// Unprivileged processes are limited by `/proc/sys/fs/pipe-max-size`.
+    /// - returns: The new capacity, which may exceed `capacity`, or `-1` with `errno` set on failure.
+    /// - seealso: [fcntl(2)](https://man7.org/linux/man-pages/man2/fcntl.2.html)
+    long set_pipe_capacity(std::size_t capacity) noexcept {
+#if defined(F_SETPIPE_SZ)
+        return ::fcntl(fileno(), F_SETPIPE_SZ, static_cast<int>(capacity));
+#else
+        (void)capacity;
+        errno = EINVAL;
+        return -1;
+#endif
+    }
+
+    /// Returns the capacity of the pipe underlying the managed stream, or `-1` with `errno` set on failure.
+    /// - seealso: [fcntl(2)](https://man7.org/linux/man-pages/man2/fcntl.2.html)
+    [[nodiscard]]
+    long pipe_capacity() const noexcept {
+#if defined(F_GETPIPE_SZ)
+        return ::fcntl(fileno(), F_GETPIPE_SZ);
+#else
+        errno = EINVAL;
+        return -1;
+#endif
+    }
+
+    /// Writes `size` bytes at `data` to the pipe underlying the managed stream without copying, using `vmsplice(2)`.
+    ///
+    /// The pipe references the caller's pages rather than copying them, so the buffer must not be modified until the
+    /// reader has consumed the data. `data` and `size` should be page-aligned for best results. The managed stream is
+    /// flushed first; where `vmsplice(2)` is unavailable this falls back to `write(2)`.
+    /// - returns: The number of bytes written.
+    std::size_t write_pages(const void *data, std::size_t size) noexcept {
+        if (fflush() != 0) {
+            return 0;
+        }
+        auto fd = fileno();
+        auto p = static_cast<const unsigned char *>(data);
+        std::size_t total = 0;
+        while (total < size) {
+#if defined(SPLICE_F_GIFT)
+            struct iovec iov{const_cast<unsigned char *>(p + total), size - total};
+            auto n = ::vmsplice(fd, &iov, 1, 0);
+#else
+            auto n = ::write(fd, p + total, size - total);
+#endif
+            if (n > 0) {
+                total += static_cast<std::size_t>(n);
+            } else if (n == -1 && errno != EINTR) {
+                break;
+            }
+        }
+        return total;
+    }
+
+    /// Moves up to `length` bytes from the pipe underlying the managed stream to the file underlying `out` without
+    /// copying through user space, using `splice(2)`.
+    ///
+    /// The pipe must not have been read through stdio, since data in the stdio buffer would be skipped. `out` is
+    /// flushed first and data is written at its file offset. Where `splice(2)` is unavailable this falls back to
+    /// `read(2)` and `write(2)`.
+    /// - returns: The number of bytes moved, which is less than `length` at end of file or on error.
+    std::size_t splice_to(cstream &out, std::size_t length) noexcept {
+        if (out.fflush() != 0) {
+            return 0;
+        }
+        auto in_fd = fileno();
+        auto out_fd = out.fileno();
+        std::size_t total = 0;
+        while (total < length) {
+#if defined(SPLICE_F_MOVE)
+            auto n = ::splice(in_fd, nullptr, out_fd, nullptr, length - total, SPLICE_F_MOVE | SPLICE_F_MORE);
+#else
+            unsigned char buffer[64 * 1024];
+            auto n = ::read(in_fd, buffer, std::min(sizeof buffer, length - total));
+            for (ssize_t written = 0; n > 0 && written < n;) {
+                auto w = ::write(out_fd, buffer + written, static_cast<std::size_t>(n - written));
+                if (w == -1 && errno != EINTR) {
+                    return total + static_cast<std::size_t>(written);
+                }
+                written += w > 0 ? w : 0;
+            }
+#endif
+            if (n > 0) {
+                total += static_cast<std::size_t>(n);
+            } else if (n == 0 || errno != EINTR) {
+                break;
+            }
+        }
+        return total;
+    }
+
     /// Reads a block of data.
     /// - parameter count: The maximum number of elements to read.
     /// - returns: A `std::vector` containing the requested elements.
@@ -334,6 +568,31 @@ class cstream {
         return static_cast<typename std::vector<T>::size_type>(fwrite(v.data(), v.size()));
     }
 
+    /// Writes unsigned integers compressed with delta coding and bit-packing.
+    ///
+    /// The count is written as a little-endian `uint64_t` followed by the values encoded as described in
+    /// `cio::bitpack`. Sorted values with small gaps compress best.
+    /// - parameter values: The values to write.
+    /// - parameter count: The number of values.
+    /// - returns: `true` on success, `false` otherwise.
+    bool write_packed_uints(const std::uint32_t *values, std::size_t count) noexcept {
+        return bitpack::write(*this, values, count);
+    }
+
+    /// Writes unsigned integers compressed with delta coding and bit-packing.
+    /// - parameter v: A `std::vector` containing the values to write.
+    /// - returns: `true` on success, `false` otherwise.
+    bool write_packed_uints(const std::vector<std::uint32_t> &v) noexcept {
+        return write_packed_uints(v.data(), v.size());
+    }
+
+    /// Reads unsigned integers written by `write_packed_uints()`.
+    /// - parameter v: A `std::vector` to receive the values.
+    /// - returns: `true` on success, `false` if the data is malformed or truncated or a read failed.
+    /// - throws: Any exception thrown by `Allocator::allocate()` (typically `std::bad_alloc`)
+    /// - throws: `std::length_error`
+    bool read_packed_uints(std::vector<std::uint32_t> &v) { return bitpack::read(*this, v); }
+
     /// Gets a value.
     /// - returns: The value read or `std::nullopt` on failure.
     template <typename T, typename = std::enable_if_t<std::is_trivially_default_constructible_v<T>>>
@@ -357,133 +616,145 @@ class cstream {
         swapped,
     };
 
-    /// Reads an unsigned integer value in the specified byte order.
-    /// - parameter value: A reference to receive the value.
-    /// - parameter order: The desired byte order.
-    /// - returns: `true` on success, `false` otherwise.
+    /// Converts an unsigned integer value from the specified byte order to host byte order.
+    /// - parameter value: The value to convert.
+    /// - parameter order: The byte order of `value`.
+    /// - returns: `value` in host byte order.
     template <typename T,
               typename = std::enable_if_t<std::is_same_v<T, std::uint16_t> || std::is_same_v<T, std::uint32_t> ||
                                           std::is_same_v<T, std::uint64_t>>>
-    bool read_uint(T &value, byte_order order = byte_order::host) noexcept {
-        if (!fread(value)) {
-            return false;
-        }
-
+    [[nodiscard]]
+    static T swap_to_host(T value, byte_order order) noexcept {
         if constexpr (std::is_same_v<T, std::uint16_t>) {
             switch (order) {
             case byte_order::little_endian:
-                value = OSSwapLittleToHostInt16(value);
-                break;
+                return OSSwapLittleToHostInt16(value);
             case byte_order::big_endian:
-                value = OSSwapBigToHostInt16(value);
-                break;
+                return OSSwapBigToHostInt16(value);
             case byte_order::host:
-                break;
+                return value;
             case byte_order::swapped:
-                value = OSSwapInt16(value);
-                break;
+                return OSSwapInt16(value);
             }
-            return true;
         } else if constexpr (std::is_same_v<T, std::uint32_t>) {
             switch (order) {
             case byte_order::little_endian:
-                value = OSSwapLittleToHostInt32(value);
-                break;
+                return OSSwapLittleToHostInt32(value);
             case byte_order::big_endian:
-                value = OSSwapBigToHostInt32(value);
-                break;
+                return OSSwapBigToHostInt32(value);
             case byte_order::host:
-                break;
+                return value;
             case byte_order::swapped:
-                value = OSSwapInt32(value);
-                break;
+                return OSSwapInt32(value);
             }
-            return true;
         } else if constexpr (std::is_same_v<T, std::uint64_t>) {
             switch (order) {
             case byte_order::little_endian:
-                value = OSSwapLittleToHostInt64(value);
-                break;
+                return OSSwapLittleToHostInt64(value);
             case byte_order::big_endian:
-                value = OSSwapBigToHostInt64(value);
-                break;
+                return OSSwapBigToHostInt64(value);
             case byte_order::host:
-                break;
+                return value;
             case byte_order::swapped:
-                value = OSSwapInt64(value);
-                break;
+                return OSSwapInt64(value);
             }
-            return true;
         } else {
-            static_assert(false, "Unsupported unsigned integer type in read_uint");
+            static_assert(false, "Unsupported unsigned integer type in swap_to_host");
         }
 
-        return false;
-    }
-
-    /// Reads an unsigned integer value in little-endian byte order.
-    /// - parameter value: A reference to receive the value.
-    /// - returns: `true` on success, `false` otherwise.
-    template <typename T> bool read_uint_little(T &value) noexcept {
-        return read_uint(value, byte_order::little_endian);
+        return value;
     }
 
-    /// Reads an unsigned integer value in big-endian byte order.
-    /// - parameter value: A reference to receive the value.
-    /// - returns: `true` on success, `false` otherwise.
-    template <typename T> bool read_uint_big(T &value) noexcept { return read_uint(value, byte_order::big_endian); }
-
-    /// Reads an unsigned integer value with swapped byte order.
-    /// - parameter value: A reference to receive the value.
-    /// - returns: `true` on success, `false` otherwise.
-    template <typename T> bool read_uint_swapped(T &value) noexcept { return read_uint(value, byte_order::swapped); }
-
-    /// Writes an unsigned integer value in the specified byte order.
-    /// - parameter value: The value to write.
+    /// Converts an unsigned integer value from host byte order to the specified byte order.
+    /// - parameter value: The value to convert.
     /// - parameter order: The desired byte order.
-    /// - returns: `true` on success, `false` otherwise.
+    /// - returns: `value` in byte order `order`.
     template <typename T,
               typename = std::enable_if_t<std::is_same_v<T, std::uint16_t> || std::is_same_v<T, std::uint32_t> ||
                                           std::is_same_v<T, std::uint64_t>>>
-    bool write_uint(const T &value, byte_order order = byte_order::host) noexcept {
+    [[nodiscard]]
+    static T swap_from_host(T value, byte_order order) noexcept {
         if constexpr (std::is_same_v<T, std::uint16_t>) {
             switch (order) {
             case byte_order::little_endian:
-                return fwrite(OSSwapHostToLittleInt16(value));
+                return OSSwapHostToLittleInt16(value);
             case byte_order::big_endian:
-                return fwrite(OSSwapHostToBigInt16(value));
+                return OSSwapHostToBigInt16(value);
             case byte_order::host:
-                return fwrite(value);
+                return value;
             case byte_order::swapped:
-                return fwrite(OSSwapInt16(value));
+                return OSSwapInt16(value);
             }
         } else if constexpr (std::is_same_v<T, std::uint32_t>) {
             switch (order) {
             case byte_order::little_endian:
-                return fwrite(OSSwapHostToLittleInt32(value));
+                return OSSwapHostToLittleInt32(value);
             case byte_order::big_endian:
-                return fwrite(OSSwapHostToBigInt32(value));
+                return OSSwapHostToBigInt32(value);
             case byte_order::host:
-                return fwrite(value);
+                return value;
             case byte_order::swapped:
-                return fwrite(OSSwapInt32(value));
+                return OSSwapInt32(value);
             }
         } else if constexpr (std::is_same_v<T, std::uint64_t>) {
             switch (order) {
             case byte_order::little_endian:
-                return fwrite(OSSwapHostToLittleInt64(value));
+                return OSSwapHostToLittleInt64(value);
             case byte_order::big_endian:
-                return fwrite(OSSwapHostToBigInt64(value));
+                return OSSwapHostToBigInt64(value);
             case byte_order::host:
-                return fwrite(value);
+                return value;
             case byte_order::swapped:
-                return fwrite(OSSwapInt64(value));
+                return OSSwapInt64(value);
             }
         } else {
-            static_assert(false, "Invalid typename T in write_uint");
+            static_assert(false, "Unsupported unsigned integer type in swap_from_host");
         }
 
-        return false;
+        return value;
+    }
+
+    /// Reads an unsigned integer value in the specified byte order.
+    /// - parameter value: A reference to receive the value.
+    /// - parameter order: The desired byte order.
+    /// - returns: `true` on success, `false` otherwise.
+    template <typename T,
+              typename = std::enable_if_t<std::is_same_v<T, std::uint16_t> || std::is_same_v<T, std::uint32_t> ||
+                                          std::is_same_v<T, std::uint64_t>>>
+    bool read_uint(T &value, byte_order order = byte_order::host) noexcept {
+        if (!fread(value)) {
+            return false;
+        }
+        value = swap_to_host(value, order);
+        return true;
+    }
+
+    /// Reads an unsigned integer value in little-endian byte order.
+    /// - parameter value: A reference to receive the value.
+    /// - returns: `true` on success, `false` otherwise.
+    template <typename T> bool read_uint_little(T &value) noexcept {
+        return read_uint(value, byte_order::little_endian);
+    }
+
+    /// Reads an unsigned integer value in big-endian byte order.
+    /// - parameter value: A reference to receive the value.
+    /// - returns: `true` on success, `false` otherwise.
+    template <typename T> bool read_uint_big(T &value) noexcept { return read_uint(value, byte_order::big_endian); }
+
+    /// Reads an unsigned integer value with swapped byte order.
+    /// - parameter value: A reference to receive the value.
+    /// - returns: `true` on success, `false` otherwise.
+    template <typename T> bool read_uint_swapped(T &value) noexcept { return read_uint(value, byte_order::swapped); }
+
+    /// Writes an unsigned integer value in the specified byte order.
+    /// - parameter value: The value to write.
+    /// - parameter order: The desired byte order.
+    /// - returns: `true` on success, `false` otherwise.
+    template <typename T,
+              typename = std::enable_if_t<std::is_same_v<T, std::uint16_t> || std::is_same_v<T, std::uint32_t> ||
+                                          std::is_same_v<T, std::uint64_t>>>
+    bool write_uint(const T &value, byte_order order = byte_order::host) noexcept {
+        return fwrite(swap_from_host(value, order));
     }
 
     /// Writes an unsigned integer value in little-endian byte order.
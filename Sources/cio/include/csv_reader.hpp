@@ -0,0 +1,408 @@
+//
+// SPDX-FileCopyrightText: 2024 Stephen F. Booth <contact@sbooth.dev>
+// SPDX-License-Identifier: MIT
+//
+// Part of https://github.com/sbooth/cio
+//
+
+#import <algorithm>
+#import <cstdint>
+#import <cstring>
+#import <exception>
+#import <string_view>
+#import <thread>
+#import <utility>
+#import <vector>
+
+#import "cstream.hpp"
+#import "memory_governor.hpp"
+#import "simd.hpp"
+
+namespace cio {
+
+/// A reader splitting delimited text such as CSV or TSV into rows of fields.
+///
+/// The stream is read in large blocks and each block is indexed before any field is produced: for each 64 bytes,
+/// masks of the delimiters, newlines and quotes are computed with vector comparisons, the bytes inside quotes are
+/// found with a prefix XOR of the quote mask, and the offsets of the delimiters and newlines outside quotes are
+/// recorded. Splitting rows then only visits those offsets.
+///
+/// Fields are `std::string_view` objects referring to the reader's buffer. A quoted field is returned without its
+/// enclosing quotes and with doubled quotes collapsed in place, so no field is copied. Rows end with LF or CRLF and
+/// empty lines are skipped; a line holding only a quoted empty field is a row with one empty field.
+///
+/// Once a block is indexed the boundaries of all of its complete rows are known, so `parse_parallel()` can split it
+/// into ranges of rows that worker threads parse concurrently.
+class csv_reader {
+  public:
+    /// The default number of bytes read at a time.
+    static constexpr std::size_t default_block_size = 1024 * 1024;
+
+    /// The smallest number of delimiters and newlines in a block that `parse_parallel()` splits between threads.
+    static constexpr std::size_t min_parallel_structurals = 16 * 1024;
+
+    /// The largest size of the buffer, which limits the length of a row.
+    static constexpr std::size_t max_buffer_size = std::size_t{1} << 31;
+
+    // This class is non-copyable.
+    csv_reader(const csv_reader &rhs) = delete;
+
+    // This class is non-assignable.
+    csv_reader &operator=(const csv_reader &rhs) = delete;
+
+    /// Initializes a `cio::csv_reader` object that reads from `stream`.
+    /// - parameter stream: The stream to read.
+    /// - parameter delimiter: The byte separating fields, typically `','` or `'\t'`.
+    /// - parameter quote: The byte enclosing fields that contain delimiters, newlines or quotes.
+    /// - parameter block_size: The number of bytes read at a time. The buffer grows as needed to hold a row, up to
+    /// `max_buffer_size`; a longer row is an error. The buffer and its index are reserved from
+    /// `cio::memory_governor::shared()`, and a buffer the budget cannot cover is an error.
+    /// - throws: Any exception thrown by `Allocator::allocate()` (typically `std::bad_alloc`)
+    explicit csv_reader(cstream &stream, char delimiter = ',', char quote = '"',
+                        std::size_t block_size = default_block_size)
+        : stream_{stream}, delimiter_{static_cast<unsigned char>(delimiter)},
+          quote_{static_cast<unsigned char>(quote)} {
+        if (!resize_buffer(std::max<std::size_t>(block_size, byte_block::size))) {
+            error_ = true;
+        }
+    }
+
+    /// Returns `true` if no error has occurred.
+    [[nodiscard]]
+    explicit operator bool() const noexcept {
+        return !error_;
+    }
+
+    /// Returns the number of rows read by `next()`, including empty lines.
+    [[nodiscard]]
+    std::uint64_t row_number() const noexcept {
+        return rows_;
+    }
+
+    // MARK: Reading
+
+    /// Reads the next row.
+    /// - parameter fields: The fields of the row, valid until the next call.
+    /// - returns: `true` on success, `false` at the end of the stream or on error.
+    /// - throws: Any exception thrown by `Allocator::allocate()` (typically `std::bad_alloc`)
+    bool next(std::vector<std::string_view> &fields) {
+        for (;;) {
+            auto limit = structural_count_;
+            auto end = next_structural_;
+            while (end < limit && !is_newline(structurals_[end])) {
+                ++end;
+            }
+            if (end < limit) {
+                auto begin = begin_;
+                begin_ = offset(structurals_[end]) + 1;
+                split(begin, next_structural_, end, fields);
+                next_structural_ = end + 1;
+                ++rows_;
+                if (!is_empty(begin, begin_ - 1)) {
+                    return true;
+                }
+                continue;
+            }
+            if (eof_) {
+                if (begin_ == end_) {
+                    return false;
+                }
+                auto begin = begin_;
+                split(begin, next_structural_, limit, fields);
+                begin_ = end_;
+                next_structural_ = limit;
+                ++rows_;
+                return !is_empty(begin, end_);
+            }
+            if (!fill()) {
+                return false;
+            }
+        }
+    }
+
+    /// Reads the remaining rows, parsing each block with up to `threads` threads.
+    ///
+    /// The callback is invoked concurrently from several threads, as `callback(const std::vector<std::string_view> &)`
+    /// with the fields of one row, and must be thread-safe. Rows within a range are reported in order, but ranges are
+    /// parsed concurrently. An exception thrown by the callback stops the parse and is rethrown.
+    /// - parameter callback: The function called with each row.
+    /// - parameter threads: The number of threads to use, or `0` for the number of hardware threads.
+    /// - returns: `false` if a read failed.
+    /// - throws: Any exception thrown by `Allocator::allocate()` (typically `std::bad_alloc`) or `callback`
+    template <typename Callback> bool parse_parallel(Callback &&callback, unsigned threads = 0) {
+        if (threads == 0) {
+            threads = std::max(std::thread::hardware_concurrency(), 1u);
+        }
+        std::vector<std::vector<std::string_view>> fields(threads);
+        std::vector<std::exception_ptr> errors(threads);
+        for (;;) {
+            // Parse every complete row indexed so far
+            auto last = structural_count_;
+            while (last > next_structural_ && !is_newline(structurals_[last - 1])) {
+                --last;
+            }
+            if (last > next_structural_) {
+                auto count = last - next_structural_;
+                auto ranges = count < min_parallel_structurals ? 1 : std::min<std::size_t>(threads, count / 1024);
+
+                // Start each range after the first at the row following an evenly spaced structural
+                std::vector<std::size_t> starts{next_structural_};
+                for (std::size_t k = 1; k < ranges; ++k) {
+                    auto s = std::max(next_structural_ + count * k / ranges, starts.back());
+                    if (s >= last) {
+                        break;
+                    }
+                    while (!is_newline(structurals_[s])) {
+                        ++s;
+                    }
+                    starts.push_back(s + 1);
+                }
+                starts.push_back(last);
+
+                auto work = [&](std::size_t k) {
+                    try {
+                        auto s = starts[k];
+                        auto begin = s == next_structural_ ? begin_ : offset(structurals_[s - 1]) + 1;
+                        for (auto t = s; t < starts[k + 1]; ++t) {
+                            if (is_newline(structurals_[t])) {
+                                split(begin, s, t, fields[k]);
+                                if (!is_empty(begin, offset(structurals_[t]))) {
+                                    callback(std::as_const(fields[k]));
+                                }
+                                begin = offset(structurals_[t]) + 1;
+                                s = t + 1;
+                            }
+                        }
+                    } catch (...) {
+                        errors[k] = std::current_exception();
+                    }
+                };
+                std::vector<std::thread> workers;
+                workers.reserve(starts.size() - 2);
+                for (std::size_t k = 1; k + 1 < starts.size(); ++k) {
+                    workers.emplace_back(work, k);
+                }
+                work(0);
+                for (auto &worker : workers) {
+                    worker.join();
+                }
+                for (auto &error : errors) {
+                    if (error) {
+                        std::rethrow_exception(error);
+                    }
+                }
+
+                begin_ = offset(structurals_[last - 1]) + 1;
+                next_structural_ = last;
+            }
+
+            if (eof_) {
+                std::vector<std::string_view> row;
+                while (next(row)) {
+                    callback(std::as_const(row));
+                }
+                return !error_;
+            }
+            if (!fill()) {
+                return !error_;
+            }
+        }
+    }
+
+    // MARK: Error Handling
+
+    /// Returns nonzero if the end of the stream has been reached and all rows have been read.
+    [[nodiscard]]
+    int feof() const noexcept {
+        return eof_ && begin_ == end_;
+    }
+
+    /// Returns nonzero if a read failed.
+    [[nodiscard]]
+    int ferror() const noexcept {
+        return error_;
+    }
+
+  private:
+    /// The flag set in a structural for a newline.
+    static constexpr std::uint32_t newline_flag = 0x80000000;
+
+    /// Returns `true` if `structural` is a newline.
+    static bool is_newline(std::uint32_t structural) noexcept {
+        return (structural & newline_flag) != 0;
+    }
+
+    /// Returns the offset in the buffer of `structural`.
+    static std::size_t offset(std::uint32_t structural) noexcept {
+        return structural & ~newline_flag;
+    }
+
+    /// Returns `true` if the row `[begin, end)`, without its newline, is empty or only a carriage return.
+    ///
+    /// A row holding a single quoted empty field is not empty, although its only field is.
+    bool is_empty(std::size_t begin, std::size_t end) const noexcept {
+        return end == begin || (end == begin + 1 && buffer_[begin] == '\r');
+    }
+
+    /// Moves the unread rows to the front of the buffer, reads more data and indexes it.
+    /// - returns: `false` if a read failed or the end of the stream had already been reached.
+    bool fill() {
+        if (eof_ || error_) {
+            return false;
+        }
+        if (begin_ > 0) {
+            std::memmove(buffer_.data(), buffer_.data() + begin_, end_ - begin_);
+            structural_count_ -= next_structural_;
+            for (std::size_t s = 0; s < structural_count_; ++s) {
+                structurals_[s] = structurals_[next_structural_ + s] - static_cast<std::uint32_t>(begin_);
+            }
+            end_ -= begin_;
+            indexed_ -= begin_;
+            begin_ = 0;
+            next_structural_ = 0;
+        }
+        if (end_ == buffer_.size()) {
+            // A single row fills the buffer
+            if (2 * buffer_.size() > max_buffer_size || !resize_buffer(2 * buffer_.size())) {
+                error_ = true;
+                return false;
+            }
+        }
+
+        auto n = stream_.fread(buffer_.data() + end_, 1, buffer_.size() - end_);
+        end_ += n;
+        if (n == 0) {
+            eof_ = true;
+            error_ = stream_.ferror();
+        }
+        index();
+        return !error_;
+    }
+
+    /// Resizes the buffer to `size` bytes and its index to match, reserving the memory from the governor.
+    /// - returns: `false` if the budget cannot cover the memory.
+    bool resize_buffer(std::size_t size) {
+        if (!reservation_.resize(size + (size + byte_block::size) * sizeof(std::uint32_t))) {
+            return false;
+        }
+        buffer_.resize(size);
+        structurals_.resize(size + byte_block::size);
+        return true;
+    }
+
+    /// Records the offsets of the delimiters and newlines outside quotes in the unindexed data.
+    ///
+    /// Only whole 64-byte blocks are indexed until the end of the stream is reached, so the quote state carries
+    /// exactly from one block to the next.
+    void index() {
+        auto count = structural_count_;
+        auto out = structurals_.data();
+        auto p = buffer_.data();
+        for (; indexed_ + byte_block::size <= end_; indexed_ += byte_block::size) {
+            count = index_block(byte_block{p + indexed_}, out, count);
+        }
+        if (eof_ && indexed_ < end_) {
+            unsigned char tail[byte_block::size];
+            std::memset(tail, delimiter_ == 0 ? 1 : 0, sizeof tail);
+            std::memcpy(tail, p + indexed_, end_ - indexed_);
+            auto tail_count = index_block(byte_block{tail}, out, count);
+            // Drop structurals found in the padding
+            while (tail_count > count && offset(out[tail_count - 1]) >= end_) {
+                --tail_count;
+            }
+            count = tail_count;
+            indexed_ = end_;
+        }
+        structural_count_ = count;
+    }
+
+    /// Appends the structurals in `block`, which begins at `indexed_`, to `out` at `count`.
+    /// - returns: The new number of structurals.
+    std::size_t index_block(const byte_block &block, std::uint32_t *out, std::size_t count) noexcept {
+        auto inside = prefix_xor(block.eq(quote_)) ^ in_quote_;
+        in_quote_ = static_cast<std::uint64_t>(static_cast<std::int64_t>(inside) >> 63);
+        auto newlines = block.eq('\n') & ~inside;
+        auto structural = (block.eq(delimiter_) & ~inside) | newlines;
+        auto base = static_cast<std::uint32_t>(indexed_);
+        for (; structural != 0; structural &= structural - 1) {
+            auto bit = static_cast<unsigned>(__builtin_ctzll(structural));
+            out[count++] = (base + bit) | (static_cast<std::uint32_t>(newlines >> bit) << 31);
+        }
+        return count;
+    }
+
+    /// Splits the row beginning at `begin` whose structurals are `[first, last)` and which ends at
+    /// `structurals_[last]`, or at `end_` if `last` is `structural_count_`.
+    void split(std::size_t begin, std::size_t first, std::size_t last, std::vector<std::string_view> &fields) {
+        fields.clear();
+        for (auto s = first; s < last; ++s) {
+            fields.push_back(field(begin, offset(structurals_[s]), false));
+            begin = offset(structurals_[s]) + 1;
+        }
+        fields.push_back(field(begin, last < structural_count_ ? offset(structurals_[last]) : end_, true));
+    }
+
+    /// Returns the field `[begin, end)`, removing the carriage return before a newline, enclosing quotes and doubled
+    /// quotes.
+    std::string_view field(std::size_t begin, std::size_t end, bool row_end) noexcept {
+        auto p = reinterpret_cast<char *>(buffer_.data());
+        auto quote = static_cast<char>(quote_);
+        if (row_end && end > begin && p[end - 1] == '\r') {
+            --end;
+        }
+        if (end > begin && p[begin] == quote) {
+            ++begin;
+            if (end > begin && p[end - 1] == quote) {
+                --end;
+            }
+            if (auto q = static_cast<char *>(std::memchr(p + begin, quote, end - begin)); q != nullptr) {
+                // Collapse doubled quotes in place
+                auto out = q;
+                for (auto in = q; in < p + end; ++in) {
+                    *out++ = *in;
+                    if (*in == quote && in + 1 < p + end && in[1] == quote) {
+                        ++in;
+                    }
+                }
+                end = static_cast<std::size_t>(out - p);
+            }
+        }
+        return {p + begin, end - begin};
+    }
+
+    /// The underlying stream.
+    cstream &stream_;
+    /// The field delimiter.
+    unsigned char delimiter_;
+    /// The quote character.
+    unsigned char quote_;
+    /// Data read from the stream.
+    std::vector<unsigned char> buffer_;
+    /// The offset of the first unread row in `buffer_`.
+    std::size_t begin_{0};
+    /// The number of valid bytes in `buffer_`.
+    std::size_t end_{0};
+    /// The number of bytes in `buffer_` that have been indexed.
+    std::size_t indexed_{0};
+    /// All ones if the byte before `indexed_` is inside quotes, otherwise zero.
+    std::uint64_t in_quote_{0};
+    /// The offsets in `buffer_` of the delimiters and newlines outside quotes, with `newline_flag` set for newlines.
+    ///
+    /// The vector holds one element per byte of `buffer_` and more for the padding of the last block, so indexing never
+    /// resizes it.
+    std::vector<std::uint32_t> structurals_;
+    /// The number of valid elements in `structurals_`.
+    std::size_t structural_count_{0};
+    /// The memory reserved from the governor for `buffer_` and `structurals_`.
+    memory_reservation reservation_;
+    /// The index in `structurals_` of the first structural of the first unread row.
+    std::size_t next_structural_{0};
+    /// The number of rows read by `next()`.
+    std::uint64_t rows_{0};
+    /// Whether the end of the stream has been reached.
+    bool eof_{false};
+    /// Whether a read failed.
+    bool error_{false};
+};
+
+} /* namespace cio */
@@ -0,0 +1,249 @@
+//
+// SPDX-FileCopyrightText: 2024 Stephen F. Booth <contact@sbooth.dev>
+// SPDX-License-Identifier: MIT
+//
+// Part of https://github.com/sbooth/cio
+//
+
+// Coroutines require C++20; in earlier language modes this header is empty.
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+
+#import <algorithm>
+#import <coroutine>
+#import <cstddef>
+#import <cstdlib>
+#import <exception>
+#import <iterator>
+#import <new>
+#import <ranges>
+#import <type_traits>
+#import <utility>
+#import <vector>
+
+namespace cio {
+
+/// A lazily evaluated sequence of values produced by a coroutine.
+///
+/// The coroutine runs only as far as needed to produce the next value. Destroying the generator, for example by
+/// leaving a range-based `for` loop early, destroys the suspended coroutine without resuming it.
+///
+/// Coroutine frames come from a small per-thread cache, so a generator recreated in a loop reuses the previous
+/// frame's memory. Where the compiler can prove the frame does not outlive the caller it may elide the allocation
+/// entirely.
+template <typename T> class generator : public std::ranges::view_base {
+  public:
+    /// The coroutine promise.
+    class promise_type {
+      public:
+        /// Returns the generator for the coroutine.
+        generator get_return_object() noexcept {
+            return generator{std::coroutine_handle<promise_type>::from_promise(*this)};
+        }
+
+        /// Suspends the coroutine before it produces its first value.
+        std::suspend_always initial_suspend() const noexcept { return {}; }
+
+        /// Suspends the coroutine on completion so the generator can observe it.
+        std::suspend_always final_suspend() const noexcept { return {}; }
+
+        /// Stores a pointer to the yielded value, which lives in the coroutine frame until it resumes.
+        std::suspend_always yield_value(std::remove_reference_t<T> &value) noexcept {
+            value_ = std::addressof(value);
+            return {};
+        }
+
+        /// Stores a pointer to the yielded value, which lives in the coroutine frame until it resumes.
+        std::suspend_always yield_value(std::remove_reference_t<T> &&value) noexcept {
+            value_ = std::addressof(value);
+            return {};
+        }
+
+        /// Completes the coroutine.
+        void return_void() const noexcept {}
+
+        /// Captures an exception escaping the coroutine for rethrowing by the consumer.
+        void unhandled_exception() noexcept { exception_ = std::current_exception(); }
+
+        // Generators must not await anything other than `co_yield`.
+        template <typename U> std::suspend_never await_transform(U &&) = delete;
+
+        /// Allocates a coroutine frame, reusing the calling thread's cached frame if it is large enough.
+        static void *operator new(std::size_t size) {
+            auto &cache = frame_cache();
+            if (cache.block && cache.size >= size) {
+                return std::exchange(cache.block, nullptr);
+            }
+            if (auto block = std::malloc(size); block) {
+                return block;
+            }
+            throw std::bad_alloc{};
+        }
+
+        /// Returns a coroutine frame to the calling thread's cache, or frees it if the cache is occupied.
+        static void operator delete(void *block, std::size_t size) noexcept {
+            auto &cache = frame_cache();
+            if (!cache.block) {
+                cache.block = block;
+                cache.size = size;
+            } else {
+                std::free(block);
+            }
+        }
+
+      private:
+        friend class generator;
+
+        /// A single cached coroutine frame.
+        struct cached_frame {
+            /// The cached block.
+            void *block{nullptr};
+            /// The size of the cached block.
+            std::size_t size{0};
+
+            ~cached_frame() { std::free(block); }
+        };
+
+        /// Returns the calling thread's frame cache.
+        static cached_frame &frame_cache() noexcept {
+            thread_local cached_frame cache;
+            return cache;
+        }
+
+        /// Rethrows an exception escaping the coroutine.
+        void rethrow_if_exception() {
+            if (exception_) {
+                std::rethrow_exception(std::exchange(exception_, nullptr));
+            }
+        }
+
+        /// The most recently yielded value.
+        std::remove_reference_t<T> *value_{nullptr};
+        /// An exception escaping the coroutine.
+        std::exception_ptr exception_;
+    };
+
+    /// An input iterator over the values of a `cio::generator`.
+    class iterator {
+      public:
+        using value_type = std::remove_cvref_t<T>;
+        using difference_type = std::ptrdiff_t;
+
+        /// Initializes a singular iterator.
+        iterator() noexcept = default;
+
+        /// Returns the current value.
+        std::remove_reference_t<T> &operator*() const noexcept { return *handle_.promise().value_; }
+
+        /// Resumes the coroutine to produce the next value.
+        /// - throws: Any exception escaping the coroutine.
+        iterator &operator++() {
+            handle_.resume();
+            if (handle_.done()) {
+                handle_.promise().rethrow_if_exception();
+            }
+            return *this;
+        }
+
+        /// Resumes the coroutine to produce the next value.
+        void operator++(int) { ++*this; }
+
+        /// Returns `true` if the coroutine has completed.
+        friend bool operator==(const iterator &i, std::default_sentinel_t) noexcept {
+            return !i.handle_ || i.handle_.done();
+        }
+
+      private:
+        friend class generator;
+
+        /// Initializes an iterator over the coroutine `handle`.
+        explicit iterator(std::coroutine_handle<promise_type> handle) noexcept : handle_{handle} {}
+
+        /// The coroutine.
+        std::coroutine_handle<promise_type> handle_;
+    };
+
+    // MARK: Standard Six
+
+    /// Initializes an empty `cio::generator` object.
+    generator() noexcept = default;
+
+    // This class is non-copyable.
+    generator(const generator &rhs) = delete;
+
+    // This class is non-assignable.
+    generator &operator=(const generator &rhs) = delete;
+
+    /// Initializes a `cio::generator` object with the coroutine from `rhs` and leaves `rhs` empty.
+    generator(generator &&rhs) noexcept : handle_{std::exchange(rhs.handle_, nullptr)} {}
+
+    /// Destroys the current coroutine and replaces it with the coroutine from `rhs`, then leaves `rhs` empty.
+    generator &operator=(generator &&rhs) noexcept {
+        if (this != &rhs) {
+            if (handle_) {
+                handle_.destroy();
+            }
+            handle_ = std::exchange(rhs.handle_, nullptr);
+        }
+        return *this;
+    }
+
+    /// Destroys the coroutine.
+    ~generator() noexcept {
+        if (handle_) {
+            handle_.destroy();
+        }
+    }
+
+    // MARK: Iteration
+
+    /// Starts the coroutine and returns an iterator to its first value.
+    /// - throws: Any exception escaping the coroutine.
+    iterator begin() {
+        if (handle_) {
+            handle_.resume();
+            if (handle_.done()) {
+                handle_.promise().rethrow_if_exception();
+            }
+        }
+        return iterator{handle_};
+    }
+
+    /// Returns the end sentinel.
+    std::default_sentinel_t end() const noexcept { return {}; }
+
+  private:
+    /// Initializes a `cio::generator` object with `handle`.
+    explicit generator(std::coroutine_handle<promise_type> handle) noexcept : handle_{handle} {}
+
+    /// The coroutine.
+    std::coroutine_handle<promise_type> handle_;
+};
+
+/// Returns a generator decoding fixed-size records from `stream` on demand.
+///
+/// Records are read `batch_size` at a time into a buffer owned by the coroutine and passed one at a time to
+/// `decode`, which receives a pointer to `record_size` bytes and returns a `Record`. Reading stops when the stream is
+/// exhausted or the generator is destroyed.
+/// - parameter stream: The stream to read, which must outlive the generator.
+/// - parameter record_size: The size of an encoded record in bytes.
+/// - parameter decode: The decoding function.
+/// - parameter batch_size: The number of records read at a time, at least `1`.
+template <typename Record, typename Stream, typename Decode>
+generator<Record> decode_records(Stream &stream, std::size_t record_size, Decode decode,
+                                 std::size_t batch_size = 4096) {
+    batch_size = std::max<std::size_t>(batch_size, 1);
+    std::vector<unsigned char> buffer(record_size * batch_size);
+    for (;;) {
+        auto count = stream.fread(buffer.data(), record_size, batch_size);
+        for (std::size_t i = 0; i < count; ++i) {
+            co_yield decode(static_cast<const unsigned char *>(buffer.data() + i * record_size));
+        }
+        if (count < batch_size) {
+            co_return;
+        }
+    }
+}
+
+} /* namespace cio */
+
+#endif
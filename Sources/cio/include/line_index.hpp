@@ -0,0 +1,380 @@
+//
+// SPDX-FileCopyrightText: 2024 Stephen F. Booth <contact@sbooth.dev>
+// SPDX-License-Identifier: MIT
+//
+// Part of https://github.com/sbooth/cio
+//
+
+#import <algorithm>
+#import <cstdint>
+#import <cstdio>
+#import <cstdlib>
+#import <cstring>
+#import <string>
+#import <vector>
+
+#import <sys/stat.h>
+#import <unistd.h>
+
+#import "cstream.hpp"
+#import "memory_governor.hpp"
+#import "simd.hpp"
+
+namespace cio {
+
+/// The file format written by `cio::line_index::save()`.
+///
+/// An index file begins with the signature "CIOL", a little-endian `uint32_t` version, the delimiter as a
+/// little-endian `uint32_t`, and little-endian `uint64_t` values for the stride, the size and modification time in
+/// nanoseconds of the indexed file, the number of delimiters, the offset following the last delimiter and the number
+/// of entries. The entries follow as little-endian `uint64_t` offsets.
+struct line_index_format {
+    /// The file signature.
+    static constexpr char magic[4] = {'C', 'I', 'O', 'L'};
+
+    /// The format version.
+    static constexpr std::uint32_t version = 1;
+
+    /// The size of the header in bytes.
+    static constexpr std::size_t header_size = 60;
+
+    /// The suffix appended to a file's path to form the path of its index.
+    static constexpr char sidecar_suffix[] = ".lidx";
+};
+
+/// A count of the delimiters in a stream and the offset of every Nth line.
+///
+/// Building an index reads the stream in large blocks and counts delimiters a block at a time with a vector kernel;
+/// delimiters are only located individually in the blocks containing an indexed line, so a build runs at close to
+/// memory bandwidth. Entry `k` is the offset of the first byte of line `k` times the stride, which lets a reader seek
+/// to any line after scanning at most one stride of lines, or split a file into ranges of whole lines for parallel
+/// parsing.
+///
+/// `open()` keeps the index of a file in a sidecar file next to it and reuses the sidecar while the file's size and
+/// modification time are unchanged.
+class line_index {
+  public:
+    /// The default number of lines between entries.
+    static constexpr std::uint64_t default_stride = 4096;
+
+    /// The number of bytes read at a time when building an index.
+    static constexpr std::size_t block_size = 1024 * 1024;
+
+    /// The smallest number of bytes read at a time under memory pressure.
+    static constexpr std::size_t min_block_size = 16 * 1024;
+
+    /// Initializes an empty `cio::line_index` object.
+    line_index() noexcept = default;
+
+    /// Returns `true` if the index was built or loaded.
+    [[nodiscard]]
+    explicit operator bool() const noexcept {
+        return valid_;
+    }
+
+    /// Returns the delimiter.
+    [[nodiscard]]
+    unsigned char delimiter() const noexcept {
+        return delimiter_;
+    }
+
+    /// Returns the number of lines between entries.
+    [[nodiscard]]
+    std::uint64_t stride() const noexcept {
+        return stride_;
+    }
+
+    /// Returns the number of bytes indexed.
+    [[nodiscard]]
+    std::uint64_t size() const noexcept {
+        return size_;
+    }
+
+    /// Returns the number of delimiters.
+    [[nodiscard]]
+    std::uint64_t delimiter_count() const noexcept {
+        return count_;
+    }
+
+    /// Returns the number of lines, counting a final line without a delimiter.
+    [[nodiscard]]
+    std::uint64_t line_count() const noexcept {
+        return count_ + (size_ > last_delimiter_end_ ? 1 : 0);
+    }
+
+    /// Returns the offsets of every `stride()`th line, beginning with line `0`.
+    [[nodiscard]]
+    const std::vector<std::uint64_t> &entries() const noexcept {
+        return entries_;
+    }
+
+    /// Returns `true` if the index was read from a sidecar file by `open()`.
+    [[nodiscard]]
+    bool from_sidecar() const noexcept {
+        return from_sidecar_;
+    }
+
+    // MARK: Building
+
+    /// Indexes the lines in `stream` from the current position to the end.
+    ///
+    /// Offsets are counted from the position of `stream` at the call. The read buffer is reserved from
+    /// `cio::memory_governor::shared()`, and under memory pressure the stream is read in smaller blocks.
+    /// - parameter stream: The stream to index.
+    /// - parameter delimiter: The byte that ends a line.
+    /// - parameter stride: The number of lines between entries, at least `1`.
+    /// - returns: `false` if a read failed or the budget cannot cover the smallest buffer.
+    /// - throws: Any exception thrown by `Allocator::allocate()` (typically `std::bad_alloc`)
+    bool build(cstream &stream, unsigned char delimiter = '\n', std::uint64_t stride = default_stride) {
+        delimiter_ = delimiter;
+        stride_ = std::max<std::uint64_t>(stride, 1);
+        size_ = 0;
+        count_ = 0;
+        last_delimiter_end_ = 0;
+        modification_time_ = 0;
+        entries_.assign(1, 0);
+        from_sidecar_ = false;
+        valid_ = false;
+
+        memory_reservation reservation;
+        auto size = reservation.resize_up_to(block_size, min_block_size);
+        if (size == 0) {
+            return false;
+        }
+        std::vector<unsigned char> buffer(size);
+        for (;;) {
+            auto n = stream.fread(buffer.data(), 1, buffer.size());
+            if (n == 0) {
+                break;
+            }
+            index_block(buffer.data(), n);
+            size_ += n;
+        }
+        valid_ = !stream.ferror();
+        return valid_;
+    }
+
+    // MARK: Lookup
+
+    /// Positions `stream` at the first byte of line `line`.
+    ///
+    /// The stream is positioned at the nearest entry at or before the line and the remaining lines are counted
+    /// forward. `stream` must hold the data the index was built from, with offsets counted from its start.
+    /// - returns: `false` if `line` is not less than `line_count()` or a seek or read failed.
+    bool seek(cstream &stream, std::uint64_t line) const noexcept {
+        if (!valid_ || line >= line_count()) {
+            return false;
+        }
+        auto offset = entries_[line / stride_];
+        if (stream.fseek(static_cast<long>(offset), SEEK_SET) != 0) {
+            return false;
+        }
+        auto remaining = line % stride_;
+        unsigned char buffer[4096];
+        while (remaining > 0) {
+            auto n = stream.fread(buffer, 1, sizeof buffer);
+            if (n == 0) {
+                return false;
+            }
+            if (auto count = count_byte(buffer, n, delimiter_); count < remaining) {
+                remaining -= count;
+                offset += n;
+                continue;
+            }
+            for (std::size_t i = 0;; ++i) {
+                if (buffer[i] == delimiter_ && --remaining == 0) {
+                    offset += i + 1;
+                    break;
+                }
+            }
+        }
+        return stream.fseek(static_cast<long>(offset), SEEK_SET) == 0;
+    }
+
+    // MARK: Persistence
+
+    /// Writes the index to `stream` in the format described by `cio::line_index_format`.
+    /// - returns: `false` if the index is empty or a write failed.
+    bool save(cstream &stream) const noexcept {
+        if (!valid_ || stream.fwrite(line_index_format::magic, 1, 4) != 4 ||
+            !stream.write_uint_little(line_index_format::version) ||
+            !stream.write_uint_little(std::uint32_t{delimiter_}) || !stream.write_uint_little(stride_) ||
+            !stream.write_uint_little(size_) || !stream.write_uint_little(modification_time_) ||
+            !stream.write_uint_little(count_) || !stream.write_uint_little(last_delimiter_end_) ||
+            !stream.write_uint_little(std::uint64_t{entries_.size()})) {
+            return false;
+        }
+        for (auto entry : entries_) {
+            if (!stream.write_uint_little(entry)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /// Reads an index written by `save()` from `stream`.
+    /// - returns: `false` if the data is not a valid index or a read failed.
+    /// - throws: Any exception thrown by `Allocator::allocate()` (typically `std::bad_alloc`)
+    bool load(cstream &stream) {
+        valid_ = false;
+        from_sidecar_ = false;
+        char magic[4];
+        std::uint32_t version, delimiter;
+        std::uint64_t entry_count;
+        if (stream.fread(magic, 1, 4) != 4 || std::memcmp(magic, line_index_format::magic, 4) != 0 ||
+            !stream.read_uint_little(version) || version != line_index_format::version ||
+            !stream.read_uint_little(delimiter) || delimiter > 0xff || !stream.read_uint_little(stride_) ||
+            stride_ == 0 || !stream.read_uint_little(size_) || !stream.read_uint_little(modification_time_) ||
+            !stream.read_uint_little(count_) || !stream.read_uint_little(last_delimiter_end_) ||
+            last_delimiter_end_ > size_ || count_ > size_ || !stream.read_uint_little(entry_count) ||
+            entry_count != count_ / stride_ + 1) {
+            return false;
+        }
+        delimiter_ = static_cast<unsigned char>(delimiter);
+        entries_.resize(entry_count);
+        for (auto &entry : entries_) {
+            if (!stream.read_uint_little(entry) || entry > size_) {
+                return false;
+            }
+        }
+        valid_ = std::is_sorted(entries_.begin(), entries_.end());
+        return valid_;
+    }
+
+    /// Returns the path of the sidecar file holding the index of the file at `path`.
+    [[nodiscard]]
+    static std::string sidecar_path(const std::string &path) {
+        return path + line_index_format::sidecar_suffix;
+    }
+
+    /// Indexes the file at `path`, reusing its sidecar file when it is current.
+    ///
+    /// The sidecar is current if it was built with the same delimiter and stride from a file of the same size and
+    /// modification time. Otherwise the file is indexed and a new sidecar written; failure to write the sidecar, for
+    /// example in a read-only directory, does not cause `open()` to fail. The sidecar is written to a uniquely named
+    /// temporary file in the same directory and renamed into place, so concurrent calls never share a file and readers
+    /// never see a partial index.
+    /// - parameter path: The file to index.
+    /// - parameter delimiter: The byte that ends a line.
+    /// - parameter stride: The number of lines between entries, at least `1`.
+    /// - returns: `false` if the file could not be read.
+    /// - throws: Any exception thrown by `Allocator::allocate()` (typically `std::bad_alloc`)
+    bool open(const std::string &path, unsigned char delimiter = '\n', std::uint64_t stride = default_stride) {
+        stride = std::max<std::uint64_t>(stride, 1);
+        valid_ = false;
+        struct stat st;
+        if (::stat(path.c_str(), &st) == -1) {
+            return false;
+        }
+        auto size = static_cast<std::uint64_t>(st.st_size);
+        auto modification_time = line_index::modification_time(st);
+
+        auto sidecar = sidecar_path(path);
+        if (cstream file{sidecar.c_str(), "rb"}; file && load(file) && delimiter_ == delimiter && stride_ == stride &&
+                                                  size_ == size && modification_time_ == modification_time) {
+            from_sidecar_ = true;
+            return true;
+        }
+
+        cstream file{path.c_str(), "rb"};
+        if (!file || !build(file, delimiter, stride) || size_ != size) {
+            valid_ = false;
+            return false;
+        }
+        modification_time_ = modification_time;
+
+        auto temporary = sidecar + ".XXXXXX";
+        if (auto fd = ::mkstemp(temporary.data()); fd != -1) {
+            // mkstemp(3) creates the file readable only by its owner, so share it like the indexed file
+            ::fchmod(fd, st.st_mode & 0666);
+            cstream out{::fdopen(fd, "wb")};
+            if (!out) {
+                ::close(fd);
+            }
+            if (!out || !save(out) || out.fclose() != 0 || std::rename(temporary.c_str(), sidecar.c_str()) != 0) {
+                std::remove(temporary.c_str());
+            }
+        }
+        return true;
+    }
+
+  private:
+    /// Returns the modification time in nanoseconds recorded in `st`.
+    static std::uint64_t modification_time(const struct stat &st) noexcept {
+#if defined(__APPLE__)
+        const auto &time = st.st_mtimespec;
+#else
+        const auto &time = st.st_mtim;
+#endif
+        return static_cast<std::uint64_t>(time.tv_sec) * 1000000000 + static_cast<std::uint64_t>(time.tv_nsec);
+    }
+
+    /// Counts the delimiters in `size` bytes at `p`, which begin at offset `size_`, and records entries.
+    void index_block(const unsigned char *p, std::size_t size) {
+        // Count whole chunks and locate delimiters only in chunks containing the next entry or the last delimiter
+        constexpr std::size_t chunk_size = 4096;
+        for (std::size_t begin = 0; begin < size; begin += chunk_size) {
+            auto n = std::min(chunk_size, size - begin);
+            auto count = count_byte(p + begin, n, delimiter_);
+            if (count == 0) {
+                continue;
+            }
+            auto next_entry = entries_.size() * stride_;
+            if (count_ + count < next_entry) {
+                count_ += count;
+                for (auto i = n; i-- > 0;) {
+                    if (p[begin + i] == delimiter_) {
+                        last_delimiter_end_ = size_ + begin + i + 1;
+                        break;
+                    }
+                }
+                continue;
+            }
+            locate(p + begin, n, size_ + begin);
+        }
+    }
+
+    /// Counts and records the delimiters in `size` bytes at `p`, which begin at offset `offset`, one at a time.
+    void locate(const unsigned char *p, std::size_t size, std::uint64_t offset) {
+        std::size_t i = 0;
+        for (; i + byte_block::size <= size; i += byte_block::size) {
+            for (auto mask = byte_block{p + i}.eq(delimiter_); mask != 0; mask &= mask - 1) {
+                record(offset + i + static_cast<std::size_t>(__builtin_ctzll(mask)) + 1);
+            }
+        }
+        for (; i < size; ++i) {
+            if (p[i] == delimiter_) {
+                record(offset + i + 1);
+            }
+        }
+    }
+
+    /// Counts a delimiter ending before offset `end`.
+    void record(std::uint64_t end) {
+        last_delimiter_end_ = end;
+        if (++count_ % stride_ == 0) {
+            entries_.push_back(end);
+        }
+    }
+
+    /// The delimiter.
+    unsigned char delimiter_{'\n'};
+    /// The number of lines between entries.
+    std::uint64_t stride_{default_stride};
+    /// The number of bytes indexed.
+    std::uint64_t size_{0};
+    /// The number of delimiters.
+    std::uint64_t count_{0};
+    /// The offset of the byte following the last delimiter.
+    std::uint64_t last_delimiter_end_{0};
+    /// The modification time of the indexed file in nanoseconds, or `0`.
+    std::uint64_t modification_time_{0};
+    /// The offset of every `stride_`th line.
+    std::vector<std::uint64_t> entries_;
+    /// Whether the index was read from a sidecar file.
+    bool from_sidecar_{false};
+    /// Whether the index was built or loaded.
+    bool valid_{false};
+};
+
+} /* namespace cio */
@@ -0,0 +1,536 @@
+//
+// SPDX-FileCopyrightText: 2024 Stephen F. Booth <contact@sbooth.dev>
+// SPDX-License-Identifier: MIT
+//
+// Part of https://github.com/sbooth/cio
+//
+
+#import <algorithm>
+#import <cerrno>
+#import <cstring>
+#import <utility>
+
+#import <fcntl.h>
+#import <poll.h>
+#import <sys/socket.h>
+#import <sys/uio.h>
+#import <sys/un.h>
+#import <unistd.h>
+
+#import "cstream.hpp"
+#import "stream_extensions.hpp"
+
+namespace cio {
+
+/// A class managing a Unix domain socket.
+///
+/// For stream sockets `fread` and `fwrite` transfer bytes and the typed extensions such as `read_uint` and
+/// `write_uint` work as they do for `cio::cstream`. For sequenced-packet and datagram sockets `send_frames()` and
+/// `recv_frames()` transfer many messages per system call using `sendmmsg(2)` and `recvmmsg(2)` on Linux.
+///
+/// File descriptors may accompany data as `SCM_RIGHTS` ancillary messages, so a large payload can be written to a
+/// `cio::cstream::memfd()` and passed by reference with `send_stream()` instead of being copied through the socket.
+class local_socket : public input_extensions<local_socket>, public output_extensions<local_socket> {
+  public:
+    /// Possible byte orders.
+    using byte_order = cstream::byte_order;
+
+    /// Possible socket types.
+    enum class type : int {
+        /// A reliable byte stream.
+        stream = SOCK_STREAM,
+        /// Reliable messages with preserved boundaries.
+        seqpacket = SOCK_SEQPACKET,
+        /// Messages with preserved boundaries.
+        datagram = SOCK_DGRAM,
+    };
+
+    /// The largest number of descriptors received in one message.
+    static constexpr std::size_t max_fds = 64;
+
+    // MARK: Standard Six
+
+    /// Initializes an empty `cio::local_socket` object.
+    local_socket() noexcept = default;
+
+    // This class is non-copyable.
+    local_socket(const local_socket &rhs) = delete;
+
+    // This class is non-assignable.
+    local_socket &operator=(const local_socket &rhs) = delete;
+
+    /// Initializes a `cio::local_socket` object with the socket from `rhs` and leaves `rhs` empty.
+    local_socket(local_socket &&rhs) noexcept : fd_{rhs.release()} {}
+
+    /// Closes the managed socket and replaces it with the socket from `rhs`, then leaves `rhs` empty.
+    local_socket &operator=(local_socket &&rhs) noexcept {
+        if (this != &rhs) {
+            reset(rhs.release());
+        }
+        return *this;
+    }
+
+    /// Closes the managed socket.
+    ~local_socket() noexcept { reset(); }
+
+    // MARK: Construction
+
+    /// Initializes a `cio::local_socket` object managing `fd`.
+    explicit local_socket(int fd) noexcept : fd_{fd} { configure(); }
+
+    /// Returns a pair of connected `cio::local_socket` objects created with `socketpair(2)`.
+    /// - seealso: [socketpair(2)](https://man7.org/linux/man-pages/man2/socketpair.2.html)
+    [[nodiscard]]
+    static std::pair<local_socket, local_socket> pair(type t = type::stream) noexcept {
+        int fds[2];
+        if (::socketpair(AF_UNIX, socket_type(t), 0, fds) == -1) {
+            return {local_socket{}, local_socket{}};
+        }
+        return {local_socket{fds[0]}, local_socket{fds[1]}};
+    }
+
+    /// Returns a `cio::local_socket` object connected to the socket bound to `path`.
+    /// - seealso: [connect(2)](https://man7.org/linux/man-pages/man2/connect.2.html)
+    [[nodiscard]]
+    static local_socket connect(const char *path, type t = type::stream) noexcept {
+        struct sockaddr_un address;
+        if (!make_address(path, address)) {
+            return local_socket{};
+        }
+        local_socket s{::socket(AF_UNIX, socket_type(t), 0)};
+        if (s && ::connect(s.fd_, reinterpret_cast<const struct sockaddr *>(&address), sizeof address) == -1) {
+            s.reset();
+        }
+        return s;
+    }
+
+    /// Returns a `cio::local_socket` object bound to `path` and listening for connections.
+    ///
+    /// `path` must not exist. It is not removed when the socket is closed.
+    /// - seealso: [listen(2)](https://man7.org/linux/man-pages/man2/listen.2.html)
+    [[nodiscard]]
+    static local_socket listen(const char *path, type t = type::stream, int backlog = SOMAXCONN) noexcept {
+        struct sockaddr_un address;
+        if (!make_address(path, address)) {
+            return local_socket{};
+        }
+        local_socket s{::socket(AF_UNIX, socket_type(t), 0)};
+        if (s && (::bind(s.fd_, reinterpret_cast<const struct sockaddr *>(&address), sizeof address) == -1 ||
+                  ::listen(s.fd_, backlog) == -1)) {
+            s.reset();
+        }
+        return s;
+    }
+
+    /// Returns the next connection to a listening socket.
+    /// - seealso: [accept(2)](https://man7.org/linux/man-pages/man2/accept.2.html)
+    [[nodiscard]]
+    local_socket accept() noexcept {
+        for (;;) {
+#if defined(__linux__) || defined(__FreeBSD__) || defined(__NetBSD__) || defined(__OpenBSD__)
+            auto fd = ::accept4(fd_, nullptr, nullptr, SOCK_CLOEXEC);
+#else
+            auto fd = ::accept(fd_, nullptr, nullptr);
+#endif
+            if (fd != -1 || errno != EINTR) {
+                return local_socket{fd};
+            }
+        }
+    }
+
+    // MARK: Socket Management
+
+    /// Returns `true` if the managed socket is valid.
+    [[nodiscard]]
+    explicit operator bool() const noexcept {
+        return fd_ != -1;
+    }
+
+    /// Returns the managed socket.
+    [[nodiscard]]
+    int fileno() const noexcept {
+        return fd_;
+    }
+
+    /// Returns the managed socket and releases ownership.
+    [[nodiscard]]
+    int release() noexcept {
+        return std::exchange(fd_, -1);
+    }
+
+    /// Replaces the managed socket with `fd`.
+    void reset(int fd = -1) noexcept {
+        if (auto old = std::exchange(fd_, fd); old != -1) {
+            ::close(old);
+        }
+        configure();
+    }
+
+    /// Shuts down part or all of the connection.
+    /// - parameter how: `SHUT_RD`, `SHUT_WR` or `SHUT_RDWR`.
+    /// - returns: `0` on success, `-1` otherwise with `errno` set.
+    /// - seealso: [shutdown(2)](https://man7.org/linux/man-pages/man2/shutdown.2.html)
+    int shutdown(int how = SHUT_WR) noexcept { return ::shutdown(fd_, how); }
+
+    // MARK: Direct Input/Output
+
+    using input_extensions<local_socket>::fread;
+    using output_extensions<local_socket>::fwrite;
+
+    /// Reads `count` objects of `size` bytes into `buffer`, blocking until they arrive or the peer shuts down.
+    /// - returns: The number of complete objects read.
+    std::size_t fread(void *buffer, std::size_t size, std::size_t count) noexcept {
+        if (size == 0 || count == 0) {
+            return 0;
+        }
+        auto p = static_cast<unsigned char *>(buffer);
+        auto length = size * count;
+        std::size_t total = 0;
+        while (total < length) {
+            auto n = ::recv(fd_, p + total, length - total, 0);
+            if (n > 0) {
+                total += static_cast<std::size_t>(n);
+            } else if (n == 0 || errno != EINTR) {
+                break;
+            }
+        }
+        return total / size;
+    }
+
+    /// Writes `count` objects of `size` bytes from `buffer`.
+    ///
+    /// A closed peer is reported as an error with `errno` set to `EPIPE` rather than by `SIGPIPE`.
+    /// - returns: The number of complete objects written.
+    std::size_t fwrite(const void *buffer, std::size_t size, std::size_t count) noexcept {
+        if (size == 0 || count == 0) {
+            return 0;
+        }
+        auto p = static_cast<const unsigned char *>(buffer);
+        auto length = size * count;
+        std::size_t total = 0;
+        while (total < length) {
+            auto n = ::send(fd_, p + total, length - total, send_flags);
+            if (n >= 0) {
+                total += static_cast<std::size_t>(n);
+            } else if (errno != EINTR) {
+                break;
+            }
+        }
+        return total / size;
+    }
+
+    // MARK: Batched Messages
+
+    /// Sends each of `count` buffers in `frames` as a separate message.
+    ///
+    /// On Linux up to 64 messages are sent per call to `sendmmsg(2)`; elsewhere each is sent with `sendmsg(2)`.
+    /// - returns: The number of messages sent, which is less than `count` on error with `errno` set.
+    /// - seealso: [sendmmsg(2)](https://man7.org/linux/man-pages/man2/sendmmsg.2.html)
+    std::size_t send_frames(const struct iovec *frames, std::size_t count) noexcept {
+        std::size_t sent = 0;
+        while (sent < count) {
+#if defined(MSG_WAITFORONE)
+            struct mmsghdr messages[batch_size];
+            auto batch = std::min(count - sent, batch_size);
+            std::memset(messages, 0, sizeof(struct mmsghdr) * batch);
+            for (std::size_t i = 0; i < batch; ++i) {
+                messages[i].msg_hdr.msg_iov = const_cast<struct iovec *>(&frames[sent + i]);
+                messages[i].msg_hdr.msg_iovlen = 1;
+            }
+            auto n = ::sendmmsg(fd_, messages, static_cast<unsigned int>(batch), send_flags);
+#else
+            struct msghdr message{};
+            message.msg_iov = const_cast<struct iovec *>(&frames[sent]);
+            message.msg_iovlen = 1;
+            auto n = ::sendmsg(fd_, &message, send_flags) == -1 ? -1 : 1;
+#endif
+            if (n > 0) {
+                sent += static_cast<std::size_t>(n);
+            } else if (errno != EINTR) {
+                break;
+            }
+        }
+        return sent;
+    }
+
+    /// Receives up to `count` messages into the buffers in `frames`, storing the length of each in `lengths`.
+    ///
+    /// Blocks until at least one message is available and then receives any others already queued without waiting.
+    /// On Linux up to 64 messages are received per call to `recvmmsg(2)`; elsewhere each is received with
+    /// `recvmsg(2)`. A message longer than its buffer is truncated.
+    ///
+    /// Empty messages on datagram and sequenced-packet sockets are received as frames of length `0`. A shut-down
+    /// sequenced-packet peer also reads as empty messages, so once the peer has shut down any empty messages after
+    /// its last nonempty one are taken as the end of the stream.
+    /// - returns: The number of messages received, or `0` if the peer shut down, with `errno` set to `0`, or on error
+    /// with `errno` set.
+    /// - seealso: [recvmmsg(2)](https://man7.org/linux/man-pages/man2/recvmmsg.2.html)
+    std::size_t recv_frames(struct iovec *frames, std::size_t count, std::size_t *lengths) noexcept {
+        std::size_t received = 0;
+        while (received < count) {
+            auto flags = received == 0 ? 0 : MSG_DONTWAIT;
+#if defined(MSG_WAITFORONE)
+            struct mmsghdr messages[batch_size];
+            auto batch = std::min(count - received, batch_size);
+            std::memset(messages, 0, sizeof(struct mmsghdr) * batch);
+            for (std::size_t i = 0; i < batch; ++i) {
+                messages[i].msg_hdr.msg_iov = &frames[received + i];
+                messages[i].msg_hdr.msg_iovlen = 1;
+            }
+            auto n = ::recvmmsg(fd_, messages, static_cast<unsigned int>(batch), flags | MSG_WAITFORONE, nullptr);
+            for (int i = 0; i < n; ++i) {
+                lengths[received + static_cast<std::size_t>(i)] = messages[i].msg_len;
+            }
+#else
+            struct msghdr message{};
+            message.msg_iov = &frames[received];
+            message.msg_iovlen = 1;
+            auto length = ::recvmsg(fd_, &message, flags);
+            if (length >= 0) {
+                lengths[received] = static_cast<std::size_t>(length);
+            }
+            auto n = length >= 0 ? 1 : -1;
+#endif
+            if (n > 0) {
+                auto end = received + static_cast<std::size_t>(n);
+                if (auto kept = without_end_of_stream(frames, lengths, received, end); kept != end) {
+                    if (kept == 0) {
+                        errno = 0;
+                    }
+                    return kept;
+                }
+                received = end;
+            } else if (received > 0) {
+                break;
+            } else if (errno != EINTR) {
+                return 0;
+            }
+        }
+        return received;
+    }
+
+    // MARK: Descriptor Passing
+
+    /// Sends `size` bytes from `data` together with `count` file descriptors from `fds`.
+    ///
+    /// The receiver gets duplicates of the descriptors. At least one byte of data is required on stream sockets.
+    /// - returns: The number of bytes sent, or `-1` on error with `errno` set.
+    /// - seealso: [unix(7)](https://man7.org/linux/man-pages/man7/unix.7.html)
+    long send_fds(const void *data, std::size_t size, const int *fds, std::size_t count) noexcept {
+        if (count > max_fds) {
+            errno = EINVAL;
+            return -1;
+        }
+        control_buffer control;
+        struct iovec iov{const_cast<void *>(data), size};
+        struct msghdr message{};
+        message.msg_iov = &iov;
+        message.msg_iovlen = 1;
+        if (count > 0) {
+            message.msg_control = control.bytes;
+            message.msg_controllen = CMSG_SPACE(sizeof(int) * count);
+            auto header = CMSG_FIRSTHDR(&message);
+            header->cmsg_level = SOL_SOCKET;
+            header->cmsg_type = SCM_RIGHTS;
+            header->cmsg_len = CMSG_LEN(sizeof(int) * count);
+            std::memcpy(CMSG_DATA(header), fds, sizeof(int) * count);
+        }
+        for (;;) {
+            auto n = ::sendmsg(fd_, &message, send_flags);
+            if (n != -1 || errno != EINTR) {
+                return n;
+            }
+        }
+    }
+
+    /// Receives up to `size` bytes into `buffer` together with any file descriptors sent with them.
+    ///
+    /// Received descriptors are close-on-exec and owned by the caller. Descriptors beyond `max_count` are closed.
+    /// If the sender passed more than `max_fds` descriptors the kernel discards the excess; the rest are closed, the
+    /// data is dropped and the call fails with `errno` set to `EMSGSIZE`.
+    /// - parameter count: Receives the number of descriptors stored in `fds`.
+    /// - returns: The number of bytes received, `0` if the peer shut down, or `-1` on error with `errno` set.
+    long recv_fds(void *buffer, std::size_t size, int *fds, std::size_t max_count, std::size_t &count) noexcept {
+        count = 0;
+        control_buffer control;
+        struct iovec iov{buffer, size};
+        struct msghdr message{};
+        message.msg_iov = &iov;
+        message.msg_iovlen = 1;
+        message.msg_control = control.bytes;
+        message.msg_controllen = sizeof control.bytes;
+#if defined(MSG_CMSG_CLOEXEC)
+        constexpr int flags = MSG_CMSG_CLOEXEC;
+#else
+        constexpr int flags = 0;
+#endif
+        ssize_t n;
+        do {
+            n = ::recvmsg(fd_, &message, flags);
+        } while (n == -1 && errno == EINTR);
+        if (n == -1) {
+            return -1;
+        }
+        for (auto header = CMSG_FIRSTHDR(&message); header; header = CMSG_NXTHDR(&message, header)) {
+            if (header->cmsg_level != SOL_SOCKET || header->cmsg_type != SCM_RIGHTS) {
+                continue;
+            }
+            auto received = (header->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            auto data = CMSG_DATA(header);
+            for (std::size_t i = 0; i < received; ++i) {
+                int fd;
+                std::memcpy(&fd, data + i * sizeof(int), sizeof(int));
+#if !defined(MSG_CMSG_CLOEXEC)
+                ::fcntl(fd, F_SETFD, FD_CLOEXEC);
+#endif
+                if (count < max_count) {
+                    fds[count++] = fd;
+                } else {
+                    ::close(fd);
+                }
+            }
+        }
+        if (message.msg_flags & MSG_CTRUNC) {
+            // Descriptors were lost so the message cannot be handled as sent
+            for (std::size_t i = 0; i < count; ++i) {
+                ::close(fds[i]);
+            }
+            count = 0;
+            errno = EMSGSIZE;
+            return -1;
+        }
+        return n;
+    }
+
+    /// Flushes `stream` and sends its file descriptor.
+    ///
+    /// The receiver shares the file and its offset with the sender, so a stream that will not be modified further
+    /// should be sealed first with `cio::cstream::add_seals()`.
+    /// - returns: `true` on success, `false` otherwise.
+    bool send_stream(cstream &stream) noexcept {
+        if (!stream || stream.fflush() != 0) {
+            return false;
+        }
+        unsigned char tag = 0;
+        auto fd = stream.fileno();
+        return send_fds(&tag, 1, &fd, 1) == 1;
+    }
+
+    /// Receives a file descriptor sent by `send_stream()` and returns a stream for it positioned at the beginning.
+    /// - parameter mode: The mode passed to `fdopen(3)`.
+    [[nodiscard]]
+    cstream recv_stream(const char *mode = "rb") noexcept {
+        unsigned char tag;
+        int fd = -1;
+        std::size_t count;
+        if (recv_fds(&tag, 1, &fd, 1, count) != 1 || count != 1) {
+            return cstream{};
+        }
+        cstream stream{::fdopen(fd, mode)};
+        if (!stream) {
+            ::close(fd);
+            return cstream{};
+        }
+        stream.rewind();
+        return stream;
+    }
+
+  private:
+    /// The number of messages per `sendmmsg(2)` or `recvmmsg(2)` call.
+    static constexpr std::size_t batch_size = 64;
+
+#if defined(MSG_NOSIGNAL)
+    /// Flags for sending, suppressing `SIGPIPE`.
+    static constexpr int send_flags = MSG_NOSIGNAL;
+#else
+    /// Flags for sending; `SIGPIPE` is suppressed with `SO_NOSIGPIPE` instead.
+    static constexpr int send_flags = 0;
+#endif
+
+    /// Suitably aligned storage for an `SCM_RIGHTS` control message.
+    union control_buffer {
+        /// The control message.
+        unsigned char bytes[CMSG_SPACE(sizeof(int) * max_fds)];
+        /// Forces alignment.
+        struct cmsghdr align;
+    };
+
+    /// Returns the position in `[begin, end)` at which the end of the stream was received, or `end` if it was not.
+    ///
+    /// A stream socket reads as a zero-length message at its end. A sequenced-packet socket does too, which cannot be
+    /// told apart from an empty message, so trailing empty messages count as the end only once the peer has shut down.
+    std::size_t without_end_of_stream(const struct iovec *frames, const std::size_t *lengths, std::size_t begin,
+                                      std::size_t end) const noexcept {
+        auto first_empty = end;
+        while (first_empty > begin && lengths[first_empty - 1] == 0 && frames[first_empty - 1].iov_len > 0) {
+            --first_empty;
+        }
+        if (first_empty == end) {
+            return end;
+        }
+        int type = SOCK_STREAM;
+        socklen_t size = sizeof type;
+        ::getsockopt(fd_, SOL_SOCKET, SO_TYPE, &type, &size);
+        if (type == SOCK_STREAM) {
+            return first_empty;
+        }
+        if (type != SOCK_SEQPACKET) {
+            return end;
+        }
+#if defined(POLLRDHUP)
+        struct pollfd p{fd_, POLLIN | POLLRDHUP, 0};
+#else
+        struct pollfd p{fd_, POLLIN, 0};
+#endif
+        if (::poll(&p, 1, 0) != 1) {
+            return end;
+        }
+#if defined(POLLRDHUP)
+        return p.revents & (POLLHUP | POLLRDHUP) ? first_empty : end;
+#else
+        return p.revents & POLLHUP ? first_empty : end;
+#endif
+    }
+
+    /// Fills `address` with `path`.
+    /// - returns: `true` on success, `false` with `errno` set to `ENAMETOOLONG` if `path` does not fit.
+    static bool make_address(const char *path, struct sockaddr_un &address) noexcept {
+        std::memset(&address, 0, sizeof address);
+        address.sun_family = AF_UNIX;
+        auto length = std::strlen(path);
+        if (length >= sizeof address.sun_path) {
+            errno = ENAMETOOLONG;
+            return false;
+        }
+        std::memcpy(address.sun_path, path, length);
+        return true;
+    }
+
+    /// Returns `t` as the type argument to `socket(2)` and `socketpair(2)`.
+    static int socket_type(type t) noexcept {
+#if defined(SOCK_CLOEXEC)
+        // Set close-on-exec atomically so a concurrent fork and exec cannot inherit the descriptors
+        return static_cast<int>(t) | SOCK_CLOEXEC;
+#else
+        return static_cast<int>(t);
+#endif
+    }
+
+    /// Makes the managed socket close-on-exec, for descriptors adopted or created without `SOCK_CLOEXEC`, and where
+    /// needed suppresses `SIGPIPE`.
+    void configure() noexcept {
+        if (fd_ == -1) {
+            return;
+        }
+        ::fcntl(fd_, F_SETFD, FD_CLOEXEC);
+#if defined(SO_NOSIGPIPE)
+        int on = 1;
+        ::setsockopt(fd_, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof on);
+#endif
+    }
+
+    /// The managed socket.
+    int fd_{-1};
+};
+
+} /* namespace cio */
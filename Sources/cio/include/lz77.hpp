@@ -0,0 +1,266 @@
+//
+// SPDX-FileCopyrightText: 2024 Stephen F. Booth <contact@sbooth.dev>
+// SPDX-License-Identifier: MIT
+//
+// Part of https://github.com/sbooth/cio
+//
+
+#import <cstddef>
+#import <cstdint>
+#import <cstring>
+
+namespace cio {
+
+/// A fast LZ77 block codec.
+///
+/// Each block is a sequence of literal runs and back-references within a 64 KiB window, encoded as in LZ4: a token
+/// holding 4-bit literal and match lengths, extended lengths in runs of 255, the literals, and a 2-byte little-endian
+/// match offset. Matches are found with a single-probe hash table and the search skips ahead faster through data that
+/// does not compress, trading ratio for speed. Blocks are independent.
+///
+/// The decoder validates every length and offset, so corrupt input is reported as an error rather than read or
+/// written out of bounds.
+namespace lz77 {
+
+/// The value returned by `decompress()` for malformed input.
+constexpr std::size_t error = static_cast<std::size_t>(-1);
+
+/// Returns the largest compressed size of `size` bytes of input.
+[[nodiscard]]
+constexpr std::size_t compress_bound(std::size_t size) noexcept {
+    return size + size / 255 + 16;
+}
+
+namespace detail {
+
+/// The minimum match length.
+constexpr std::size_t min_match = 4;
+/// The number of bits in a hash table index.
+constexpr unsigned hash_bits = 14;
+/// The largest match offset.
+constexpr std::size_t max_offset = 65535;
+/// The number of trailing bytes always encoded as literals.
+constexpr std::size_t last_literals = 5;
+/// The distance from the end of the input within which no match may start.
+constexpr std::size_t match_start_margin = 12;
+
+/// Reads 4 unaligned bytes.
+inline std::uint32_t read32(const unsigned char *p) noexcept {
+    std::uint32_t v;
+    std::memcpy(&v, p, 4);
+    return v;
+}
+
+/// Reads 8 unaligned bytes.
+inline std::uint64_t read64(const unsigned char *p) noexcept {
+    std::uint64_t v;
+    std::memcpy(&v, p, 8);
+    return v;
+}
+
+/// Returns the hash table index for the 4 bytes `v`.
+inline std::uint32_t hash(std::uint32_t v) noexcept { return (v * 2654435761u) >> (32 - hash_bits); }
+
+/// Returns the number of equal bytes at `a` and `b`, comparing no further than `limit`.
+inline std::size_t common_length(const unsigned char *a, const unsigned char *b, const unsigned char *limit) noexcept {
+    auto start = a;
+    while (a + 8 <= limit) {
+        if (auto diff = read64(a) ^ read64(b); diff != 0) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+            return static_cast<std::size_t>(a - start) + (static_cast<unsigned>(__builtin_ctzll(diff)) >> 3);
+#else
+            return static_cast<std::size_t>(a - start) + (static_cast<unsigned>(__builtin_clzll(diff)) >> 3);
+#endif
+        }
+        a += 8;
+        b += 8;
+    }
+    while (a < limit && *a == *b) {
+        ++a;
+        ++b;
+    }
+    return static_cast<std::size_t>(a - start);
+}
+
+/// Writes the extension bytes of a length of at least 15, or returns `nullptr` if they would pass `end`.
+inline unsigned char *write_length(unsigned char *op, unsigned char *end, std::size_t length) noexcept {
+    for (length -= 15; length >= 255; length -= 255) {
+        if (op == end) {
+            return nullptr;
+        }
+        *op++ = 255;
+    }
+    if (op == end) {
+        return nullptr;
+    }
+    *op++ = static_cast<unsigned char>(length);
+    return op;
+}
+
+/// Writes a sequence of `literal_length` literals at `literals` followed by a match, or only the literals if
+/// `match_length` is `0`.
+/// - returns: The new output position, or `nullptr` if the sequence does not fit before `end`.
+inline unsigned char *write_sequence(unsigned char *op, unsigned char *end, const unsigned char *literals,
+                                     std::size_t literal_length, std::size_t offset,
+                                     std::size_t match_length) noexcept {
+    if (op == end) {
+        return nullptr;
+    }
+    auto token = op++;
+    auto match_code = match_length > 0 ? match_length - min_match : 0;
+    *token = static_cast<unsigned char>(((literal_length < 15 ? literal_length : 15) << 4) |
+                                        (match_code < 15 ? match_code : 15));
+    if (literal_length >= 15 && !(op = write_length(op, end, literal_length))) {
+        return nullptr;
+    }
+    if (static_cast<std::size_t>(end - op) < literal_length) {
+        return nullptr;
+    }
+    if (literal_length > 0) {
+        std::memcpy(op, literals, literal_length);
+        op += literal_length;
+    }
+    if (match_length == 0) {
+        return op;
+    }
+    if (end - op < 2) {
+        return nullptr;
+    }
+    *op++ = static_cast<unsigned char>(offset);
+    *op++ = static_cast<unsigned char>(offset >> 8);
+    if (match_code >= 15 && !(op = write_length(op, end, match_code))) {
+        return nullptr;
+    }
+    return op;
+}
+
+/// Reads the extension bytes of a length, or returns `false` if they run past `end`.
+inline bool read_length(const unsigned char *&ip, const unsigned char *end, std::size_t &length) noexcept {
+    for (;;) {
+        if (ip == end) {
+            return false;
+        }
+        auto byte = *ip++;
+        length += byte;
+        if (byte != 255) {
+            return true;
+        }
+    }
+}
+
+} /* namespace detail */
+
+/// Compresses `size` bytes at `src` into at most `capacity` bytes at `dst`.
+/// - returns: The compressed size, or `0` if the result would not fit in `capacity` bytes.
+[[nodiscard]]
+inline std::size_t compress(const void *src, std::size_t size, void *dst, std::size_t capacity) noexcept {
+    using namespace detail;
+    auto base = static_cast<const unsigned char *>(src);
+    auto ip = base;
+    auto anchor = base;
+    auto end = base + size;
+    auto op = static_cast<unsigned char *>(dst);
+    auto op_end = op + capacity;
+
+    if (size >= match_start_margin) {
+        std::uint32_t table[1u << hash_bits] = {};
+        auto match_start_limit = end - match_start_margin;
+        auto match_end_limit = end - last_literals;
+        while (ip < match_start_limit) {
+            auto v = read32(ip);
+            auto h = hash(v);
+            auto ref = base + table[h];
+            table[h] = static_cast<std::uint32_t>(ip - base);
+            if (static_cast<std::size_t>(ip - ref) > max_offset || ref == ip || read32(ref) != v) {
+                // Skip faster the longer the search goes without finding a match
+                ip += 1 + (static_cast<std::size_t>(ip - anchor) >> 6);
+                continue;
+            }
+            while (ip > anchor && ref > base && ip[-1] == ref[-1]) {
+                --ip;
+                --ref;
+            }
+            auto length = min_match + common_length(ip + min_match, ref + min_match, match_end_limit);
+            op = write_sequence(op, op_end, anchor, static_cast<std::size_t>(ip - anchor),
+                                static_cast<std::size_t>(ip - ref), length);
+            if (!op) {
+                return 0;
+            }
+            ip += length;
+            anchor = ip;
+            if (ip < match_start_limit) {
+                table[hash(read32(ip - 2))] = static_cast<std::uint32_t>(ip - 2 - base);
+            }
+        }
+    }
+
+    op = write_sequence(op, op_end, anchor, static_cast<std::size_t>(end - anchor), 0, 0);
+    return op ? static_cast<std::size_t>(op - static_cast<unsigned char *>(dst)) : 0;
+}
+
+/// Decompresses `size` bytes at `src` into at most `capacity` bytes at `dst`.
+/// - returns: The decompressed size, or `cio::lz77::error` if the input is malformed or does not fit.
+[[nodiscard]]
+inline std::size_t decompress(const void *src, std::size_t size, void *dst, std::size_t capacity) noexcept {
+    using namespace detail;
+    auto ip = static_cast<const unsigned char *>(src);
+    auto end = ip + size;
+    auto base = static_cast<unsigned char *>(dst);
+    auto op = base;
+    auto op_end = base + capacity;
+
+    while (ip < end) {
+        auto token = *ip++;
+        std::size_t literal_length = token >> 4;
+        if (literal_length == 15 && !read_length(ip, end, literal_length)) {
+            return error;
+        }
+        if (static_cast<std::size_t>(end - ip) < literal_length ||
+            static_cast<std::size_t>(op_end - op) < literal_length) {
+            return error;
+        }
+        if (literal_length > 0) {
+            std::memcpy(op, ip, literal_length);
+            ip += literal_length;
+            op += literal_length;
+        }
+        if (ip == end) {
+            break;
+        }
+
+        if (end - ip < 2) {
+            return error;
+        }
+        std::size_t offset = ip[0] | (static_cast<std::size_t>(ip[1]) << 8);
+        ip += 2;
+        std::size_t match_length = token & 15;
+        if (match_length == 15 && !read_length(ip, end, match_length)) {
+            return error;
+        }
+        match_length += min_match;
+        if (offset == 0 || offset > static_cast<std::size_t>(op - base) ||
+            static_cast<std::size_t>(op_end - op) < match_length) {
+            return error;
+        }
+
+        auto ref = op - offset;
+        if (offset >= 8 && static_cast<std::size_t>(op_end - op) >= match_length + 8) {
+            // Each 8-byte copy reads only bytes already written, and may overrun the match into free space
+            auto match_end = op + match_length;
+            for (; op < match_end; op += 8, ref += 8) {
+                std::memcpy(op, ref, 8);
+            }
+            op = match_end;
+        } else {
+            for (std::size_t i = 0; i < match_length; ++i) {
+                op[i] = ref[i];
+            }
+            op += match_length;
+        }
+    }
+    return static_cast<std::size_t>(op - base);
+}
+
+} /* namespace lz77 */
+
+} /* namespace cio */
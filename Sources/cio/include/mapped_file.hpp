@@ -0,0 +1,398 @@
+//
+// SPDX-FileCopyrightText: 2024 Stephen F. Booth <contact@sbooth.dev>
+// SPDX-License-Identifier: MIT
+//
+// Part of https://github.com/sbooth/cio
+//
+
+#import <algorithm>
+#import <cerrno>
+#import <cstdint>
+#import <cstdio>
+#import <cstring>
+#import <utility>
+
+#import <fcntl.h>
+#import <sys/mman.h>
+#import <sys/resource.h>
+#import <sys/stat.h>
+#import <unistd.h>
+
+#import "stream_extensions.hpp"
+
+namespace cio {
+
+/// A class managing a read-only memory mapping of a file with a sliding-window prefetch policy.
+///
+/// Sequential reads advise the kernel to fetch pages ahead of the read position (`MADV_WILLNEED`) and, optionally, to
+/// drop pages that have fallen behind it (`MADV_DONTNEED` or `MADV_COLD`). Page fault counts taken while scanning are
+/// available from `faults()`.
+class mapped_file : public input_extensions<mapped_file> {
+  public:
+    /// Possible advice for pages behind the read position.
+    enum class release_advice {
+        /// Pages are left alone.
+        none,
+        /// Pages are released with `MADV_DONTNEED`.
+        dontneed,
+        /// Pages are deactivated with `MADV_COLD` where available, or `MADV_DONTNEED` otherwise.
+        cold,
+    };
+
+    /// A sliding-window prefetch policy.
+    struct prefetch_policy {
+        /// The number of bytes ahead of the read position to request with `MADV_WILLNEED`, or `0` to disable
+        /// read-ahead.
+        std::size_t read_ahead{8 * 1024 * 1024};
+        /// The number of bytes behind the read position to retain before applying `release`.
+        std::size_t retain_behind{1024 * 1024};
+        /// The advice applied to pages behind the retained window.
+        release_advice release{release_advice::none};
+    };
+
+    /// Mapping options.
+    struct options {
+        /// Whether to prefault the entire mapping with `MAP_POPULATE` (Linux only).
+        bool populate{false};
+        /// Whether to request transparent huge pages with `MADV_HUGEPAGE` (Linux only).
+        bool huge_pages{false};
+        /// The prefetch policy for sequential reads.
+        prefetch_policy prefetch{};
+    };
+
+    /// Page fault counts.
+    struct fault_counts {
+        /// The number of page faults serviced without I/O.
+        long minor{0};
+        /// The number of page faults that required I/O.
+        long major{0};
+    };
+
+    // MARK: Standard Six
+
+    /// Initializes an empty `cio::mapped_file` object.
+    mapped_file() noexcept = default;
+
+    // This class is non-copyable.
+    mapped_file(const mapped_file &rhs) = delete;
+
+    // This class is non-assignable.
+    mapped_file &operator=(const mapped_file &rhs) = delete;
+
+    /// Initializes a `cio::mapped_file` object with the mapping from `rhs` and leaves `rhs` empty.
+    mapped_file(mapped_file &&rhs) noexcept { swap(rhs); }
+
+    /// Unmaps the current mapping and replaces it with the mapping from `rhs`, then leaves `rhs` empty.
+    mapped_file &operator=(mapped_file &&rhs) noexcept {
+        if (this != &rhs) {
+            close();
+            swap(rhs);
+        }
+        return *this;
+    }
+
+    /// Unmaps the current mapping.
+    ~mapped_file() noexcept { close(); }
+
+    // MARK: Construction
+
+    /// Initializes a `cio::mapped_file` object and maps `filename` with the default options.
+    explicit mapped_file(const char *filename) noexcept { open(filename); }
+
+    /// Initializes a `cio::mapped_file` object and maps `filename`.
+    mapped_file(const char *filename, const options &opts) noexcept { open(filename, opts); }
+
+    // MARK: Mapping Handling
+
+    /// Returns `true` if a file is mapped.
+    [[nodiscard]]
+    explicit operator bool() const noexcept {
+        return is_open_;
+    }
+
+    /// Returns the address of the mapping or `nullptr` for an empty file.
+    [[nodiscard]]
+    const unsigned char *data() const noexcept {
+        return data_;
+    }
+
+    /// Returns the size of the mapping in bytes.
+    [[nodiscard]]
+    std::size_t size() const noexcept {
+        return size_;
+    }
+
+    /// Swaps the mappings of this object and `other`.
+    void swap(mapped_file &other) noexcept {
+        std::swap(data_, other.data_);
+        std::swap(size_, other.size_);
+        std::swap(position_, other.position_);
+        std::swap(eof_, other.eof_);
+        std::swap(is_open_, other.is_open_);
+        std::swap(policy_, other.policy_);
+        std::swap(prefetched_, other.prefetched_);
+        std::swap(released_, other.released_);
+        std::swap(baseline_, other.baseline_);
+    }
+
+    /// Unmaps the current mapping and maps `filename` with the default options.
+    /// - parameter filename: The file to map.
+    /// - returns: `true` on success, `false` otherwise with `errno` set.
+    bool open(const char *filename) noexcept { return open(filename, options{}); }
+
+    /// Unmaps the current mapping and maps `filename`.
+    /// - parameter filename: The file to map.
+    /// - parameter opts: The mapping options.
+    /// - returns: `true` on success, `false` otherwise with `errno` set.
+    bool open(const char *filename, const options &opts) noexcept {
+        close();
+
+        auto fd = ::open(filename, O_RDONLY | O_CLOEXEC);
+        if (fd == -1) {
+            return false;
+        }
+
+        struct stat st;
+        if (::fstat(fd, &st) == -1) {
+            auto err = errno;
+            ::close(fd);
+            errno = err;
+            return false;
+        }
+
+        if (st.st_size > 0) {
+            auto flags = MAP_PRIVATE;
+#if defined(MAP_POPULATE)
+            if (opts.populate) {
+                flags |= MAP_POPULATE;
+            }
+#endif
+            auto addr = ::mmap(nullptr, static_cast<std::size_t>(st.st_size), PROT_READ, flags, fd, 0);
+            if (addr == MAP_FAILED) {
+                auto err = errno;
+                ::close(fd);
+                errno = err;
+                return false;
+            }
+            data_ = static_cast<unsigned char *>(addr);
+            size_ = static_cast<std::size_t>(st.st_size);
+        }
+
+        ::close(fd);
+        is_open_ = true;
+        policy_ = opts.prefetch;
+
+#if defined(MADV_HUGEPAGE)
+        if (opts.huge_pages && data_) {
+            ::madvise(data_, size_, MADV_HUGEPAGE);
+        }
+#endif
+
+        reset_faults();
+        advance(0);
+        return true;
+    }
+
+    /// Unmaps the current mapping.
+    void close() noexcept {
+        if (data_) {
+            ::munmap(data_, size_);
+        }
+        data_ = nullptr;
+        size_ = 0;
+        position_ = 0;
+        eof_ = false;
+        is_open_ = false;
+        prefetched_ = 0;
+        released_ = 0;
+    }
+
+    // MARK: Prefetching
+
+    /// Returns the prefetch policy.
+    [[nodiscard]]
+    const prefetch_policy &policy() const noexcept {
+        return policy_;
+    }
+
+    /// Replaces the prefetch policy.
+    void set_policy(const prefetch_policy &policy) noexcept {
+        policy_ = policy;
+        prefetched_ = std::min(prefetched_, position_);
+        advance(position_);
+    }
+
+    /// Returns the page faults taken by the calling thread since the file was mapped or `reset_faults()` was called.
+    [[nodiscard]]
+    fault_counts faults() const noexcept {
+        auto now = current_faults();
+        return {now.minor - baseline_.minor, now.major - baseline_.major};
+    }
+
+    /// Resets the page fault counts returned by `faults()`.
+    void reset_faults() noexcept { baseline_ = current_faults(); }
+
+    // MARK: Direct Input
+
+    using input_extensions<mapped_file>::fread;
+
+    /// Copies up to `count` objects of `size` bytes from the current position into `buffer`.
+    /// - returns: The number of objects read.
+    std::size_t fread(void *buffer, std::size_t size, std::size_t count) noexcept {
+        if (size == 0 || count == 0) {
+            return 0;
+        }
+        auto available = (size_ - position_) / size;
+        if (available < count) {
+            count = available;
+            eof_ = true;
+        }
+        auto length = size * count;
+        if (length) {
+            std::memcpy(buffer, data_ + position_, length);
+            advance(position_ + length);
+        }
+        return count;
+    }
+
+    /// Returns the next byte as an `unsigned char` converted to `int`, or `EOF` at end of file.
+    [[nodiscard]]
+    int fgetc() noexcept {
+        if (position_ >= size_) {
+            eof_ = true;
+            return EOF;
+        }
+        int ch = data_[position_];
+        advance(position_ + 1);
+        return ch;
+    }
+
+    // MARK: File Positioning
+
+    /// Returns the current position.
+    [[nodiscard]]
+    long ftell() const noexcept {
+        return static_cast<long>(position_);
+    }
+
+    /// Sets the current position.
+    /// - returns: `0` on success, `-1` otherwise.
+    int fseek(long offset, int origin) noexcept {
+        long base;
+        switch (origin) {
+        case SEEK_SET:
+            base = 0;
+            break;
+        case SEEK_CUR:
+            base = static_cast<long>(position_);
+            break;
+        case SEEK_END:
+            base = static_cast<long>(size_);
+            break;
+        default:
+            return -1;
+        }
+        if (offset < -base || base + offset > static_cast<long>(size_)) {
+            return -1;
+        }
+        auto position = static_cast<std::size_t>(base + offset);
+        if (position < position_) {
+            prefetched_ = std::min(prefetched_, position);
+            released_ = std::min(released_, position & ~(page_size() - 1));
+        }
+        eof_ = false;
+        advance(position);
+        return 0;
+    }
+
+    /// Sets the current position to the beginning of the file.
+    void rewind() noexcept { fseek(0, SEEK_SET); }
+
+    // MARK: Error Handling
+
+    /// Returns nonzero if a read has reached the end of the file.
+    [[nodiscard]]
+    int feof() const noexcept {
+        return eof_;
+    }
+
+    /// Clears the end-of-file indicator.
+    void clearerr() noexcept { eof_ = false; }
+
+  private:
+    /// Returns the page size.
+    static std::size_t page_size() noexcept {
+        static const auto size = static_cast<std::size_t>(::sysconf(_SC_PAGESIZE));
+        return size;
+    }
+
+    /// Returns the page fault counts for the calling thread, or the process where per-thread counts are unavailable.
+    static fault_counts current_faults() noexcept {
+        struct rusage usage;
+#if defined(RUSAGE_THREAD)
+        auto who = RUSAGE_THREAD;
+#else
+        auto who = RUSAGE_SELF;
+#endif
+        if (::getrusage(who, &usage) == -1) {
+            return {};
+        }
+        return {usage.ru_minflt, usage.ru_majflt};
+    }
+
+    /// Moves the read position to `position` and applies the prefetch policy.
+    void advance(std::size_t position) noexcept {
+        position_ = position;
+        if (!data_) {
+            return;
+        }
+
+        const auto page = page_size();
+
+        // Issue read-ahead in half-window steps to avoid a system call per read
+        if (policy_.read_ahead && prefetched_ < size_ && position_ + policy_.read_ahead / 2 >= prefetched_) {
+            auto begin = std::max(prefetched_, position_) & ~(page - 1);
+            auto end = std::min(position_ + policy_.read_ahead, size_);
+            if (end > begin) {
+                ::madvise(data_ + begin, end - begin, MADV_WILLNEED);
+            }
+            prefetched_ = end;
+        }
+
+        if (policy_.release != release_advice::none && position_ > policy_.retain_behind) {
+            auto end = (position_ - policy_.retain_behind) & ~(page - 1);
+            // Release in steps of at least the retained window for the same reason
+            if (end > released_ && end - released_ >= std::max(policy_.retain_behind, page)) {
+                auto advice = MADV_DONTNEED;
+#if defined(MADV_COLD)
+                if (policy_.release == release_advice::cold) {
+                    advice = MADV_COLD;
+                }
+#endif
+                ::madvise(data_ + released_, end - released_, advice);
+                released_ = end;
+            }
+        }
+    }
+
+    /// The address of the mapping.
+    unsigned char *data_{nullptr};
+    /// The size of the mapping in bytes.
+    std::size_t size_{0};
+    /// The current read position.
+    std::size_t position_{0};
+    /// Whether a read has reached the end of the file.
+    bool eof_{false};
+    /// Whether a file is mapped.
+    bool is_open_{false};
+    /// The prefetch policy.
+    prefetch_policy policy_{};
+    /// The offset up to which read-ahead has been requested.
+    std::size_t prefetched_{0};
+    /// The offset up to which pages have been released.
+    std::size_t released_{0};
+    /// The page fault counts when counting began.
+    fault_counts baseline_{};
+};
+
+} /* namespace cio */
@@ -0,0 +1,275 @@
+//
+// SPDX-FileCopyrightText: 2024 Stephen F. Booth <contact@sbooth.dev>
+// SPDX-License-Identifier: MIT
+//
+// Part of https://github.com/sbooth/cio
+//
+
+#import <algorithm>
+#import <atomic>
+#import <chrono>
+#import <condition_variable>
+#import <cstddef>
+#import <cstdint>
+#import <mutex>
+#import <utility>
+
+namespace cio {
+
+/// A process-wide budget for memory held by cio buffers.
+///
+/// Components reserve memory before allocating buffers and release it after freeing them. When a reservation would
+/// exceed the budget it is refused, and the component falls back to a path using less memory: `cio::buffer_pool`
+/// frees cached buffers, `cio::pooled_stream` flushes early, `cio::spill_stream` spills to its temporary file,
+/// `cio::compressed_reader` reads fewer blocks ahead, `cio::seekable_compressed_reader` caches fewer blocks and
+/// `cio::cdc_chunker` reads in smaller blocks. Producers that can wait, such as `cio::compressed_writer`, call
+/// `reserve()` with a timeout and are throttled until other reservations are released.
+///
+/// Once usage reaches the high-water mark `under_pressure()` returns `true`, so components can shed memory before
+/// reservations start to fail. With a budget of `0`, the default, usage is tracked but never limited.
+class memory_governor {
+  public:
+    // This class is non-copyable.
+    memory_governor(const memory_governor &rhs) = delete;
+
+    // This class is non-assignable.
+    memory_governor &operator=(const memory_governor &rhs) = delete;
+
+    /// Returns the process-wide governor.
+    static memory_governor &shared() noexcept {
+        static memory_governor governor;
+        return governor;
+    }
+
+    // MARK: Budget
+
+    /// Returns the budget in bytes, or `0` if usage is not limited.
+    [[nodiscard]]
+    std::size_t budget() const noexcept {
+        return budget_.load(std::memory_order_relaxed);
+    }
+
+    /// Returns the usage in bytes at which `under_pressure()` returns `true`.
+    [[nodiscard]]
+    std::size_t high_water_mark() const noexcept {
+        return high_water_mark_.load(std::memory_order_relaxed);
+    }
+
+    /// Sets the budget.
+    /// - parameter budget: The budget in bytes, or `0` to remove the limit.
+    /// - parameter high_water_mark: The usage at which `under_pressure()` returns `true`, or `0` for seven eighths of
+    /// `budget`.
+    void set_budget(std::size_t budget, std::size_t high_water_mark = 0) noexcept {
+        budget_.store(budget, std::memory_order_relaxed);
+        high_water_mark_.store(high_water_mark > 0 ? high_water_mark : budget - budget / 8, std::memory_order_relaxed);
+        // A larger budget may admit waiting producers
+        std::lock_guard<std::mutex> lock{mutex_};
+        released_.notify_all();
+    }
+
+    // MARK: Usage
+
+    /// Returns the number of bytes currently reserved.
+    [[nodiscard]]
+    std::size_t current() const noexcept {
+        return current_.load(std::memory_order_relaxed);
+    }
+
+    /// Returns the largest number of bytes reserved at once.
+    [[nodiscard]]
+    std::size_t peak() const noexcept {
+        return peak_.load(std::memory_order_relaxed);
+    }
+
+    /// Sets the peak usage to the current usage.
+    void reset_peak() noexcept { peak_.store(current(), std::memory_order_relaxed); }
+
+    /// Returns the number of reservations refused or timed out.
+    [[nodiscard]]
+    std::uint64_t refusals() const noexcept {
+        return refusals_.load(std::memory_order_relaxed);
+    }
+
+    /// Returns `true` if a budget is set and usage has reached the high-water mark.
+    [[nodiscard]]
+    bool under_pressure() const noexcept {
+        return budget() > 0 && current() >= high_water_mark();
+    }
+
+    // MARK: Reservations
+
+    /// Reserves `bytes` if they fit within the budget.
+    /// - returns: `true` if the reservation was made.
+    bool try_reserve(std::size_t bytes) noexcept {
+        if (reserve_if_fits(bytes)) {
+            return true;
+        }
+        refusals_.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    /// Reserves `bytes`, waiting up to `timeout` for other reservations to be released if they do not fit.
+    /// - returns: `true` if the reservation was made.
+    template <typename Rep, typename Period>
+    bool reserve(std::size_t bytes, std::chrono::duration<Rep, Period> timeout) noexcept {
+        if (reserve_if_fits(bytes)) {
+            return true;
+        }
+        auto deadline = std::chrono::steady_clock::now() + timeout;
+        std::unique_lock<std::mutex> lock{mutex_};
+        waiters_.fetch_add(1, std::memory_order_seq_cst);
+        auto reserved = reserve_if_fits(bytes);
+        while (!reserved && released_.wait_until(lock, deadline) == std::cv_status::no_timeout) {
+            reserved = reserve_if_fits(bytes);
+        }
+        waiters_.fetch_sub(1, std::memory_order_relaxed);
+        if (!reserved && !reserve_if_fits(bytes)) {
+            refusals_.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        return true;
+    }
+
+    /// Releases `bytes` previously reserved and wakes any throttled producers.
+    void release(std::size_t bytes) noexcept {
+        current_.fetch_sub(bytes, std::memory_order_seq_cst);
+        if (waiters_.load(std::memory_order_seq_cst) > 0) {
+            std::lock_guard<std::mutex> lock{mutex_};
+            released_.notify_all();
+        }
+    }
+
+  private:
+    /// Initializes the governor with no budget.
+    memory_governor() noexcept = default;
+
+    /// Reserves `bytes` if they fit within the budget, without counting a refusal.
+    bool reserve_if_fits(std::size_t bytes) noexcept {
+        auto current = current_.load(std::memory_order_relaxed);
+        for (;;) {
+            auto budget = budget_.load(std::memory_order_relaxed);
+            if (budget > 0 && (bytes > budget || current > budget - bytes)) {
+                return false;
+            }
+            if (current_.compare_exchange_weak(current, current + bytes, std::memory_order_seq_cst)) {
+                break;
+            }
+        }
+        for (auto peak = peak_.load(std::memory_order_relaxed), usage = current + bytes;
+             usage > peak && !peak_.compare_exchange_weak(peak, usage, std::memory_order_relaxed);) {
+        }
+        return true;
+    }
+
+    /// The budget in bytes, or `0` if usage is not limited.
+    std::atomic<std::size_t> budget_{0};
+    /// The usage at which `under_pressure()` returns `true`.
+    std::atomic<std::size_t> high_water_mark_{0};
+    /// The number of bytes currently reserved.
+    std::atomic<std::size_t> current_{0};
+    /// The largest number of bytes reserved at once.
+    std::atomic<std::size_t> peak_{0};
+    /// The number of reservations refused or timed out.
+    std::atomic<std::uint64_t> refusals_{0};
+    /// The number of producers waiting in `reserve()`.
+    std::atomic<std::size_t> waiters_{0};
+    /// Guards waiting for released memory.
+    std::mutex mutex_;
+    /// Signaled when memory is released.
+    std::condition_variable released_;
+};
+
+/// An amount of memory reserved from `cio::memory_governor::shared()` and released on destruction.
+class memory_reservation {
+  public:
+    // MARK: Standard Six
+
+    /// Initializes an empty `cio::memory_reservation` object.
+    memory_reservation() noexcept = default;
+
+    // This class is non-copyable.
+    memory_reservation(const memory_reservation &rhs) = delete;
+
+    // This class is non-assignable.
+    memory_reservation &operator=(const memory_reservation &rhs) = delete;
+
+    /// Initializes a `cio::memory_reservation` object with the reservation from `rhs` and leaves `rhs` empty.
+    memory_reservation(memory_reservation &&rhs) noexcept : size_{std::exchange(rhs.size_, 0)} {}
+
+    /// Releases the current reservation and replaces it with the reservation from `rhs`, then leaves `rhs` empty.
+    memory_reservation &operator=(memory_reservation &&rhs) noexcept {
+        if (this != &rhs) {
+            reset();
+            size_ = std::exchange(rhs.size_, 0);
+        }
+        return *this;
+    }
+
+    /// Releases the reservation.
+    ~memory_reservation() noexcept { reset(); }
+
+    // MARK: Reservation Handling
+
+    /// Returns the number of bytes reserved.
+    [[nodiscard]]
+    std::size_t size() const noexcept {
+        return size_;
+    }
+
+    /// Grows or shrinks the reservation to `size` bytes.
+    /// - returns: `true` on success, `false` if growing would exceed the budget.
+    bool resize(std::size_t size) noexcept {
+        auto &governor = memory_governor::shared();
+        if (size > size_ && !governor.try_reserve(size - size_)) {
+            return false;
+        }
+        if (size < size_) {
+            governor.release(size_ - size);
+        }
+        size_ = size;
+        return true;
+    }
+
+    /// Grows or shrinks the reservation to `size` bytes, waiting up to `timeout` for other reservations to be released
+    /// if growing would exceed the budget.
+    /// - returns: `true` on success, `false` if the memory was not released in time.
+    template <typename Rep, typename Period>
+    bool resize(std::size_t size, std::chrono::duration<Rep, Period> timeout) noexcept {
+        auto &governor = memory_governor::shared();
+        if (size > size_ && !governor.reserve(size - size_, timeout)) {
+            return false;
+        }
+        if (size < size_) {
+            governor.release(size_ - size);
+        }
+        size_ = size;
+        return true;
+    }
+
+    /// Grows or shrinks the reservation to the largest of `size`, `size / 2`, `size / 4` and so on, but at least
+    /// `minimum`, that fits within the budget.
+    ///
+    /// Components whose buffer size is a matter of efficiency use this to run in smaller buffers under memory pressure.
+    /// - returns: The number of bytes reserved, or `0` with the reservation unchanged if not even `minimum` bytes fit.
+    std::size_t resize_up_to(std::size_t size, std::size_t minimum) noexcept {
+        size = std::max(size, minimum);
+        for (;;) {
+            if (resize(size)) {
+                return size;
+            }
+            if (size <= minimum) {
+                return 0;
+            }
+            size = std::max(size / 2, minimum);
+        }
+    }
+
+    /// Releases the reservation.
+    void reset() noexcept { resize(0); }
+
+  private:
+    /// The number of bytes reserved.
+    std::size_t size_{0};
+};
+
+} /* namespace cio */
@@ -0,0 +1,133 @@
+//
+// SPDX-FileCopyrightText: 2024 Stephen F. Booth <contact@sbooth.dev>
+// SPDX-License-Identifier: MIT
+//
+// Part of https://github.com/sbooth/cio
+//
+
+#import <cerrno>
+#import <cstddef>
+#import <utility>
+
+#import <sys/mman.h>
+#import <sys/stat.h>
+
+#import "cstream.hpp"
+
+namespace cio {
+
+/// A class managing a shared memory mapping of a file descriptor.
+///
+/// Combined with `cio::cstream::memfd()` this allows data written through a stream to be handed to another component,
+/// or to a child process holding the same descriptor, without copying.
+class memory_map {
+  public:
+    // MARK: Standard Six
+
+    /// Initializes an empty `cio::memory_map` object.
+    memory_map() noexcept = default;
+
+    // This class is non-copyable.
+    memory_map(const memory_map &rhs) = delete;
+
+    // This class is non-assignable.
+    memory_map &operator=(const memory_map &rhs) = delete;
+
+    /// Initializes a `cio::memory_map` object with the mapping from `rhs` and leaves `rhs` empty.
+    memory_map(memory_map &&rhs) noexcept
+        : data_{std::exchange(rhs.data_, nullptr)}, size_{std::exchange(rhs.size_, 0)} {}
+
+    /// Unmaps the current mapping and replaces it with the mapping from `rhs`, then leaves `rhs` empty.
+    memory_map &operator=(memory_map &&rhs) noexcept {
+        if (this != &rhs) {
+            reset();
+            data_ = std::exchange(rhs.data_, nullptr);
+            size_ = std::exchange(rhs.size_, 0);
+        }
+        return *this;
+    }
+
+    /// Unmaps the current mapping.
+    ~memory_map() noexcept { reset(); }
+
+    // MARK: Construction
+
+    /// Initializes a `cio::memory_map` object with a `MAP_SHARED` mapping of `length` bytes of `fd` at `offset`.
+    /// - parameter fd: The file descriptor to map.
+    /// - parameter length: The number of bytes to map.
+    /// - parameter writable: Whether the mapping is writable.
+    /// - parameter offset: The offset in the file of the mapping, which must be a multiple of the page size.
+    memory_map(int fd, std::size_t length, bool writable, off_t offset = 0) noexcept {
+        if (length == 0) {
+            errno = EINVAL;
+            return;
+        }
+        auto prot = PROT_READ | (writable ? PROT_WRITE : 0);
+        if (auto addr = ::mmap(nullptr, length, prot, MAP_SHARED, fd, offset); addr != MAP_FAILED) {
+            data_ = addr;
+            size_ = length;
+        }
+    }
+
+    /// Initializes a `cio::memory_map` object with a `MAP_SHARED` mapping of the entire file underlying `stream`.
+    ///
+    /// The stream is flushed before mapping so that everything written through it is visible in the mapping.
+    /// - parameter stream: The stream whose file to map.
+    /// - parameter writable: Whether the mapping is writable.
+    memory_map(cstream &stream, bool writable = false) noexcept {
+        if (stream.fflush() != 0) {
+            return;
+        }
+        struct stat st;
+        if (::fstat(stream.fileno(), &st) == -1) {
+            return;
+        }
+        *this = memory_map{stream.fileno(), static_cast<std::size_t>(st.st_size), writable};
+    }
+
+    // MARK: Mapping Handling
+
+    /// Returns `true` if the mapping is valid.
+    [[nodiscard]]
+    explicit operator bool() const noexcept {
+        return data_ != nullptr;
+    }
+
+    /// Returns the address of the mapping.
+    [[nodiscard]]
+    void *data() const noexcept {
+        return data_;
+    }
+
+    /// Returns the size of the mapping in bytes.
+    [[nodiscard]]
+    std::size_t size() const noexcept {
+        return size_;
+    }
+
+    /// Unmaps the current mapping.
+    void reset() noexcept {
+        if (auto old = std::exchange(data_, nullptr); old) {
+            ::munmap(old, std::exchange(size_, 0));
+        }
+    }
+
+    /// Swaps the mappings of this object and `other`.
+    void swap(memory_map &other) noexcept {
+        std::swap(data_, other.data_);
+        std::swap(size_, other.size_);
+    }
+
+    /// Returns the result of `msync(2)` on the mapping.
+    /// - parameter async: Whether to schedule the write-back and return immediately.
+    /// - seealso: [msync(2)](https://man7.org/linux/man-pages/man2/msync.2.html)
+    int msync(bool async = false) noexcept { return ::msync(data_, size_, async ? MS_ASYNC : MS_SYNC); }
+
+  private:
+    /// The address of the mapping.
+    void *data_{nullptr};
+    /// The size of the mapping in bytes.
+    std::size_t size_{0};
+};
+
+} /* namespace cio */
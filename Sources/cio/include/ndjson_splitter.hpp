@@ -0,0 +1,325 @@
+//
+// SPDX-FileCopyrightText: 2024 Stephen F. Booth <contact@sbooth.dev>
+// SPDX-License-Identifier: MIT
+//
+// Part of https://github.com/sbooth/cio
+//
+
+#import <algorithm>
+#import <atomic>
+#import <cstdint>
+#import <cstring>
+#import <exception>
+#import <string_view>
+#import <thread>
+#import <vector>
+
+#import "cstream.hpp"
+#import "memory_governor.hpp"
+#import "simd.hpp"
+
+namespace cio {
+
+/// A splitter dividing newline-delimited JSON into records without parsing them.
+///
+/// The stream is read in large blocks, and each 64 bytes are classified with vector comparisons. A mask of backslashes
+/// gives the escaped characters, the unescaped quotes give the bytes inside strings through a prefix XOR, and the
+/// newlines outside strings are the record boundaries. Escape and string state carry from one block to the next, so a
+/// newline inside a string, or a quote preceded by any number of backslashes, never splits a record.
+///
+/// Records are `std::string_view` objects referring to the splitter's buffer, without the newline or a carriage return
+/// before it. Empty lines are skipped. A record with an unterminated string extends to the end of the stream.
+///
+/// `dispatch()` divides the complete records of each block into batches and hands them to worker threads for parsing
+/// or routing.
+class ndjson_splitter {
+  public:
+    /// The default number of bytes read at a time.
+    static constexpr std::size_t default_block_size = 1024 * 1024;
+
+    /// The default number of records in a batch passed to `dispatch()` workers.
+    static constexpr std::size_t default_batch_size = 256;
+
+    /// The largest size of the buffer, which limits the length of a record.
+    static constexpr std::size_t max_buffer_size = std::size_t{1} << 31;
+
+    /// A batch of consecutive records.
+    struct batch {
+        /// The index of the first record in the stream.
+        std::uint64_t first;
+        /// The records.
+        const std::string_view *records;
+        /// The number of records.
+        std::size_t count;
+    };
+
+    // This class is non-copyable.
+    ndjson_splitter(const ndjson_splitter &rhs) = delete;
+
+    // This class is non-assignable.
+    ndjson_splitter &operator=(const ndjson_splitter &rhs) = delete;
+
+    /// Initializes a `cio::ndjson_splitter` object that reads from `stream`.
+    /// - parameter stream: The stream to read.
+    /// - parameter block_size: The number of bytes read at a time. The buffer grows as needed to hold a record, up to
+    /// `max_buffer_size`; a longer record is an error. The buffer is reserved from `cio::memory_governor::shared()`,
+    /// and a buffer the budget cannot cover is an error.
+    /// - throws: Any exception thrown by `Allocator::allocate()` (typically `std::bad_alloc`)
+    explicit ndjson_splitter(cstream &stream, std::size_t block_size = default_block_size) : stream_{stream} {
+        auto size = std::clamp<std::size_t>(block_size, byte_block::size, max_buffer_size);
+        if (reservation_.resize(size)) {
+            buffer_.resize(size);
+        } else {
+            error_ = true;
+        }
+    }
+
+    /// Returns `true` if no error has occurred.
+    [[nodiscard]]
+    explicit operator bool() const noexcept {
+        return !error_;
+    }
+
+    /// Returns the number of records split.
+    [[nodiscard]]
+    std::uint64_t record_count() const noexcept {
+        return records_;
+    }
+
+    // MARK: Splitting
+
+    /// Finds the next record.
+    /// - parameter record: The record, valid until the next call.
+    /// - returns: `true` on success, `false` at the end of the stream or on error.
+    /// - throws: Any exception thrown by `Allocator::allocate()` (typically `std::bad_alloc`)
+    bool next(std::string_view &record) {
+        while (!split(record)) {
+            if (!fill()) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /// Splits the remaining records and passes them in batches to up to `threads` threads.
+    ///
+    /// The records of each block are divided into batches of `batch_size`, which workers take in turn; the next block
+    /// is read when all batches of the current one have been handled. The worker is invoked concurrently from several
+    /// threads, as `worker(const cio::ndjson_splitter::batch &)`, and must be thread-safe. An exception thrown by the
+    /// worker stops the split and is rethrown.
+    /// - parameter worker: The function called with each batch.
+    /// - parameter threads: The number of threads to use, or `0` for the number of hardware threads.
+    /// - parameter batch_size: The largest number of records in a batch.
+    /// - returns: `false` if a read failed.
+    /// - throws: Any exception thrown by `Allocator::allocate()` (typically `std::bad_alloc`) or `worker`
+    template <typename Worker>
+    bool dispatch(Worker &&worker, unsigned threads = 0, std::size_t batch_size = default_batch_size) {
+        if (threads == 0) {
+            threads = std::max(std::thread::hardware_concurrency(), 1u);
+        }
+        batch_size = std::max<std::size_t>(batch_size, 1);
+        std::vector<std::string_view> records;
+        std::vector<std::exception_ptr> errors(threads);
+        for (;;) {
+            records.clear();
+            for (std::string_view record; split(record);) {
+                records.push_back(record);
+            }
+
+            if (!records.empty()) {
+                auto first = records_ - records.size();
+                auto batches = (records.size() + batch_size - 1) / batch_size;
+                std::atomic<std::size_t> next_batch{0};
+                std::atomic<bool> failed{false};
+                auto work = [&](std::size_t k) {
+                    try {
+                        for (std::size_t b; !failed && (b = next_batch++) < batches;) {
+                            auto offset = b * batch_size;
+                            worker(batch{first + offset, records.data() + offset,
+                                         std::min(batch_size, records.size() - offset)});
+                        }
+                    } catch (...) {
+                        errors[k] = std::current_exception();
+                        failed = true;
+                    }
+                };
+                std::vector<std::thread> workers;
+                auto count = std::min<std::size_t>(threads, batches);
+                workers.reserve(count - 1);
+                for (std::size_t k = 1; k < count; ++k) {
+                    workers.emplace_back(work, k);
+                }
+                work(0);
+                for (auto &thread : workers) {
+                    thread.join();
+                }
+                for (auto &error : errors) {
+                    if (error) {
+                        std::rethrow_exception(error);
+                    }
+                }
+            }
+
+            if (eof_ || !fill()) {
+                return !error_;
+            }
+        }
+    }
+
+    // MARK: Error Handling
+
+    /// Returns nonzero if the end of the stream has been reached and all records have been split.
+    [[nodiscard]]
+    int feof() const noexcept {
+        return eof_ && begin_ == end_;
+    }
+
+    /// Returns nonzero if a read failed or a record did not fit in the buffer.
+    [[nodiscard]]
+    int ferror() const noexcept {
+        return error_;
+    }
+
+  private:
+    /// Finds the next record in the indexed data without reading.
+    /// - returns: `false` if all complete records in the buffer have been split.
+    bool split(std::string_view &record) noexcept {
+        while (next_boundary_ < boundaries_.size()) {
+            auto end = boundaries_[next_boundary_++];
+            record = view(begin_, end);
+            begin_ = end + 1;
+            if (!record.empty()) {
+                ++records_;
+                return true;
+            }
+        }
+        if (eof_ && begin_ < end_) {
+            record = view(begin_, end_);
+            begin_ = end_;
+            if (!record.empty()) {
+                ++records_;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /// Returns the record `[begin, end)` without a trailing carriage return.
+    std::string_view view(std::size_t begin, std::size_t end) const noexcept {
+        if (end > begin && buffer_[end - 1] == '\r') {
+            --end;
+        }
+        return {reinterpret_cast<const char *>(buffer_.data()) + begin, end - begin};
+    }
+
+    /// Returns a mask of the bytes escaped by the backslashes in `backslash`.
+    ///
+    /// Each run of backslashes escapes the byte after it if the run has odd length. `carry` is set if the last byte of
+    /// the block is an unpaired backslash, escaping the first byte of the next block.
+    static std::uint64_t escaped(std::uint64_t backslash, std::uint64_t &carry) noexcept {
+        constexpr std::uint64_t even_bits = 0x5555555555555555;
+        backslash &= ~carry;
+        auto follows_escape = (backslash << 1) | carry;
+        // Adding the start of each run beginning on an odd bit to the run carries out of its end; the parity of the
+        // end relative to the start determines whether the byte after the run is escaped
+        auto odd_starts = backslash & ~even_bits & ~follows_escape;
+        unsigned long long sequences_on_even;
+        carry = __builtin_uaddll_overflow(odd_starts, backslash, &sequences_on_even);
+        auto invert = static_cast<std::uint64_t>(sequences_on_even) << 1;
+        return (even_bits ^ invert) & follows_escape;
+    }
+
+    /// Moves the unsplit data to the front of the buffer, reads more data and indexes it.
+    /// - returns: `false` if a read failed, a record did not fit in the buffer, or the end of the stream had already
+    /// been reached.
+    bool fill() {
+        if (eof_ || error_) {
+            return false;
+        }
+        // All boundaries have been consumed
+        boundaries_.clear();
+        next_boundary_ = 0;
+        if (begin_ > 0) {
+            std::memmove(buffer_.data(), buffer_.data() + begin_, end_ - begin_);
+            end_ -= begin_;
+            indexed_ -= begin_;
+            begin_ = 0;
+        }
+        if (end_ == buffer_.size()) {
+            // A single record fills the buffer
+            if (2 * buffer_.size() > max_buffer_size || !reservation_.resize(2 * buffer_.size())) {
+                error_ = true;
+                return false;
+            }
+            buffer_.resize(2 * buffer_.size());
+        }
+
+        auto n = stream_.fread(buffer_.data() + end_, 1, buffer_.size() - end_);
+        end_ += n;
+        if (n == 0) {
+            eof_ = true;
+            error_ = stream_.ferror();
+        }
+        index();
+        return !error_;
+    }
+
+    /// Records the offsets of the newlines outside strings in the unindexed data.
+    ///
+    /// Only whole 64-byte blocks are indexed until the end of the stream is reached, so that string and escape state
+    /// carries exactly from one block to the next.
+    void index() {
+        auto p = buffer_.data();
+        for (; indexed_ + byte_block::size <= end_; indexed_ += byte_block::size) {
+            byte_block block{p + indexed_};
+            auto quotes = block.eq('"') & ~escaped(block.eq('\\'), escape_carry_);
+            auto inside = prefix_xor(quotes) ^ in_string_;
+            in_string_ = static_cast<std::uint64_t>(static_cast<std::int64_t>(inside) >> 63);
+            for (auto newlines = block.eq('\n') & ~inside; newlines != 0; newlines &= newlines - 1) {
+                boundaries_.push_back(static_cast<std::uint32_t>(indexed_) +
+                                      static_cast<std::uint32_t>(__builtin_ctzll(newlines)));
+            }
+        }
+        if (eof_ && indexed_ < end_) {
+            unsigned char tail[byte_block::size] = {};
+            std::memcpy(tail, p + indexed_, end_ - indexed_);
+            byte_block block{tail};
+            auto quotes = block.eq('"') & ~escaped(block.eq('\\'), escape_carry_);
+            auto inside = prefix_xor(quotes) ^ in_string_;
+            for (auto newlines = block.eq('\n') & ~inside; newlines != 0; newlines &= newlines - 1) {
+                boundaries_.push_back(static_cast<std::uint32_t>(indexed_) +
+                                      static_cast<std::uint32_t>(__builtin_ctzll(newlines)));
+            }
+            indexed_ = end_;
+        }
+    }
+
+    /// The underlying stream.
+    cstream &stream_;
+    /// Data read from the stream.
+    std::vector<unsigned char> buffer_;
+    /// The memory reserved from the governor for `buffer_`.
+    memory_reservation reservation_;
+    /// The offset of the first unsplit byte in `buffer_`.
+    std::size_t begin_{0};
+    /// The number of valid bytes in `buffer_`.
+    std::size_t end_{0};
+    /// The number of bytes in `buffer_` that have been indexed.
+    std::size_t indexed_{0};
+    /// All ones if the byte before `indexed_` is inside a string, otherwise zero.
+    std::uint64_t in_string_{0};
+    /// `1` if the byte at `indexed_` is escaped, otherwise `0`.
+    std::uint64_t escape_carry_{0};
+    /// The offsets in `buffer_` of the newlines outside strings.
+    std::vector<std::uint32_t> boundaries_;
+    /// The index in `boundaries_` of the end of the first unsplit record.
+    std::size_t next_boundary_{0};
+    /// The number of records split.
+    std::uint64_t records_{0};
+    /// Whether the end of the stream has been reached.
+    bool eof_{false};
+    /// Whether a read failed or a record did not fit in the buffer.
+    bool error_{false};
+};
+
+} /* namespace cio */
@@ -0,0 +1,307 @@
+//
+// SPDX-FileCopyrightText: 2024 Stephen F. Booth <contact@sbooth.dev>
+// SPDX-License-Identifier: MIT
+//
+// Part of https://github.com/sbooth/cio
+//
+
+#import <algorithm>
+#import <cstdio>
+#import <cstring>
+#import <utility>
+
+#import "buffer_pool.hpp"
+#import "cstream.hpp"
+#import "memory_governor.hpp"
+#import "stream_extensions.hpp"
+
+namespace cio {
+
+/// A stream that borrows its buffer from `cio::buffer_pool` only while it holds buffered data.
+///
+/// The underlying `cio::cstream` is made unbuffered and this class buffers on its behalf. A read buffer is returned
+/// to the pool as soon as it has been consumed and a write buffer as soon as it has been flushed, so an idle stream
+/// holds no buffer memory. Reads and writes at least as large as the buffer bypass it.
+///
+/// When `cio::memory_governor::shared()` is under pressure buffered output is flushed as soon as it is written, and
+/// when no buffer can be borrowed I/O goes directly to the underlying stream.
+class pooled_stream : public input_extensions<pooled_stream>, public output_extensions<pooled_stream> {
+  public:
+    /// Possible byte orders.
+    using byte_order = cstream::byte_order;
+
+    /// The default buffer size in bytes.
+    static constexpr std::size_t default_buffer_size = 64 * 1024;
+
+    // MARK: Standard Six
+
+    /// Initializes an empty `cio::pooled_stream` object.
+    pooled_stream() noexcept = default;
+
+    // This class is non-copyable.
+    pooled_stream(const pooled_stream &rhs) = delete;
+
+    // This class is non-assignable.
+    pooled_stream &operator=(const pooled_stream &rhs) = delete;
+
+    /// Initializes a `cio::pooled_stream` object with the stream and buffer from `rhs` and leaves `rhs` empty.
+    pooled_stream(pooled_stream &&rhs) noexcept
+        : stream_{std::move(rhs.stream_)}, buffer_{std::move(rhs.buffer_)}, buffer_size_{rhs.buffer_size_},
+          begin_{std::exchange(rhs.begin_, 0)}, end_{std::exchange(rhs.end_, 0)},
+          writing_{std::exchange(rhs.writing_, false)} {}
+
+    /// Flushes and closes the current stream and replaces it with the stream and buffer from `rhs`.
+    pooled_stream &operator=(pooled_stream &&rhs) noexcept {
+        if (this != &rhs) {
+            fflush();
+            stream_ = std::move(rhs.stream_);
+            buffer_ = std::move(rhs.buffer_);
+            buffer_size_ = rhs.buffer_size_;
+            begin_ = std::exchange(rhs.begin_, 0);
+            end_ = std::exchange(rhs.end_, 0);
+            writing_ = std::exchange(rhs.writing_, false);
+        }
+        return *this;
+    }
+
+    /// Flushes and closes the stream.
+    ~pooled_stream() noexcept { fflush(); }
+
+    // MARK: Construction
+
+    /// Initializes a `cio::pooled_stream` object buffering `stream`.
+    ///
+    /// `stream` must not have been read, written or repositioned, because `setvbuf(3)` may only be called before any
+    /// other operation on a stream.
+    /// - parameter stream: The stream, which is made unbuffered.
+    /// - parameter buffer_size: The size of the buffer borrowed from the pool.
+    explicit pooled_stream(cstream stream, std::size_t buffer_size = default_buffer_size) noexcept
+        : stream_{std::move(stream)}, buffer_size_{buffer_size > 0 ? buffer_size : 1} {
+        if (stream_) {
+            stream_.setvbuf(nullptr);
+        }
+    }
+
+    // MARK: Stream Handling
+
+    /// Returns `true` if the stream is valid.
+    [[nodiscard]]
+    explicit operator bool() const noexcept {
+        return static_cast<bool>(stream_);
+    }
+
+    /// Returns the underlying stream.
+    ///
+    /// The stream must not be read, written or repositioned while this object holds buffered data.
+    [[nodiscard]]
+    cstream &stream() noexcept {
+        return stream_;
+    }
+
+    /// Returns `true` if a buffer is currently borrowed.
+    [[nodiscard]]
+    bool holds_buffer() const noexcept {
+        return static_cast<bool>(buffer_);
+    }
+
+    /// Writes any buffered output and returns the buffer to the pool.
+    /// - returns: `0` on success, `EOF` otherwise.
+    int fflush() noexcept {
+        if (!writing_) {
+            return stream_ ? 0 : EOF;
+        }
+        auto result = 0;
+        if (begin_ < end_ && stream_.fwrite(buffer_.data() + begin_, 1, end_ - begin_) != end_ - begin_) {
+            result = EOF;
+        }
+        discard();
+        return result;
+    }
+
+    /// Returns any buffer to the pool, writing buffered output and moving the stream position back over unread input.
+    /// - returns: `0` on success, `EOF` otherwise.
+    int release_buffer() noexcept {
+        if (writing_) {
+            return fflush();
+        }
+        auto unread = end_ - begin_;
+        discard();
+        return unread > 0 && stream_.fseek(-static_cast<long>(unread), SEEK_CUR) != 0 ? EOF : 0;
+    }
+
+    // MARK: Direct Input/Output
+
+    using input_extensions<pooled_stream>::fread;
+    using output_extensions<pooled_stream>::fwrite;
+
+    /// Reads up to `count` objects of `size` bytes into `buffer`.
+    /// - returns: The number of complete objects read.
+    std::size_t fread(void *buffer, std::size_t size, std::size_t count) noexcept {
+        if (size == 0 || count == 0 || (writing_ && fflush() != 0)) {
+            return 0;
+        }
+        auto dst = static_cast<unsigned char *>(buffer);
+        auto wanted = size * count;
+        std::size_t total = 0;
+        while (total < wanted) {
+            if (begin_ == end_) {
+                auto remaining = wanted - total;
+                if (remaining >= buffer_size_ || !borrow()) {
+                    // Large reads, and reads without a buffer, go directly to the destination
+                    total += stream_.fread(dst + total, 1, remaining);
+                    break;
+                }
+                if (!fill()) {
+                    break;
+                }
+            }
+            auto n = std::min(wanted - total, end_ - begin_);
+            std::memcpy(dst + total, buffer_.data() + begin_, n);
+            begin_ += n;
+            total += n;
+            if (begin_ == end_) {
+                discard();
+            }
+        }
+        return total / size;
+    }
+
+    /// Writes `count` objects of `size` bytes from `buffer`.
+    /// - returns: The number of complete objects written.
+    std::size_t fwrite(const void *buffer, std::size_t size, std::size_t count) noexcept {
+        if (size == 0 || count == 0 || (!writing_ && release_buffer() != 0)) {
+            return 0;
+        }
+        auto src = static_cast<const unsigned char *>(buffer);
+        auto length = size * count;
+        if (end_ + length > buffer_size_) {
+            if (fflush() != 0) {
+                return 0;
+            }
+            if (length >= buffer_size_) {
+                // Large writes go directly to the stream
+                return stream_.fwrite(src, size, count);
+            }
+        }
+        if (!buffer_) {
+            if (!borrow()) {
+                return stream_.fwrite(src, size, count);
+            }
+            writing_ = true;
+        }
+        std::memcpy(buffer_.data() + end_, src, length);
+        end_ += length;
+        // Give the buffer back early when memory is short
+        if (memory_governor::shared().under_pressure() && fflush() != 0) {
+            return 0;
+        }
+        return count;
+    }
+
+    // MARK: Unformatted Input/Output
+
+    /// Returns the next byte as an `unsigned char` converted to `int`, or `EOF`.
+    [[nodiscard]]
+    int fgetc() noexcept {
+        unsigned char ch;
+        return fread(&ch, 1, 1) == 1 ? ch : EOF;
+    }
+
+    /// Writes `ch` converted to `unsigned char`.
+    /// - returns: The byte written, or `EOF` on failure.
+    int fputc(int ch) noexcept {
+        auto c = static_cast<unsigned char>(ch);
+        return fwrite(&c, 1, 1) == 1 ? c : EOF;
+    }
+
+    // MARK: File Positioning
+
+    /// Returns the current position, accounting for buffered data.
+    [[nodiscard]]
+    long ftell() const noexcept {
+        auto position = stream_.ftell();
+        if (position == -1) {
+            return -1;
+        }
+        return writing_ ? position + static_cast<long>(end_) : position - static_cast<long>(end_ - begin_);
+    }
+
+    /// Writes any buffered output, discards buffered input and sets the position of the underlying stream.
+    /// - returns: `0` on success, nonzero otherwise.
+    int fseek(long offset, int origin) noexcept {
+        if (origin == SEEK_CUR && !writing_) {
+            offset -= static_cast<long>(end_ - begin_);
+        }
+        if (fflush() != 0) {
+            return -1;
+        }
+        discard();
+        return stream_.fseek(offset, origin);
+    }
+
+    /// Sets the position to the beginning of the stream and clears the error indicators.
+    void rewind() noexcept {
+        fseek(0, SEEK_SET);
+        stream_.clearerr();
+    }
+
+    // MARK: Error Handling
+
+    /// Returns nonzero if the underlying stream has reached end of file and no buffered input remains.
+    [[nodiscard]]
+    int feof() const noexcept {
+        return begin_ == end_ ? stream_.feof() : 0;
+    }
+
+    /// Returns nonzero if an error has occurred on the underlying stream.
+    [[nodiscard]]
+    int ferror() const noexcept {
+        return stream_.ferror();
+    }
+
+    /// Clears the end-of-file and error indicators.
+    void clearerr() noexcept { stream_.clearerr(); }
+
+  private:
+    /// Borrows a buffer from the pool if none is held.
+    /// - returns: `true` if a buffer is held.
+    bool borrow() noexcept {
+        if (!buffer_) {
+            buffer_ = buffer_pool::shared().acquire(buffer_size_);
+        }
+        return static_cast<bool>(buffer_);
+    }
+
+    /// Reads into the borrowed buffer.
+    bool fill() noexcept {
+        begin_ = 0;
+        end_ = stream_.fread(buffer_.data(), 1, buffer_size_);
+        if (end_ == 0) {
+            discard();
+            return false;
+        }
+        return true;
+    }
+
+    /// Returns the buffer to the pool without writing it.
+    void discard() noexcept {
+        buffer_.reset();
+        begin_ = end_ = 0;
+        writing_ = false;
+    }
+
+    /// The underlying unbuffered stream.
+    cstream stream_;
+    /// The borrowed buffer, if any.
+    pooled_buffer buffer_;
+    /// The size of the buffer to borrow in bytes.
+    std::size_t buffer_size_{default_buffer_size};
+    /// The offset of the next unread byte in `buffer_`.
+    std::size_t begin_{0};
+    /// The number of valid bytes in `buffer_`.
+    std::size_t end_{0};
+    /// Whether `buffer_` holds output.
+    bool writing_{false};
+};
+
+} /* namespace cio */
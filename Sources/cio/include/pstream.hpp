@@ -0,0 +1,92 @@
+//
+// SPDX-FileCopyrightText: 2024 Stephen F. Booth <contact@sbooth.dev>
+// SPDX-License-Identifier: MIT
+//
+// Part of https://github.com/sbooth/cio
+//
+
+#import <cstdio>
+#import <utility>
+
+#import "cstream.hpp"
+
+namespace cio {
+
+/// A class managing a pipe stream to or from a process opened with `popen(3)`.
+///
+/// The stream is available through `stream()` with the full `cio::cstream` API and is closed with `pclose(3)`.
+class pstream {
+  public:
+    // MARK: Standard Six
+
+    /// Initializes an empty `cio::pstream` object.
+    pstream() noexcept = default;
+
+    // This class is non-copyable.
+    pstream(const pstream &rhs) = delete;
+
+    // This class is non-assignable.
+    pstream &operator=(const pstream &rhs) = delete;
+
+    /// Initializes a `cio::pstream` object with the process stream from `rhs` and leaves `rhs` empty.
+    pstream(pstream &&rhs) noexcept = default;
+
+    /// Closes the process stream and replaces it with the process stream from `rhs`, then leaves `rhs` empty.
+    pstream &operator=(pstream &&rhs) noexcept {
+        if (this != &rhs) {
+            pclose();
+            stream_ = std::move(rhs.stream_);
+        }
+        return *this;
+    }
+
+    /// Closes the process stream and waits for the process to exit.
+    ~pstream() noexcept { pclose(); }
+
+    // MARK: Construction
+
+    /// Initializes a `cio::pstream` object with the result of `popen(command, mode)`.
+    /// - parameter command: The shell command to run.
+    /// - parameter mode: `"r"` to read the command's standard output or `"w"` to write its standard input.
+    /// - parameter capacity: The pipe capacity in bytes to request with `F_SETPIPE_SZ`, or `0` for the default.
+    /// - seealso: [popen(3)](https://man7.org/linux/man-pages/man3/popen.3.html)
+    pstream(const char *command, const char *mode, std::size_t capacity = 0) noexcept
+        : stream_{::popen(command, mode)} {
+        if (stream_ && capacity > 0) {
+            // The default capacity still works so failure is not an error
+            stream_.set_pipe_capacity(capacity);
+        }
+    }
+
+    // MARK: Process Stream Handling
+
+    /// Returns `true` if the process was started.
+    [[nodiscard]]
+    explicit operator bool() const noexcept {
+        return static_cast<bool>(stream_);
+    }
+
+    /// Returns the pipe stream.
+    ///
+    /// The stream must not be closed or reset through the returned reference.
+    [[nodiscard]]
+    cstream &stream() noexcept {
+        return stream_;
+    }
+
+    /// Closes the pipe stream and waits for the process to exit.
+    /// - returns: The process's wait status, or `-1` on failure.
+    /// - seealso: [pclose(3)](https://man7.org/linux/man-pages/man3/pclose.3.html)
+    int pclose() noexcept {
+        if (auto stream = stream_.release(); stream) {
+            return ::pclose(stream);
+        }
+        return -1;
+    }
+
+  private:
+    /// The pipe stream.
+    cstream stream_;
+};
+
+} /* namespace cio */
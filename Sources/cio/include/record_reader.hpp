@@ -0,0 +1,227 @@
+//
+// SPDX-FileCopyrightText: 2024 Stephen F. Booth <contact@sbooth.dev>
+// SPDX-License-Identifier: MIT
+//
+// Part of https://github.com/sbooth/cio
+//
+
+#import <algorithm>
+#import <cstddef>
+#import <cstring>
+#import <tuple>
+#import <type_traits>
+#import <utility>
+#import <vector>
+
+#import "cstream.hpp"
+#import "memory_governor.hpp"
+#import "simd.hpp"
+
+namespace cio {
+
+/// A field of a fixed-size binary record.
+///
+/// - parameter T: The type of the field, which must be trivially copyable and 1, 2, 4 or 8 bytes in size.
+/// - parameter Order: The byte order of the field in the record.
+template <typename T, cstream::byte_order Order = cstream::byte_order::host> struct field {
+    static_assert(std::is_trivially_copyable_v<T>, "Record fields must be trivially copyable");
+    static_assert(sizeof(T) == 1 || sizeof(T) == 2 || sizeof(T) == 4 || sizeof(T) == 8,
+                  "Record fields must be 1, 2, 4 or 8 bytes");
+
+    /// The type of the field.
+    using type = T;
+    /// The byte order of the field in the record.
+    static constexpr cstream::byte_order order = Order;
+};
+
+/// A reader that bulk-reads packed fixed-size records and transposes them into one column buffer per field.
+///
+/// Records are read in batches into a reusable staging buffer and each field is gathered directly into its column, so
+/// no array of structs is ever materialized. Byte swapping happens on the contiguous column with the vector kernels in
+/// `simd.hpp`. The staging buffer is reserved from `cio::memory_governor::shared()`, and under memory pressure records
+/// are read in smaller batches.
+///
+/// ```
+/// cio::record_reader<cio::field<std::uint32_t, cio::cstream::byte_order::big_endian>, cio::field<float>> reader;
+/// std::vector<std::uint32_t> ids(n);
+/// std::vector<float> values(n);
+/// auto count = reader.read(stream, n, ids.data(), values.data());
+/// ```
+template <typename... Fields> class record_reader {
+    static_assert(sizeof...(Fields) > 0, "A record must have at least one field");
+
+  public:
+    /// The size of a packed record in bytes.
+    static constexpr std::size_t record_size = (sizeof(typename Fields::type) + ...);
+
+    /// The number of fields in a record.
+    static constexpr std::size_t field_count = sizeof...(Fields);
+
+    /// The default number of records read per batch.
+    static constexpr std::size_t default_batch_size = std::max<std::size_t>(64 * 1024 / record_size, 1);
+
+    /// Initializes a `cio::record_reader` object.
+    /// - parameter batch_size: The number of records read from the stream at a time.
+    explicit record_reader(std::size_t batch_size = default_batch_size) noexcept
+        : batch_size_{std::max<std::size_t>(batch_size, 1)} {}
+
+    /// Reads up to `count` records from `stream` and stores field `i` of record `j` in `columns[i][j]`.
+    ///
+    /// Fields are converted to host byte order. `Stream` may be `cio::cstream` or any class with a compatible `fread`.
+    /// - parameter stream: The stream to read.
+    /// - parameter count: The maximum number of records to read.
+    /// - parameter columns: One buffer per field, each with room for `count` values.
+    /// - returns: The number of complete records read, which is `0` if the budget cannot cover one record.
+    /// - throws: Any exception thrown by `Allocator::allocate()` (typically `std::bad_alloc`)
+    template <typename Stream>
+    std::size_t read(Stream &stream, std::size_t count, typename Fields::type *...columns) {
+        auto batch = std::min(count, batch_size_);
+        if (batch * record_size > staging_.size()) {
+            // Under memory pressure keep the current buffer or read in smaller batches
+            auto size = reservation_.resize_up_to(batch * record_size, std::max(staging_.size(), record_size));
+            if (size == 0) {
+                return 0;
+            }
+            staging_.resize(size / record_size * record_size);
+        }
+        batch = std::min(batch, staging_.size() / record_size);
+        std::size_t total = 0;
+        while (total < count) {
+            auto wanted = std::min(count - total, batch);
+            auto n = stream.fread(staging_.data(), record_size, wanted);
+            if (n == 0) {
+                break;
+            }
+            scatter(staging_.data(), n, std::make_tuple((columns + total)...),
+                    std::index_sequence_for<Fields...>{});
+            total += n;
+            if (n < wanted) {
+                break;
+            }
+        }
+        return total;
+    }
+
+    /// Reads up to `count` records from `stream` and appends their fields to `columns`.
+    ///
+    /// Each field is appended at the end of its own column, so columns need not have the same length.
+    /// - parameter stream: The stream to read.
+    /// - parameter count: The maximum number of records to read.
+    /// - parameter columns: One vector per field.
+    /// - returns: The number of complete records read.
+    /// - throws: Any exception thrown by `Allocator::allocate()` (typically `std::bad_alloc`)
+    template <typename Stream>
+    std::size_t read(Stream &stream, std::size_t count, std::vector<typename Fields::type> &...columns) {
+        (columns.resize(columns.size() + count), ...);
+        auto n = read(stream, count, (columns.data() + columns.size() - count)...);
+        (columns.resize(columns.size() - (count - n)), ...);
+        return n;
+    }
+
+  private:
+    /// The offset of field `I` in a packed record.
+    template <std::size_t I> static constexpr std::size_t field_offset() noexcept {
+        constexpr std::size_t sizes[] = {sizeof(typename Fields::type)...};
+        std::size_t offset = 0;
+        for (std::size_t i = 0; i < I; ++i) {
+            offset += sizes[i];
+        }
+        return offset;
+    }
+
+    /// Whether every field is four bytes wide, enabling the vector transpose kernels.
+    static constexpr bool uniform_32 = ((sizeof(typename Fields::type) == 4) && ...);
+
+    /// Transposes `count` packed records at `src` into the column buffers in `columns`.
+    template <typename Columns, std::size_t... I>
+    static void scatter(const unsigned char *src, std::size_t count, Columns columns,
+                        std::index_sequence<I...>) noexcept {
+        std::size_t done = 0;
+        if constexpr (uniform_32) {
+            done = transpose_32(src, count, static_cast<void *>(std::get<I>(columns))...);
+        }
+        (gather<I>(src, done, count, std::get<I>(columns)), ...);
+        (swap_to_host<sizeof(typename Fields::type)>(std::get<I>(columns), count, Fields::order), ...);
+    }
+
+    /// Copies field `I` of records `begin` through `end - 1` at `src` into `dst`.
+    template <std::size_t I, typename T>
+    static void gather(const unsigned char *src, std::size_t begin, std::size_t end, T *dst) noexcept {
+        constexpr auto offset = field_offset<I>();
+        auto out = reinterpret_cast<unsigned char *>(dst);
+        for (auto j = begin; j < end; ++j) {
+            std::memcpy(out + j * sizeof(T), src + j * record_size + offset, sizeof(T));
+        }
+    }
+
+    /// Transposes records of two, three or four 32-bit fields with vector instructions.
+    /// - returns: The number of records transposed; the remainder is left for `gather()`.
+    template <typename... Dst>
+    static std::size_t transpose_32([[maybe_unused]] const unsigned char *src, [[maybe_unused]] std::size_t count,
+                                    [[maybe_unused]] Dst... dst) noexcept {
+        [[maybe_unused]] unsigned char *out[] = {static_cast<unsigned char *>(dst)...};
+        std::size_t j = 0;
+#if defined(__ARM_NEON)
+        auto in = reinterpret_cast<const std::uint32_t *>(src);
+        if constexpr (field_count == 2) {
+            for (; j + 4 <= count; j += 4) {
+                auto v = vld2q_u32(in + j * 2);
+                vst1q_u32(reinterpret_cast<std::uint32_t *>(out[0]) + j, v.val[0]);
+                vst1q_u32(reinterpret_cast<std::uint32_t *>(out[1]) + j, v.val[1]);
+            }
+        } else if constexpr (field_count == 3) {
+            for (; j + 4 <= count; j += 4) {
+                auto v = vld3q_u32(in + j * 3);
+                vst1q_u32(reinterpret_cast<std::uint32_t *>(out[0]) + j, v.val[0]);
+                vst1q_u32(reinterpret_cast<std::uint32_t *>(out[1]) + j, v.val[1]);
+                vst1q_u32(reinterpret_cast<std::uint32_t *>(out[2]) + j, v.val[2]);
+            }
+        } else if constexpr (field_count == 4) {
+            for (; j + 4 <= count; j += 4) {
+                auto v = vld4q_u32(in + j * 4);
+                vst1q_u32(reinterpret_cast<std::uint32_t *>(out[0]) + j, v.val[0]);
+                vst1q_u32(reinterpret_cast<std::uint32_t *>(out[1]) + j, v.val[1]);
+                vst1q_u32(reinterpret_cast<std::uint32_t *>(out[2]) + j, v.val[2]);
+                vst1q_u32(reinterpret_cast<std::uint32_t *>(out[3]) + j, v.val[3]);
+            }
+        }
+#elif defined(__SSE2__)
+        if constexpr (field_count == 2) {
+            for (; j + 4 <= count; j += 4) {
+                // a0 b0 a1 b1 | a2 b2 a3 b3 -> a0 a1 a2 a3 | b0 b1 b2 b3
+                auto r0 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + j * 8));
+                auto r1 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + j * 8 + 16));
+                auto s0 = _mm_shuffle_epi32(r0, _MM_SHUFFLE(3, 1, 2, 0));
+                auto s1 = _mm_shuffle_epi32(r1, _MM_SHUFFLE(3, 1, 2, 0));
+                _mm_storeu_si128(reinterpret_cast<__m128i *>(out[0] + j * 4), _mm_unpacklo_epi64(s0, s1));
+                _mm_storeu_si128(reinterpret_cast<__m128i *>(out[1] + j * 4), _mm_unpackhi_epi64(s0, s1));
+            }
+        } else if constexpr (field_count == 4) {
+            for (; j + 4 <= count; j += 4) {
+                auto r0 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + j * 16));
+                auto r1 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + j * 16 + 16));
+                auto r2 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + j * 16 + 32));
+                auto r3 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + j * 16 + 48));
+                auto t0 = _mm_unpacklo_epi32(r0, r1);
+                auto t1 = _mm_unpacklo_epi32(r2, r3);
+                auto t2 = _mm_unpackhi_epi32(r0, r1);
+                auto t3 = _mm_unpackhi_epi32(r2, r3);
+                _mm_storeu_si128(reinterpret_cast<__m128i *>(out[0] + j * 4), _mm_unpacklo_epi64(t0, t1));
+                _mm_storeu_si128(reinterpret_cast<__m128i *>(out[1] + j * 4), _mm_unpackhi_epi64(t0, t1));
+                _mm_storeu_si128(reinterpret_cast<__m128i *>(out[2] + j * 4), _mm_unpacklo_epi64(t2, t3));
+                _mm_storeu_si128(reinterpret_cast<__m128i *>(out[3] + j * 4), _mm_unpackhi_epi64(t2, t3));
+            }
+        }
+#endif
+        return j;
+    }
+
+    /// The number of records read from the stream at a time.
+    std::size_t batch_size_{default_batch_size};
+    /// The staging buffer for packed records.
+    std::vector<unsigned char> staging_;
+    /// The memory reserved from the governor for `staging_`.
+    memory_reservation reservation_;
+};
+
+} /* namespace cio */
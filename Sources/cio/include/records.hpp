@@ -0,0 +1,171 @@
+//
+// SPDX-FileCopyrightText: 2024 Stephen F. Booth <contact@sbooth.dev>
+// SPDX-License-Identifier: MIT
+//
+// Part of https://github.com/sbooth/cio
+//
+
+#import <cstddef>
+#import <iterator>
+#import <type_traits>
+#import <vector>
+
+#if __has_include(<ranges>)
+#import <ranges>
+#endif
+
+#import "cstream.hpp"
+#import "simd.hpp"
+
+namespace cio {
+
+/// The sentinel marking the end of a `cio::record_range`.
+struct record_sentinel {};
+
+/// An input range of fixed-size values read from a stream in batches.
+///
+/// Values are read `batch_size` at a time with a single `fread` and converted to host byte order with the vector
+/// kernels in `simd.hpp`, so iteration costs no per-element calls into the stream. In C++20 the range is a view and
+/// composes with the adaptors in `std::views`.
+///
+/// - parameter T: The value type, which must be trivially copyable and 1, 2, 4 or 8 bytes in size.
+/// - parameter Stream: `cio::cstream` or any class with a compatible `fread`.
+template <typename T, typename Stream = cstream>
+class record_range
+#if defined(__cpp_lib_ranges)
+        : public std::ranges::view_base
+#endif
+{
+    static_assert(std::is_trivially_copyable_v<T>, "Record values must be trivially copyable");
+    static_assert(sizeof(T) == 1 || sizeof(T) == 2 || sizeof(T) == 4 || sizeof(T) == 8,
+                  "Record values must be 1, 2, 4 or 8 bytes");
+
+  public:
+    /// The default number of values read per batch.
+    static constexpr std::size_t default_batch_size = 64 * 1024 / sizeof(T);
+
+    /// An input iterator over the values of a `cio::record_range`.
+    class iterator {
+      public:
+        using iterator_category = std::input_iterator_tag;
+        using value_type = T;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const T *;
+        using reference = const T &;
+
+        /// Initializes a singular iterator.
+        iterator() noexcept = default;
+
+        /// Returns the current value.
+        reference operator*() const noexcept { return range_->buffer_[range_->index_]; }
+
+        /// Returns a pointer to the current value.
+        pointer operator->() const noexcept { return &range_->buffer_[range_->index_]; }
+
+        /// Advances to the next value, reading a new batch when the current one is exhausted.
+        iterator &operator++() noexcept {
+            range_->advance();
+            return *this;
+        }
+
+        /// Advances to the next value.
+        void operator++(int) noexcept { ++*this; }
+
+        /// Returns `true` if `i` has reached the end of its range.
+        friend bool operator==(const iterator &i, record_sentinel) noexcept { return i.at_end(); }
+
+        /// Returns `true` if `i` has not reached the end of its range.
+        friend bool operator!=(const iterator &i, record_sentinel s) noexcept { return !(i == s); }
+
+#if !defined(__cpp_impl_three_way_comparison)
+        /// Returns `true` if `i` has reached the end of its range.
+        friend bool operator==(record_sentinel s, const iterator &i) noexcept { return i == s; }
+
+        /// Returns `true` if `i` has not reached the end of its range.
+        friend bool operator!=(record_sentinel s, const iterator &i) noexcept { return !(i == s); }
+#endif
+
+      private:
+        friend class record_range;
+
+        /// Initializes an iterator over `range`.
+        explicit iterator(record_range *range) noexcept : range_{range} {}
+
+        /// Returns `true` if the range has been exhausted.
+        bool at_end() const noexcept { return range_->at_end(); }
+
+        /// The range.
+        record_range *range_{nullptr};
+    };
+
+    /// Initializes a `cio::record_range` object reading from `stream`.
+    /// - parameter stream: The stream to read.
+    /// - parameter order: The byte order of the values in the stream.
+    /// - parameter batch_size: The number of values read at a time.
+    record_range(Stream &stream, cstream::byte_order order, std::size_t batch_size = default_batch_size) noexcept
+        : stream_{&stream}, order_{order}, batch_size_{batch_size > 0 ? batch_size : 1} {}
+
+    /// Returns an iterator to the first unread value, reading the first batch if needed.
+    ///
+    /// As with any input range, `begin()` should be called once; values consumed by one iterator are not seen again.
+    /// - throws: Any exception thrown by `Allocator::allocate()` (typically `std::bad_alloc`)
+    iterator begin() {
+        if (buffer_.empty()) {
+            buffer_.resize(batch_size_);
+            fill();
+        }
+        return iterator{this};
+    }
+
+    /// Returns the end sentinel.
+    record_sentinel end() const noexcept { return {}; }
+
+  private:
+    /// Returns `true` if all values have been consumed.
+    bool at_end() const noexcept { return index_ == count_; }
+
+    /// Moves to the next value.
+    void advance() noexcept {
+        if (++index_ == count_) {
+            fill();
+        }
+    }
+
+    /// Reads the next batch.
+    void fill() noexcept {
+        index_ = 0;
+        count_ = stream_->fread(static_cast<void *>(buffer_.data()), sizeof(T), buffer_.size());
+        swap_to_host<sizeof(T)>(buffer_.data(), count_, order_);
+    }
+
+    /// The stream.
+    Stream *stream_;
+    /// The byte order of the values in the stream.
+    cstream::byte_order order_;
+    /// The number of values read at a time.
+    std::size_t batch_size_;
+    /// The current batch.
+    std::vector<T> buffer_;
+    /// The index of the current value in `buffer_`.
+    std::size_t index_{0};
+    /// The number of values in `buffer_`.
+    std::size_t count_{0};
+};
+
+/// Returns an input range over the values of type `T` in `stream`.
+///
+/// ```
+/// for (auto v : cio::records<std::uint32_t>(stream, cio::cstream::byte_order::big_endian)) {
+///     ...
+/// }
+/// ```
+/// - parameter stream: The stream to read.
+/// - parameter order: The byte order of the values in the stream.
+/// - parameter batch_size: The number of values read at a time.
+template <typename T, typename Stream>
+record_range<T, Stream> records(Stream &stream, cstream::byte_order order = cstream::byte_order::host,
+                                std::size_t batch_size = record_range<T, Stream>::default_batch_size) noexcept {
+    return {stream, order, batch_size};
+}
+
+} /* namespace cio */
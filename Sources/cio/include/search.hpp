@@ -0,0 +1,355 @@
+//
+// SPDX-FileCopyrightText: 2024 Stephen F. Booth <contact@sbooth.dev>
+// SPDX-License-Identifier: MIT
+//
+// Part of https://github.com/sbooth/cio
+//
+
+#import <algorithm>
+#import <array>
+#import <cstdint>
+#import <cstring>
+#import <optional>
+#import <string>
+#import <string_view>
+#import <vector>
+
+#import "cstream.hpp"
+#import "memory_governor.hpp"
+#import "simd.hpp"
+
+namespace cio {
+
+/// The default size in bytes of the blocks read by `cio::find()` and `cio::pattern_matcher`.
+inline constexpr std::size_t default_search_block_size = 1024 * 1024;
+
+/// The smallest size in bytes of the blocks read by `cio::find()` and `cio::pattern_matcher` under memory pressure.
+inline constexpr std::size_t min_search_block_size = 16 * 1024;
+
+namespace detail {
+
+/// Returns the offset of the first occurrence of `needle` in `size` bytes at `p`, or `std::string_view::npos`.
+///
+/// Candidates are found 64 positions at a time by comparing the first and last bytes of the needle with the bytes at
+/// each position, and only positions matching both are compared in full.
+inline std::size_t search(const unsigned char *p, std::size_t size, std::string_view needle) noexcept {
+    auto n = needle.size();
+    if (n == 0) {
+        return 0;
+    }
+    if (n > size) {
+        return std::string_view::npos;
+    }
+    auto first = static_cast<unsigned char>(needle.front());
+    auto last = static_cast<unsigned char>(needle.back());
+    std::size_t i = 0;
+    for (; i + byte_block::size + n - 1 <= size; i += byte_block::size) {
+        auto mask = byte_block{p + i}.eq(first) & byte_block{p + i + n - 1}.eq(last);
+        while (mask != 0) {
+            auto j = i + static_cast<std::size_t>(__builtin_ctzll(mask));
+            if (n <= 2 || std::memcmp(p + j + 1, needle.data() + 1, n - 2) == 0) {
+                return j;
+            }
+            mask &= mask - 1;
+        }
+    }
+    for (; i + n <= size; ++i) {
+        if (p[i] == first && p[i + n - 1] == last &&
+            (n <= 2 || std::memcmp(p + i + 1, needle.data() + 1, n - 2) == 0)) {
+            return i;
+        }
+    }
+    return std::string_view::npos;
+}
+
+/// Returns the position of `stream`, or `0` if it has none.
+inline std::uint64_t search_base(cstream &stream) noexcept {
+    auto offset = stream.ftell();
+    return offset < 0 ? 0 : static_cast<std::uint64_t>(offset);
+}
+
+} /* namespace detail */
+
+/// Finds the first occurrence of `needle` in `stream` at or after the current position.
+///
+/// The stream is read in large blocks and the last `needle.size() - 1` bytes of each block are carried into the next,
+/// so occurrences spanning a block boundary are found. On success a seekable stream is positioned just past the
+/// occurrence, so repeated calls find successive non-overlapping occurrences; otherwise the stream position is
+/// unspecified.
+///
+/// The buffer is reserved from `cio::memory_governor::shared()`, and under memory pressure smaller blocks are read.
+/// - parameter stream: The stream to search.
+/// - parameter needle: The bytes to find.
+/// - parameter block_size: The number of bytes to read at a time.
+/// - returns: The offset of the occurrence in the stream, or `std::nullopt` if `needle` was not found, a read failed or
+/// the budget cannot cover a block holding `needle`.
+/// Offsets are counted from the start of the stream, or from the position at the call for a stream that has none.
+/// - throws: Any exception thrown by `Allocator::allocate()` (typically `std::bad_alloc`)
+inline std::optional<std::uint64_t> find(cstream &stream, std::string_view needle,
+                                         std::size_t block_size = default_search_block_size) {
+    auto seekable = stream.ftell() >= 0;
+    auto base = detail::search_base(stream);
+    if (needle.empty()) {
+        return base;
+    }
+    auto overlap = needle.size() - 1;
+    auto minimum = std::max(std::min(block_size, min_search_block_size), needle.size()) + overlap;
+    memory_reservation reservation;
+    auto size = reservation.resize_up_to(std::max(block_size, needle.size()) + overlap, minimum);
+    if (size == 0) {
+        return std::nullopt;
+    }
+    std::vector<unsigned char> buffer(size);
+    std::size_t kept = 0;
+    for (;;) {
+        auto n = stream.fread(buffer.data() + kept, 1, buffer.size() - kept);
+        if (n == 0) {
+            return std::nullopt;
+        }
+        auto size = kept + n;
+        if (auto i = detail::search(buffer.data(), size, needle); i != std::string_view::npos) {
+            auto offset = base + i;
+            if (seekable) {
+                stream.fseek(static_cast<long>(offset + needle.size()), SEEK_SET);
+            }
+            return offset;
+        }
+        kept = std::min(overlap, size);
+        std::memmove(buffer.data(), buffer.data() + size - kept, kept);
+        base += size - kept;
+    }
+}
+
+/// A matcher finding every occurrence of a set of patterns in a single pass with the Aho-Corasick algorithm.
+///
+/// The patterns are compiled into a deterministic automaton with a dense transition table, so each byte costs one
+/// table lookup. Bytes that appear in no pattern share a single column of the table, which keeps it small enough to
+/// stay in cache for typical pattern sets. While no pattern is partially matched the scanner skips ahead, 64 bytes at a
+/// time, to the next byte that begins a pattern, which makes scanning data with few candidates nearly as fast as
+/// reading it. The automaton state carries across blocks, so matches spanning a block boundary are found without
+/// rescanning.
+///
+/// The table takes four bytes per state for each distinct byte in the patterns, plus one, and the number of states is
+/// at most one more than the total length of the patterns.
+class pattern_matcher {
+  public:
+    /// A match.
+    struct match {
+        /// The offset of the first byte of the match.
+        std::uint64_t offset;
+        /// The index of the pattern matched.
+        std::size_t pattern;
+    };
+
+    /// The largest number of distinct first bytes for which the scanner skips ahead.
+    static constexpr std::size_t max_skip_bytes = 4;
+
+    // This class is non-copyable.
+    pattern_matcher(const pattern_matcher &rhs) = delete;
+
+    // This class is non-assignable.
+    pattern_matcher &operator=(const pattern_matcher &rhs) = delete;
+
+    /// Initializes a `cio::pattern_matcher` object for `patterns`.
+    ///
+    /// Empty patterns never match. When patterns are repeated, matches are reported for the first.
+    /// - parameter patterns: The patterns to find.
+    /// - throws: Any exception thrown by `Allocator::allocate()` (typically `std::bad_alloc`)
+    explicit pattern_matcher(const std::vector<std::string> &patterns) {
+        for (const auto &pattern : patterns) {
+            for (auto c : pattern) {
+                auto &column = columns_[static_cast<unsigned char>(c)];
+                if (column == 0) {
+                    column = stride_++;
+                }
+            }
+        }
+        add_state();
+        lengths_.reserve(patterns.size());
+        for (std::size_t i = 0; i < patterns.size(); ++i) {
+            lengths_.push_back(patterns[i].size());
+            if (patterns[i].empty()) {
+                continue;
+            }
+            std::uint32_t state = 0;
+            for (auto c : patterns[i]) {
+                auto index = state * stride_ + columns_[static_cast<unsigned char>(c)];
+                if (delta_[index] == 0) {
+                    auto next = add_state();
+                    delta_[index] = next;
+                }
+                state = delta_[index];
+            }
+            if (output_[state] == no_pattern) {
+                output_[state] = i;
+            }
+        }
+
+        for (unsigned c = 0; c < 256; ++c) {
+            if (delta_[columns_[c]] != 0) {
+                skip_bytes_.push_back(static_cast<unsigned char>(c));
+            }
+        }
+        if (skip_bytes_.size() > max_skip_bytes) {
+            skip_bytes_.clear();
+        }
+
+        // Breadth-first, fill in failure transitions and the nearest state with output along each failure chain
+        std::vector<std::uint32_t> queue;
+        queue.reserve(output_.size());
+        for (std::uint32_t c = 0; c < stride_; ++c) {
+            if (auto next = delta_[c]; next != 0) {
+                queue.push_back(next);
+            }
+        }
+        for (std::size_t head = 0; head < queue.size(); ++head) {
+            auto state = queue[head];
+            report_[state] = output_[state] != no_pattern ? state : report_[failure_[state]];
+            for (std::uint32_t c = 0; c < stride_; ++c) {
+                auto &next = delta_[state * stride_ + c];
+                auto fallback = delta_[failure_[state] * stride_ + c];
+                if (next == 0) {
+                    next = fallback;
+                } else {
+                    failure_[next] = fallback;
+                    queue.push_back(next);
+                }
+            }
+        }
+    }
+
+    /// Returns the number of patterns.
+    [[nodiscard]]
+    std::size_t pattern_count() const noexcept {
+        return lengths_.size();
+    }
+
+    /// Returns the number of states in the automaton.
+    [[nodiscard]]
+    std::size_t state_count() const noexcept {
+        return output_.size();
+    }
+
+    // MARK: Scanning
+
+    /// Reports every match in `stream` from the current position to the end.
+    ///
+    /// Matches are reported in order of their last byte; matches ending at the same byte are reported longest first.
+    /// The buffer is reserved from `cio::memory_governor::shared()`, and under memory pressure smaller blocks are read.
+    /// - parameter stream: The stream to scan.
+    /// - parameter callback: A function called as `callback(const match &)` for each match, returning `false` to stop.
+    /// - parameter block_size: The number of bytes to read at a time.
+    /// - returns: `false` if a read failed or the budget cannot cover the smallest block.
+    /// Offsets are counted from the start of the stream, or from the position at the call for a stream that has none.
+    /// - throws: Any exception thrown by `Allocator::allocate()` (typically `std::bad_alloc`)
+    template <typename Callback>
+    bool scan(cstream &stream, Callback &&callback, std::size_t block_size = default_search_block_size) {
+        auto base = detail::search_base(stream);
+        memory_reservation reservation;
+        auto size = reservation.resize_up_to(std::max<std::size_t>(block_size, 1),
+                                             std::clamp<std::size_t>(block_size, 1, min_search_block_size));
+        if (size == 0) {
+            return false;
+        }
+        std::vector<unsigned char> buffer(size);
+        std::uint32_t state = 0;
+        for (;;) {
+            auto n = stream.fread(buffer.data(), 1, buffer.size());
+            if (n == 0) {
+                return !stream.ferror();
+            }
+            if (!scan_block(buffer.data(), n, base, state, callback)) {
+                return true;
+            }
+            base += n;
+        }
+    }
+
+    /// Reports every match in `size` bytes at `data`.
+    /// - parameter data: The bytes to scan.
+    /// - parameter size: The number of bytes.
+    /// - parameter callback: A function called as `callback(const match &)` for each match, returning `false` to stop.
+    template <typename Callback> void scan(const void *data, std::size_t size, Callback &&callback) const {
+        std::uint32_t state = 0;
+        scan_block(static_cast<const unsigned char *>(data), size, 0, state, callback);
+    }
+
+  private:
+    /// The value of `output_` for a state that completes no pattern.
+    static constexpr std::size_t no_pattern = ~std::size_t{0};
+
+    /// Adds a state and returns its index.
+    std::uint32_t add_state() {
+        auto state = static_cast<std::uint32_t>(output_.size());
+        delta_.resize(delta_.size() + stride_, 0);
+        output_.push_back(no_pattern);
+        failure_.push_back(0);
+        report_.push_back(0);
+        return state;
+    }
+
+    /// Returns the offset of the first byte in `[i, size)` that begins a pattern, or `size`.
+    std::size_t skip(const unsigned char *p, std::size_t i, std::size_t size) const noexcept {
+        for (; i + byte_block::size <= size; i += byte_block::size) {
+            byte_block block{p + i};
+            std::uint64_t mask = 0;
+            for (auto c : skip_bytes_) {
+                mask |= block.eq(c);
+            }
+            if (mask != 0) {
+                return i + static_cast<std::size_t>(__builtin_ctzll(mask));
+            }
+        }
+        while (i < size && delta_[columns_[p[i]]] == 0) {
+            ++i;
+        }
+        return i;
+    }
+
+    /// Advances the automaton over `size` bytes at `p`, reporting matches.
+    /// - returns: `false` if `callback` stopped the scan.
+    template <typename Callback>
+    bool scan_block(const unsigned char *p, std::size_t size, std::uint64_t base, std::uint32_t &state,
+                    Callback &callback) const {
+        auto delta = delta_.data();
+        auto columns = columns_.data();
+        auto stride = stride_;
+        auto skipping = !skip_bytes_.empty();
+        auto report = report_.data();
+        for (std::size_t i = 0; i < size; ++i) {
+            if (skipping && state == 0) {
+                i = skip(p, i, size);
+                if (i == size) {
+                    break;
+                }
+            }
+            state = delta[state * stride + columns[p[i]]];
+            for (auto s = report[state]; s != 0; s = report[failure_[s]]) {
+                auto pattern = output_[s];
+                if (!callback(match{base + i + 1 - lengths_[pattern], pattern})) {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    /// The column of the transition table for each byte; bytes in no pattern share column `0`.
+    std::array<std::uint32_t, 256> columns_{};
+    /// The number of columns in the transition table.
+    std::uint32_t stride_{1};
+    /// The transitions, `stride_` per state.
+    std::vector<std::uint32_t> delta_;
+    /// The pattern completed by each state, or `no_pattern`.
+    std::vector<std::size_t> output_;
+    /// The failure transition of each state.
+    std::vector<std::uint32_t> failure_;
+    /// The nearest state with output on each state's failure chain, including itself, or `0`.
+    std::vector<std::uint32_t> report_;
+    /// The length of each pattern.
+    std::vector<std::size_t> lengths_;
+    /// The bytes that begin a pattern, if few enough to skip ahead with.
+    std::vector<unsigned char> skip_bytes_;
+};
+
+} /* namespace cio */
@@ -0,0 +1,497 @@
+//
+// SPDX-FileCopyrightText: 2024 Stephen F. Booth <contact@sbooth.dev>
+// SPDX-License-Identifier: MIT
+//
+// Part of https://github.com/sbooth/cio
+//
+
+#import <algorithm>
+#import <cstdint>
+#import <cstdio>
+#import <cstring>
+#import <new>
+#import <vector>
+
+#import "compressed_stream.hpp"
+#import "cstream.hpp"
+#import "lz77.hpp"
+#import "memory_governor.hpp"
+#import "stream_extensions.hpp"
+
+namespace cio {
+
+/// The block index appended by `cio::seekable_compressed_writer`.
+///
+/// A seekable container is a compressed stream as described by `cio::compressed_format` in which every block except
+/// the last holds exactly the block size, followed after the end marker by the index and a trailer. The index holds
+/// the offset of each block's frame from the start of the container as a little-endian `uint64_t`. Block `i` begins at
+/// uncompressed offset `i` times the block size, so locating the block containing any position takes constant time.
+///
+/// The trailer is a little-endian `uint64_t` offset of the index, a little-endian `uint64_t` uncompressed size, a
+/// little-endian `uint32_t` block count and the signature "CIOX". Because the index follows the end marker, a
+/// container may also be read sequentially by `cio::compressed_reader`.
+struct seekable_compressed_format {
+    /// The trailer signature.
+    static constexpr char magic[4] = {'C', 'I', 'O', 'X'};
+
+    /// The size of the trailer in bytes.
+    static constexpr std::size_t trailer_size = 24;
+};
+
+/// A writer producing a compressed container with a block index for random access.
+///
+/// Blocks are compressed with `cio::compressed_writer` and the offset of each is recorded. `finish()` writes the end
+/// marker, the index and the trailer; a container without them cannot be opened by
+/// `cio::seekable_compressed_reader`.
+class seekable_compressed_writer : public output_extensions<seekable_compressed_writer> {
+  public:
+    // This class is non-copyable.
+    seekable_compressed_writer(const seekable_compressed_writer &rhs) = delete;
+
+    // This class is non-assignable.
+    seekable_compressed_writer &operator=(const seekable_compressed_writer &rhs) = delete;
+
+    /// Initializes a `cio::seekable_compressed_writer` object that writes a container to `stream`.
+    /// - parameter stream: The stream to write, positioned where the container begins.
+    /// - parameter block_size: The uncompressed block size, rounded up to a power of two between
+    /// `compressed_format::min_block_size` and `compressed_format::max_block_size`.
+    /// - throws: Any exception thrown by `Allocator::allocate()` (typically `std::bad_alloc`)
+    explicit seekable_compressed_writer(cstream &stream,
+                                        std::size_t block_size = compressed_format::default_block_size)
+        : stream_{stream}, writer_{stream, block_size} {}
+
+    /// Writes the index and trailer if `finish()` has not been called.
+    ~seekable_compressed_writer() noexcept {
+        if (!finished_) {
+            finish();
+        }
+    }
+
+    /// Returns `true` if no error has occurred.
+    [[nodiscard]]
+    explicit operator bool() const noexcept {
+        return !error_ && static_cast<bool>(writer_);
+    }
+
+    /// Returns the uncompressed block size.
+    [[nodiscard]]
+    std::size_t block_size() const noexcept {
+        return writer_.block_size();
+    }
+
+    /// Returns the number of blocks begun.
+    [[nodiscard]]
+    std::size_t block_count() const noexcept {
+        return offsets_.size();
+    }
+
+    /// Returns the number of uncompressed bytes written.
+    [[nodiscard]]
+    std::uint64_t bytes_in() const noexcept {
+        return writer_.bytes_in();
+    }
+
+    /// Returns the number of bytes written to the underlying stream.
+    [[nodiscard]]
+    std::uint64_t bytes_out() const noexcept {
+        return bytes_out_ + writer_.bytes_out();
+    }
+
+    // MARK: Direct Output
+
+    using output_extensions<seekable_compressed_writer>::fwrite;
+
+    /// Writes `count` objects of `size` bytes from `buffer`.
+    /// - returns: The number of objects written.
+    std::size_t fwrite(const void *buffer, std::size_t size, std::size_t count) noexcept {
+        if (error_ || finished_ || size == 0 || count == 0) {
+            return 0;
+        }
+        auto src = static_cast<const unsigned char *>(buffer);
+        auto length = size * count;
+        for (std::size_t written = 0; written < length;) {
+            // Record each block's frame offset as its first byte arrives
+            auto in_block = static_cast<std::size_t>(writer_.bytes_in() % block_size());
+            if (in_block == 0) {
+                try {
+                    offsets_.push_back(writer_.bytes_out());
+                } catch (const std::bad_alloc &) {
+                    error_ = true;
+                    return written / size;
+                }
+            }
+            auto n = std::min(length - written, block_size() - in_block);
+            if (writer_.fwrite(src + written, 1, n) != n) {
+                error_ = true;
+                return written / size;
+            }
+            written += n;
+        }
+        return count;
+    }
+
+    /// Flushes the underlying stream.
+    ///
+    /// A partial block is not written, since every block but the last must be full for positions to map to blocks.
+    /// - returns: `0` on success, `EOF` otherwise.
+    int fflush() noexcept { return error_ ? EOF : stream_.fflush(); }
+
+    /// Writes any partial block, the end marker, the index and the trailer.
+    /// - returns: `true` on success, `false` otherwise.
+    bool finish() noexcept {
+        if (finished_) {
+            return !error_;
+        }
+        finished_ = true;
+        if (error_ || !writer_.finish()) {
+            error_ = true;
+            return false;
+        }
+        auto index_offset = writer_.bytes_out();
+        for (auto offset : offsets_) {
+            if (!stream_.write_uint_little(offset)) {
+                error_ = true;
+                return false;
+            }
+        }
+        error_ = !stream_.write_uint_little(index_offset) || !stream_.write_uint_little(writer_.bytes_in()) ||
+                 !stream_.write_uint_little(static_cast<std::uint32_t>(offsets_.size())) ||
+                 stream_.fwrite(seekable_compressed_format::magic, 1, 4) != 4;
+        bytes_out_ = 8 * offsets_.size() + seekable_compressed_format::trailer_size;
+        return !error_;
+    }
+
+  private:
+    /// The underlying stream.
+    cstream &stream_;
+    /// The writer compressing the blocks.
+    compressed_writer writer_;
+    /// The frame offset of each block from the start of the container.
+    std::vector<std::uint64_t> offsets_;
+    /// The number of index and trailer bytes written.
+    std::uint64_t bytes_out_{0};
+    /// Whether the index has been written.
+    bool finished_{false};
+    /// Whether an error has occurred.
+    bool error_{false};
+};
+
+/// A reader providing random access to a container written by `cio::seekable_compressed_writer`.
+///
+/// The index is read when the reader is created. Positions are uncompressed offsets, and reading decompresses only
+/// the blocks containing the requested bytes. The most recently used blocks are kept decompressed, so reads that stay
+/// within or return to a few blocks are served without touching the underlying stream.
+///
+/// Cached blocks are reserved from `cio::memory_governor::shared()`. When the budget has no room for another block the
+/// least recently used block already held is reused, so the cache holds fewer blocks than requested.
+class seekable_compressed_reader : public input_extensions<seekable_compressed_reader> {
+  public:
+    /// The default number of decompressed blocks kept.
+    static constexpr std::size_t default_cache_blocks = 4;
+
+    // This class is non-copyable.
+    seekable_compressed_reader(const seekable_compressed_reader &rhs) = delete;
+
+    // This class is non-assignable.
+    seekable_compressed_reader &operator=(const seekable_compressed_reader &rhs) = delete;
+
+    /// Initializes a `cio::seekable_compressed_reader` object that reads from `stream`.
+    ///
+    /// If the container is malformed the object is invalid.
+    /// - parameter stream: The stream to read, positioned at the start of a container that extends to its end.
+    /// - parameter cache_blocks: The number of decompressed blocks to keep, at least one.
+    /// - throws: Any exception thrown by `Allocator::allocate()` (typically `std::bad_alloc`)
+    explicit seekable_compressed_reader(cstream &stream, std::size_t cache_blocks = default_cache_blocks)
+        : stream_{stream}, cache_(std::max<std::size_t>(cache_blocks, 1)) {
+        error_ = !read_index() || !reservation_.resize(lz77::compress_bound(block_size_));
+        if (!error_) {
+            scratch_.resize(lz77::compress_bound(block_size_));
+        }
+    }
+
+    /// Returns `true` if the container was opened and no error has occurred.
+    [[nodiscard]]
+    explicit operator bool() const noexcept {
+        return !error_;
+    }
+
+    /// Returns the uncompressed size in bytes.
+    [[nodiscard]]
+    std::uint64_t size() const noexcept {
+        return size_;
+    }
+
+    /// Returns the uncompressed block size.
+    [[nodiscard]]
+    std::size_t block_size() const noexcept {
+        return block_size_;
+    }
+
+    /// Returns the number of blocks.
+    [[nodiscard]]
+    std::size_t block_count() const noexcept {
+        return offsets_.size();
+    }
+
+    /// Returns the number of blocks decompressed, counting each time a block is decompressed again after eviction.
+    [[nodiscard]]
+    std::uint64_t blocks_decoded() const noexcept {
+        return blocks_decoded_;
+    }
+
+    // MARK: Direct Input
+
+    using input_extensions<seekable_compressed_reader>::fread;
+
+    /// Reads up to `count` objects of `size` bytes into `buffer`.
+    /// - returns: The number of complete objects read.
+    std::size_t fread(void *buffer, std::size_t size, std::size_t count) noexcept {
+        if (size == 0 || count == 0 || error_) {
+            return 0;
+        }
+        auto dst = static_cast<unsigned char *>(buffer);
+        auto wanted = size * count;
+        std::size_t total = 0;
+        while (total < wanted) {
+            if (position_ >= size_) {
+                eof_ = true;
+                break;
+            }
+            auto b = load(static_cast<std::size_t>(position_ >> shift_));
+            if (!b) {
+                error_ = true;
+                break;
+            }
+            auto offset = static_cast<std::size_t>(position_ & (block_size_ - 1));
+            auto n = std::min(wanted - total, b->size - offset);
+            std::memcpy(dst + total, b->data.data() + offset, n);
+            position_ += n;
+            total += n;
+        }
+        return total / size;
+    }
+
+    /// Returns the next byte as an `unsigned char` converted to `int`, or `EOF`.
+    [[nodiscard]]
+    int fgetc() noexcept {
+        unsigned char ch;
+        return fread(&ch, 1, 1) == 1 ? ch : EOF;
+    }
+
+    // MARK: File Positioning
+
+    /// Returns the current uncompressed position.
+    [[nodiscard]]
+    long ftell() const noexcept {
+        return static_cast<long>(position_);
+    }
+
+    /// Sets the current uncompressed position. No data is read until the next read.
+    /// - returns: `0` on success, `-1` otherwise.
+    int fseek(long offset, int origin) noexcept {
+        long base;
+        switch (origin) {
+        case SEEK_SET:
+            base = 0;
+            break;
+        case SEEK_CUR:
+            base = static_cast<long>(position_);
+            break;
+        case SEEK_END:
+            base = static_cast<long>(size_);
+            break;
+        default:
+            return -1;
+        }
+        if (offset < -base) {
+            return -1;
+        }
+        position_ = static_cast<std::uint64_t>(base + offset);
+        eof_ = false;
+        return 0;
+    }
+
+    /// Sets the current position to the beginning and clears the end-of-file and error indicators.
+    void rewind() noexcept {
+        fseek(0, SEEK_SET);
+        clearerr();
+    }
+
+    // MARK: Error Handling
+
+    /// Clears the end-of-file indicator, and the error indicator if the container was opened.
+    void clearerr() noexcept {
+        eof_ = false;
+        error_ = block_size_ == 0;
+    }
+
+    /// Returns nonzero if a read has reached the end of the uncompressed data.
+    [[nodiscard]]
+    int feof() const noexcept {
+        return eof_;
+    }
+
+    /// Returns nonzero if the container is malformed or a read failed.
+    [[nodiscard]]
+    int ferror() const noexcept {
+        return error_;
+    }
+
+  private:
+    /// A decompressed block.
+    struct cached_block {
+        /// The block's index, or `SIZE_MAX` if the slot is unused.
+        std::size_t index{SIZE_MAX};
+        /// The decompressed data.
+        std::vector<unsigned char> data;
+        /// The number of valid bytes in `data`.
+        std::size_t size{0};
+        /// The value of `clock_` when the block was last used.
+        std::uint64_t last_used{0};
+    };
+
+    /// Reads the header, trailer and index.
+    /// - returns: `true` on success, `false` if the container is malformed or could not be read.
+    bool read_index() {
+        base_ = stream_.ftell();
+        unsigned char header[8];
+        if (base_ == -1 || stream_.fread(header, 1, sizeof header) != sizeof header ||
+            std::memcmp(header, compressed_format::magic, 4) != 0 || header[4] != compressed_format::version ||
+            header[5] < 12 || (std::size_t{1} << header[5]) > compressed_format::max_block_size) {
+            return false;
+        }
+        shift_ = header[5];
+
+        std::uint64_t index_offset;
+        std::uint32_t count;
+        unsigned char magic[4];
+        if (stream_.fseek(-static_cast<long>(seekable_compressed_format::trailer_size), SEEK_END) != 0) {
+            return false;
+        }
+        auto trailer_offset = static_cast<std::uint64_t>(stream_.ftell() - base_);
+        if (!stream_.read_uint_little(index_offset) || !stream_.read_uint_little(size_) ||
+            !stream_.read_uint_little(count) || stream_.fread(magic, 1, 4) != 4 ||
+            std::memcmp(magic, seekable_compressed_format::magic, 4) != 0 || index_offset > trailer_offset ||
+            trailer_offset - index_offset != std::uint64_t{8} * count ||
+            (size_ >> shift_) + ((size_ & ((std::uint64_t{1} << shift_) - 1)) != 0) != count) {
+            return false;
+        }
+
+        offsets_.resize(count);
+        if (stream_.fseek(base_ + static_cast<long>(index_offset), SEEK_SET) != 0) {
+            return false;
+        }
+        for (auto &offset : offsets_) {
+            if (!stream_.read_uint_little(offset) || offset >= index_offset) {
+                return false;
+            }
+        }
+
+        // The uncompressed size must match the size of the last block
+        std::uint32_t last_size;
+        if (count > 0 && (stream_.fseek(base_ + static_cast<long>(offsets_.back()) + 4, SEEK_SET) != 0 ||
+                          !stream_.read_uint_little(last_size) ||
+                          last_size != size_ - (static_cast<std::uint64_t>(count - 1) << shift_))) {
+            return false;
+        }
+        block_size_ = std::size_t{1} << shift_;
+        return true;
+    }
+
+    /// Returns block `index`, decompressing it into the least recently used cache slot if it is not cached.
+    /// - returns: The block, or `nullptr` on error.
+    cached_block *load(std::size_t index) noexcept {
+        auto victim = &cache_.front();
+        for (auto &b : cache_) {
+            if (b.index == index) {
+                b.last_used = ++clock_;
+                return &b;
+            }
+            if (b.last_used < victim->last_used) {
+                victim = &b;
+            }
+        }
+        // An unused slot needs memory for a new block, so evict an allocated block instead if the budget has no room
+        if (victim->data.empty() && !reservation_.resize(reservation_.size() + block_size_)) {
+            victim = nullptr;
+            for (auto &b : cache_) {
+                if (!b.data.empty() && (!victim || b.last_used < victim->last_used)) {
+                    victim = &b;
+                }
+            }
+            if (!victim) {
+                return nullptr;
+            }
+        }
+        victim->index = SIZE_MAX;
+        if (!decode(index, *victim)) {
+            return nullptr;
+        }
+        victim->index = index;
+        victim->last_used = ++clock_;
+        ++blocks_decoded_;
+        return victim;
+    }
+
+    /// Reads and decompresses block `index` into `b`.
+    bool decode(std::size_t index, cached_block &b) noexcept {
+        auto expected = static_cast<std::size_t>(
+                std::min<std::uint64_t>(block_size_, size_ - (static_cast<std::uint64_t>(index) << shift_)));
+        std::uint32_t length, size;
+        if (stream_.fseek(base_ + static_cast<long>(offsets_[index]), SEEK_SET) != 0 ||
+            !stream_.read_uint_little(length) || !stream_.read_uint_little(size) || size != expected) {
+            return false;
+        }
+        auto stored = (length & compressed_format::stored_flag) != 0;
+        length &= ~compressed_format::stored_flag;
+        if (length == 0 || length > scratch_.size() || (stored && length != size)) {
+            return false;
+        }
+        try {
+            b.data.resize(block_size_);
+        } catch (const std::bad_alloc &) {
+            return false;
+        }
+        if (stored) {
+            b.size = stream_.fread(b.data.data(), 1, length);
+            return b.size == length;
+        }
+        if (stream_.fread(scratch_.data(), 1, length) != length ||
+            lz77::decompress(scratch_.data(), length, b.data.data(), b.data.size()) != size) {
+            return false;
+        }
+        b.size = size;
+        return true;
+    }
+
+    /// The underlying stream.
+    cstream &stream_;
+    /// The position of the container in the underlying stream.
+    long base_{0};
+    /// The base-2 logarithm of the block size.
+    unsigned shift_{0};
+    /// The uncompressed block size, or `0` if the container could not be opened.
+    std::size_t block_size_{0};
+    /// The uncompressed size.
+    std::uint64_t size_{0};
+    /// The frame offset of each block from the start of the container.
+    std::vector<std::uint64_t> offsets_;
+    /// The compressed data of the block being decoded.
+    std::vector<unsigned char> scratch_;
+    /// The decompressed blocks.
+    std::vector<cached_block> cache_;
+    /// The memory reserved from the governor for `scratch_` and the allocated blocks in `cache_`.
+    memory_reservation reservation_;
+    /// Incremented each time a block is used.
+    std::uint64_t clock_{0};
+    /// The number of blocks decompressed.
+    std::uint64_t blocks_decoded_{0};
+    /// The current uncompressed position.
+    std::uint64_t position_{0};
+    /// Whether a read has reached the end of the data.
+    bool eof_{false};
+    /// Whether an error has occurred.
+    bool error_{false};
+};
+
+} /* namespace cio */
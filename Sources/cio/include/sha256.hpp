@@ -0,0 +1,285 @@
+//
+// SPDX-FileCopyrightText: 2024 Stephen F. Booth <contact@sbooth.dev>
+// SPDX-License-Identifier: MIT
+//
+// Part of https://github.com/sbooth/cio
+//
+
+#import <algorithm>
+#import <array>
+#import <cstddef>
+#import <cstdint>
+#import <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#import <cpuid.h>
+#import <immintrin.h>
+#endif
+#if defined(__ARM_FEATURE_SHA2)
+#import <arm_neon.h>
+#endif
+
+namespace cio {
+
+namespace detail {
+
+/// The SHA-256 round constants.
+inline constexpr std::uint32_t sha256_k[64] = {
+        0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+        0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+        0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+        0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+        0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+        0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+        0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+        0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+
+/// Returns `x` rotated right by `n` bits.
+constexpr std::uint32_t sha256_rotr(std::uint32_t x, unsigned n) noexcept { return (x >> n) | (x << (32 - n)); }
+
+/// Compresses `count` 64-byte blocks at `p` into `state` with portable code.
+inline void sha256_compress_portable(std::array<std::uint32_t, 8> &state, const unsigned char *p,
+                                     std::size_t count) noexcept {
+    for (; count > 0; --count, p += 64) {
+        std::uint32_t w[64];
+        for (std::size_t i = 0; i < 16; ++i) {
+            w[i] = (std::uint32_t{p[4 * i]} << 24) | (std::uint32_t{p[4 * i + 1]} << 16) |
+                   (std::uint32_t{p[4 * i + 2]} << 8) | std::uint32_t{p[4 * i + 3]};
+        }
+        for (std::size_t i = 16; i < 64; ++i) {
+            auto s0 = sha256_rotr(w[i - 15], 7) ^ sha256_rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+            auto s1 = sha256_rotr(w[i - 2], 17) ^ sha256_rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+            w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+        auto [a, b, c, d, e, f, g, h] = state;
+        for (std::size_t i = 0; i < 64; ++i) {
+            auto t1 = h + (sha256_rotr(e, 6) ^ sha256_rotr(e, 11) ^ sha256_rotr(e, 25)) + ((e & f) ^ (~e & g)) +
+                      sha256_k[i] + w[i];
+            auto t2 = (sha256_rotr(a, 2) ^ sha256_rotr(a, 13) ^ sha256_rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+            h = g;
+            g = f;
+            f = e;
+            e = d + t1;
+            d = c;
+            c = b;
+            b = a;
+            a = t1 + t2;
+        }
+        state[0] += a;
+        state[1] += b;
+        state[2] += c;
+        state[3] += d;
+        state[4] += e;
+        state[5] += f;
+        state[6] += g;
+        state[7] += h;
+    }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+/// Returns `true` if the processor supports the SHA extensions and SSE4.1.
+inline bool sha256_extensions_supported() noexcept {
+#if defined(__SHA__) && defined(__SSE4_1__)
+    return true;
+#else
+    static const bool supported = [] {
+        unsigned a, b, c, d;
+        return __get_cpuid(1, &a, &b, &c, &d) && (c & bit_SSE4_1) && __get_cpuid_count(7, 0, &a, &b, &c, &d) &&
+               (b & bit_SHA);
+    }();
+    return supported;
+#endif
+}
+
+/// Compresses `count` 64-byte blocks at `p` into `state` with the SHA extensions.
+///
+/// The function is compiled for the SHA extensions whatever the target, so it may only be called when
+/// `sha256_extensions_supported()` returns `true`.
+__attribute__((target("sha,sse4.1"))) inline void
+sha256_compress_extensions(std::array<std::uint32_t, 8> &state, const unsigned char *p, std::size_t count) noexcept {
+    // The state is kept as the register pairs ABEF and CDGH used by the SHA instructions
+    const auto byte_swap = _mm_set_epi64x(0x0c0d0e0f08090a0bLL, 0x0405060700010203LL);
+    auto t = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(&state[0])), 0xb1);
+    auto s1 = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(&state[4])), 0x1b);
+    auto s0 = _mm_alignr_epi8(t, s1, 8);
+    s1 = _mm_blend_epi16(s1, t, 0xf0);
+
+    for (; count > 0; --count, p += 64) {
+        auto abef = s0;
+        auto cdgh = s1;
+        __m128i m[4];
+        for (int i = 0; i < 4; ++i) {
+            m[i] = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(p + 16 * i)), byte_swap);
+        }
+        for (int i = 0; i < 16; ++i) {
+            auto &w = m[i & 3];
+            if (i >= 4) {
+                // Extend the message schedule by four words
+                w = _mm_sha256msg1_epu32(w, m[(i + 1) & 3]);
+                w = _mm_add_epi32(w, _mm_alignr_epi8(m[(i + 3) & 3], m[(i + 2) & 3], 4));
+                w = _mm_sha256msg2_epu32(w, m[(i + 3) & 3]);
+            }
+            auto wk = _mm_add_epi32(w, _mm_loadu_si128(reinterpret_cast<const __m128i *>(&sha256_k[4 * i])));
+            s1 = _mm_sha256rnds2_epu32(s1, s0, wk);
+            s0 = _mm_sha256rnds2_epu32(s0, s1, _mm_shuffle_epi32(wk, 0x0e));
+        }
+        s0 = _mm_add_epi32(s0, abef);
+        s1 = _mm_add_epi32(s1, cdgh);
+    }
+
+    t = _mm_shuffle_epi32(s0, 0x1b);
+    s1 = _mm_shuffle_epi32(s1, 0xb1);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(&state[0]), _mm_blend_epi16(t, s1, 0xf0));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(&state[4]), _mm_alignr_epi8(s1, t, 8));
+}
+#endif
+
+#if defined(__ARM_FEATURE_SHA2)
+/// Compresses `count` 64-byte blocks at `p` into `state` with the ARMv8 cryptography extensions.
+inline void sha256_compress_armv8(std::array<std::uint32_t, 8> &state, const unsigned char *p,
+                                  std::size_t count) noexcept {
+    // The state is kept as the register pair ABCD and EFGH used by the SHA instructions
+    auto s0 = vld1q_u32(&state[0]);
+    auto s1 = vld1q_u32(&state[4]);
+
+    for (; count > 0; --count, p += 64) {
+        auto abcd = s0;
+        auto efgh = s1;
+        uint32x4_t m[4];
+        for (int i = 0; i < 4; ++i) {
+            m[i] = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(p + 16 * i)));
+        }
+        for (int i = 0; i < 16; ++i) {
+            auto &w = m[i & 3];
+            if (i >= 4) {
+                // Extend the message schedule by four words
+                w = vsha256su1q_u32(vsha256su0q_u32(w, m[(i + 1) & 3]), m[(i + 2) & 3], m[(i + 3) & 3]);
+            }
+            auto wk = vaddq_u32(w, vld1q_u32(&sha256_k[4 * i]));
+            auto t = s0;
+            s0 = vsha256hq_u32(s0, s1, wk);
+            s1 = vsha256h2q_u32(s1, t, wk);
+        }
+        s0 = vaddq_u32(s0, abcd);
+        s1 = vaddq_u32(s1, efgh);
+    }
+
+    vst1q_u32(&state[0], s0);
+    vst1q_u32(&state[4], s1);
+}
+#endif
+
+} /* namespace detail */
+
+/// An incremental SHA-256 hash.
+///
+/// Blocks are compressed with the SHA extensions on x86 processors that support them, whatever the compilation target,
+/// with the cryptography extensions on ARMv8 targets that have them (`__ARM_FEATURE_SHA2`), and otherwise with a
+/// portable implementation.
+class sha256 {
+  public:
+    /// The size of a digest in bytes.
+    static constexpr std::size_t digest_size = 32;
+
+    /// A digest.
+    using digest = std::array<unsigned char, digest_size>;
+
+    /// Initializes a `cio::sha256` object.
+    sha256() noexcept { reset(); }
+
+    /// Returns the digest of `size` bytes at `data`.
+    [[nodiscard]]
+    static digest hash(const void *data, std::size_t size) noexcept {
+        sha256 h;
+        h.update(data, size);
+        return h.finish();
+    }
+
+    /// Discards any data hashed.
+    void reset() noexcept {
+        state_ = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+        length_ = 0;
+        buffered_ = 0;
+    }
+
+    /// Hashes `size` bytes at `data`.
+    void update(const void *data, std::size_t size) noexcept {
+        auto p = static_cast<const unsigned char *>(data);
+        length_ += size;
+        if (buffered_ > 0) {
+            auto n = std::min(size, block_size - buffered_);
+            std::memcpy(buffer_.data() + buffered_, p, n);
+            buffered_ += n;
+            p += n;
+            size -= n;
+            if (buffered_ < block_size) {
+                return;
+            }
+            compress(buffer_.data(), 1);
+            buffered_ = 0;
+        }
+        if (auto blocks = size / block_size; blocks > 0) {
+            compress(p, blocks);
+            p += blocks * block_size;
+            size -= blocks * block_size;
+        }
+        std::memcpy(buffer_.data(), p, size);
+        buffered_ = size;
+    }
+
+    /// Returns the digest of the data hashed and resets the hash.
+    [[nodiscard]]
+    digest finish() noexcept {
+        auto bits = length_ * 8;
+        buffer_[buffered_++] = 0x80;
+        if (buffered_ > block_size - 8) {
+            std::memset(buffer_.data() + buffered_, 0, block_size - buffered_);
+            compress(buffer_.data(), 1);
+            buffered_ = 0;
+        }
+        std::memset(buffer_.data() + buffered_, 0, block_size - 8 - buffered_);
+        for (int i = 0; i < 8; ++i) {
+            buffer_[block_size - 1 - static_cast<std::size_t>(i)] = static_cast<unsigned char>(bits >> (8 * i));
+        }
+        compress(buffer_.data(), 1);
+
+        digest result;
+        for (std::size_t i = 0; i < 8; ++i) {
+            for (std::size_t j = 0; j < 4; ++j) {
+                result[4 * i + j] = static_cast<unsigned char>(state_[i] >> (24 - 8 * j));
+            }
+        }
+        reset();
+        return result;
+    }
+
+  private:
+    /// The size of a block in bytes.
+    static constexpr std::size_t block_size = 64;
+
+    /// Compresses `count` blocks at `p` into the state.
+    void compress(const unsigned char *p, std::size_t count) noexcept {
+#if defined(__x86_64__) || defined(__i386__)
+        if (detail::sha256_extensions_supported()) {
+            detail::sha256_compress_extensions(state_, p, count);
+        } else {
+            detail::sha256_compress_portable(state_, p, count);
+        }
+#elif defined(__ARM_FEATURE_SHA2)
+        detail::sha256_compress_armv8(state_, p, count);
+#else
+        detail::sha256_compress_portable(state_, p, count);
+#endif
+    }
+
+    /// The hash state.
+    std::array<std::uint32_t, 8> state_;
+    /// The number of bytes hashed.
+    std::uint64_t length_;
+    /// Data not yet compressed.
+    std::array<unsigned char, block_size> buffer_;
+    /// The number of valid bytes in `buffer_`.
+    std::size_t buffered_;
+};
+
+} /* namespace cio */
@@ -0,0 +1,344 @@
+//
+// SPDX-FileCopyrightText: 2024 Stephen F. Booth <contact@sbooth.dev>
+// SPDX-License-Identifier: MIT
+//
+// Part of https://github.com/sbooth/cio
+//
+
+#import <algorithm>
+#import <atomic>
+#import <cerrno>
+#import <cstdint>
+#import <cstring>
+#import <ctime>
+#import <new>
+#import <utility>
+
+#import <sched.h>
+#import <sys/stat.h>
+#import <unistd.h>
+
+#if defined(__linux__)
+#import <linux/futex.h>
+#import <sys/syscall.h>
+#endif
+
+#import "cstream.hpp"
+#import "memory_map.hpp"
+#import "stream_extensions.hpp"
+
+namespace cio {
+
+/// A single-producer, single-consumer byte ring in shared memory for passing data between processes.
+///
+/// The ring lives in a `cio::cstream::memfd()` file that is mapped by each process. One process writes with `fwrite`
+/// and the other reads with `fread`; the typed extensions such as `read_uint` and `write_uint` work as they do for
+/// `cio::cstream`. The file is shared by passing `stream()` to the peer, for example with
+/// `cio::local_socket::send_stream()`, or by inheriting its descriptor across `fork(2)`.
+///
+/// While data keeps flowing neither side makes a system call: positions are exchanged through atomics in the mapping
+/// and a waiting side spins briefly before sleeping. On Linux a sleeping side is woken with a shared `futex(2)`; the
+/// other side only issues the wake-up if a sleeper has announced itself. Elsewhere a sleeping side polls with an
+/// increasing back-off.
+///
+/// The writer calls `close()` to mark end of data. Closing from the reader side makes further writes fail.
+class shm_ring : public input_extensions<shm_ring>, public output_extensions<shm_ring> {
+  public:
+    /// Possible byte orders.
+    using byte_order = cstream::byte_order;
+
+    /// The default ring capacity in bytes.
+    static constexpr std::size_t default_capacity = 1024 * 1024;
+
+    // MARK: Standard Six
+
+    /// Initializes an empty `cio::shm_ring` object.
+    shm_ring() noexcept = default;
+
+    // This class is non-copyable.
+    shm_ring(const shm_ring &rhs) = delete;
+
+    // This class is non-assignable.
+    shm_ring &operator=(const shm_ring &rhs) = delete;
+
+    /// Initializes a `cio::shm_ring` object with the ring from `rhs` and leaves `rhs` empty.
+    shm_ring(shm_ring &&rhs) noexcept
+        : file_{std::move(rhs.file_)}, map_{std::move(rhs.map_)}, control_{std::exchange(rhs.control_, nullptr)},
+          data_{std::exchange(rhs.data_, nullptr)} {}
+
+    /// Unmaps the current ring and replaces it with the ring from `rhs`, then leaves `rhs` empty.
+    shm_ring &operator=(shm_ring &&rhs) noexcept {
+        if (this != &rhs) {
+            file_ = std::move(rhs.file_);
+            map_ = std::move(rhs.map_);
+            control_ = std::exchange(rhs.control_, nullptr);
+            data_ = std::exchange(rhs.data_, nullptr);
+        }
+        return *this;
+    }
+
+    /// Unmaps the ring without closing it.
+    ~shm_ring() noexcept = default;
+
+    // MARK: Construction
+
+    /// Returns a new, empty ring.
+    /// - parameter capacity: The ring capacity in bytes, rounded up to a power of two.
+    [[nodiscard]]
+    static shm_ring create(std::size_t capacity = default_capacity) noexcept {
+        std::size_t rounded = 4096;
+        while (rounded < capacity) {
+            rounded <<= 1;
+        }
+        auto file = cstream::memfd("cio-shm-ring", sizeof(control) + rounded);
+        if (!file || ::ftruncate(file.fileno(), static_cast<off_t>(sizeof(control) + rounded)) == -1) {
+            return shm_ring{};
+        }
+        shm_ring ring{std::move(file)};
+        if (!ring.map_) {
+            return ring;
+        }
+        auto c = new (ring.map_.data()) control;
+        c->capacity = rounded;
+        c->magic = magic;
+        ring.control_ = c;
+        ring.data_ = static_cast<unsigned char *>(ring.map_.data()) + sizeof(control);
+        return ring;
+    }
+
+    /// Initializes a `cio::shm_ring` object for the ring in `file`, as returned by `stream()` in the creating process.
+    explicit shm_ring(cstream file) noexcept : file_{std::move(file)} {
+        struct stat st;
+        if (!file_ || ::fstat(file_.fileno(), &st) == -1 || static_cast<std::size_t>(st.st_size) < sizeof(control)) {
+            return;
+        }
+        map_ = memory_map{file_.fileno(), static_cast<std::size_t>(st.st_size), true};
+        if (!map_) {
+            return;
+        }
+        auto c = static_cast<control *>(map_.data());
+        // A freshly created file is attached by create() before the header is written
+        if (c->magic == magic && sizeof(control) + c->capacity <= map_.size()) {
+            control_ = c;
+            data_ = static_cast<unsigned char *>(map_.data()) + sizeof(control);
+        }
+    }
+
+    // MARK: Ring Handling
+
+    /// Returns `true` if the ring is mapped.
+    [[nodiscard]]
+    explicit operator bool() const noexcept {
+        return control_ != nullptr;
+    }
+
+    /// Returns the file containing the ring, for sharing with the peer process.
+    [[nodiscard]]
+    cstream &stream() noexcept {
+        return file_;
+    }
+
+    /// Returns the ring capacity in bytes.
+    [[nodiscard]]
+    std::size_t capacity() const noexcept {
+        return control_ ? static_cast<std::size_t>(control_->capacity) : 0;
+    }
+
+    /// Returns the number of bytes available to read.
+    [[nodiscard]]
+    std::size_t readable() const noexcept {
+        if (!control_) {
+            return 0;
+        }
+        return static_cast<std::size_t>(control_->head.load(std::memory_order_acquire) -
+                                        control_->tail.load(std::memory_order_relaxed));
+    }
+
+    /// Returns `true` if either side has closed the ring or the ring is not mapped.
+    [[nodiscard]]
+    bool closed() const noexcept {
+        return !control_ || control_->closed.load(std::memory_order_acquire) != 0;
+    }
+
+    /// Marks the ring closed and wakes the peer.
+    ///
+    /// Once closed, reads return the remaining data and then end of file, and writes fail with `errno` set to `EPIPE`.
+    void close() noexcept {
+        if (!control_) {
+            return;
+        }
+        control_->closed.store(1, std::memory_order_seq_cst);
+        signal(control_->data_signal);
+        signal(control_->space_signal);
+    }
+
+    // MARK: Direct Input/Output
+
+    using input_extensions<shm_ring>::fread;
+    using output_extensions<shm_ring>::fwrite;
+
+    /// Reads `count` objects of `size` bytes into `buffer`, waiting until they arrive or the ring is closed.
+    /// - returns: The number of complete objects read.
+    std::size_t fread(void *buffer, std::size_t size, std::size_t count) noexcept {
+        if (!control_ || size == 0 || count == 0) {
+            return 0;
+        }
+        auto out = static_cast<unsigned char *>(buffer);
+        auto length = size * count;
+        auto mask = control_->capacity - 1;
+        auto tail = control_->tail.load(std::memory_order_relaxed);
+        std::size_t total = 0;
+        while (total < length) {
+            auto head = control_->head.load(std::memory_order_acquire);
+            if (head == tail) {
+                if (!wait(control_->data_signal, control_->reader_waiting,
+                          [&] { return control_->head.load(std::memory_order_seq_cst) != tail; })) {
+                    break;
+                }
+                continue;
+            }
+            auto n = static_cast<std::size_t>(std::min<std::uint64_t>(head - tail, length - total));
+            auto offset = static_cast<std::size_t>(tail & mask);
+            auto first = std::min(n, static_cast<std::size_t>(control_->capacity) - offset);
+            std::memcpy(out + total, data_ + offset, first);
+            std::memcpy(out + total + first, data_, n - first);
+            tail += n;
+            total += n;
+            control_->tail.store(tail, std::memory_order_seq_cst);
+            if (control_->writer_waiting.load(std::memory_order_seq_cst)) {
+                signal(control_->space_signal);
+            }
+        }
+        return total / size;
+    }
+
+    /// Writes `count` objects of `size` bytes from `buffer`, waiting for space as needed.
+    /// - returns: The number of complete objects written.
+    std::size_t fwrite(const void *buffer, std::size_t size, std::size_t count) noexcept {
+        if (!control_ || size == 0 || count == 0) {
+            return 0;
+        }
+        auto in = static_cast<const unsigned char *>(buffer);
+        auto length = size * count;
+        auto capacity = control_->capacity;
+        auto head = control_->head.load(std::memory_order_relaxed);
+        std::size_t total = 0;
+        while (total < length) {
+            if (closed()) {
+                errno = EPIPE;
+                break;
+            }
+            auto tail = control_->tail.load(std::memory_order_acquire);
+            if (head - tail == capacity) {
+                wait(control_->space_signal, control_->writer_waiting,
+                     [&] { return control_->tail.load(std::memory_order_seq_cst) != tail; });
+                continue;
+            }
+            auto n = static_cast<std::size_t>(std::min<std::uint64_t>(capacity - (head - tail), length - total));
+            auto offset = static_cast<std::size_t>(head & (capacity - 1));
+            auto first = std::min(n, static_cast<std::size_t>(capacity) - offset);
+            std::memcpy(data_ + offset, in + total, first);
+            std::memcpy(data_, in + total + first, n - first);
+            head += n;
+            total += n;
+            control_->head.store(head, std::memory_order_seq_cst);
+            if (control_->reader_waiting.load(std::memory_order_seq_cst)) {
+                signal(control_->data_signal);
+            }
+        }
+        return total / size;
+    }
+
+  private:
+    static_assert(std::atomic<std::uint64_t>::is_always_lock_free && std::atomic<std::uint32_t>::is_always_lock_free,
+                  "Shared memory atomics must be lock-free");
+
+    /// Identifies an initialized ring ("CIOR").
+    static constexpr std::uint32_t magic = 0x52'4f'49'43;
+
+    /// The number of checks before a waiting side yields the processor.
+    static constexpr int spin_count = 256;
+
+    /// The number of times a waiting side yields the processor before it sleeps.
+    static constexpr int yield_count = 16;
+
+    /// The shared ring header, which precedes the data in the mapping.
+    struct control {
+        /// `magic` once initialized.
+        std::uint32_t magic;
+        /// Nonzero once either side has closed the ring.
+        std::atomic<std::uint32_t> closed{0};
+        /// The capacity of the data area in bytes.
+        std::uint64_t capacity;
+        /// The total number of bytes written, on its own cache line.
+        alignas(64) std::atomic<std::uint64_t> head{0};
+        /// Nonzero while the reader is about to sleep.
+        std::atomic<std::uint32_t> reader_waiting{0};
+        /// Incremented to wake the reader.
+        std::atomic<std::uint32_t> data_signal{0};
+        /// The total number of bytes read, on its own cache line.
+        alignas(64) std::atomic<std::uint64_t> tail{0};
+        /// Nonzero while the writer is about to sleep.
+        std::atomic<std::uint32_t> writer_waiting{0};
+        /// Incremented to wake the writer.
+        std::atomic<std::uint32_t> space_signal{0};
+    };
+
+    /// Waits until `ready()` returns `true` or the ring is closed.
+    /// - returns: `true` if `ready()` returned `true`.
+    template <typename Ready>
+    bool wait(std::atomic<std::uint32_t> &word, std::atomic<std::uint32_t> &waiting, Ready ready) noexcept {
+        for (int i = 0; i < spin_count; ++i) {
+            if (ready()) {
+                return true;
+            }
+            if (closed()) {
+                return ready();
+            }
+        }
+        // Yielding lets the peer run when both sides share a processor
+        for (int i = 0; i < yield_count; ++i) {
+            ::sched_yield();
+            if (ready() || closed()) {
+                return ready();
+            }
+        }
+        for (long delay = 1000;; delay = std::min(delay * 2, 1'000'000L)) {
+            auto value = word.load(std::memory_order_seq_cst);
+            waiting.store(1, std::memory_order_seq_cst);
+            // Recheck after announcing so a wake-up sent before the announcement is not missed
+            if (ready() || closed()) {
+                waiting.store(0, std::memory_order_relaxed);
+                return ready();
+            }
+#if defined(__linux__)
+            (void)delay;
+            ::syscall(SYS_futex, reinterpret_cast<std::uint32_t *>(&word), FUTEX_WAIT, value, nullptr, nullptr, 0);
+#else
+            (void)value;
+            struct timespec ts{0, delay};
+            ::nanosleep(&ts, nullptr);
+#endif
+            waiting.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    /// Wakes the side waiting on `word`.
+    static void signal(std::atomic<std::uint32_t> &word) noexcept {
+        word.fetch_add(1, std::memory_order_seq_cst);
+#if defined(__linux__)
+        ::syscall(SYS_futex, reinterpret_cast<std::uint32_t *>(&word), FUTEX_WAKE, 1, nullptr, nullptr, 0);
+#endif
+    }
+
+    /// The file containing the ring.
+    cstream file_;
+    /// The mapping of `file_`.
+    memory_map map_;
+    /// The ring header in the mapping.
+    control *control_{nullptr};
+    /// The data area in the mapping.
+    unsigned char *data_{nullptr};
+};
+
+} /* namespace cio */
@@ -0,0 +1,285 @@
+//
+// SPDX-FileCopyrightText: 2024 Stephen F. Booth <contact@sbooth.dev>
+// SPDX-License-Identifier: MIT
+//
+// Part of https://github.com/sbooth/cio
+//
+
+#import <algorithm>
+#import <cstddef>
+#import <cstdint>
+#import <cstring>
+
+#if defined(__AVX2__) || defined(__SSSE3__)
+#import <immintrin.h>
+#elif defined(__SSE2__)
+#import <emmintrin.h>
+#endif
+#if defined(__PCLMUL__)
+#import <wmmintrin.h>
+#endif
+#if defined(__ARM_NEON)
+#import <arm_neon.h>
+#endif
+
+#import "cstream.hpp"
+
+namespace cio {
+
+// Vector kernels are selected at compile time from the target's instruction set (AVX2, SSSE3 or SSE2 on x86-64 and
+// NEON on arm64), with a scalar fallback.
+
+/// Returns `true` if values in byte order `order` must be swapped to convert them to or from host byte order.
+[[nodiscard]]
+constexpr bool byte_order_needs_swap(cstream::byte_order order) noexcept {
+    switch (order) {
+    case cstream::byte_order::little_endian:
+        return __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__;
+    case cstream::byte_order::big_endian:
+        return __BYTE_ORDER__ != __ORDER_BIG_ENDIAN__;
+    case cstream::byte_order::host:
+        return false;
+    case cstream::byte_order::swapped:
+        return true;
+    }
+    return false;
+}
+
+/// Reverses the byte order of `count` contiguous values of `Size` bytes in place.
+/// - parameter values: The values to swap, which need not be aligned.
+/// - parameter count: The number of values.
+template <std::size_t Size> void swap_bytes(void *values, std::size_t count) noexcept {
+    static_assert(Size == 1 || Size == 2 || Size == 4 || Size == 8, "Unsupported value size in swap_bytes");
+    if constexpr (Size > 1) {
+        auto p = static_cast<unsigned char *>(values);
+        auto n = count * Size;
+        std::size_t i = 0;
+
+#if defined(__AVX2__) || defined(__SSSE3__)
+        // Index of the byte that moves to position k when reversing each value
+        constexpr auto r = [](int k) { return static_cast<char>(k / Size * Size + (Size - 1 - k % Size)); };
+        const auto mask128 = _mm_setr_epi8(r(0), r(1), r(2), r(3), r(4), r(5), r(6), r(7), r(8), r(9), r(10), r(11),
+                                           r(12), r(13), r(14), r(15));
+#if defined(__AVX2__)
+        const auto mask256 = _mm256_broadcastsi128_si256(mask128);
+        for (; i + 32 <= n; i += 32) {
+            auto v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p + i));
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(p + i), _mm256_shuffle_epi8(v, mask256));
+        }
+#endif
+        for (; i + 16 <= n; i += 16) {
+            auto v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + i));
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(p + i), _mm_shuffle_epi8(v, mask128));
+        }
+#elif defined(__ARM_NEON)
+        for (; i + 16 <= n; i += 16) {
+            auto v = vld1q_u8(p + i);
+            if constexpr (Size == 2) {
+                v = vrev16q_u8(v);
+            } else if constexpr (Size == 4) {
+                v = vrev32q_u8(v);
+            } else {
+                v = vrev64q_u8(v);
+            }
+            vst1q_u8(p + i, v);
+        }
+#endif
+
+        for (; i < n; i += Size) {
+            if constexpr (Size == 2) {
+                std::uint16_t v;
+                std::memcpy(&v, p + i, 2);
+                v = OSSwapInt16(v);
+                std::memcpy(p + i, &v, 2);
+            } else if constexpr (Size == 4) {
+                std::uint32_t v;
+                std::memcpy(&v, p + i, 4);
+                v = OSSwapInt32(v);
+                std::memcpy(p + i, &v, 4);
+            } else {
+                std::uint64_t v;
+                std::memcpy(&v, p + i, 8);
+                v = OSSwapInt64(v);
+                std::memcpy(p + i, &v, 8);
+            }
+        }
+    }
+}
+
+/// Converts `count` contiguous values of `Size` bytes from byte order `order` to host byte order in place.
+template <std::size_t Size> void swap_to_host(void *values, std::size_t count, cstream::byte_order order) noexcept {
+    if (byte_order_needs_swap(order)) {
+        swap_bytes<Size>(values, count);
+    }
+}
+
+/// Converts `count` contiguous values of `Size` bytes from host byte order to byte order `order` in place.
+template <std::size_t Size> void swap_from_host(void *values, std::size_t count, cstream::byte_order order) noexcept {
+    if (byte_order_needs_swap(order)) {
+        swap_bytes<Size>(values, count);
+    }
+}
+
+/// Returns the number of bytes equal to `c` in `size` bytes at `data`.
+///
+/// Matches are accumulated in per-lane byte counters, which are summed before they can overflow, so the kernel
+/// touches each byte once and runs at memory bandwidth.
+[[nodiscard]]
+inline std::uint64_t count_byte(const void *data, std::size_t size, unsigned char c) noexcept {
+    auto p = static_cast<const unsigned char *>(data);
+    std::uint64_t count = 0;
+    std::size_t i = 0;
+
+#if defined(__AVX2__)
+    const auto splat = _mm256_set1_epi8(static_cast<char>(c));
+    const auto zero = _mm256_setzero_si256();
+    while (i + 32 <= size) {
+        auto limit = std::min(size - 31, i + 255 * 32);
+        auto counters = zero;
+        for (; i < limit; i += 32) {
+            auto v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p + i));
+            counters = _mm256_sub_epi8(counters, _mm256_cmpeq_epi8(v, splat));
+        }
+        auto sums = _mm256_sad_epu8(counters, zero);
+        count += static_cast<std::uint64_t>(_mm256_extract_epi64(sums, 0) + _mm256_extract_epi64(sums, 1) +
+                                            _mm256_extract_epi64(sums, 2) + _mm256_extract_epi64(sums, 3));
+    }
+#elif defined(__SSE2__)
+    const auto splat = _mm_set1_epi8(static_cast<char>(c));
+    const auto zero = _mm_setzero_si128();
+    while (i + 16 <= size) {
+        auto limit = std::min(size - 15, i + 255 * 16);
+        auto counters = zero;
+        for (; i < limit; i += 16) {
+            auto v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + i));
+            counters = _mm_sub_epi8(counters, _mm_cmpeq_epi8(v, splat));
+        }
+        auto sums = _mm_sad_epu8(counters, zero);
+        count += static_cast<std::uint64_t>(_mm_cvtsi128_si32(sums)) +
+                 static_cast<std::uint64_t>(_mm_cvtsi128_si32(_mm_srli_si128(sums, 8)));
+    }
+#elif defined(__ARM_NEON)
+    const auto splat = vdupq_n_u8(c);
+    while (i + 16 <= size) {
+        auto limit = std::min(size - 15, i + 255 * 16);
+        auto counters = vdupq_n_u8(0);
+        for (; i < limit; i += 16) {
+            counters = vsubq_u8(counters, vceqq_u8(vld1q_u8(p + i), splat));
+        }
+        count += vaddlvq_u8(counters);
+    }
+#endif
+
+    for (; i < size; ++i) {
+        count += p[i] == c;
+    }
+    return count;
+}
+
+/// Returns `mask` with each bit replaced by the XOR of itself and all lower bits.
+///
+/// Applied to a mask of quote characters the result marks the bytes from each opening quote up to, but not including,
+/// the matching closing quote. The product is computed with a carry-less multiplication by all ones when the target
+/// supports it (`-mpclmul` on x86-64, the AES extension on arm64).
+[[nodiscard]]
+inline std::uint64_t prefix_xor(std::uint64_t mask) noexcept {
+#if defined(__PCLMUL__)
+    auto product = _mm_clmulepi64_si128(_mm_set_epi64x(0, static_cast<long long>(mask)), _mm_set1_epi8(-1), 0);
+    return static_cast<std::uint64_t>(_mm_cvtsi128_si64(product));
+#elif defined(__ARM_NEON) && (defined(__ARM_FEATURE_AES) || defined(__ARM_FEATURE_CRYPTO))
+    return vgetq_lane_u64(vreinterpretq_u64_p128(vmull_p64(mask, ~std::uint64_t{0})), 0);
+#else
+    mask ^= mask << 1;
+    mask ^= mask << 2;
+    mask ^= mask << 4;
+    mask ^= mask << 8;
+    mask ^= mask << 16;
+    mask ^= mask << 32;
+    return mask;
+#endif
+}
+
+/// 64 bytes loaded into vector registers for comparison.
+///
+/// Comparisons return a 64-bit mask in which bit `i` describes byte `i`, so that scanners can iterate over matches
+/// with `__builtin_ctzll` and carry state between blocks with shifts.
+class byte_block {
+  public:
+    /// The number of bytes in a block.
+    static constexpr std::size_t size = 64;
+
+    /// Loads `size` bytes at `p`, which need not be aligned.
+    explicit byte_block(const unsigned char *p) noexcept {
+#if defined(__AVX2__)
+        v_[0] = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+        v_[1] = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p + 32));
+#elif defined(__SSE2__)
+        for (int i = 0; i < 4; ++i) {
+            v_[i] = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + 16 * i));
+        }
+#elif defined(__ARM_NEON)
+        for (int i = 0; i < 4; ++i) {
+            v_[i] = vld1q_u8(p + 16 * i);
+        }
+#else
+        std::memcpy(v_, p, size);
+#endif
+    }
+
+    /// Returns a mask of the bytes equal to `c`.
+    [[nodiscard]]
+    std::uint64_t eq(unsigned char c) const noexcept {
+#if defined(__AVX2__)
+        auto splat = _mm256_set1_epi8(static_cast<char>(c));
+        auto lo = static_cast<std::uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(v_[0], splat)));
+        auto hi = static_cast<std::uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(v_[1], splat)));
+        return lo | (std::uint64_t{hi} << 32);
+#elif defined(__SSE2__)
+        auto splat = _mm_set1_epi8(static_cast<char>(c));
+        std::uint64_t mask = 0;
+        for (int i = 0; i < 4; ++i) {
+            mask |= std::uint64_t{static_cast<std::uint16_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(v_[i], splat)))}
+                    << (16 * i);
+        }
+        return mask;
+#elif defined(__ARM_NEON)
+        auto splat = vdupq_n_u8(c);
+        return movemask(vceqq_u8(v_[0], splat), vceqq_u8(v_[1], splat), vceqq_u8(v_[2], splat),
+                        vceqq_u8(v_[3], splat));
+#else
+        std::uint64_t mask = 0;
+        for (std::size_t i = 0; i < size; ++i) {
+            mask |= std::uint64_t{v_[i] == c} << i;
+        }
+        return mask;
+#endif
+    }
+
+  private:
+#if defined(__AVX2__)
+    /// The bytes.
+    __m256i v_[2];
+#elif defined(__SSE2__)
+    /// The bytes.
+    __m128i v_[4];
+#elif defined(__ARM_NEON)
+    /// Returns a mask of the high bits of the bytes in `a`, `b`, `c` and `d`, which must be `0x00` or `0xff`.
+    static std::uint64_t movemask(uint8x16_t a, uint8x16_t b, uint8x16_t c, uint8x16_t d) noexcept {
+        const uint8x16_t bits = {0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80,
+                                 0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80};
+        auto ab = vpaddq_u8(vandq_u8(a, bits), vandq_u8(b, bits));
+        auto cd = vpaddq_u8(vandq_u8(c, bits), vandq_u8(d, bits));
+        auto sum = vpaddq_u8(ab, cd);
+        sum = vpaddq_u8(sum, sum);
+        return vgetq_lane_u64(vreinterpretq_u64_u8(sum), 0);
+    }
+
+    /// The bytes.
+    uint8x16_t v_[4];
+#else
+    /// The bytes.
+    unsigned char v_[64];
+#endif
+};
+
+} /* namespace cio */
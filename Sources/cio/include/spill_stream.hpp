@@ -0,0 +1,290 @@
+//
+// SPDX-FileCopyrightText: 2024 Stephen F. Booth <contact@sbooth.dev>
+// SPDX-License-Identifier: MIT
+//
+// Part of https://github.com/sbooth/cio
+//
+
+#import <algorithm>
+#import <cstdio>
+#import <cstring>
+#import <new>
+#import <vector>
+
+#import "cstream.hpp"
+#import "memory_governor.hpp"
+#import "stream_extensions.hpp"
+
+namespace cio {
+
+/// A read/write stream that stays in memory until it grows past a threshold and then spills to a temporary file.
+///
+/// Once spilled the contents move to `cio::cstream::tmpfile()` and all further I/O goes to the file, so memory use is
+/// bounded by the threshold regardless of how much is written. The in-memory contents are reserved from
+/// `cio::memory_governor::shared()`, and the stream spills early if its growth would exceed the budget.
+class spill_stream : public input_extensions<spill_stream>, public output_extensions<spill_stream> {
+  public:
+    /// Possible byte orders.
+    using byte_order = cstream::byte_order;
+
+    /// The default spill threshold in bytes.
+    static constexpr std::size_t default_threshold = 4 * 1024 * 1024;
+
+    // MARK: Standard Six
+
+    /// Initializes a `cio::spill_stream` object with the default spill threshold.
+    spill_stream() noexcept = default;
+
+    // This class is non-copyable.
+    spill_stream(const spill_stream &rhs) = delete;
+
+    // This class is non-assignable.
+    spill_stream &operator=(const spill_stream &rhs) = delete;
+
+    /// Initializes a `cio::spill_stream` object with the contents of `rhs`.
+    spill_stream(spill_stream &&rhs) noexcept = default;
+
+    /// Replaces the contents of this object with the contents of `rhs`.
+    spill_stream &operator=(spill_stream &&rhs) noexcept = default;
+
+    /// Destroys the stream and its temporary file, if any.
+    ~spill_stream() noexcept = default;
+
+    // MARK: Construction
+
+    /// Initializes a `cio::spill_stream` object that spills once its contents would exceed `threshold` bytes.
+    explicit spill_stream(std::size_t threshold) noexcept : threshold_{threshold} {}
+
+    // MARK: Spill State
+
+    /// Returns the spill threshold in bytes.
+    [[nodiscard]]
+    std::size_t threshold() const noexcept {
+        return threshold_;
+    }
+
+    /// Returns `true` if the contents have spilled to a temporary file.
+    [[nodiscard]]
+    bool spilled() const noexcept {
+        return static_cast<bool>(file_);
+    }
+
+    /// Returns the number of bytes of memory currently held for the contents.
+    [[nodiscard]]
+    std::size_t memory_usage() const noexcept {
+        return buffer_.capacity();
+    }
+
+    /// Returns the largest number of bytes of memory held for the contents.
+    [[nodiscard]]
+    std::size_t peak_memory_usage() const noexcept {
+        return peak_;
+    }
+
+    /// Moves the contents to a temporary file if they have not spilled already.
+    /// - returns: `true` on success, `false` otherwise.
+    bool spill() noexcept {
+        if (file_) {
+            return true;
+        }
+        auto file = cstream::tmpfile();
+        if (!file || file.fwrite(buffer_.data(), 1, buffer_.size()) != buffer_.size() ||
+            file.fseek(static_cast<long>(position_), SEEK_SET) != 0) {
+            error_ = true;
+            return false;
+        }
+        file_ = std::move(file);
+        std::vector<unsigned char>{}.swap(buffer_);
+        reservation_.reset();
+        position_ = 0;
+        return true;
+    }
+
+    // MARK: Direct Input/Output
+
+    using input_extensions<spill_stream>::fread;
+    using output_extensions<spill_stream>::fwrite;
+
+    /// Reads up to `count` objects of `size` bytes into `buffer`.
+    /// - returns: The number of objects read.
+    std::size_t fread(void *buffer, std::size_t size, std::size_t count) noexcept {
+        if (file_) {
+            return file_.fread(buffer, size, count);
+        }
+        if (size == 0 || count == 0) {
+            return 0;
+        }
+        auto available = position_ < buffer_.size() ? (buffer_.size() - position_) / size : 0;
+        if (available < count) {
+            count = available;
+            eof_ = true;
+        }
+        if (count > 0) {
+            std::memcpy(buffer, buffer_.data() + position_, size * count);
+            position_ += size * count;
+        }
+        return count;
+    }
+
+    /// Writes `count` objects of `size` bytes from `buffer`.
+    /// - returns: The number of objects written.
+    std::size_t fwrite(const void *buffer, std::size_t size, std::size_t count) noexcept {
+        if (file_) {
+            return file_.fwrite(buffer, size, count);
+        }
+        if (size == 0 || count == 0) {
+            return 0;
+        }
+        auto length = size * count;
+        auto end = position_ + length;
+        // Spill early if the memory budget cannot cover the growth
+        if (end > threshold_ || !reserve(end)) {
+            return spill() ? file_.fwrite(buffer, size, count) : 0;
+        }
+        std::memcpy(buffer_.data() + position_, buffer, length);
+        position_ = end;
+        return count;
+    }
+
+    // MARK: Unformatted Input/Output
+
+    /// Returns the next byte as an `unsigned char` converted to `int`, or `EOF`.
+    [[nodiscard]]
+    int fgetc() noexcept {
+        if (file_) {
+            return file_.fgetc();
+        }
+        unsigned char ch;
+        return fread(&ch, 1, 1) == 1 ? ch : EOF;
+    }
+
+    /// Writes `ch` converted to `unsigned char` and returns it, or `EOF` on failure.
+    int fputc(int ch) noexcept {
+        if (file_) {
+            return file_.fputc(ch);
+        }
+        auto c = static_cast<unsigned char>(ch);
+        return fwrite(&c, 1, 1) == 1 ? c : EOF;
+    }
+
+    /// Writes the null-terminated string `str`.
+    /// - returns: A nonnegative value on success, `EOF` otherwise.
+    int fputs(const char *str) noexcept {
+        if (file_) {
+            return file_.fputs(str);
+        }
+        auto length = std::strlen(str);
+        return fwrite(str, 1, length) == length ? 0 : EOF;
+    }
+
+    /// Flushes the temporary file, if any.
+    /// - returns: `0` on success, `EOF` otherwise.
+    int fflush() noexcept { return file_ ? file_.fflush() : 0; }
+
+    // MARK: File Positioning
+
+    /// Returns the current position.
+    [[nodiscard]]
+    long ftell() const noexcept {
+        return file_ ? file_.ftell() : static_cast<long>(position_);
+    }
+
+    /// Sets the current position.
+    /// - returns: `0` on success, nonzero otherwise.
+    int fseek(long offset, int origin) noexcept {
+        if (file_) {
+            return file_.fseek(offset, origin);
+        }
+        long base;
+        switch (origin) {
+        case SEEK_SET:
+            base = 0;
+            break;
+        case SEEK_CUR:
+            base = static_cast<long>(position_);
+            break;
+        case SEEK_END:
+            base = static_cast<long>(buffer_.size());
+            break;
+        default:
+            return -1;
+        }
+        if (offset < -base) {
+            return -1;
+        }
+        position_ = static_cast<std::size_t>(base + offset);
+        eof_ = false;
+        return 0;
+    }
+
+    /// Sets the current position to the beginning of the stream and clears the error indicators.
+    void rewind() noexcept {
+        fseek(0, SEEK_SET);
+        clearerr();
+    }
+
+    // MARK: Error Handling
+
+    /// Clears the end-of-file and error indicators.
+    void clearerr() noexcept {
+        if (file_) {
+            file_.clearerr();
+        }
+        eof_ = false;
+        error_ = false;
+    }
+
+    /// Returns nonzero if a read has reached the end of the stream.
+    [[nodiscard]]
+    int feof() const noexcept {
+        return file_ ? file_.feof() : eof_;
+    }
+
+    /// Returns nonzero if an error has occurred.
+    [[nodiscard]]
+    int ferror() const noexcept {
+        return error_ || (file_ && file_.ferror());
+    }
+
+  private:
+    /// Extends the contents to `size` bytes, zero-filling as a file would and growing geometrically up to the
+    /// threshold.
+    /// - returns: `false` if the memory could not be reserved from the governor or allocated.
+    bool reserve(std::size_t size) noexcept {
+        if (size > buffer_.size()) {
+            auto capacity = std::min(std::max(size, 2 * buffer_.capacity()), threshold_);
+            if (capacity > reservation_.size() && !reservation_.resize(capacity) &&
+                !reservation_.resize(std::max(size, buffer_.capacity()))) {
+                return false;
+            }
+            try {
+                buffer_.reserve(reservation_.size());
+                buffer_.resize(size);
+            } catch (const std::bad_alloc &) {
+                reservation_.resize(buffer_.capacity());
+                return false;
+            }
+            peak_ = std::max(peak_, buffer_.capacity());
+        }
+        return true;
+    }
+
+    /// The spill threshold in bytes.
+    std::size_t threshold_{default_threshold};
+    /// The in-memory contents.
+    std::vector<unsigned char> buffer_;
+    /// The memory reserved from the governor for `buffer_`.
+    memory_reservation reservation_;
+    /// The current position in the in-memory contents.
+    std::size_t position_{0};
+    /// The largest capacity of `buffer_`.
+    std::size_t peak_{0};
+    /// Whether a read has reached the end of the in-memory contents.
+    bool eof_{false};
+    /// Whether an in-memory operation has failed.
+    bool error_{false};
+    /// The temporary file once the contents have spilled.
+    cstream file_;
+};
+
+} /* namespace cio */
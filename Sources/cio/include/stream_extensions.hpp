@@ -0,0 +1,192 @@
+//
+// SPDX-FileCopyrightText: 2024 Stephen F. Booth <contact@sbooth.dev>
+// SPDX-License-Identifier: MIT
+//
+// Part of https://github.com/sbooth/cio
+//
+
+#import <algorithm>
+#import <cstdint>
+#import <optional>
+#import <type_traits>
+#import <vector>
+
+#import "bitpack.hpp"
+#import "cstream.hpp"
+
+namespace cio {
+
+/// A mixin providing the `cio::cstream` typed input extensions for a stream-like class.
+///
+/// `Derived` must provide `std::size_t fread(void *buffer, std::size_t size, std::size_t count)` and bring the
+/// overloads declared here into scope with `using input_extensions<Derived>::fread;`.
+template <typename Derived> class input_extensions {
+  public:
+    /// Possible byte orders.
+    using byte_order = cstream::byte_order;
+
+    /// Returns the result of `fread(buffer, sizeof(T), count)`.
+    template <typename T, typename = std::enable_if_t<std::is_trivially_copyable_v<T>>>
+    std::size_t fread(T *buffer, std::size_t count) noexcept {
+        return derived().fread(static_cast<void *>(buffer), sizeof(T), count);
+    }
+
+    /// Returns the result of `fread(buffer, S)`.
+    template <typename T, std::size_t S> std::size_t fread(T (&buffer)[S]) noexcept { return fread(buffer, S); }
+
+    /// Returns the result of `fread(&value, 1) == 1`.
+    template <typename T> bool fread(T &value) noexcept { return fread(&value, 1) == 1; }
+
+    /// Reads a block of data.
+    /// - parameter count: The maximum number of elements to read.
+    /// - returns: A `std::vector` containing the requested elements.
+    /// - throws: Any exception thrown by `Allocator::allocate()` (typically `std::bad_alloc`)
+    /// - throws: `std::length_error`
+    template <typename T> std::vector<T> read_block(typename std::vector<T>::size_type count) {
+        if (count == 0) {
+            return {};
+        }
+        std::vector<T> buf(count);
+        buf.resize(fread(buf.data(), count));
+        return buf;
+    }
+
+    /// Gets a value.
+    /// - returns: The value read or `std::nullopt` on failure.
+    template <typename T, typename = std::enable_if_t<std::is_trivially_default_constructible_v<T>>>
+    std::optional<T> get_value() noexcept(std::is_nothrow_default_constructible_v<T>) {
+        T value{};
+        if (!fread(value)) {
+            return std::nullopt;
+        }
+        return value;
+    }
+
+    /// Reads an unsigned integer value in the specified byte order.
+    /// - parameter value: A reference to receive the value.
+    /// - parameter order: The desired byte order.
+    /// - returns: `true` on success, `false` otherwise.
+    template <typename T,
+              typename = std::enable_if_t<std::is_same_v<T, std::uint16_t> || std::is_same_v<T, std::uint32_t> ||
+                                          std::is_same_v<T, std::uint64_t>>>
+    bool read_uint(T &value, byte_order order = byte_order::host) noexcept {
+        if (!fread(value)) {
+            return false;
+        }
+        value = cstream::swap_to_host(value, order);
+        return true;
+    }
+
+    /// Reads an unsigned integer value in little-endian byte order.
+    /// - parameter value: A reference to receive the value.
+    /// - returns: `true` on success, `false` otherwise.
+    template <typename T> bool read_uint_little(T &value) noexcept {
+        return read_uint(value, byte_order::little_endian);
+    }
+
+    /// Reads an unsigned integer value in big-endian byte order.
+    /// - parameter value: A reference to receive the value.
+    /// - returns: `true` on success, `false` otherwise.
+    template <typename T> bool read_uint_big(T &value) noexcept { return read_uint(value, byte_order::big_endian); }
+
+    /// Reads an unsigned integer value with swapped byte order.
+    /// - parameter value: A reference to receive the value.
+    /// - returns: `true` on success, `false` otherwise.
+    template <typename T> bool read_uint_swapped(T &value) noexcept { return read_uint(value, byte_order::swapped); }
+
+    /// Reads unsigned integers written by `cio::output_extensions::write_packed_uints()`.
+    /// - parameter v: A `std::vector` to receive the values.
+    /// - returns: `true` on success, `false` if the data is malformed or truncated or a read failed.
+    /// - throws: Any exception thrown by `Allocator::allocate()` (typically `std::bad_alloc`)
+    /// - throws: `std::length_error`
+    bool read_packed_uints(std::vector<std::uint32_t> &v) { return bitpack::read(derived(), v); }
+
+  private:
+    /// Returns this object as `Derived`.
+    Derived &derived() noexcept { return static_cast<Derived &>(*this); }
+};
+
+/// A mixin providing the `cio::cstream` typed output extensions for a stream-like class.
+///
+/// `Derived` must provide `std::size_t fwrite(const void *buffer, std::size_t size, std::size_t count)` and bring the
+/// overloads declared here into scope with `using output_extensions<Derived>::fwrite;`.
+template <typename Derived> class output_extensions {
+  public:
+    /// Possible byte orders.
+    using byte_order = cstream::byte_order;
+
+    /// Returns the result of `fwrite(buffer, sizeof(T), count)`.
+    template <typename T, typename = std::enable_if_t<std::is_trivially_copyable_v<T>>>
+    std::size_t fwrite(const T *buffer, std::size_t count) noexcept {
+        return derived().fwrite(static_cast<const void *>(buffer), sizeof(T), count);
+    }
+
+    /// Returns the result of `fwrite(buffer, S)`.
+    template <typename T, std::size_t S> std::size_t fwrite(const T (&buffer)[S]) noexcept { return fwrite(buffer, S); }
+
+    /// Returns the result of `fwrite(&value, 1) == 1`.
+    template <typename T> bool fwrite(const T &value) noexcept { return fwrite(&value, 1) == 1; }
+
+    /// Writes a block of data.
+    /// - parameter v: A `std::vector` containing the elements to write.
+    /// - returns: The number of elements written.
+    template <typename T> typename std::vector<T>::size_type write_block(const std::vector<T> &v) noexcept {
+        return static_cast<typename std::vector<T>::size_type>(fwrite(v.data(), v.size()));
+    }
+
+    /// Writes an unsigned integer value in the specified byte order.
+    /// - parameter value: The value to write.
+    /// - parameter order: The desired byte order.
+    /// - returns: `true` on success, `false` otherwise.
+    template <typename T,
+              typename = std::enable_if_t<std::is_same_v<T, std::uint16_t> || std::is_same_v<T, std::uint32_t> ||
+                                          std::is_same_v<T, std::uint64_t>>>
+    bool write_uint(const T &value, byte_order order = byte_order::host) noexcept {
+        return fwrite(cstream::swap_from_host(value, order));
+    }
+
+    /// Writes an unsigned integer value in little-endian byte order.
+    /// - parameter value: The value to write.
+    /// - returns: `true` on success, `false` otherwise.
+    template <typename T> bool write_uint_little(const T &value) noexcept {
+        return write_uint(value, byte_order::little_endian);
+    }
+
+    /// Writes an unsigned integer value in big-endian byte order.
+    /// - parameter value: The value to write.
+    /// - returns: `true` on success, `false` otherwise.
+    template <typename T> bool write_uint_big(const T &value) noexcept {
+        return write_uint(value, byte_order::big_endian);
+    }
+
+    /// Writes an unsigned integer value with swapped byte order.
+    /// - parameter value: The value to write.
+    /// - returns: `true` on success, `false` otherwise.
+    template <typename T> bool write_uint_swapped(const T &value) noexcept {
+        return write_uint(value, byte_order::swapped);
+    }
+
+    /// Writes unsigned integers compressed with delta coding and bit-packing.
+    ///
+    /// The count is written as a little-endian `uint64_t` followed by the values encoded as described in
+    /// `cio::bitpack`. Sorted values with small gaps compress best.
+    /// - parameter values: The values to write.
+    /// - parameter count: The number of values.
+    /// - returns: `true` on success, `false` otherwise.
+    bool write_packed_uints(const std::uint32_t *values, std::size_t count) noexcept {
+        return bitpack::write(derived(), values, count);
+    }
+
+    /// Writes unsigned integers compressed with delta coding and bit-packing.
+    /// - parameter v: A `std::vector` containing the values to write.
+    /// - returns: `true` on success, `false` otherwise.
+    bool write_packed_uints(const std::vector<std::uint32_t> &v) noexcept {
+        return write_packed_uints(v.data(), v.size());
+    }
+
+  private:
+    /// Returns this object as `Derived`.
+    Derived &derived() noexcept { return static_cast<Derived &>(*this); }
+};
+
+} /* namespace cio */
@@ -0,0 +1,297 @@
+//
+// SPDX-FileCopyrightText: 2024 Stephen F. Booth <contact@sbooth.dev>
+// SPDX-License-Identifier: MIT
+//
+// Part of https://github.com/sbooth/cio
+//
+
+#import <cerrno>
+#import <cstddef>
+#import <functional>
+#import <optional>
+#import <string>
+#import <string_view>
+#import <vector>
+
+#import <fcntl.h>
+#import <poll.h>
+#import <unistd.h>
+
+#if defined(__linux__)
+#import <sys/epoll.h>
+#endif
+
+#import "cstream.hpp"
+
+namespace cio {
+
+/// An event loop reading many pipe, FIFO or socket streams from a single thread.
+///
+/// Each added stream is switched to non-blocking mode and watched with `epoll(7)` on Linux or `poll(2)` elsewhere.
+/// Data is read directly from the file descriptor, bypassing the stdio buffer, and delivered to a handler either as
+/// complete lines or as chunks as it arrives. Each stream keeps its own buffer for an incomplete line.
+///
+/// Streams must not be read through stdio while they are registered. The multiplexer does not own the streams.
+class stream_multiplexer {
+  public:
+    /// Possible delivery modes.
+    enum class delivery {
+        /// Data is delivered one complete line at a time, including the newline.
+        lines,
+        /// Data is delivered as it is read.
+        chunks,
+    };
+
+    /// A function receiving data for the stream with identifier `id`.
+    ///
+    /// When a stream reaches end of file any incomplete final line is delivered, followed by a call with empty `data`
+    /// and `eof` set, after which the stream is removed.
+    ///
+    /// The handler may call `add()` and `remove()`. A stream removed by the handler receives no further calls, even
+    /// for lines already read. The handler must not call `poll()` or `run()`.
+    using handler = std::function<void(std::size_t id, std::string_view data, bool eof)>;
+
+    /// The default size of the shared read buffer in bytes.
+    static constexpr std::size_t default_buffer_size = 64 * 1024;
+
+    /// The default length at which an incomplete line is delivered as is.
+    static constexpr std::size_t default_max_line_length = 1024 * 1024;
+
+    // This class is non-copyable.
+    stream_multiplexer(const stream_multiplexer &rhs) = delete;
+
+    // This class is non-assignable.
+    stream_multiplexer &operator=(const stream_multiplexer &rhs) = delete;
+
+    /// Initializes a `cio::stream_multiplexer` object.
+    /// - parameter mode: The delivery mode.
+    /// - parameter max_line_length: In line mode, the length at which an incomplete line is delivered as is.
+    /// - throws: Any exception thrown by `Allocator::allocate()` (typically `std::bad_alloc`)
+    explicit stream_multiplexer(delivery mode = delivery::lines,
+                                std::size_t max_line_length = default_max_line_length)
+        : mode_{mode}, max_line_length_{max_line_length}, buffer_(default_buffer_size) {
+#if defined(__linux__)
+        epoll_fd_ = ::epoll_create1(EPOLL_CLOEXEC);
+#endif
+    }
+
+    /// Closes the event loop without closing the streams.
+    ~stream_multiplexer() noexcept {
+#if defined(__linux__)
+        if (epoll_fd_ != -1) {
+            ::close(epoll_fd_);
+        }
+#endif
+    }
+
+    /// Returns `true` if the event loop was created successfully.
+    [[nodiscard]]
+    explicit operator bool() const noexcept {
+#if defined(__linux__)
+        return epoll_fd_ != -1;
+#else
+        return true;
+#endif
+    }
+
+    /// Returns the number of streams that have not reached end of file.
+    [[nodiscard]]
+    std::size_t active() const noexcept {
+        return active_;
+    }
+
+    /// Adds the file descriptor underlying `stream`.
+    /// - returns: An identifier for the stream, or `std::nullopt` on failure with `errno` set.
+    /// - throws: Any exception thrown by `Allocator::allocate()` (typically `std::bad_alloc`)
+    std::optional<std::size_t> add(cstream &stream) { return add(stream.fileno()); }
+
+    /// Adds `fd`.
+    /// - returns: An identifier for the stream, or `std::nullopt` on failure with `errno` set.
+    /// - throws: Any exception thrown by `Allocator::allocate()` (typically `std::bad_alloc`)
+    std::optional<std::size_t> add(int fd) {
+        auto flags = ::fcntl(fd, F_GETFL);
+        if (flags == -1 || ::fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1) {
+            return std::nullopt;
+        }
+        auto id = sources_.size();
+        sources_.push_back({fd, {}, true});
+#if defined(__linux__)
+        struct epoll_event event{};
+        event.events = EPOLLIN;
+        event.data.u64 = id;
+        if (::epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &event) == -1) {
+            sources_.back().open = false;
+            return std::nullopt;
+        }
+#endif
+        ++active_;
+        return id;
+    }
+
+    /// Stops watching the stream with identifier `id` and discards its buffered data.
+    void remove(std::size_t id) noexcept {
+        if (id >= sources_.size() || !sources_[id].open) {
+            return;
+        }
+#if defined(__linux__)
+        ::epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, sources_[id].fd, nullptr);
+#endif
+        sources_[id].open = false;
+        sources_[id].pending.clear();
+        --active_;
+    }
+
+    /// Waits up to `timeout` milliseconds for data and delivers it to `handle`.
+    /// - parameter handle: The function receiving data.
+    /// - parameter timeout: The maximum time to wait in milliseconds, or `-1` to wait indefinitely.
+    /// - returns: The number of streams serviced, or `-1` on failure with `errno` set.
+    /// - throws: Any exception thrown by `handle` or by `Allocator::allocate()` (typically `std::bad_alloc`)
+    int poll(const handler &handle, int timeout = -1) {
+        if (active_ == 0) {
+            return 0;
+        }
+#if defined(__linux__)
+        struct epoll_event events[64];
+        auto n = ::epoll_wait(epoll_fd_, events, 64, timeout);
+        if (n == -1) {
+            return errno == EINTR ? 0 : -1;
+        }
+        for (int i = 0; i < n; ++i) {
+            service(static_cast<std::size_t>(events[i].data.u64), handle);
+        }
+        return n;
+#else
+        std::vector<struct pollfd> fds;
+        std::vector<std::size_t> ids;
+        for (std::size_t id = 0; id < sources_.size(); ++id) {
+            if (sources_[id].open) {
+                fds.push_back({sources_[id].fd, POLLIN, 0});
+                ids.push_back(id);
+            }
+        }
+        auto n = ::poll(fds.data(), static_cast<nfds_t>(fds.size()), timeout);
+        if (n == -1) {
+            return errno == EINTR ? 0 : -1;
+        }
+        for (std::size_t i = 0; i < fds.size(); ++i) {
+            if (fds[i].revents) {
+                service(ids[i], handle);
+            }
+        }
+        return n;
+#endif
+    }
+
+    /// Delivers data to `handle` until every stream has reached end of file.
+    /// - returns: `true` on success, `false` otherwise with `errno` set.
+    /// - throws: Any exception thrown by `handle` or by `Allocator::allocate()` (typically `std::bad_alloc`)
+    bool run(const handler &handle) {
+        while (active_ > 0) {
+            if (poll(handle) == -1) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+  private:
+    /// A watched stream.
+    struct source {
+        /// The file descriptor.
+        int fd;
+        /// Buffered data not yet delivered in line mode.
+        std::string pending;
+        /// Whether the stream is still watched.
+        bool open;
+    };
+
+    /// Reads available data from the stream with identifier `id` and delivers it.
+    void service(std::size_t id, const handler &handle) {
+        // Bound the reads per wakeup so a fast producer cannot starve the others
+        for (int reads = 0; reads < 16 && sources_[id].open; ++reads) {
+            auto n = ::read(sources_[id].fd, buffer_.data(), buffer_.size());
+            if (n > 0) {
+                deliver(id, {buffer_.data(), static_cast<std::size_t>(n)}, handle);
+                if (static_cast<std::size_t>(n) < buffer_.size()) {
+                    return;
+                }
+            } else if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+                finish(id, handle);
+                return;
+            } else if (errno != EINTR) {
+                return;
+            }
+        }
+    }
+
+    /// Delivers `data` read from the stream with identifier `id`.
+    ///
+    /// `sources_` is indexed afresh after every call to `handle`, which may add streams and so reallocate it, or remove
+    /// the stream being delivered.
+    void deliver(std::size_t id, std::string_view data, const handler &handle) {
+        if (mode_ == delivery::chunks) {
+            handle(id, data, false);
+            return;
+        }
+
+        std::size_t start = 0;
+        for (auto newline = data.find('\n'); newline != std::string_view::npos && sources_[id].open;
+             newline = data.find('\n', start)) {
+            auto line = data.substr(start, newline + 1 - start);
+            start = newline + 1;
+            if (sources_[id].pending.empty()) {
+                handle(id, line, false);
+            } else {
+                sources_[id].pending.append(line);
+                deliver_pending(id, handle);
+            }
+        }
+        if (!sources_[id].open) {
+            return;
+        }
+        sources_[id].pending.append(data.substr(start));
+        if (sources_[id].pending.size() >= max_line_length_) {
+            deliver_pending(id, handle);
+        }
+    }
+
+    /// Delivers and clears the buffered data of the stream with identifier `id`.
+    void deliver_pending(std::size_t id, const handler &handle) {
+        // Deliver from a local string, which stays put if the handler reallocates `sources_`
+        std::string line;
+        line.swap(sources_[id].pending);
+        handle(id, line, false);
+        if (sources_[id].open) {
+            // Keep the buffer's capacity for the next line
+            line.clear();
+            line.swap(sources_[id].pending);
+        }
+    }
+
+    /// Delivers any incomplete line and the end-of-file notification for the stream with identifier `id`.
+    void finish(std::size_t id, const handler &handle) {
+        auto pending = std::move(sources_[id].pending);
+        remove(id);
+        if (!pending.empty()) {
+            handle(id, pending, false);
+        }
+        handle(id, {}, true);
+    }
+
+    /// The delivery mode.
+    delivery mode_;
+    /// The length at which an incomplete line is delivered as is.
+    std::size_t max_line_length_;
+    /// The shared read buffer.
+    std::vector<char> buffer_;
+    /// The watched streams, indexed by identifier.
+    std::vector<source> sources_;
+    /// The number of streams that have not reached end of file.
+    std::size_t active_{0};
+#if defined(__linux__)
+    /// The epoll instance.
+    int epoll_fd_{-1};
+#endif
+};
+
+} /* namespace cio */
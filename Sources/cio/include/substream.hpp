@@ -0,0 +1,338 @@
+//
+// SPDX-FileCopyrightText: 2024 Stephen F. Booth <contact@sbooth.dev>
+// SPDX-License-Identifier: MIT
+//
+// Part of https://github.com/sbooth/cio
+//
+
+#import <algorithm>
+#import <cerrno>
+#import <cstdint>
+#import <cstdio>
+#import <cstring>
+
+#import <unistd.h>
+
+#import "buffer_pool.hpp"
+#import "cstream.hpp"
+#import "stream_extensions.hpp"
+
+namespace cio {
+
+/// A read-only view of a byte range of a file.
+///
+/// A substream reads with `pread(2)` and keeps its own position and buffer, so any number of substreams over the
+/// same descriptor may be used concurrently from different threads without sharing stdio state. Reads never extend
+/// past the end of the range.
+///
+/// A substream does not own the descriptor, which must remain open while the substream is in use. Data written
+/// through the base stream must be flushed before it is visible to a substream.
+class substream : public input_extensions<substream> {
+  public:
+    /// The default buffer size in bytes.
+    static constexpr std::size_t default_buffer_size = 64 * 1024;
+
+    // MARK: Standard Six
+
+    /// Initializes an empty `cio::substream` object.
+    substream() noexcept = default;
+
+    // This class is non-copyable.
+    substream(const substream &rhs) = delete;
+
+    // This class is non-assignable.
+    substream &operator=(const substream &rhs) = delete;
+
+    /// Initializes a `cio::substream` object with the range and state of `rhs`.
+    substream(substream &&rhs) noexcept = default;
+
+    /// Replaces the range and state of this object with those of `rhs`.
+    substream &operator=(substream &&rhs) noexcept = default;
+
+    /// Destroys the substream without closing the descriptor.
+    ~substream() noexcept = default;
+
+    // MARK: Construction
+
+    /// Initializes a `cio::substream` object for `length` bytes of `fd` starting at `offset`.
+    /// - parameter fd: The file descriptor to read.
+    /// - parameter offset: The offset of the first byte of the range.
+    /// - parameter length: The length of the range in bytes.
+    /// - parameter buffer_size: The buffer size in bytes, or `0` for unbuffered reads.
+    substream(int fd, std::uint64_t offset, std::uint64_t length,
+              std::size_t buffer_size = default_buffer_size) noexcept
+        : fd_{fd}, offset_{offset}, length_{length}, buffer_size_{buffer_size} {}
+
+    /// Initializes a `cio::substream` object for `length` bytes of the file underlying `base` starting at `offset`.
+    /// - parameter base: The stream whose file to read.
+    /// - parameter offset: The offset of the first byte of the range.
+    /// - parameter length: The length of the range in bytes.
+    /// - parameter buffer_size: The buffer size in bytes, or `0` for unbuffered reads.
+    substream(const cstream &base, std::uint64_t offset, std::uint64_t length,
+              std::size_t buffer_size = default_buffer_size) noexcept
+        : substream{base.fileno(), offset, length, buffer_size} {}
+
+    // MARK: Range Handling
+
+    /// Returns `true` if the substream refers to a descriptor.
+    [[nodiscard]]
+    explicit operator bool() const noexcept {
+        return fd_ != -1;
+    }
+
+    /// Returns the file descriptor.
+    [[nodiscard]]
+    int fileno() const noexcept {
+        return fd_;
+    }
+
+    /// Returns the offset of the range in the file.
+    [[nodiscard]]
+    std::uint64_t offset() const noexcept {
+        return offset_;
+    }
+
+    /// Returns the length of the range in bytes.
+    [[nodiscard]]
+    std::uint64_t size() const noexcept {
+        return length_;
+    }
+
+    /// Returns a substream for `length` bytes of this substream starting at `offset`, clamped to this range.
+    [[nodiscard]]
+    substream subrange(std::uint64_t offset, std::uint64_t length) const noexcept {
+        offset = std::min(offset, length_);
+        return {fd_, offset_ + offset, std::min(length, length_ - offset), buffer_size_};
+    }
+
+    // MARK: Direct Input
+
+    using input_extensions<substream>::fread;
+
+    /// Reads up to `count` objects of `size` bytes into `buffer`.
+    /// - returns: The number of complete objects read.
+    std::size_t fread(void *buffer, std::size_t size, std::size_t count) noexcept {
+        if (size == 0 || count == 0) {
+            return 0;
+        }
+        auto dst = static_cast<unsigned char *>(buffer);
+        auto requested = size * count;
+        auto wanted = static_cast<std::size_t>(std::min<std::uint64_t>(requested, length_ - position_));
+        std::size_t total = 0;
+
+        // Drain buffered bytes first
+        if (buffer_begin_ < buffer_end_) {
+            auto n = std::min(wanted, buffer_end_ - buffer_begin_);
+            std::memcpy(dst, buffer_.data() + buffer_begin_, n);
+            buffer_begin_ += n;
+            position_ += n;
+            total += n;
+            release_if_drained();
+        }
+
+        while (total < wanted) {
+            auto remaining = wanted - total;
+            if (remaining >= buffer_size_ || !borrow()) {
+                // Large reads, and reads without a buffer, go directly to the destination
+                auto n = pread_fully(dst + total, remaining, position_);
+                position_ += n;
+                total += n;
+                if (n < remaining) {
+                    break;
+                }
+            } else {
+                if (!fill()) {
+                    break;
+                }
+                auto n = std::min(remaining, buffer_end_ - buffer_begin_);
+                std::memcpy(dst + total, buffer_.data() + buffer_begin_, n);
+                buffer_begin_ += n;
+                position_ += n;
+                total += n;
+                release_if_drained();
+            }
+        }
+
+        if (total < requested && !error_) {
+            eof_ = true;
+        }
+        return total / size;
+    }
+
+    // MARK: Unformatted Input
+
+    /// Returns the next byte as an `unsigned char` converted to `int`, or `EOF`.
+    [[nodiscard]]
+    int fgetc() noexcept {
+        if (buffer_begin_ < buffer_end_) {
+            ++position_;
+            auto ch = buffer_.data()[buffer_begin_++];
+            release_if_drained();
+            return ch;
+        }
+        unsigned char ch;
+        return fread(&ch, 1, 1) == 1 ? ch : EOF;
+    }
+
+    /// Reads at most `count - 1` bytes into `str`, stopping after a newline, and null-terminates the result.
+    /// - returns: `str` on success, `nullptr` if no bytes were read.
+    char *fgets(char *str, int count) noexcept {
+        if (count <= 0) {
+            return nullptr;
+        }
+        int i = 0;
+        while (i < count - 1) {
+            auto ch = fgetc();
+            if (ch == EOF) {
+                break;
+            }
+            str[i++] = static_cast<char>(ch);
+            if (ch == '\n') {
+                break;
+            }
+        }
+        if (i == 0) {
+            return nullptr;
+        }
+        str[i] = '\0';
+        return str;
+    }
+
+    /// Returns the result of `fgets(str, S)`.
+    template <std::size_t S> char *fgets(char (&str)[S]) noexcept { return fgets(str, S); }
+
+    // MARK: File Positioning
+
+    /// Returns the current position relative to the start of the range.
+    [[nodiscard]]
+    long ftell() const noexcept {
+        return static_cast<long>(position_);
+    }
+
+    /// Sets the current position relative to the start of the range.
+    /// - returns: `0` on success, `-1` if the position would fall outside the range.
+    int fseek(long offset, int origin) noexcept {
+        long base;
+        switch (origin) {
+        case SEEK_SET:
+            base = 0;
+            break;
+        case SEEK_CUR:
+            base = static_cast<long>(position_);
+            break;
+        case SEEK_END:
+            base = static_cast<long>(length_);
+            break;
+        default:
+            return -1;
+        }
+        if (offset < -base || base + offset > static_cast<long>(length_)) {
+            return -1;
+        }
+        auto position = static_cast<std::uint64_t>(base + offset);
+        // Keep the buffer if the new position falls within it
+        auto buffer_start = position_ - buffer_begin_;
+        if (position >= buffer_start && position < buffer_start + buffer_end_) {
+            buffer_begin_ = static_cast<std::size_t>(position - buffer_start);
+        } else {
+            buffer_begin_ = buffer_end_;
+            release_if_drained();
+        }
+        position_ = position;
+        eof_ = false;
+        return 0;
+    }
+
+    /// Sets the current position to the start of the range and clears the error indicators.
+    void rewind() noexcept {
+        fseek(0, SEEK_SET);
+        clearerr();
+    }
+
+    // MARK: Error Handling
+
+    /// Clears the end-of-file and error indicators.
+    void clearerr() noexcept {
+        eof_ = false;
+        error_ = false;
+    }
+
+    /// Returns nonzero if a read has reached the end of the range.
+    [[nodiscard]]
+    int feof() const noexcept {
+        return eof_;
+    }
+
+    /// Returns nonzero if an error has occurred.
+    [[nodiscard]]
+    int ferror() const noexcept {
+        return error_;
+    }
+
+  private:
+    /// Reads up to `size` bytes at `position` in the range with `pread(2)`, retrying short and interrupted reads.
+    std::size_t pread_fully(unsigned char *buffer, std::size_t size, std::uint64_t position) noexcept {
+        std::size_t total = 0;
+        while (total < size) {
+            auto n = ::pread(fd_, buffer + total, size - total, static_cast<off_t>(offset_ + position + total));
+            if (n > 0) {
+                total += static_cast<std::size_t>(n);
+            } else if (n == 0) {
+                break;
+            } else if (errno != EINTR) {
+                error_ = true;
+                break;
+            }
+        }
+        return total;
+    }
+
+    /// Borrows a buffer from the pool if none is held.
+    /// - returns: `true` if a buffer is held.
+    bool borrow() noexcept {
+        if (!buffer_) {
+            buffer_ = buffer_pool::shared().acquire(buffer_size_);
+        }
+        return static_cast<bool>(buffer_);
+    }
+
+    /// Refills the borrowed buffer at the current position.
+    bool fill() noexcept {
+        auto wanted = static_cast<std::size_t>(std::min<std::uint64_t>(buffer_size_, length_ - position_));
+        buffer_begin_ = 0;
+        buffer_end_ = pread_fully(buffer_.data(), wanted, position_);
+        release_if_drained();
+        return buffer_end_ > 0;
+    }
+
+    /// Returns the buffer to the pool once all of its bytes have been read.
+    void release_if_drained() noexcept {
+        if (buffer_begin_ == buffer_end_) {
+            buffer_.reset();
+            buffer_begin_ = buffer_end_ = 0;
+        }
+    }
+
+    /// The file descriptor.
+    int fd_{-1};
+    /// The offset of the range in the file.
+    std::uint64_t offset_{0};
+    /// The length of the range in bytes.
+    std::uint64_t length_{0};
+    /// The current position relative to the start of the range.
+    std::uint64_t position_{0};
+    /// The buffer size in bytes.
+    std::size_t buffer_size_{default_buffer_size};
+    /// The read buffer, borrowed from the pool while it holds unread bytes.
+    pooled_buffer buffer_;
+    /// The offset of the next unread byte in `buffer_`.
+    std::size_t buffer_begin_{0};
+    /// The number of valid bytes in `buffer_`.
+    std::size_t buffer_end_{0};
+    /// Whether a read has reached the end of the range.
+    bool eof_{false};
+    /// Whether an error has occurred.
+    bool error_{false};
+};
+
+} /* namespace cio */
@@ -0,0 +1,599 @@
+//
+// SPDX-FileCopyrightText: 2024 Stephen F. Booth <contact@sbooth.dev>
+// SPDX-License-Identifier: MIT
+//
+// Part of https://github.com/sbooth/cio
+//
+
+#import <algorithm>
+#import <cstdint>
+#import <cstdio>
+#import <cstring>
+#import <limits>
+#import <new>
+#import <vector>
+
+#import "cstream.hpp"
+#import "memory_governor.hpp"
+
+namespace cio {
+
+/// The format shared by `cio::timeseries_writer` and `cio::timeseries_reader`.
+///
+/// A time series starts with the signature "CIOT", a version byte, three reserved bytes and the largest number of
+/// points in a block as a little-endian `uint32_t`. Each block follows as a little-endian `uint32_t` point count, the
+/// smallest and largest timestamps in the block as little-endian `int64_t`, a little-endian `uint32_t` payload size
+/// and the payload. A point count of `0` ends the series.
+///
+/// The payload is a bit stream, most significant bit first, compressed as in Facebook's Gorilla. The first point is
+/// stored as a raw 64-bit timestamp and value. Each following timestamp is stored as the zigzag-encoded difference
+/// between its delta and the previous delta: `0` for no change, then `10`, `110` and `1110` followed by 7, 9 and 12
+/// bits, and `1111` followed by 64 bits. Each following value is stored as its XOR with the previous value: `0` if
+/// they are equal, `10` followed by the meaningful bits if they fit the previous window of leading and trailing
+/// zeros, and otherwise `11`, 5 bits of leading zero count, 6 bits of meaningful bit count and the meaningful bits.
+struct timeseries_format {
+    /// The series signature.
+    static constexpr char magic[4] = {'C', 'I', 'O', 'T'};
+
+    /// The format version.
+    static constexpr std::uint8_t version = 1;
+
+    /// The default number of points in a block.
+    static constexpr std::size_t default_block_points = 1024;
+
+    /// The largest number of points in a block.
+    static constexpr std::size_t max_block_points = 65536;
+
+    /// The size of a block header in bytes.
+    static constexpr std::size_t block_header_size = 24;
+
+    /// Returns the largest payload size of a block of `points` points.
+    [[nodiscard]]
+    static constexpr std::size_t payload_bound(std::size_t points) noexcept {
+        // 68 bits for the worst timestamp and 77 for the worst value
+        return (points * (68 + 77) + 7) / 8 + 8;
+    }
+};
+
+/// A writer compressing (timestamp, value) points in blocks.
+///
+/// Points are collected into blocks of the configured size. Each block records the range of its timestamps so that
+/// `cio::timeseries_reader` can skip blocks outside a requested range without decompressing them. Timestamps usually
+/// increase at a near-constant interval and values change slowly, which the codec stores in a few bits per point,
+/// but any sequence of points is accepted. `finish()` writes the end marker.
+class timeseries_writer {
+  public:
+    // This class is non-copyable.
+    timeseries_writer(const timeseries_writer &rhs) = delete;
+
+    // This class is non-assignable.
+    timeseries_writer &operator=(const timeseries_writer &rhs) = delete;
+
+    /// Initializes a `cio::timeseries_writer` object that writes to `stream`.
+    /// - parameter stream: The stream to write.
+    /// - parameter block_points: The number of points in a block, clamped to between `1` and
+    /// `timeseries_format::max_block_points`. The block buffer is reserved from `cio::memory_governor::shared()`, and
+    /// a buffer the budget cannot cover is an error.
+    /// - throws: Any exception thrown by `Allocator::allocate()` (typically `std::bad_alloc`)
+    explicit timeseries_writer(cstream &stream, std::size_t block_points = timeseries_format::default_block_points)
+        : stream_{stream},
+          block_points_{std::clamp<std::size_t>(block_points, 1, timeseries_format::max_block_points)} {
+        if (!reservation_.resize(timeseries_format::payload_bound(block_points_))) {
+            error_ = true;
+            return;
+        }
+        payload_.reserve(timeseries_format::payload_bound(block_points_));
+        const unsigned char header[4] = {timeseries_format::version, 0, 0, 0};
+        error_ = stream_.fwrite(timeseries_format::magic, 1, 4) != 4 || stream_.fwrite(header, 1, 4) != 4 ||
+                 !stream_.write_uint_little(static_cast<std::uint32_t>(block_points_));
+        bytes_out_ = 12;
+    }
+
+    /// Writes the end marker if `finish()` has not been called.
+    ~timeseries_writer() noexcept {
+        if (!finished_) {
+            finish();
+        }
+    }
+
+    /// Returns `true` if no error has occurred.
+    [[nodiscard]]
+    explicit operator bool() const noexcept {
+        return !error_;
+    }
+
+    /// Returns the number of points in a block.
+    [[nodiscard]]
+    std::size_t block_points() const noexcept {
+        return block_points_;
+    }
+
+    /// Returns the number of points written.
+    [[nodiscard]]
+    std::uint64_t points_written() const noexcept {
+        return points_written_;
+    }
+
+    /// Returns the number of bytes written to the underlying stream.
+    [[nodiscard]]
+    std::uint64_t bytes_out() const noexcept {
+        return bytes_out_;
+    }
+
+    // MARK: Output
+
+    /// Appends a point.
+    /// - returns: `true` on success, `false` otherwise.
+    bool append(std::int64_t timestamp, double value) noexcept {
+        if (error_ || finished_) {
+            return false;
+        }
+        std::uint64_t bits;
+        std::memcpy(&bits, &value, sizeof bits);
+        if (count_ == 0) {
+            last_ = timestamp;
+            min_ = max_ = timestamp;
+            delta_ = 0;
+            put(static_cast<std::uint64_t>(timestamp), 64);
+            put(bits, 64);
+            leading_ = 64;
+            trailing_ = 0;
+        } else {
+            put_timestamp(timestamp);
+            put_value(bits);
+        }
+        value_ = bits;
+        min_ = std::min(min_, timestamp);
+        max_ = std::max(max_, timestamp);
+        ++points_written_;
+        if (++count_ == block_points_) {
+            return write_block();
+        }
+        return true;
+    }
+
+    /// Appends `count` points from parallel arrays.
+    /// - returns: The number of points appended.
+    std::size_t append(const std::int64_t *timestamps, const double *values, std::size_t count) noexcept {
+        for (std::size_t i = 0; i < count; ++i) {
+            if (!append(timestamps[i], values[i])) {
+                return i;
+            }
+        }
+        return count;
+    }
+
+    /// Writes any partial block and flushes the underlying stream.
+    ///
+    /// Flushing often produces small blocks and lowers the compression ratio.
+    /// - returns: `0` on success, `EOF` otherwise.
+    int fflush() noexcept {
+        if (error_ || (count_ > 0 && !write_block())) {
+            return EOF;
+        }
+        return stream_.fflush();
+    }
+
+    /// Writes any partial block and the end marker.
+    /// - returns: `true` on success, `false` otherwise.
+    bool finish() noexcept {
+        if (finished_) {
+            return !error_;
+        }
+        finished_ = true;
+        if (error_ || (count_ > 0 && !write_block())) {
+            return false;
+        }
+        error_ = !stream_.write_uint_little(std::uint32_t{0});
+        bytes_out_ += 4;
+        return !error_;
+    }
+
+  private:
+    /// Appends the low `count` bits of `value`, at most 64, to the payload.
+    void put(std::uint64_t value, unsigned count) noexcept {
+        if (count < 64) {
+            value &= (std::uint64_t{1} << count) - 1;
+        }
+        while (count > 0) {
+            auto n = std::min(count, 64 - used_);
+            // Move the top `n` of the remaining bits into the accumulator
+            auto chunk = count == n ? value : value >> (count - n);
+            accumulator_ = n == 64 ? chunk : (accumulator_ << n) | (chunk & ((std::uint64_t{1} << n) - 1));
+            used_ += n;
+            count -= n;
+            if (used_ == 64) {
+                for (int shift = 56; shift >= 0; shift -= 8) {
+                    payload_.push_back(static_cast<unsigned char>(accumulator_ >> shift));
+                }
+                accumulator_ = 0;
+                used_ = 0;
+            }
+        }
+    }
+
+    /// Appends the delta-of-delta encoding of `timestamp`.
+    void put_timestamp(std::int64_t timestamp) noexcept {
+        // Differences are computed modulo 2^64 so that no timestamps overflow
+        auto delta =
+                static_cast<std::int64_t>(static_cast<std::uint64_t>(timestamp) - static_cast<std::uint64_t>(last_));
+        auto dod = static_cast<std::uint64_t>(delta) - static_cast<std::uint64_t>(delta_);
+        auto zigzag = (dod << 1) ^ (dod >> 63 ? ~std::uint64_t{0} : 0);
+        if (zigzag == 0) {
+            put(0, 1);
+        } else if (zigzag < (1u << 7)) {
+            put(0b10, 2);
+            put(zigzag, 7);
+        } else if (zigzag < (1u << 9)) {
+            put(0b110, 3);
+            put(zigzag, 9);
+        } else if (zigzag < (1u << 12)) {
+            put(0b1110, 4);
+            put(zigzag, 12);
+        } else {
+            put(0b1111, 4);
+            put(zigzag, 64);
+        }
+        delta_ = delta;
+        last_ = timestamp;
+    }
+
+    /// Appends the XOR encoding of `bits`.
+    void put_value(std::uint64_t bits) noexcept {
+        auto x = bits ^ value_;
+        if (x == 0) {
+            put(0, 1);
+            return;
+        }
+        auto leading = static_cast<unsigned>(__builtin_clzll(x));
+        auto trailing = static_cast<unsigned>(__builtin_ctzll(x));
+        // The leading zero count is stored in 5 bits
+        leading = std::min(leading, 31u);
+        if (leading >= leading_ && trailing >= trailing_) {
+            put(0b10, 2);
+            put(x >> trailing_, 64 - leading_ - trailing_);
+            return;
+        }
+        auto meaningful = 64 - leading - trailing;
+        put(0b11, 2);
+        put(leading, 5);
+        // A meaningful bit count of 64 is stored as 0
+        put(meaningful & 63, 6);
+        put(x >> trailing, meaningful);
+        leading_ = leading;
+        trailing_ = trailing;
+    }
+
+    /// Writes the current block.
+    bool write_block() noexcept {
+        if (used_ > 0) {
+            auto bits = accumulator_ << (64 - used_);
+            for (unsigned i = 0; i < used_; i += 8) {
+                payload_.push_back(static_cast<unsigned char>(bits >> (56 - i)));
+            }
+        }
+        error_ = !stream_.write_uint_little(static_cast<std::uint32_t>(count_)) ||
+                 !stream_.write_uint_little(static_cast<std::uint64_t>(min_)) ||
+                 !stream_.write_uint_little(static_cast<std::uint64_t>(max_)) ||
+                 !stream_.write_uint_little(static_cast<std::uint32_t>(payload_.size())) ||
+                 stream_.fwrite(payload_.data(), 1, payload_.size()) != payload_.size();
+        bytes_out_ += timeseries_format::block_header_size + payload_.size();
+        payload_.clear();
+        accumulator_ = 0;
+        used_ = 0;
+        count_ = 0;
+        return !error_;
+    }
+
+    /// The underlying stream.
+    cstream &stream_;
+    /// The number of points in a block.
+    std::size_t block_points_;
+    /// The compressed points of the current block, whose capacity is the largest payload size.
+    std::vector<unsigned char> payload_;
+    /// The memory reserved from the governor for `payload_`.
+    memory_reservation reservation_;
+    /// Bits not yet appended to `payload_`.
+    std::uint64_t accumulator_{0};
+    /// The number of valid bits in `accumulator_`.
+    unsigned used_{0};
+    /// The number of points in the current block.
+    std::size_t count_{0};
+    /// The previous timestamp.
+    std::int64_t last_{0};
+    /// The previous difference between timestamps.
+    std::int64_t delta_{0};
+    /// The smallest timestamp in the current block.
+    std::int64_t min_{0};
+    /// The largest timestamp in the current block.
+    std::int64_t max_{0};
+    /// The bits of the previous value.
+    std::uint64_t value_{0};
+    /// The leading zero count of the previous XOR window.
+    unsigned leading_{64};
+    /// The trailing zero count of the previous XOR window.
+    unsigned trailing_{0};
+    /// The number of points written.
+    std::uint64_t points_written_{0};
+    /// The number of bytes written.
+    std::uint64_t bytes_out_{0};
+    /// Whether the end marker has been written.
+    bool finished_{false};
+    /// Whether an error has occurred.
+    bool error_{false};
+};
+
+/// A reader decompressing a series written by `cio::timeseries_writer`.
+///
+/// Blocks are decompressed whole as they are reached. After `set_range()` only points within the range are returned,
+/// and blocks whose timestamps all fall outside it are skipped by seeking past their payload when the underlying
+/// stream is seekable, or by reading past it otherwise.
+class timeseries_reader {
+  public:
+    // This class is non-copyable.
+    timeseries_reader(const timeseries_reader &rhs) = delete;
+
+    // This class is non-assignable.
+    timeseries_reader &operator=(const timeseries_reader &rhs) = delete;
+
+    /// Initializes a `cio::timeseries_reader` object that reads from `stream`.
+    ///
+    /// The block buffers are reserved from `cio::memory_governor::shared()`, and buffers the budget cannot cover are an
+    /// error.
+    /// - parameter stream: The stream to read, positioned at the signature.
+    /// - throws: Any exception thrown by `Allocator::allocate()` (typically `std::bad_alloc`)
+    explicit timeseries_reader(cstream &stream) : stream_{stream} {
+        unsigned char header[8];
+        std::uint32_t block_points;
+        if (stream_.fread(header, 1, sizeof header) != sizeof header ||
+            std::memcmp(header, timeseries_format::magic, 4) != 0 || header[4] != timeseries_format::version ||
+            !stream_.read_uint_little(block_points) || block_points == 0 ||
+            block_points > timeseries_format::max_block_points) {
+            error_ = true;
+            return;
+        }
+        block_points_ = block_points;
+        auto payload_size = timeseries_format::payload_bound(block_points_);
+        if (!reservation_.resize(payload_size + block_points_ * (sizeof(std::int64_t) + sizeof(double)))) {
+            error_ = true;
+            return;
+        }
+        timestamps_.reserve(block_points_);
+        values_.reserve(block_points_);
+        payload_.reserve(payload_size);
+    }
+
+    /// Returns `true` if no error has occurred.
+    [[nodiscard]]
+    explicit operator bool() const noexcept {
+        return !error_;
+    }
+
+    /// Returns the largest number of points in a block.
+    [[nodiscard]]
+    std::size_t block_points() const noexcept {
+        return block_points_;
+    }
+
+    /// Returns the number of blocks skipped without decompression.
+    [[nodiscard]]
+    std::uint64_t blocks_skipped() const noexcept {
+        return blocks_skipped_;
+    }
+
+    /// Restricts the points returned to those with timestamps between `begin` and `end` inclusive.
+    ///
+    /// The restriction applies from the next block read; the points remaining in the current block are filtered.
+    void set_range(std::int64_t begin, std::int64_t end) noexcept {
+        begin_ = begin;
+        end_ = end;
+    }
+
+    // MARK: Input
+
+    /// Reads the next point.
+    /// - returns: `true` on success, `false` at the end of the series or on error.
+    bool next(std::int64_t &timestamp, double &value) noexcept { return read(&timestamp, &value, 1) == 1; }
+
+    /// Reads up to `count` points into parallel arrays.
+    /// - returns: The number of points read.
+    std::size_t read(std::int64_t *timestamps, double *values, std::size_t count) noexcept {
+        std::size_t total = 0;
+        while (total < count) {
+            if (position_ == timestamps_.size() && !next_block()) {
+                break;
+            }
+            auto ts = timestamps_[position_];
+            if (ts >= begin_ && ts <= end_) {
+                timestamps[total] = ts;
+                values[total] = values_[position_];
+                ++total;
+            }
+            ++position_;
+        }
+        return total;
+    }
+
+    // MARK: Error Handling
+
+    /// Returns nonzero if the end of the series has been reached.
+    [[nodiscard]]
+    int feof() const noexcept {
+        return eof_;
+    }
+
+    /// Returns nonzero if the series is malformed or truncated or a read failed.
+    [[nodiscard]]
+    int ferror() const noexcept {
+        return error_;
+    }
+
+  private:
+    /// Reads blocks until one overlapping the range is decompressed.
+    /// - returns: `false` at the end of the series or on error.
+    bool next_block() noexcept {
+        timestamps_.clear();
+        values_.clear();
+        position_ = 0;
+        while (!eof_ && !error_) {
+            std::uint32_t count, size;
+            std::uint64_t min, max;
+            if (!stream_.read_uint_little(count)) {
+                error_ = true;
+                break;
+            }
+            if (count == 0) {
+                eof_ = true;
+                break;
+            }
+            if (count > block_points_ || !stream_.read_uint_little(min) || !stream_.read_uint_little(max) ||
+                !stream_.read_uint_little(size) || size > timeseries_format::payload_bound(count)) {
+                error_ = true;
+                break;
+            }
+            if (static_cast<std::int64_t>(max) < begin_ || static_cast<std::int64_t>(min) > end_) {
+                skip(size);
+                ++blocks_skipped_;
+                continue;
+            }
+            payload_.resize(size);
+            if (stream_.fread(payload_.data(), 1, size) != size || !decode(count)) {
+                error_ = true;
+                break;
+            }
+            return true;
+        }
+        return false;
+    }
+
+    /// Moves past `size` bytes of payload.
+    void skip(std::size_t size) noexcept {
+        if (stream_.fseek(static_cast<long>(size), SEEK_CUR) == 0) {
+            return;
+        }
+        // Pipes cannot seek
+        stream_.clearerr();
+        payload_.resize(size);
+        error_ = stream_.fread(payload_.data(), 1, size) != size;
+    }
+
+    /// Returns the next `count` bits, at most 64, of the payload, or sets `truncated_` if it is exhausted.
+    std::uint64_t get(unsigned count) noexcept {
+        std::uint64_t value = 0;
+        while (count > 0) {
+            if (available_ == 0) {
+                if (offset_ == payload_.size()) {
+                    truncated_ = true;
+                    return 0;
+                }
+                // Refill a byte at a time near the end, otherwise eight at once
+                if (payload_.size() - offset_ >= 8) {
+                    bits_ = 0;
+                    for (int i = 0; i < 8; ++i) {
+                        bits_ = (bits_ << 8) | payload_[offset_++];
+                    }
+                    available_ = 64;
+                } else {
+                    bits_ = static_cast<std::uint64_t>(payload_[offset_++]) << 56;
+                    available_ = 8;
+                }
+            }
+            auto n = std::min(count, available_);
+            value = n == 64 ? bits_ : (value << n) | (bits_ >> (64 - n));
+            bits_ = n == 64 ? 0 : bits_ << n;
+            available_ -= n;
+            count -= n;
+        }
+        return value;
+    }
+
+    /// Returns the number of leading `1` bits before a `0`, reading at most `limit` bits.
+    unsigned get_prefix(unsigned limit) noexcept {
+        unsigned ones = 0;
+        while (ones < limit && get(1) == 1) {
+            ++ones;
+        }
+        return ones;
+    }
+
+    /// Decompresses `count` points from `payload_`.
+    bool decode(std::size_t count) noexcept {
+        try {
+            timestamps_.resize(count);
+            values_.resize(count);
+        } catch (const std::bad_alloc &) {
+            return false;
+        }
+        offset_ = 0;
+        available_ = 0;
+        truncated_ = false;
+
+        auto timestamp = get(64);
+        auto value = get(64);
+        std::uint64_t delta = 0;
+        unsigned leading = 64, trailing = 0;
+        timestamps_[0] = static_cast<std::int64_t>(timestamp);
+        std::memcpy(&values_[0], &value, sizeof value);
+        for (std::size_t i = 1; i < count && !truncated_; ++i) {
+            static constexpr unsigned widths[] = {0, 7, 9, 12, 64};
+            if (auto width = widths[get_prefix(4)]; width > 0) {
+                auto zigzag = get(width);
+                delta += (zigzag >> 1) ^ (zigzag & 1 ? ~std::uint64_t{0} : 0);
+            }
+            timestamp += delta;
+            timestamps_[i] = static_cast<std::int64_t>(timestamp);
+
+            if (auto prefix = get_prefix(2); prefix > 0) {
+                if (prefix == 2) {
+                    leading = static_cast<unsigned>(get(5));
+                    auto meaningful = static_cast<unsigned>(get(6));
+                    trailing = 64 - leading - (meaningful == 0 ? 64 : meaningful);
+                    if (trailing > 64) {
+                        return false;
+                    }
+                } else if (leading == 64) {
+                    // A value must set a window before reusing it
+                    return false;
+                }
+                value ^= get(64 - leading - trailing) << trailing;
+            }
+            std::memcpy(&values_[i], &value, sizeof value);
+        }
+        return !truncated_;
+    }
+
+    /// The underlying stream.
+    cstream &stream_;
+    /// The largest number of points in a block.
+    std::size_t block_points_{0};
+    /// The compressed points of the current block.
+    std::vector<unsigned char> payload_;
+    /// The offset of the next unread byte in `payload_`.
+    std::size_t offset_{0};
+    /// Bits read from `payload_` but not yet consumed, most significant first.
+    std::uint64_t bits_{0};
+    /// The number of valid bits in `bits_`.
+    unsigned available_{0};
+    /// Whether decoding ran past the end of `payload_`.
+    bool truncated_{false};
+    /// The timestamps of the current block.
+    std::vector<std::int64_t> timestamps_;
+    /// The values of the current block.
+    std::vector<double> values_;
+    /// The memory reserved from the governor for `payload_`, `timestamps_` and `values_`.
+    memory_reservation reservation_;
+    /// The index of the next unread point in the current block.
+    std::size_t position_{0};
+    /// The smallest timestamp returned.
+    std::int64_t begin_{std::numeric_limits<std::int64_t>::min()};
+    /// The largest timestamp returned.
+    std::int64_t end_{std::numeric_limits<std::int64_t>::max()};
+    /// The number of blocks skipped.
+    std::uint64_t blocks_skipped_{0};
+    /// Whether the end of the series has been reached.
+    bool eof_{false};
+    /// Whether an error has occurred.
+    bool error_{false};
+};
+
+} /* namespace cio */
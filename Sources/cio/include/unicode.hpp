@@ -0,0 +1,714 @@
+//
+// SPDX-FileCopyrightText: 2024 Stephen F. Booth <contact@sbooth.dev>
+// SPDX-License-Identifier: MIT
+//
+// Part of https://github.com/sbooth/cio
+//
+
+#import <algorithm>
+#import <cstdint>
+#import <cstdio>
+#import <cstring>
+#import <vector>
+
+#import "cstream.hpp"
+#import "memory_governor.hpp"
+#import "simd.hpp"
+#import "stream_extensions.hpp"
+
+namespace cio {
+
+namespace detail {
+
+#if defined(__SSSE3__) || defined(__ARM_NEON)
+
+/// Sixteen bytes in a vector register, with the operations used by `utf8_checker`.
+struct utf8_vector {
+#if defined(__SSSE3__)
+    __m128i v;
+
+    static utf8_vector load(const unsigned char *p) noexcept {
+        return {_mm_loadu_si128(reinterpret_cast<const __m128i *>(p))};
+    }
+    static utf8_vector splat(unsigned char c) noexcept { return {_mm_set1_epi8(static_cast<char>(c))}; }
+    /// Returns the entries of `table` at the indexes in this vector, which must be less than 16.
+    utf8_vector lookup(const utf8_vector &table) const noexcept { return {_mm_shuffle_epi8(table.v, v)}; }
+    utf8_vector high_nibbles() const noexcept { return {_mm_and_si128(_mm_srli_epi16(v, 4), _mm_set1_epi8(0x0f))}; }
+    utf8_vector low_nibbles() const noexcept { return {_mm_and_si128(v, _mm_set1_epi8(0x0f))}; }
+    /// Returns this vector shifted up by `N` bytes, with the last `N` bytes of `previous` shifted in.
+    template <int N> utf8_vector prev(const utf8_vector &previous) const noexcept {
+        return {_mm_alignr_epi8(v, previous.v, 16 - N)};
+    }
+    utf8_vector saturating_sub(const utf8_vector &rhs) const noexcept { return {_mm_subs_epu8(v, rhs.v)}; }
+    utf8_vector operator&(const utf8_vector &rhs) const noexcept { return {_mm_and_si128(v, rhs.v)}; }
+    utf8_vector operator|(const utf8_vector &rhs) const noexcept { return {_mm_or_si128(v, rhs.v)}; }
+    utf8_vector operator^(const utf8_vector &rhs) const noexcept { return {_mm_xor_si128(v, rhs.v)}; }
+    bool any() const noexcept { return _mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_setzero_si128())) != 0xffff; }
+    bool ascii() const noexcept { return _mm_movemask_epi8(v) == 0; }
+#else
+    uint8x16_t v;
+
+    static utf8_vector load(const unsigned char *p) noexcept { return {vld1q_u8(p)}; }
+    static utf8_vector splat(unsigned char c) noexcept { return {vdupq_n_u8(c)}; }
+    /// Returns the entries of `table` at the indexes in this vector, which must be less than 16.
+    utf8_vector lookup(const utf8_vector &table) const noexcept { return {vqtbl1q_u8(table.v, v)}; }
+    utf8_vector high_nibbles() const noexcept { return {vshrq_n_u8(v, 4)}; }
+    utf8_vector low_nibbles() const noexcept { return {vandq_u8(v, vdupq_n_u8(0x0f))}; }
+    /// Returns this vector shifted up by `N` bytes, with the last `N` bytes of `previous` shifted in.
+    template <int N> utf8_vector prev(const utf8_vector &previous) const noexcept {
+        return {vextq_u8(previous.v, v, 16 - N)};
+    }
+    utf8_vector saturating_sub(const utf8_vector &rhs) const noexcept { return {vqsubq_u8(v, rhs.v)}; }
+    utf8_vector operator&(const utf8_vector &rhs) const noexcept { return {vandq_u8(v, rhs.v)}; }
+    utf8_vector operator|(const utf8_vector &rhs) const noexcept { return {vorrq_u8(v, rhs.v)}; }
+    utf8_vector operator^(const utf8_vector &rhs) const noexcept { return {veorq_u8(v, rhs.v)}; }
+    bool any() const noexcept { return vmaxvq_u8(v) != 0; }
+    bool ascii() const noexcept { return vmaxvq_u8(v) < 0x80; }
+#endif
+};
+
+/// A UTF-8 validator using the lookup algorithm of Keiser and Lemire.
+///
+/// Every error in a sequence of two bytes is identified by the high nibble of the first byte, its low nibble and the
+/// high nibble of the second byte, so three table lookups ANDed together find them all. The remaining errors, missing
+/// or surplus third and fourth bytes, are found by comparing the bytes two and three positions back with the lead
+/// bytes that require them. Blocks of ASCII are skipped after a single test.
+class utf8_checker {
+  public:
+    /// Checks 64 bytes at `p`.
+    void check(const unsigned char *p) noexcept {
+        auto a = utf8_vector::load(p);
+        auto b = utf8_vector::load(p + 16);
+        auto c = utf8_vector::load(p + 32);
+        auto d = utf8_vector::load(p + 48);
+        if ((a | b | c | d).ascii()) {
+            error_ = error_ | incomplete_;
+            previous_ = utf8_vector::splat(0);
+            incomplete_ = utf8_vector::splat(0);
+            return;
+        }
+        check_bytes(a, previous_);
+        check_bytes(b, a);
+        check_bytes(c, b);
+        check_bytes(d, c);
+        // A lead byte too close to the end to be complete, which the next block must continue
+        incomplete_ = d.saturating_sub(utf8_vector::load(incomplete_limits));
+        previous_ = d;
+    }
+
+    /// Returns `true` if all bytes checked are valid and end with a complete character.
+    [[nodiscard]]
+    bool valid() const noexcept {
+        return !(error_ | incomplete_).any();
+    }
+
+  private:
+    // The errors detected by the lookup tables
+    static constexpr unsigned char too_short = 1 << 0;
+    static constexpr unsigned char too_long = 1 << 1;
+    static constexpr unsigned char overlong_3 = 1 << 2;
+    static constexpr unsigned char too_large = 1 << 3;
+    static constexpr unsigned char surrogate = 1 << 4;
+    static constexpr unsigned char overlong_2 = 1 << 5;
+    static constexpr unsigned char too_large_1000 = 1 << 6;
+    static constexpr unsigned char overlong_4 = 1 << 6;
+    static constexpr unsigned char two_continuations = 1 << 7;
+    static constexpr unsigned char carry = too_short | too_long | two_continuations;
+
+    /// The errors indicated by the high nibble of the first byte.
+    static constexpr unsigned char first_high[16] = {
+            too_long, too_long, too_long, too_long, too_long, too_long, too_long, too_long,
+            two_continuations, two_continuations, two_continuations, two_continuations,
+            too_short | overlong_2,
+            too_short,
+            too_short | overlong_3 | surrogate,
+            too_short | too_large | too_large_1000 | overlong_4};
+
+    /// The errors indicated by the low nibble of the first byte.
+    static constexpr unsigned char first_low[16] = {
+            carry | overlong_3 | overlong_2 | overlong_4,
+            carry | overlong_2,
+            carry,
+            carry,
+            carry | too_large,
+            carry | too_large | too_large_1000,
+            carry | too_large | too_large_1000,
+            carry | too_large | too_large_1000,
+            carry | too_large | too_large_1000,
+            carry | too_large | too_large_1000,
+            carry | too_large | too_large_1000,
+            carry | too_large | too_large_1000,
+            carry | too_large | too_large_1000,
+            carry | too_large | too_large_1000 | surrogate,
+            carry | too_large | too_large_1000,
+            carry | too_large | too_large_1000};
+
+    /// The errors indicated by the high nibble of the second byte.
+    static constexpr unsigned char second_high[16] = {
+            too_short, too_short, too_short, too_short, too_short, too_short, too_short, too_short,
+            too_long | overlong_2 | two_continuations | overlong_3 | too_large_1000 | overlong_4,
+            too_long | overlong_2 | two_continuations | overlong_3 | too_large,
+            too_long | overlong_2 | two_continuations | surrogate | too_large,
+            too_long | overlong_2 | two_continuations | surrogate | too_large,
+            too_short, too_short, too_short, too_short};
+
+    /// The largest byte in each position of the last vector of a block that leaves no character incomplete.
+    static constexpr unsigned char incomplete_limits[16] = {0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+                                                            0xff, 0xff, 0xff, 0xff, 0xff, 0xef, 0xdf, 0xbf};
+
+    /// Accumulates the errors in `input`, which follows `previous`.
+    void check_bytes(const utf8_vector &input, const utf8_vector &previous) noexcept {
+        auto prev1 = input.prev<1>(previous);
+        auto special = prev1.high_nibbles().lookup(utf8_vector::load(first_high)) &
+                       prev1.low_nibbles().lookup(utf8_vector::load(first_low)) &
+                       input.high_nibbles().lookup(utf8_vector::load(second_high));
+        // Bytes two after a three or four byte lead or three after a four byte lead must be continuations
+        auto third = input.prev<2>(previous).saturating_sub(utf8_vector::splat(0xe0 - 0x80));
+        auto fourth = input.prev<3>(previous).saturating_sub(utf8_vector::splat(0xf0 - 0x80));
+        auto required = (third | fourth) & utf8_vector::splat(0x80);
+        error_ = error_ | (required ^ special);
+    }
+
+    /// The accumulated errors.
+    utf8_vector error_{utf8_vector::splat(0)};
+    /// The last vector checked.
+    utf8_vector previous_{utf8_vector::splat(0)};
+    /// Nonzero if the last vector checked ends with an incomplete character.
+    utf8_vector incomplete_{utf8_vector::splat(0)};
+};
+
+#endif
+
+/// Returns `true` if `c` is the first of a pair of UTF-16 surrogates.
+constexpr bool is_high_surrogate(char16_t c) noexcept {
+    return (c & 0xfc00) == 0xd800;
+}
+
+} /* namespace detail */
+
+// MARK: Kernels
+
+/// Returns the length of the longest prefix of `size` bytes at `data` that is valid UTF-8.
+///
+/// This is a scalar implementation with an ASCII fast path, used to locate errors once `is_valid_utf8()` has found
+/// one. Overlong encodings, surrogates and code points above U+10FFFF are invalid, as is a truncated final character.
+[[nodiscard]]
+inline std::size_t utf8_valid_length(const void *data, std::size_t size) noexcept {
+    auto p = static_cast<const unsigned char *>(data);
+    auto is_continuation = [](unsigned char c) { return (c & 0xc0) == 0x80; };
+    std::size_t i = 0;
+    while (i < size) {
+        std::uint64_t word;
+        if (i + 8 <= size && (std::memcpy(&word, p + i, 8), (word & 0x8080808080808080) == 0)) {
+            i += 8;
+            continue;
+        }
+        auto c = p[i];
+        if (c < 0x80) {
+            ++i;
+        } else if (c < 0xc2) {
+            break;
+        } else if (c < 0xe0) {
+            if (size - i < 2 || !is_continuation(p[i + 1])) {
+                break;
+            }
+            i += 2;
+        } else if (c < 0xf0) {
+            if (size - i < 3 || (c == 0xe0 && p[i + 1] < 0xa0) || (c == 0xed && p[i + 1] > 0x9f) ||
+                !is_continuation(p[i + 1]) || !is_continuation(p[i + 2])) {
+                break;
+            }
+            i += 3;
+        } else if (c < 0xf5) {
+            if (size - i < 4 || (c == 0xf0 && p[i + 1] < 0x90) || (c == 0xf4 && p[i + 1] > 0x8f) ||
+                !is_continuation(p[i + 1]) || !is_continuation(p[i + 2]) || !is_continuation(p[i + 3])) {
+                break;
+            }
+            i += 4;
+        } else {
+            break;
+        }
+    }
+    return i;
+}
+
+/// Returns `true` if `size` bytes at `data` are valid UTF-8.
+///
+/// The data is checked 64 bytes at a time with the vector validator in `detail::utf8_checker` when the target
+/// supports SSSE3 or NEON, and with `utf8_valid_length()` otherwise.
+[[nodiscard]]
+inline bool is_valid_utf8(const void *data, std::size_t size) noexcept {
+#if defined(__SSSE3__) || defined(__ARM_NEON)
+    auto p = static_cast<const unsigned char *>(data);
+    detail::utf8_checker checker;
+    std::size_t i = 0;
+    for (; i + 64 <= size; i += 64) {
+        checker.check(p + i);
+    }
+    if (i < size) {
+        // Zero padding is ASCII, which leaves a truncated final character incomplete
+        unsigned char tail[64] = {};
+        std::memcpy(tail, p + i, size - i);
+        checker.check(tail);
+    }
+    return checker.valid();
+#else
+    return utf8_valid_length(data, size) == size;
+#endif
+}
+
+/// Converts UTF-16 in host byte order to UTF-8.
+///
+/// Runs of 16 ASCII code units are narrowed with vector instructions; other code units are converted one at a time.
+/// Conversion stops at an unpaired surrogate, including a high surrogate in the last code unit.
+/// - parameter src: The UTF-16 code units.
+/// - parameter count: The number of code units.
+/// - parameter dst: The buffer to receive the UTF-8, which must hold `3 * count` bytes.
+/// - parameter consumed: The number of code units converted, which is less than `count` if an unpaired surrogate
+/// was found.
+/// - returns: The number of bytes written to `dst`.
+inline std::size_t utf16_to_utf8(const char16_t *src, std::size_t count, unsigned char *dst,
+                                 std::size_t &consumed) noexcept {
+    auto out = dst;
+    std::size_t i = 0;
+    while (i < count) {
+#if defined(__SSE2__)
+        for (; i + 16 <= count; i += 16) {
+            auto a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+            auto b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i + 8));
+            auto high = _mm_and_si128(_mm_or_si128(a, b), _mm_set1_epi16(static_cast<short>(0xff80)));
+            if (_mm_movemask_epi8(_mm_cmpeq_epi16(high, _mm_setzero_si128())) != 0xffff) {
+                break;
+            }
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(out), _mm_packus_epi16(a, b));
+            out += 16;
+        }
+#elif defined(__ARM_NEON)
+        for (; i + 16 <= count; i += 16) {
+            auto a = vld1q_u16(reinterpret_cast<const std::uint16_t *>(src + i));
+            auto b = vld1q_u16(reinterpret_cast<const std::uint16_t *>(src + i + 8));
+            if (vmaxvq_u16(vorrq_u16(a, b)) >= 0x80) {
+                break;
+            }
+            vst1q_u8(out, vcombine_u8(vmovn_u16(a), vmovn_u16(b)));
+            out += 16;
+        }
+#endif
+
+        // Convert code units one at a time until the next possible run of ASCII
+        for (auto limit = std::min(count, i + 16); i < limit; ++i) {
+            std::uint32_t c = src[i];
+            if (c < 0x80) {
+                *out++ = static_cast<unsigned char>(c);
+            } else if (c < 0x800) {
+                *out++ = static_cast<unsigned char>(0xc0 | (c >> 6));
+                *out++ = static_cast<unsigned char>(0x80 | (c & 0x3f));
+            } else if ((c & 0xf800) != 0xd800) {
+                *out++ = static_cast<unsigned char>(0xe0 | (c >> 12));
+                *out++ = static_cast<unsigned char>(0x80 | ((c >> 6) & 0x3f));
+                *out++ = static_cast<unsigned char>(0x80 | (c & 0x3f));
+            } else if (detail::is_high_surrogate(static_cast<char16_t>(c)) && i + 1 < count &&
+                       (src[i + 1] & 0xfc00) == 0xdc00) {
+                c = 0x10000 + ((c - 0xd800) << 10) + (src[i + 1] - 0xdc00u);
+                *out++ = static_cast<unsigned char>(0xf0 | (c >> 18));
+                *out++ = static_cast<unsigned char>(0x80 | ((c >> 12) & 0x3f));
+                *out++ = static_cast<unsigned char>(0x80 | ((c >> 6) & 0x3f));
+                *out++ = static_cast<unsigned char>(0x80 | (c & 0x3f));
+                ++i;
+            } else {
+                consumed = i;
+                return static_cast<std::size_t>(out - dst);
+            }
+        }
+    }
+    consumed = i;
+    return static_cast<std::size_t>(out - dst);
+}
+
+// MARK: Streams
+
+/// A reader passing through the contents of a stream after validating them as UTF-8.
+///
+/// The stream is read in large blocks and each is validated with `is_valid_utf8()` before any of it is returned, so
+/// validation costs a single pass over data already in cache. A character split between blocks is held back and
+/// validated with the next block. When invalid data is found, the bytes before it are returned, after which reads
+/// fail and `ferror()` is set; `error_offset()` gives the position of the first invalid byte.
+class utf8_reader : public input_extensions<utf8_reader> {
+  public:
+    /// The default number of bytes read at a time.
+    static constexpr std::size_t default_block_size = 256 * 1024;
+
+    /// The smallest number of bytes read at a time under memory pressure.
+    static constexpr std::size_t min_block_size = 16 * 1024;
+
+    // This class is non-copyable.
+    utf8_reader(const utf8_reader &rhs) = delete;
+
+    // This class is non-assignable.
+    utf8_reader &operator=(const utf8_reader &rhs) = delete;
+
+    /// Initializes a `cio::utf8_reader` object that reads from `stream`.
+    /// - parameter stream: The stream to read.
+    /// - parameter block_size: The number of bytes read at a time. The buffer is reserved from
+    /// `cio::memory_governor::shared()`; under memory pressure smaller blocks are read, and a buffer the budget cannot
+    /// cover is an error.
+    /// - throws: Any exception thrown by `Allocator::allocate()` (typically `std::bad_alloc`)
+    explicit utf8_reader(cstream &stream, std::size_t block_size = default_block_size) : stream_{stream} {
+        auto size = std::max<std::size_t>(block_size, 64);
+        if (auto reserved = reservation_.resize_up_to(size, std::min(size, min_block_size)); reserved > 0) {
+            buffer_.resize(reserved);
+        } else {
+            error_ = true;
+        }
+    }
+
+    /// Returns `true` if no error has occurred.
+    [[nodiscard]]
+    explicit operator bool() const noexcept {
+        return !error_ && !invalid_;
+    }
+
+    /// Returns `true` if invalid UTF-8 was found.
+    [[nodiscard]]
+    bool invalid() const noexcept {
+        return invalid_;
+    }
+
+    /// Returns the offset of the first invalid byte, counted from the position of the stream when the reader was
+    /// created, if `invalid()` is `true`.
+    [[nodiscard]]
+    std::uint64_t error_offset() const noexcept {
+        return error_offset_;
+    }
+
+    // MARK: Direct Input
+
+    using input_extensions<utf8_reader>::fread;
+
+    /// Reads up to `count` objects of `size` bytes of validated UTF-8 into `buffer`.
+    /// - returns: The number of complete objects read.
+    std::size_t fread(void *buffer, std::size_t size, std::size_t count) noexcept {
+        if (size == 0 || count == 0) {
+            return 0;
+        }
+        auto dst = static_cast<unsigned char *>(buffer);
+        auto wanted = size * count;
+        std::size_t total = 0;
+        while (total < wanted) {
+            if (position_ == valid_ && !refill()) {
+                break;
+            }
+            auto n = std::min(wanted - total, valid_ - position_);
+            std::memcpy(dst + total, buffer_.data() + position_, n);
+            position_ += n;
+            total += n;
+        }
+        return total / size;
+    }
+
+    /// Returns the next byte as an `unsigned char` converted to `int`, or `EOF`.
+    [[nodiscard]]
+    int fgetc() noexcept {
+        if (position_ < valid_) {
+            return buffer_[position_++];
+        }
+        unsigned char ch;
+        return fread(&ch, 1, 1) == 1 ? ch : EOF;
+    }
+
+    // MARK: Error Handling
+
+    /// Returns nonzero if the end of the stream has been reached.
+    [[nodiscard]]
+    int feof() const noexcept {
+        return eof_ && position_ == valid_;
+    }
+
+    /// Returns nonzero if a read failed or invalid UTF-8 was found.
+    [[nodiscard]]
+    int ferror() const noexcept {
+        return error_ || invalid_;
+    }
+
+  private:
+    /// Returns the offset in `size` bytes at `p` of a final character that may continue in the next block, or `size`.
+    static std::size_t complete_length(const unsigned char *p, std::size_t size) noexcept {
+        for (std::size_t k = 1; k <= std::min<std::size_t>(size, 3); ++k) {
+            auto c = p[size - k];
+            if ((c & 0xc0) == 0x80) {
+                continue;
+            }
+            auto length = c >= 0xf0 ? 4u : c >= 0xe0 ? 3u : c >= 0xc0 ? 2u : 1u;
+            return length > k ? size - k : size;
+        }
+        return size;
+    }
+
+    /// Reads and validates the next block, keeping a final incomplete character for the next.
+    /// - returns: `false` at the end of the stream, on invalid data or on error.
+    bool refill() noexcept {
+        if (eof_ || error_ || invalid_) {
+            return false;
+        }
+        // Move the held back bytes to the front
+        auto held = end_ - valid_;
+        std::memmove(buffer_.data(), buffer_.data() + valid_, held);
+        offset_ += valid_;
+        position_ = valid_ = 0;
+        end_ = held;
+
+        std::size_t length = 0;
+        while (length == 0) {
+            auto n = stream_.fread(buffer_.data() + end_, 1, buffer_.size() - end_);
+            end_ += n;
+            if (n == 0) {
+                eof_ = true;
+                error_ = stream_.ferror();
+                length = end_;
+                break;
+            }
+            length = complete_length(buffer_.data(), end_);
+        }
+        if (length == 0) {
+            return false;
+        }
+        if (is_valid_utf8(buffer_.data(), length)) {
+            valid_ = length;
+        } else {
+            valid_ = utf8_valid_length(buffer_.data(), length);
+            invalid_ = true;
+            error_offset_ = offset_ + valid_;
+        }
+        return valid_ > 0;
+    }
+
+    /// The underlying stream.
+    cstream &stream_;
+    /// Data read from the stream.
+    std::vector<unsigned char> buffer_;
+    /// The memory reserved from the governor for `buffer_`.
+    memory_reservation reservation_;
+    /// The offset of the next unread byte in `buffer_`.
+    std::size_t position_{0};
+    /// The number of validated bytes in `buffer_`.
+    std::size_t valid_{0};
+    /// The number of bytes in `buffer_`.
+    std::size_t end_{0};
+    /// The offset in the stream of `buffer_[0]`.
+    std::uint64_t offset_{0};
+    /// The offset of the first invalid byte.
+    std::uint64_t error_offset_{0};
+    /// Whether the end of the stream has been reached.
+    bool eof_{false};
+    /// Whether a read failed.
+    bool error_{false};
+    /// Whether invalid UTF-8 was found.
+    bool invalid_{false};
+};
+
+/// A reader converting a UTF-16 stream to UTF-8.
+///
+/// A leading byte order mark selects the byte order and is removed; without one the byte order given at creation is
+/// used. The stream is read in large blocks, which are converted to host byte order with `swap_to_host()` and then to
+/// UTF-8 with `utf16_to_utf8()`. A surrogate pair split between blocks is held back and converted with the next block.
+/// When an unpaired surrogate is found, the text before it is returned, after which reads fail and `ferror()` is set;
+/// `error_offset()` gives the position of the surrogate.
+class utf16_reader : public input_extensions<utf16_reader> {
+  public:
+    /// The default number of bytes read at a time.
+    static constexpr std::size_t default_block_size = 256 * 1024;
+
+    /// The smallest number of bytes read at a time under memory pressure.
+    static constexpr std::size_t min_block_size = 16 * 1024;
+
+    // This class is non-copyable.
+    utf16_reader(const utf16_reader &rhs) = delete;
+
+    // This class is non-assignable.
+    utf16_reader &operator=(const utf16_reader &rhs) = delete;
+
+    /// Initializes a `cio::utf16_reader` object that reads from `stream`, reading any byte order mark.
+    /// - parameter stream: The stream to read.
+    /// - parameter order: The byte order of the stream if it has no byte order mark.
+    /// - parameter block_size: The number of bytes read at a time. The buffers are reserved from
+    /// `cio::memory_governor::shared()`; under memory pressure smaller blocks are read, and buffers the budget cannot
+    /// cover are an error.
+    /// - throws: Any exception thrown by `Allocator::allocate()` (typically `std::bad_alloc`)
+    explicit utf16_reader(cstream &stream, cstream::byte_order order = cstream::byte_order::little_endian,
+                          std::size_t block_size = default_block_size)
+        : stream_{stream}, order_{order} {
+        // Each code unit takes two bytes of input and up to three of output
+        auto units = std::max<std::size_t>(block_size / 2, 16);
+        units = reservation_.resize_up_to(5 * units, 5 * std::min(units, min_block_size / 2)) / 5;
+        if (units == 0) {
+            error_ = true;
+            return;
+        }
+        input_.resize(units);
+        output_.resize(3 * units);
+
+        unsigned char bom[2];
+        auto n = stream_.fread(bom, 1, 2);
+        if (n == 2 && bom[0] == 0xff && bom[1] == 0xfe) {
+            order_ = cstream::byte_order::little_endian;
+            offset_ = 2;
+        } else if (n == 2 && bom[0] == 0xfe && bom[1] == 0xff) {
+            order_ = cstream::byte_order::big_endian;
+            offset_ = 2;
+        } else {
+            std::memcpy(input_.data(), bom, n);
+            held_ = n;
+        }
+    }
+
+    /// Returns `true` if no error has occurred.
+    [[nodiscard]]
+    explicit operator bool() const noexcept {
+        return !error_ && !invalid_;
+    }
+
+    /// Returns the byte order of the stream.
+    [[nodiscard]]
+    cstream::byte_order byte_order() const noexcept {
+        return order_;
+    }
+
+    /// Returns `true` if an unpaired surrogate or a truncated code unit was found.
+    [[nodiscard]]
+    bool invalid() const noexcept {
+        return invalid_;
+    }
+
+    /// Returns the offset of the first invalid code unit, counted in bytes from the position of the stream when the
+    /// reader was created, if `invalid()` is `true`.
+    [[nodiscard]]
+    std::uint64_t error_offset() const noexcept {
+        return error_offset_;
+    }
+
+    // MARK: Direct Input
+
+    using input_extensions<utf16_reader>::fread;
+
+    /// Reads up to `count` objects of `size` bytes of UTF-8 into `buffer`.
+    /// - returns: The number of complete objects read.
+    std::size_t fread(void *buffer, std::size_t size, std::size_t count) noexcept {
+        if (size == 0 || count == 0) {
+            return 0;
+        }
+        auto dst = static_cast<unsigned char *>(buffer);
+        auto wanted = size * count;
+        std::size_t total = 0;
+        while (total < wanted) {
+            if (position_ == output_size_ && !refill()) {
+                break;
+            }
+            auto n = std::min(wanted - total, output_size_ - position_);
+            std::memcpy(dst + total, output_.data() + position_, n);
+            position_ += n;
+            total += n;
+        }
+        return total / size;
+    }
+
+    /// Returns the next byte of UTF-8 as an `unsigned char` converted to `int`, or `EOF`.
+    [[nodiscard]]
+    int fgetc() noexcept {
+        if (position_ < output_size_) {
+            return output_[position_++];
+        }
+        unsigned char ch;
+        return fread(&ch, 1, 1) == 1 ? ch : EOF;
+    }
+
+    // MARK: Error Handling
+
+    /// Returns nonzero if the end of the stream has been reached.
+    [[nodiscard]]
+    int feof() const noexcept {
+        return eof_ && position_ == output_size_;
+    }
+
+    /// Returns nonzero if a read failed or invalid UTF-16 was found.
+    [[nodiscard]]
+    int ferror() const noexcept {
+        return error_ || invalid_;
+    }
+
+  private:
+    /// Reads and converts the next block, keeping a final high surrogate or odd byte for the next.
+    /// - returns: `false` at the end of the stream, on invalid data or on error.
+    bool refill() noexcept {
+        if (error_ || invalid_) {
+            return false;
+        }
+        position_ = output_size_ = 0;
+        auto bytes = reinterpret_cast<unsigned char *>(input_.data());
+        auto capacity = 2 * input_.size();
+
+        std::size_t units = 0;
+        while (units == 0) {
+            if (eof_) {
+                if (held_ > 0 && !error_) {
+                    // A truncated code unit
+                    invalid_ = true;
+                    error_offset_ = offset_;
+                }
+                return false;
+            }
+            auto n = stream_.fread(bytes + held_, 1, capacity - held_);
+            held_ += n;
+            if (n == 0) {
+                eof_ = true;
+                error_ = stream_.ferror();
+            }
+            units = held_ / 2;
+            swap_to_host<2>(bytes, units, order_);
+            if (!eof_ && units > 0 && detail::is_high_surrogate(input_[units - 1])) {
+                // Hold back the high surrogate, in stream byte order, until its pair is read
+                swap_from_host<2>(bytes + 2 * (units - 1), 1, order_);
+                --units;
+            }
+        }
+
+        std::size_t consumed;
+        output_size_ = utf16_to_utf8(input_.data(), units, output_.data(), consumed);
+        if (consumed < units) {
+            invalid_ = true;
+            error_offset_ = offset_ + 2 * consumed;
+        }
+        offset_ += 2 * units;
+        held_ -= 2 * units;
+        std::memmove(bytes, bytes + 2 * units, held_);
+        return output_size_ > 0;
+    }
+
+    /// The underlying stream.
+    cstream &stream_;
+    /// The byte order of the stream.
+    cstream::byte_order order_;
+    /// Code units read from the stream.
+    std::vector<char16_t> input_;
+    /// The number of bytes in `input_` not yet converted, in stream byte order.
+    std::size_t held_{0};
+    /// The converted text.
+    std::vector<unsigned char> output_;
+    /// The memory reserved from the governor for `input_` and `output_`.
+    memory_reservation reservation_;
+    /// The offset of the next unread byte in `output_`.
+    std::size_t position_{0};
+    /// The number of valid bytes in `output_`.
+    std::size_t output_size_{0};
+    /// The offset in the stream of the first code unit in `input_`.
+    std::uint64_t offset_{0};
+    /// The offset of the first invalid code unit.
+    std::uint64_t error_offset_{0};
+    /// Whether the end of the stream has been reached.
+    bool eof_{false};
+    /// Whether a read failed.
+    bool error_{false};
+    /// Whether invalid UTF-16 was found.
+    bool invalid_{false};
+};
+
+} /* namespace cio */
@@ -0,0 +1,86 @@
+//
+// SPDX-FileCopyrightText: 2024 Stephen F. Booth <contact@sbooth.dev>
+// SPDX-License-Identifier: MIT
+//
+// Part of https://github.com/sbooth/cio
+//
+
+#import <algorithm>
+#import <random>
+#import <vector>
+
+#import "bitpack.hpp"
+#import "cioTestSupport.hpp"
+#import "spill_stream.hpp"
+#import "test_support.hpp"
+
+bool cio_test::packed_uints_round_trip() noexcept {
+    try {
+        std::mt19937 rng{199};
+        for (int i = 0; i < 600; ++i) {
+            // Counts from 0 to 1000, including exact multiples of the block size, with bit widths from 0 to 32
+            std::size_t count = i < 20 ? (i < 10 ? i : 128 * (i - 9)) % 1001 : rng() % 1001;
+            auto width = static_cast<unsigned>(i % 33);
+            auto mask = width == 32 ? ~std::uint32_t{0} : (std::uint32_t{1} << width) - 1;
+            std::vector<std::uint32_t> values(count);
+            for (auto &value : values) {
+                value = static_cast<std::uint32_t>(rng()) & mask;
+            }
+            if (i % 2 == 0) {
+                std::sort(values.begin(), values.end());
+            }
+
+            // A plain stream has the packed members
+            auto file = cio::cstream::memfd("cio-test");
+            if (!file.write_packed_uints(values)) {
+                return false;
+            }
+            file.rewind();
+            std::vector<std::uint32_t> read{4, 5};
+            if (!file.read_packed_uints(read) || read != values || file.fgetc() != EOF) {
+                return false;
+            }
+
+            // The buffer codec writes the same blocks without the count, and refuses them cut short
+            std::vector<unsigned char> encoded(cio::bitpack::encoded_bound(count));
+            auto size = cio::bitpack::encode(values.data(), count, encoded.data());
+            std::vector<std::uint32_t> unpacked(count);
+            if (cio::bitpack::decode(encoded.data(), size, count, unpacked.data()) != size || unpacked != values ||
+                (count > 0 && cio::bitpack::decode(encoded.data(), size - 1, count, unpacked.data()) !=
+                                      cio::bitpack::error)) {
+                return false;
+            }
+
+            // A spill stream in memory is a stream with the typed extensions
+            cio::spill_stream stream;
+            if (!stream.write_packed_uints(values) || !stream.write_uint_little(std::uint32_t{0xfeedface})) {
+                return false;
+            }
+            stream.rewind();
+            std::vector<std::uint32_t> decoded{1, 2, 3};
+            std::uint32_t sentinel;
+            if (!stream.read_packed_uints(decoded) || decoded != values || !stream.read_uint_little(sentinel) ||
+                sentinel != 0xfeedface) {
+                return false;
+            }
+
+            // Any truncation is refused
+            stream.rewind();
+            auto bytes = read_all(stream);
+            bytes.resize(bytes.size() - 4);
+            for (std::size_t size = 0; size < bytes.size(); size += 1 + size / 8) {
+                cio::spill_stream truncated;
+                if (truncated.fwrite(bytes.data(), 1, size) != size) {
+                    return false;
+                }
+                truncated.rewind();
+                if (truncated.read_packed_uints(decoded)) {
+                    return false;
+                }
+            }
+        }
+        return true;
+    } catch (...) {
+        return false;
+    }
+}
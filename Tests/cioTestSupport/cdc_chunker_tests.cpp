@@ -0,0 +1,97 @@
+//
+// SPDX-FileCopyrightText: 2024 Stephen F. Booth <contact@sbooth.dev>
+// SPDX-License-Identifier: MIT
+//
+// Part of https://github.com/sbooth/cio
+//
+
+#import <cstdint>
+#import <set>
+#import <vector>
+
+#import "cdc_chunker.hpp"
+#import "cioTestSupport.hpp"
+#import "memory_governor.hpp"
+#import "test_support.hpp"
+
+namespace {
+
+/// Chunks `input`, checking that the chunks cover it in order within the size bounds, and returns their hashes.
+std::vector<cio::sha256::digest> chunk(const std::vector<unsigned char> &input, std::size_t min_size,
+                                       std::size_t avg_size, std::size_t max_size, bool &ok) {
+    auto stream = cio_test::scratch_stream(input);
+    cio::cdc_chunker chunker{stream, min_size, avg_size, max_size};
+    std::vector<cio::sha256::digest> hashes;
+    ok = static_cast<bool>(chunker);
+    std::uint64_t offset = 0;
+    for (cio::cdc_chunker::chunk c; ok && chunker.next(c);) {
+        auto last = offset + c.size == input.size();
+        ok = c.offset == offset && c.size > 0 && c.size <= max_size && (last || c.size >= min_size) &&
+             std::equal(c.data, c.data + c.size, input.begin() + static_cast<long>(offset)) &&
+             c.hash == cio::sha256::hash(c.data, c.size);
+        offset += c.size;
+        hashes.push_back(c.hash);
+    }
+    ok = ok && offset == input.size() && chunker.feof() && !chunker.ferror();
+    return hashes;
+}
+
+} /* namespace */
+
+bool cio_test::cdc_chunker_respects_bounds() noexcept {
+    try {
+        // Random data cuts near the average, text repeats and zeros never match the mask so every chunk is maximal
+        for (auto &input : {random_bytes(3 * 1024 * 1024 + 17, 223), text_bytes(2 * 1024 * 1024, 227),
+                            std::vector<unsigned char>(1024 * 1024 + 5, 0), std::vector<unsigned char>(100, 'x'),
+                            std::vector<unsigned char>{}}) {
+            bool ok;
+            auto hashes = chunk(input, 1024, 4096, 16384, ok);
+            if (!ok || (input.size() > 1024 * 1024 && hashes.size() < input.size() / 16384)) {
+                return false;
+            }
+        }
+
+        // The bounds are clamped, so no average size makes the masks shift out of range
+        return in_child_process([] {
+            // A budget too small for any buffer leaves the chunker invalid without allocating
+            cio::memory_governor::shared().set_budget(1);
+            auto stream = cio::cstream::memfd("cio-test");
+            cio::cdc_chunker huge{stream, 0, SIZE_MAX, SIZE_MAX};
+            cio::cdc_chunker inverted{stream, 8192, 1, 16};
+            return !huge && huge.min_size() == 64 && huge.max_size() == cio::cdc_chunker::max_chunk_size &&
+                   huge.avg_size() == cio::cdc_chunker::max_chunk_size && inverted.min_size() == 8192 &&
+                   inverted.max_size() == 8192 && inverted.avg_size() == 8192;
+        });
+    } catch (...) {
+        return false;
+    }
+}
+
+bool cio_test::cdc_chunker_boundaries_survive_insertion() noexcept {
+    try {
+        auto original = random_bytes(2 * 1024 * 1024, 229);
+        auto inserted = random_bytes(100, 233);
+        auto edited = original;
+        edited.insert(edited.begin() + 1000000, inserted.begin(), inserted.end());
+
+        bool ok, edited_ok;
+        auto before = chunk(original, 2048, 8192, 65536, ok);
+        auto after = chunk(edited, 2048, 8192, 65536, edited_ok);
+        if (!ok || !edited_ok) {
+            return false;
+        }
+
+        // Only the chunks around the insertion change: the rest match in order from each end
+        std::size_t prefix = 0, suffix = 0;
+        while (prefix < before.size() && prefix < after.size() && before[prefix] == after[prefix]) {
+            ++prefix;
+        }
+        while (suffix < before.size() - prefix && suffix < after.size() - prefix &&
+               before[before.size() - 1 - suffix] == after[after.size() - 1 - suffix]) {
+            ++suffix;
+        }
+        return prefix > 0 && suffix > 0 && after.size() - prefix - suffix <= 3 && before.size() - prefix - suffix <= 3;
+    } catch (...) {
+        return false;
+    }
+}
@@ -0,0 +1,131 @@
+//
+// SPDX-FileCopyrightText: 2024 Stephen F. Booth <contact@sbooth.dev>
+// SPDX-License-Identifier: MIT
+//
+// Part of https://github.com/sbooth/cio
+//
+
+#import <cstdint>
+#import <cstring>
+#import <random>
+
+#import "cioTestSupport.hpp"
+#import "columnar.hpp"
+#import "test_support.hpp"
+
+namespace {
+
+/// The rows written by `write_table()`, one vector per column.
+struct table {
+    std::vector<std::uint8_t> a;
+    std::vector<std::uint16_t> b;
+    std::vector<std::uint32_t> c;
+    std::vector<std::uint64_t> d;
+};
+
+/// Writes a table of 3200 rows to `stream`: 2500 appended in row groups of 1000, then 700 as one row group.
+bool write_table(cio::cstream &stream, table &t) {
+    std::mt19937_64 rng{57};
+    cio::column_writer writer{stream, {1, 2, 4, 8}, 1000};
+    for (std::uint64_t i = 0; i < 2500; ++i) {
+        // Values are truncated to the column width
+        std::uint64_t row[] = {rng(), rng(), i * 3, rng()};
+        t.a.push_back(static_cast<std::uint8_t>(row[0]));
+        t.b.push_back(static_cast<std::uint16_t>(row[1]));
+        t.c.push_back(static_cast<std::uint32_t>(row[2]));
+        t.d.push_back(row[3]);
+        if (!writer.append_row(row)) {
+            return false;
+        }
+    }
+    std::vector<std::uint8_t> a(700);
+    std::vector<std::uint16_t> b(700);
+    std::vector<std::uint32_t> c(700);
+    std::vector<std::uint64_t> d(700);
+    for (std::size_t i = 0; i < 700; ++i) {
+        a[i] = static_cast<std::uint8_t>(i);
+        b[i] = static_cast<std::uint16_t>(rng());
+        c[i] = static_cast<std::uint32_t>(100000 + i);
+        d[i] = rng();
+    }
+    const void *columns[] = {a.data(), b.data(), c.data(), d.data()};
+    if (!writer.write_row_group(700, columns) || !writer.finish()) {
+        return false;
+    }
+    t.a.insert(t.a.end(), a.begin(), a.end());
+    t.b.insert(t.b.end(), b.begin(), b.end());
+    t.c.insert(t.c.end(), c.begin(), c.end());
+    t.d.insert(t.d.end(), d.begin(), d.end());
+    return static_cast<bool>(writer);
+}
+
+} /* namespace */
+
+bool cio_test::column_reader_reads_what_column_writer_wrote() noexcept {
+    try {
+        auto stream = cio::cstream::memfd("cio-test");
+        table t;
+        if (!stream || !write_table(stream, t)) {
+            return false;
+        }
+
+        cio::column_reader reader{stream};
+        if (!reader || reader.column_count() != 4 || reader.column_width(2) != 4 || reader.row_group_count() != 4 ||
+            reader.row_count() != 3200 || reader.row_count(2) != 500 || reader.row_count(3) != 700) {
+            return false;
+        }
+
+        std::vector<std::size_t> all{0, 1, 2, 3};
+        std::vector<std::uint8_t> a;
+        std::vector<std::uint16_t> b;
+        std::vector<std::uint32_t> c;
+        std::vector<std::uint64_t> d;
+        if (!reader.read_column(all, 0, a) || !reader.read_column(all, 1, b) || !reader.read_column(all, 2, c) ||
+            !reader.read_column(all, 3, d) || a != t.a || b != t.b || c != t.c || d != t.d) {
+            return false;
+        }
+
+        // A type of the wrong width or a missing chunk is refused
+        std::vector<std::uint64_t> wrong;
+        if (reader.read_column(0, 2, wrong) || reader.read_column(4, 0, a) || reader.read_column(0, 4, a)) {
+            return false;
+        }
+
+        // Statistics prune row groups: column 2 holds 3 * row in the appended groups and 100000 + i in the last
+        const auto &chunk = reader.chunk(1, 2);
+        if (chunk.min != 3000 || chunk.max != 3 * 1999) {
+            return false;
+        }
+        return reader.row_groups_overlapping(2, 3100, 3200) == std::vector<std::size_t>{1} &&
+               reader.row_groups_overlapping(2, 100500, ~std::uint64_t{0}) == std::vector<std::size_t>{3} &&
+               reader.row_groups_overlapping(2, 8000, 90000).empty();
+    } catch (...) {
+        return false;
+    }
+}
+
+bool cio_test::column_reader_rejects_wrapping_chunk() noexcept {
+    try {
+        auto stream = cio::cstream::memfd("cio-test");
+        table t;
+        if (!stream || !write_table(stream, t) || !cio::column_reader{stream}) {
+            return false;
+        }
+
+        // The footer starts with u32 column_count, u8 width[4], u64 row_group_count and u64 row_count, followed by
+        // the offset and length of the first chunk
+        std::uint64_t footer_offset = 0;
+        if (stream.fseek(-12, SEEK_END) != 0 || !stream.read_uint_little(footer_offset)) {
+            return false;
+        }
+        // An offset and length whose sum wraps to a small value
+        if (stream.fseek(static_cast<long>(footer_offset + 4 + 4 + 8 + 8), SEEK_SET) != 0 ||
+            !stream.write_uint_little(~std::uint64_t{0} - 7) || !stream.write_uint_little(std::uint64_t{16}) ||
+            stream.fflush() != 0) {
+            return false;
+        }
+        return !cio::column_reader{stream};
+    } catch (...) {
+        return false;
+    }
+}
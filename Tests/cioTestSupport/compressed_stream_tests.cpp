@@ -0,0 +1,110 @@
+//
+// SPDX-FileCopyrightText: 2024 Stephen F. Booth <contact@sbooth.dev>
+// SPDX-License-Identifier: MIT
+//
+// Part of https://github.com/sbooth/cio
+//
+
+#import <cstdio>
+#import <random>
+#import <vector>
+
+#import "cioTestSupport.hpp"
+#import "compressed_stream.hpp"
+#import "test_support.hpp"
+
+namespace {
+
+/// Compresses `input` in blocks of `block_size` bytes, written in pieces of varying size.
+std::vector<unsigned char> compress(const std::vector<unsigned char> &input, std::size_t block_size,
+                                    bool finish = true) {
+    auto stream = cio::cstream::memfd("cio-test");
+    cio::compressed_writer writer{stream, block_size};
+    if (!writer) {
+        return {};
+    }
+    std::mt19937 rng{149};
+    for (std::size_t written = 0; written < input.size();) {
+        auto n = std::min<std::size_t>(input.size() - written, 1 + rng() % (2 * block_size));
+        if (writer.fwrite(input.data() + written, 1, n) != n) {
+            return {};
+        }
+        written += n;
+    }
+    if ((finish && !writer.finish()) || (!finish && writer.fflush() != 0) || writer.bytes_in() != input.size()) {
+        return {};
+    }
+    stream.rewind();
+    return cio_test::read_all(stream);
+}
+
+/// Decompresses `compressed` and checks that it gives `expected` and then only the end of the stream.
+bool decompresses_to(const std::vector<unsigned char> &compressed, const std::vector<unsigned char> &expected,
+                     bool background) {
+    auto stream = cio_test::scratch_stream(compressed);
+    cio::compressed_reader reader{stream, background};
+    if (!reader || cio_test::read_all(reader, static_cast<std::uint32_t>(expected.size())) != expected) {
+        return false;
+    }
+    // Reads after the end of the stream return nothing, however often they are repeated
+    unsigned char buffer[64];
+    for (int i = 0; i < 3; ++i) {
+        if (reader.fread(buffer, 1, sizeof buffer) != 0 || reader.fgetc() != EOF) {
+            return false;
+        }
+    }
+    return reader.feof() && !reader.ferror() && reader;
+}
+
+} /* namespace */
+
+bool cio_test::compressed_stream_round_trips() noexcept {
+    try {
+        constexpr auto block_size = cio::compressed_format::min_block_size;
+        for (auto background : {false, true}) {
+            // Compressible and stored blocks, a partial last block, an exact multiple of the block size and no blocks
+            for (auto &input : {text_bytes(40 * block_size + 123, 151), random_bytes(9 * block_size + 1, 157),
+                                std::vector<unsigned char>(16 * block_size, 0), std::vector<unsigned char>{},
+                                std::vector<unsigned char>{'x'}}) {
+                auto compressed = compress(input, block_size);
+                if (compressed.empty() || !decompresses_to(compressed, input, background)) {
+                    return false;
+                }
+            }
+        }
+
+        // Data written in larger blocks than the minimum round trips and shrinks
+        auto text = text_bytes(3 * 1024 * 1024, 163);
+        auto compressed = compress(text, cio::compressed_format::default_block_size);
+        return !compressed.empty() && compressed.size() < text.size() / 2 && decompresses_to(compressed, text, true);
+    } catch (...) {
+        return false;
+    }
+}
+
+bool cio_test::compressed_reader_reports_truncation() noexcept {
+    try {
+        constexpr auto block_size = cio::compressed_format::min_block_size;
+        auto input = text_bytes(12 * block_size, 167);
+        for (auto background : {false, true}) {
+            // A stream without the end marker, and one cut short inside a block
+            auto unfinished = compress(input, block_size, false);
+            auto cut = compress(input, block_size);
+            cut.resize(cut.size() * 2 / 3);
+            for (auto &compressed : {unfinished, cut}) {
+                auto stream = scratch_stream(compressed);
+                cio::compressed_reader reader{stream, background};
+                auto bytes = read_all(reader);
+                unsigned char buffer[64];
+                if (bytes.size() > input.size() || !std::equal(bytes.begin(), bytes.end(), input.begin()) ||
+                    !reader.ferror() || reader || reader.fread(buffer, 1, sizeof buffer) != 0 ||
+                    reader.fgetc() != EOF) {
+                    return false;
+                }
+            }
+        }
+        return true;
+    } catch (...) {
+        return false;
+    }
+}
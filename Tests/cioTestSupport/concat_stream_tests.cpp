@@ -0,0 +1,73 @@
+//
+// SPDX-FileCopyrightText: 2024 Stephen F. Booth <contact@sbooth.dev>
+// SPDX-License-Identifier: MIT
+//
+// Part of https://github.com/sbooth/cio
+//
+
+#import <cstdio>
+#import <cstring>
+#import <iterator>
+#import <random>
+
+#import "cioTestSupport.hpp"
+#import "concat_stream.hpp"
+#import "test_support.hpp"
+
+bool cio_test::concat_stream_reads_across_segments() noexcept {
+    try {
+        const std::size_t sizes[] = {5000, 0, 1, 12345, 4096};
+        temp_file files[std::size(sizes)];
+        std::vector<std::string> paths;
+        std::vector<unsigned char> all;
+        for (std::size_t i = 0; i < std::size(sizes); ++i) {
+            auto bytes = random_bytes(sizes[i], 54 + static_cast<std::uint32_t>(i));
+            if (!write_file(files[i].path(), bytes)) {
+                return false;
+            }
+            paths.emplace_back(files[i].path());
+            all.insert(all.end(), bytes.begin(), bytes.end());
+        }
+
+        cio::concat_stream stream{paths, 1000};
+        if (!stream || stream.segment_count() != std::size(sizes) || stream.size() != all.size()) {
+            return false;
+        }
+        if (read_all(stream) != all || !stream.feof() || stream.ferror() || stream.fgetc() != EOF) {
+            return false;
+        }
+
+        // Random reads, most of which cross one or more segment ends, in both directions
+        std::mt19937 rng{54};
+        std::vector<unsigned char> buffer(8000);
+        for (int i = 0; i < 500; ++i) {
+            auto offset = rng() % (all.size() + 1);
+            auto length = rng() % buffer.size();
+            if (stream.fseek(static_cast<long>(offset), SEEK_SET) != 0) {
+                return false;
+            }
+            auto expected = std::min<std::size_t>(length, all.size() - offset);
+            if (stream.fread(buffer.data(), 1, length) != expected ||
+                std::memcmp(buffer.data(), all.data() + offset, expected) != 0 ||
+                stream.ftell() != static_cast<long>(offset + expected) || stream.ferror()) {
+                return false;
+            }
+        }
+
+        // Relative seeks from the end land in the right segment
+        if (stream.fseek(-4097, SEEK_END) != 0 || stream.fgetc() != all[all.size() - 4097] ||
+            stream.fseek(-1, SEEK_CUR) != 0 || stream.ftell() != static_cast<long>(all.size() - 4097)) {
+            return false;
+        }
+
+        stream.rewind();
+        if (read_all(stream, 2) != all) {
+            return false;
+        }
+
+        paths.emplace_back("/nonexistent/cio-test");
+        return !cio::concat_stream{paths};
+    } catch (...) {
+        return false;
+    }
+}
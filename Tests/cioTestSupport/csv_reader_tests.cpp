@@ -0,0 +1,157 @@
+//
+// SPDX-FileCopyrightText: 2024 Stephen F. Booth <contact@sbooth.dev>
+// SPDX-License-Identifier: MIT
+//
+// Part of https://github.com/sbooth/cio
+//
+
+#import <algorithm>
+#import <atomic>
+#import <mutex>
+#import <random>
+#import <string>
+#import <string_view>
+#import <vector>
+
+#import "cioTestSupport.hpp"
+#import "csv_reader.hpp"
+#import "test_support.hpp"
+
+namespace {
+
+/// Rows of fields.
+using table = std::vector<std::vector<std::string>>;
+
+/// Returns random rows and their text, with quoted delimiters, newlines and quotes, rows holding a single quoted empty
+/// field, and empty lines, which are not rows.
+std::pair<table, std::string> random_csv(std::size_t rows, char delimiter, bool crlf, bool final_newline,
+                                         std::mt19937 &rng) {
+    const std::string pieces[] = {"", "a", "bc", "hello world", "1.5", std::string(1, delimiter), "\"", "\n", "\r\n",
+                                  "x\"\"y"};
+    auto newline = crlf ? "\r\n" : "\n";
+    table expected;
+    std::string text;
+    for (std::size_t i = 0; i < rows; ++i) {
+        if (rng() % 10 == 0) {
+            text += newline;
+        }
+        std::vector<std::string> row(i % 13 == 0 ? 1 : 1 + rng() % 6);
+        for (auto &field : row) {
+            for (auto n = rng() % 4; n > 0; --n) {
+                field += pieces[rng() % std::size(pieces)];
+            }
+            if (rng() % 50 == 0) {
+                field += std::string(100 + rng() % 300, 'z');
+            }
+        }
+        for (std::size_t j = 0; j < row.size(); ++j) {
+            const auto &field = row[j];
+            // Quote fields that need it, a single empty field so the row is not an empty line, and others at random
+            auto quoted = field.find_first_of(std::string{delimiter, '"', '\n', '\r'}) != std::string::npos ||
+                          (row.size() == 1 && field.empty()) || rng() % 4 == 0;
+            if (j > 0) {
+                text += delimiter;
+            }
+            if (quoted) {
+                text += '"';
+                for (auto c : field) {
+                    text += c;
+                    if (c == '"') {
+                        text += '"';
+                    }
+                }
+                text += '"';
+            } else {
+                text += field;
+            }
+        }
+        if (i + 1 < rows || final_newline) {
+            text += newline;
+        }
+        expected.push_back(std::move(row));
+    }
+    return {expected, text};
+}
+
+/// Reads every row of `text` with `next()`.
+table read_rows(const std::string &text, char delimiter, std::size_t block_size, bool &ok) {
+    auto stream = cio_test::scratch_stream(text);
+    cio::csv_reader reader{stream, delimiter, '"', block_size};
+    table rows;
+    for (std::vector<std::string_view> fields; reader.next(fields);) {
+        rows.emplace_back(fields.begin(), fields.end());
+    }
+    ok = reader && reader.feof() && !reader.ferror();
+    return rows;
+}
+
+} /* namespace */
+
+bool cio_test::csv_reader_splits_quoted_fields() noexcept {
+    try {
+        std::mt19937 rng{263};
+        for (int round = 0; round < 16; ++round) {
+            auto delimiter = round % 4 == 3 ? '\t' : ',';
+            auto [expected, text] = random_csv(2000, delimiter, round % 2 == 1, round % 3 != 0, rng);
+            // Blocks of the smallest size, sizes that split rows and quoted newlines at every offset, and the default
+            for (std::size_t block_size : {std::size_t{1}, std::size_t{65}, std::size_t{100}, std::size_t{4099},
+                                           cio::csv_reader::default_block_size}) {
+                bool ok;
+                if (read_rows(text, delimiter, block_size, ok) != expected || !ok) {
+                    return false;
+                }
+            }
+        }
+
+        // Empty lines are skipped, but a quoted empty field, alone or with empty neighbors, is a row
+        const std::pair<std::string, table> cases[] = {
+                {"", {}},
+                {"\n\r\n\n", {}},
+                {"\"\"\n", {{""}}},
+                {"\"\"", {{""}}},
+                {"a\n\n\"\"\r\n\nb", {{"a"}, {""}, {"b"}}},
+                {",\n", {{"", ""}}},
+                {"\"a,b\",\"c\"\"d\"\r\n\"e\nf\",g", {{"a,b", "c\"d"}, {"e\nf", "g"}}},
+        };
+        for (const auto &[text, expected] : cases) {
+            bool ok;
+            if (read_rows(text, ',', 64, ok) != expected || !ok) {
+                return false;
+            }
+        }
+        return true;
+    } catch (...) {
+        return false;
+    }
+}
+
+bool cio_test::csv_reader_parses_in_parallel() noexcept {
+    try {
+        std::mt19937 rng{269};
+        for (auto crlf : {false, true}) {
+            // Enough rows that blocks are split between threads
+            auto [expected, text] = random_csv(60000, ',', crlf, !crlf, rng);
+            std::mutex mutex;
+            table rows;
+            std::atomic<std::size_t> count{0};
+            auto stream = scratch_stream(text);
+            cio::csv_reader reader{stream, ',', '"', 256 * 1024};
+            auto parsed = reader.parse_parallel(
+                    [&](const std::vector<std::string_view> &fields) {
+                        ++count;
+                        std::lock_guard<std::mutex> lock{mutex};
+                        rows.emplace_back(fields.begin(), fields.end());
+                    },
+                    4);
+            // Ranges are parsed concurrently, so only the set of rows is fixed
+            std::sort(expected.begin(), expected.end());
+            std::sort(rows.begin(), rows.end());
+            if (!parsed || count != expected.size() || rows != expected || !reader.feof()) {
+                return false;
+            }
+        }
+        return true;
+    } catch (...) {
+        return false;
+    }
+}
@@ -0,0 +1,119 @@
+//
+// SPDX-FileCopyrightText: 2024 Stephen F. Booth <contact@sbooth.dev>
+// SPDX-License-Identifier: MIT
+//
+// Part of https://github.com/sbooth/cio
+//
+
+#import <cstdint>
+#import <cstring>
+#import <stdexcept>
+
+#import "cioTestSupport.hpp"
+#import "generator.hpp"
+#import "test_support.hpp"
+
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+
+namespace {
+
+/// A decoded record.
+struct point {
+    std::uint32_t id;
+    std::uint16_t x;
+    std::uint16_t y;
+};
+
+/// Decodes a host-order record.
+point decode_point(const unsigned char *p) noexcept {
+    point value;
+    std::memcpy(&value.id, p, 4);
+    std::memcpy(&value.x, p + 4, 2);
+    std::memcpy(&value.y, p + 6, 2);
+    return value;
+}
+
+/// Returns a stream of `count` records, with an extra partial record.
+cio::cstream point_stream(std::size_t count) {
+    std::vector<unsigned char> bytes;
+    for (std::uint32_t i = 0; i < count; ++i) {
+        point value{i, static_cast<std::uint16_t>(i * 3), static_cast<std::uint16_t>(i ^ 0x5555)};
+        unsigned char record[8];
+        std::memcpy(record, &value.id, 4);
+        std::memcpy(record + 4, &value.x, 2);
+        std::memcpy(record + 6, &value.y, 2);
+        bytes.insert(bytes.end(), record, record + 8);
+    }
+    bytes.insert(bytes.end(), {1, 2, 3});
+    return cio_test::scratch_stream(bytes);
+}
+
+} /* namespace */
+
+bool cio_test::generator_decodes_records_lazily() noexcept {
+    try {
+        constexpr std::size_t count = 1000;
+        for (std::size_t batch_size : {std::size_t{0}, std::size_t{1}, std::size_t{64}, std::size_t{4096}}) {
+            auto stream = point_stream(count);
+            std::uint32_t expected = 0;
+            for (const auto &p : cio::decode_records<point>(stream, 8, decode_point, batch_size)) {
+                if (p.id != expected || p.x != static_cast<std::uint16_t>(expected * 3) ||
+                    p.y != static_cast<std::uint16_t>(expected ^ 0x5555)) {
+                    return false;
+                }
+                ++expected;
+            }
+            if (expected != count) {
+                return false;
+            }
+        }
+
+        // The coroutine runs only as far as needed: stopping after 10 records reads only the first batch
+        auto stream = point_stream(count);
+        {
+            auto records = cio::decode_records<point>(stream, 8, decode_point, 16);
+            std::size_t seen = 0;
+            for (const auto &p : records) {
+                (void)p;
+                if (++seen == 10) {
+                    break;
+                }
+            }
+            if (stream.ftell() != 16 * 8) {
+                return false;
+            }
+        }
+
+        // An exception thrown by the decoder reaches the consumer
+        stream.rewind();
+        std::size_t decoded = 0;
+        auto throwing = [&](const unsigned char *p) {
+            if (++decoded == 100) {
+                throw std::runtime_error("decode");
+            }
+            return decode_point(p);
+        };
+        try {
+            for (const auto &p : cio::decode_records<point>(stream, 8, throwing, 32)) {
+                (void)p;
+            }
+            return false;
+        } catch (const std::runtime_error &) {
+        }
+
+        // An empty generator has no values
+        cio::generator<int> empty;
+        return decoded == 100 && empty.begin() == empty.end();
+    } catch (...) {
+        return false;
+    }
+}
+
+#else
+
+// The test support target is built as C++20; without coroutines there is nothing to test, which is a failure
+bool cio_test::generator_decodes_records_lazily() noexcept {
+    return false;
+}
+
+#endif
@@ -0,0 +1,258 @@
+//
+// SPDX-FileCopyrightText: 2024 Stephen F. Booth <contact@sbooth.dev>
+// SPDX-License-Identifier: MIT
+//
+// Part of https://github.com/sbooth/cio
+//
+
+#pragma once
+
+// Behavior checks for the cio classes.
+//
+// Several cio interfaces take C++ callables or return types Swift cannot use directly, so the checks are written in
+// C++ and called from `Tests/cioTests`. Each returns `true` if every expectation held.
+
+namespace cio_test {
+
+// MARK: mapped_file
+
+/// Maps a temporary file and reads it back sequentially, with seeks and with `fgetc()`.
+bool mapped_file_reads_back() noexcept;
+
+/// Scans a file mapped with and without `populate` and `huge_pages` and checks the page faults reported by
+/// `faults()`.
+bool mapped_file_counts_faults() noexcept;
+
+// MARK: memory_map
+
+/// Maps a scratch stream and checks that the mapping and the stream see each other's writes.
+bool memory_map_shares_scratch_stream() noexcept;
+
+// MARK: spill_stream
+
+/// Writes a spill_stream below and then past its threshold and reads the contents back each time.
+bool spill_stream_round_trips_across_threshold() noexcept;
+
+// MARK: concat_stream
+
+/// Reads and seeks across the segment ends of a concat_stream, including an empty segment, and checks the result
+/// against the concatenated files.
+bool concat_stream_reads_across_segments() noexcept;
+
+// MARK: substream
+
+/// Reads and seeks within substreams of a file, checking that reads stop at the range end and that concurrent
+/// substreams over one descriptor are independent.
+bool substream_reads_within_range() noexcept;
+
+// MARK: record_reader
+
+/// Transposes packed records of mixed widths and byte orders into columns, including columns of unequal length.
+bool record_reader_transposes_records() noexcept;
+
+// MARK: column_writer and column_reader
+
+/// Reads back the columns, row groups and statistics written by a column_writer.
+bool column_reader_reads_what_column_writer_wrote() noexcept;
+
+/// Checks that a column_reader refuses a footer whose chunk range wraps around.
+bool column_reader_rejects_wrapping_chunk() noexcept;
+
+// MARK: record_range
+
+/// Iterates the values of a stream in batches, converting their byte order and ignoring a partial final value.
+bool record_range_iterates_values() noexcept;
+
+// MARK: generator
+
+/// Decodes records lazily with `decode_records()`, stops early and propagates an exception from the decoder.
+///
+/// Coroutines require C++20, so the test support target is built as C++20; in earlier language modes this returns
+/// `false`.
+bool generator_decodes_records_lazily() noexcept;
+
+// MARK: stream_multiplexer
+
+/// Delivers lines from several pipes, including lines longer than the read buffer, and an end-of-file notification
+/// for each.
+bool stream_multiplexer_delivers_lines() noexcept;
+
+/// Checks that a handler may add streams, forcing the multiplexer to reallocate, and remove the stream being
+/// delivered.
+bool stream_multiplexer_allows_handler_changes() noexcept;
+
+// MARK: pstream
+
+/// Reads a command's output, writes a command's input and checks the exit status returned by `pclose()`.
+bool pstream_reads_and_writes_processes() noexcept;
+
+/// Checks that both ends of `cio::cstream::pipe()` are close-on-exec and carry data.
+bool cstream_pipe_is_close_on_exec() noexcept;
+
+/// Raises the capacity of a pipe and reads it back from both ends, and checks the capacity requested by `pipe()` and
+/// `cio::pstream`.
+bool cstream_pipe_capacity_can_grow() noexcept;
+
+/// Writes a page-aligned buffer larger than the pipe with `write_pages()` while another thread moves it to a scratch
+/// stream with `splice_to()`, and compares the bytes.
+bool cstream_pipe_splices_pages() noexcept;
+
+/// Checks that `set_nonblocking()` sets and clears `O_NONBLOCK`, and that an empty nonblocking pipe does not block.
+bool cstream_sets_nonblocking() noexcept;
+
+// MARK: local_socket
+
+/// Transfers bytes and typed values over a stream socket pair and reads the end of the stream after a shutdown.
+bool local_socket_transfers_bytes() noexcept;
+
+/// Sends frames, some of them empty, over sequenced-packet and datagram sockets and receives them in batches.
+bool local_socket_receives_empty_frames() noexcept;
+
+/// Passes a stream's descriptor and checks that descriptors truncated by the control buffer are reported and closed.
+bool local_socket_passes_descriptors() noexcept;
+
+/// Checks that sockets from `pair()`, `listen()`, `connect()` and `accept()` are close-on-exec and connected.
+bool local_socket_is_close_on_exec() noexcept;
+
+// MARK: shm_ring
+
+/// Streams data larger than the ring between two attachments of the same file and checks the behavior of an empty
+/// ring and of writes after `close()`.
+bool shm_ring_streams_between_attachments() noexcept;
+
+// MARK: pooled_stream
+
+/// Writes and reads back through a small pooled buffer, returning the buffer once drained, and checks positioning.
+bool pooled_stream_round_trips() noexcept;
+
+/// Checks that `stats()` counts the buffers held in thread caches, and that `trim()` frees the calling thread's cache
+/// at once and another thread's cache on its next use.
+bool buffer_pool_counts_thread_caches() noexcept;
+
+// MARK: memory_governor
+
+/// Checks that readers fall back to using less memory, or are invalid, when the budget cannot cover their buffers.
+///
+/// The budget is process-wide, so this runs in a child process.
+bool memory_governor_limits_readers() noexcept;
+
+/// Checks that a compressed writer waits for the budget to admit its buffers and gives up after its timeout.
+///
+/// The budget is process-wide, so this runs in a child process.
+bool memory_governor_throttles_writers() noexcept;
+
+/// Checks that column writers flush row groups early, that block readers read smaller blocks, and that all of them
+/// fail when the budget cannot cover their buffers.
+///
+/// The budget is process-wide, so this runs in a child process.
+bool memory_governor_limits_remaining_buffers() noexcept;
+
+// MARK: lz77
+
+/// Compresses and decompresses empty, short, random, repetitive and text inputs, and checks that output buffers one
+/// byte too small are refused.
+bool lz77_round_trips() noexcept;
+
+/// Decompresses truncated and damaged input and checks that it is refused or stays within the output buffer.
+bool lz77_rejects_corrupt_input() noexcept;
+
+// MARK: compressed_stream
+
+/// Round trips data through a compressed writer and reader, with and without a background thread, and checks that
+/// reads after the end of the stream return nothing.
+bool compressed_stream_round_trips() noexcept;
+
+/// Checks that a stream without its end marker, or cut short inside a block, is reported as an error.
+bool compressed_reader_reports_truncation() noexcept;
+
+// MARK: seekable_compressed
+
+/// Reads a container at random positions with a cache smaller than the block count and compares with the source.
+bool seekable_compressed_reads_at_random() noexcept;
+
+/// Checks that a container with a truncated or damaged trailer cannot be opened.
+bool seekable_compressed_refuses_damaged_trailers() noexcept;
+
+// MARK: timeseries
+
+/// Round trips series with special values, repeated values and extreme timestamps in several block sizes, comparing
+/// value bits so NaNs and signed zeros must be preserved.
+bool timeseries_round_trips() noexcept;
+
+/// Reads a range of a series from a file and a pipe and checks the points returned and the blocks skipped.
+bool timeseries_skips_blocks_outside_range() noexcept;
+
+// MARK: bitpack
+
+/// Round trips sorted and unsorted arrays of 0 to 1000 values of every bit width through `cio::cstream`, the packed
+/// stream extensions and the buffer codec, and checks that truncated data is refused.
+bool packed_uints_round_trip() noexcept;
+
+// MARK: sha256
+
+/// Checks the FIPS 180-2 vectors with each compression function and with updates of odd sizes.
+bool sha256_matches_known_answers() noexcept;
+
+// MARK: cdc_chunker
+
+/// Chunks random, text and constant data and checks that chunks cover it within the size bounds, and that the bounds
+/// are clamped.
+bool cdc_chunker_respects_bounds() noexcept;
+
+/// Checks that inserting bytes changes only the chunks around the insertion.
+bool cdc_chunker_boundaries_survive_insertion() noexcept;
+
+// MARK: search
+
+/// Finds needles, some longer than the block, with small block sizes and repeated calls, and compares the offsets
+/// with a naive search.
+bool find_crosses_block_boundaries() noexcept;
+
+/// Scans for overlapping, nested and duplicate patterns in memory and in streams read in blocks of several sizes, and
+/// compares the matches with a naive search.
+bool pattern_matcher_matches_naive_search() noexcept;
+
+// MARK: line_index
+
+/// Builds, saves and loads indexes with several strides and delimiters and checks that seeking to a line matches a
+/// naive scan.
+bool line_index_seeks_to_lines() noexcept;
+
+/// Checks that `open()` reuses a current sidecar file, rebuilds the index when the stride or the file changes, and
+/// leaves no temporary files behind when threads rebuild it concurrently.
+bool line_index_reuses_sidecar() noexcept;
+
+// MARK: csv_reader
+
+/// Reads rows with quoted delimiters and newlines, doubled quotes, CRLF, empty lines and quoted empty fields, with and
+/// without a final newline, in blocks of several sizes.
+bool csv_reader_splits_quoted_fields() noexcept;
+
+/// Parses rows in parallel and checks that every row is reported once.
+bool csv_reader_parses_in_parallel() noexcept;
+
+// MARK: ndjson_splitter
+
+/// Splits records with escaped quotes, backslash runs across 64-byte blocks, newlines in strings and CRLF, and
+/// compares them with a byte-at-a-time split.
+bool ndjson_splitter_respects_strings() noexcept;
+
+/// Dispatches records to several threads and checks that each batch holds the records at its index and that every
+/// record is dispatched once.
+bool ndjson_splitter_dispatches_every_record() noexcept;
+
+// MARK: unicode
+
+/// Compares `is_valid_utf8()` with `utf8_valid_length()` on known invalid sequences around the 64-byte blocks, on
+/// damaged and truncated valid text and on random bytes.
+bool utf8_validators_agree() noexcept;
+
+/// Reads valid and damaged UTF-8 with several block sizes and checks the output and the offset of the first invalid
+/// byte.
+bool utf8_reader_reports_error_offsets() noexcept;
+
+/// Reads UTF-16 in both byte orders, with and without a byte order mark, in blocks of odd sizes that split surrogate
+/// pairs, and checks the offsets of unpaired surrogates and truncated code units.
+bool utf16_reader_converts_surrogates() noexcept;
+
+} /* namespace cio_test */
@@ -0,0 +1,181 @@
+//
+// SPDX-FileCopyrightText: 2024 Stephen F. Booth <contact@sbooth.dev>
+// SPDX-License-Identifier: MIT
+//
+// Part of https://github.com/sbooth/cio
+//
+
+#import <algorithm>
+#import <atomic>
+#import <cstdio>
+#import <filesystem>
+#import <random>
+#import <string>
+#import <vector>
+
+#import "cioTestSupport.hpp"
+#import "line_index.hpp"
+#import "test_support.hpp"
+
+namespace {
+
+/// Returns lines of random lengths, including empty lines and lines longer than the index's scanning chunks.
+std::string random_lines(std::size_t count, char delimiter, bool final_delimiter, std::mt19937 &rng) {
+    std::string text;
+    for (std::size_t i = 0; i < count; ++i) {
+        auto length = i % 97 == 5 ? 5000 + rng() % 10000 : rng() % 3 == 0 ? 0 : rng() % 120;
+        for (std::size_t j = 0; j < length; ++j) {
+            text += static_cast<char>('a' + rng() % 26);
+        }
+        if (i + 1 < count || final_delimiter) {
+            text += delimiter;
+        }
+    }
+    return text;
+}
+
+/// Returns the offset of the first byte of each line in `text`, counting a final line without a delimiter.
+std::vector<std::uint64_t> naive_line_starts(const std::string &text, char delimiter) {
+    std::vector<std::uint64_t> starts;
+    for (std::size_t begin = 0; begin < text.size();) {
+        starts.push_back(begin);
+        auto end = text.find(delimiter, begin);
+        begin = end == std::string::npos ? text.size() : end + 1;
+    }
+    return starts;
+}
+
+/// Checks that `index` counts the lines of `text` and seeks `stream` to each of a sample of them.
+bool seeks_like_naive_scan(const cio::line_index &index, cio::cstream &stream, const std::string &text, char delimiter,
+                           std::mt19937 &rng) {
+    auto starts = naive_line_starts(text, delimiter);
+    if (!index || index.size() != text.size() || index.line_count() != starts.size() ||
+        index.delimiter_count() != static_cast<std::uint64_t>(std::count(text.begin(), text.end(), delimiter)) ||
+        index.seek(stream, starts.size())) {
+        return false;
+    }
+    for (int i = 0; i < 300 && !starts.empty(); ++i) {
+        // The first and last lines, lines at and around entries, and random lines
+        auto line = i == 0 ? 0 : i == 1 ? starts.size() - 1 : i < 40 ? (i * index.stride() + i % 3 - 1) % starts.size()
+                                                                      : rng() % starts.size();
+        if (!index.seek(stream, line) || stream.ftell() != static_cast<long>(starts[line])) {
+            return false;
+        }
+        // The stream reads the line from its first byte
+        auto length = std::min<std::size_t>(text.size() - starts[line], 64);
+        std::string bytes(length, '\0');
+        if (stream.fread(bytes.data(), 1, length) != length || text.compare(starts[line], length, bytes) != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+} /* namespace */
+
+bool cio_test::line_index_seeks_to_lines() noexcept {
+    try {
+        std::mt19937 rng{251};
+        // Strides from every line to more lines than the text holds, with and without a final delimiter
+        for (std::uint64_t stride : {1, 2, 7, 64, 4096}) {
+            for (auto final_delimiter : {true, false}) {
+                for (auto delimiter : {'\n', '\0'}) {
+                    auto text = random_lines(1500, delimiter, final_delimiter, rng);
+                    auto stream = scratch_stream(text);
+                    cio::line_index index;
+                    if (!index.build(stream, static_cast<unsigned char>(delimiter), stride) ||
+                        index.entries().size() != index.delimiter_count() / stride + 1 ||
+                        !seeks_like_naive_scan(index, stream, text, delimiter, rng)) {
+                        return false;
+                    }
+
+                    // A saved index loads with the same entries and seeks the same way
+                    auto saved = cio::cstream::memfd("cio-test");
+                    cio::line_index loaded;
+                    if (!index.save(saved)) {
+                        return false;
+                    }
+                    saved.rewind();
+                    if (!loaded.load(saved) || loaded.entries() != index.entries() ||
+                        !seeks_like_naive_scan(loaded, stream, text, delimiter, rng)) {
+                        return false;
+                    }
+                }
+            }
+        }
+
+        // Empty data has no lines, and a single line without a delimiter has one
+        for (std::string text : {"", "x", "\n"}) {
+            auto stream = scratch_stream(text);
+            cio::line_index index;
+            if (!index.build(stream) || index.line_count() != naive_line_starts(text, '\n').size()) {
+                return false;
+            }
+        }
+        return true;
+    } catch (...) {
+        return false;
+    }
+}
+
+bool cio_test::line_index_reuses_sidecar() noexcept {
+    try {
+        std::mt19937 rng{257};
+        temp_file file;
+        auto text = random_lines(2000, '\n', true, rng);
+        if (!write_file(file.path(), {text.begin(), text.end()})) {
+            return false;
+        }
+        auto sidecar = cio::line_index::sidecar_path(file.path());
+        struct remover {
+            std::string path;
+            ~remover() { std::remove(path.c_str()); }
+        } remove_sidecar{sidecar};
+
+        // The first open builds the index and the second reads it back
+        cio::line_index built, reused, other_stride;
+        if (!built.open(file.path(), '\n', 16) || built.from_sidecar() || !reused.open(file.path(), '\n', 16) ||
+            !reused.from_sidecar() || reused.entries() != built.entries() ||
+            !other_stride.open(file.path(), '\n', 32) || other_stride.from_sidecar()) {
+            return false;
+        }
+
+        // Concurrent rebuilds write separate temporary files, and none is left behind
+        std::atomic<int> failures{0};
+        {
+            auto rebuild = [&] {
+                for (int i = 0; i < 20; ++i) {
+                    cio::line_index index;
+                    if (!index.open(file.path(), '\n', 8 + i % 2) || index.line_count() != 2000) {
+                        ++failures;
+                    }
+                }
+            };
+            scoped_thread a{rebuild}, b{rebuild}, c{rebuild};
+        }
+        std::size_t leftovers = 0;
+        for (const auto &entry : std::filesystem::directory_iterator{std::filesystem::path{sidecar}.parent_path()}) {
+            auto name = entry.path().string();
+            leftovers += name.size() > sidecar.size() && name.compare(0, sidecar.size(), sidecar) == 0;
+        }
+        if (failures != 0 || leftovers != 0) {
+            return false;
+        }
+        cio::cstream stream{file.path(), "rb"};
+        if (!seeks_like_naive_scan(reused, stream, text, '\n', rng)) {
+            return false;
+        }
+
+        // A file that changed size is indexed again
+        text += "one more line\n";
+        cio::line_index rebuilt;
+        if (!write_file(file.path(), {text.begin(), text.end()}) || !rebuilt.open(file.path(), '\n', 32) ||
+            rebuilt.from_sidecar()) {
+            return false;
+        }
+        cio::cstream changed{file.path(), "rb"};
+        return seeks_like_naive_scan(rebuilt, changed, text, '\n', rng);
+    } catch (...) {
+        return false;
+    }
+}
@@ -0,0 +1,202 @@
+//
+// SPDX-FileCopyrightText: 2024 Stephen F. Booth <contact@sbooth.dev>
+// SPDX-License-Identifier: MIT
+//
+// Part of https://github.com/sbooth/cio
+//
+
+#import <cerrno>
+#import <cstring>
+#import <string>
+#import <vector>
+
+#import <dirent.h>
+#import <fcntl.h>
+#import <sys/socket.h>
+#import <sys/uio.h>
+#import <unistd.h>
+
+#import "cioTestSupport.hpp"
+#import "local_socket.hpp"
+#import "test_support.hpp"
+
+namespace {
+
+/// Returns the number of open file descriptors in this process.
+std::size_t open_descriptor_count() noexcept {
+    std::size_t count = 0;
+    if (auto dir = ::opendir("/dev/fd"); dir) {
+        while (auto entry = ::readdir(dir)) {
+            count += entry->d_name[0] != '.';
+        }
+        ::closedir(dir);
+    }
+    return count;
+}
+
+/// Returns `true` if `s` is valid and close-on-exec.
+bool is_close_on_exec(const cio::local_socket &s) noexcept {
+    auto flags = s ? ::fcntl(s.fileno(), F_GETFD) : -1;
+    return flags != -1 && (flags & FD_CLOEXEC);
+}
+
+} /* namespace */
+
+bool cio_test::local_socket_transfers_bytes() noexcept {
+    try {
+        auto [a, b] = cio::local_socket::pair();
+        if (!a || !b) {
+            return false;
+        }
+        auto bytes = random_bytes(512 * 1024, 71);
+        // More than the socket buffer holds, so the writer runs concurrently
+        scoped_thread writer{[&, &a = a] {
+            a.fwrite(bytes.data(), 1, bytes.size());
+            a.write_uint_big(0x01020304u);
+            a.shutdown();
+        }};
+        std::vector<unsigned char> received(bytes.size());
+        if (b.fread(received.data(), 1, received.size()) != received.size() || received != bytes) {
+            return false;
+        }
+        std::uint32_t value;
+        if (!b.read_uint_big(value) || value != 0x01020304u) {
+            return false;
+        }
+        writer.join();
+        unsigned char ch;
+        return b.fread(&ch, 1, 1) == 0;
+    } catch (...) {
+        return false;
+    }
+}
+
+bool cio_test::local_socket_receives_empty_frames() noexcept {
+    try {
+        for (auto type : {cio::local_socket::type::seqpacket, cio::local_socket::type::datagram}) {
+            auto [a, b] = cio::local_socket::pair(type);
+            if (!a || !b) {
+                return false;
+            }
+            // More frames than one batch, with empty frames inside, at a batch boundary and at the end
+            std::vector<std::string> sent;
+            for (std::size_t i = 0; i < 150; ++i) {
+                sent.push_back(i % 7 == 0 || i == 63 || i == 64 || i == 149 ? "" : "frame " + std::to_string(i));
+            }
+            std::vector<struct iovec> out;
+            for (auto &frame : sent) {
+                out.push_back({frame.data(), frame.size()});
+            }
+            if (a.send_frames(out.data(), out.size()) != out.size()) {
+                return false;
+            }
+
+            std::vector<std::string> received;
+            std::vector<std::vector<char>> buffers(sent.size(), std::vector<char>(32));
+            std::vector<std::size_t> lengths(sent.size());
+            while (received.size() < sent.size()) {
+                std::vector<struct iovec> in;
+                for (auto i = received.size(); i < sent.size(); ++i) {
+                    in.push_back({buffers[i].data(), buffers[i].size()});
+                }
+                auto n = b.recv_frames(in.data(), in.size(), lengths.data() + received.size());
+                if (n == 0) {
+                    return false;
+                }
+                for (auto i = received.size(), end = i + n; i < end; ++i) {
+                    received.emplace_back(buffers[i].data(), lengths[i]);
+                }
+            }
+            if (received != sent) {
+                return false;
+            }
+
+            if (type == cio::local_socket::type::seqpacket) {
+                // Once the peer is closed the stream ends
+                a.reset();
+                char buffer[8];
+                struct iovec frame{buffer, sizeof buffer};
+                std::size_t length;
+                errno = EINTR;
+                if (b.recv_frames(&frame, 1, &length) != 0 || errno != 0) {
+                    return false;
+                }
+            }
+        }
+        return true;
+    } catch (...) {
+        return false;
+    }
+}
+
+bool cio_test::local_socket_passes_descriptors() noexcept {
+    try {
+        auto [a, b] = cio::local_socket::pair();
+        auto text = std::string("shared through a descriptor");
+        auto stream = scratch_stream(text);
+        if (!a || !b || !stream || !a.send_stream(stream)) {
+            return false;
+        }
+        auto copy = b.recv_stream();
+        auto bytes = read_all(copy);
+        if (std::string(bytes.begin(), bytes.end()) != text) {
+            return false;
+        }
+
+        // More descriptors than the receiver's control buffer holds are reported rather than silently dropped
+        auto before = open_descriptor_count();
+        std::vector<int> fds(cio::local_socket::max_fds + 8, stream.fileno());
+        union {
+            unsigned char bytes[CMSG_SPACE(sizeof(int) * (cio::local_socket::max_fds + 8))];
+            struct cmsghdr align;
+        } control;
+        unsigned char tag = 0;
+        struct iovec iov{&tag, 1};
+        struct msghdr message{};
+        message.msg_iov = &iov;
+        message.msg_iovlen = 1;
+        message.msg_control = control.bytes;
+        message.msg_controllen = sizeof control.bytes;
+        auto header = CMSG_FIRSTHDR(&message);
+        header->cmsg_level = SOL_SOCKET;
+        header->cmsg_type = SCM_RIGHTS;
+        header->cmsg_len = CMSG_LEN(sizeof(int) * fds.size());
+        std::memcpy(CMSG_DATA(header), fds.data(), sizeof(int) * fds.size());
+        if (::sendmsg(a.fileno(), &message, 0) != 1) {
+            return false;
+        }
+        int received[4];
+        std::size_t count = 99;
+        errno = 0;
+        if (b.recv_fds(&tag, 1, received, 4, count) != -1 || errno != EMSGSIZE || count != 0) {
+            return false;
+        }
+        return open_descriptor_count() == before;
+    } catch (...) {
+        return false;
+    }
+}
+
+bool cio_test::local_socket_is_close_on_exec() noexcept {
+    try {
+        auto [a, b] = cio::local_socket::pair(cio::local_socket::type::seqpacket);
+        if (!is_close_on_exec(a) || !is_close_on_exec(b)) {
+            return false;
+        }
+
+        // The listening socket is bound to a path that must not exist
+        temp_file file;
+        ::unlink(file.path());
+        auto listener = cio::local_socket::listen(file.path());
+        auto client = cio::local_socket::connect(file.path());
+        auto server = listener.accept();
+        if (!is_close_on_exec(listener) || !is_close_on_exec(client) || !is_close_on_exec(server)) {
+            return false;
+        }
+        client.write_uint_big(0x0a0b0c0du);
+        std::uint32_t value;
+        return server.read_uint_big(value) && value == 0x0a0b0c0du;
+    } catch (...) {
+        return false;
+    }
+}
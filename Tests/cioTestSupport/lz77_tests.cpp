@@ -0,0 +1,113 @@
+//
+// SPDX-FileCopyrightText: 2024 Stephen F. Booth <contact@sbooth.dev>
+// SPDX-License-Identifier: MIT
+//
+// Part of https://github.com/sbooth/cio
+//
+
+#import <random>
+#import <vector>
+
+#import "cioTestSupport.hpp"
+#import "lz77.hpp"
+#import "test_support.hpp"
+
+namespace {
+
+/// Compresses `input`, or returns an empty vector if the result does not fit in the bound.
+std::vector<unsigned char> compress(const std::vector<unsigned char> &input) {
+    std::vector<unsigned char> compressed(cio::lz77::compress_bound(input.size()));
+    auto n = cio::lz77::compress(input.data(), input.size(), compressed.data(), compressed.size());
+    compressed.resize(n);
+    return compressed;
+}
+
+/// Compresses and decompresses `input` and checks the result, including that a smaller output buffer is refused.
+bool round_trips(const std::vector<unsigned char> &input) {
+    auto compressed = compress(input);
+    if (compressed.empty() && !input.empty()) {
+        return false;
+    }
+    // Output buffers are padded so a write past the capacity would be seen
+    std::vector<unsigned char> output(input.size() + 64, 0xa5);
+    if (cio::lz77::decompress(compressed.data(), compressed.size(), output.data(), input.size()) != input.size() ||
+        !std::equal(input.begin(), input.end(), output.begin()) ||
+        std::any_of(output.begin() + static_cast<long>(input.size()), output.end(), [](auto b) { return b != 0xa5; })) {
+        return false;
+    }
+    return input.empty() ||
+           cio::lz77::decompress(compressed.data(), compressed.size(), output.data(), input.size() - 1) ==
+                   cio::lz77::error;
+}
+
+} /* namespace */
+
+bool cio_test::lz77_round_trips() noexcept {
+    try {
+        // Empty and very short inputs are all literals
+        for (std::size_t size = 0; size < 40; ++size) {
+            if (!round_trips(random_bytes(size, static_cast<std::uint32_t>(size)))) {
+                return false;
+            }
+        }
+        if (!round_trips({}) || !round_trips({'x'})) {
+            return false;
+        }
+
+        // Incompressible, repetitive and text inputs, with matches at the window limit and long runs
+        std::vector<unsigned char> period(70000);
+        auto unit = random_bytes(65535, 109);
+        for (std::size_t i = 0; i < period.size(); ++i) {
+            period[i] = unit[i % unit.size()];
+        }
+        for (auto &input : {random_bytes(1024 * 1024, 113), std::vector<unsigned char>(1024 * 1024, 0),
+                            std::vector<unsigned char>(100000, 'a'), text_bytes(1024 * 1024, 127), period}) {
+            if (!round_trips(input)) {
+                return false;
+            }
+        }
+
+        // Repetitive data compresses well and random data does not fit in less than its size
+        auto zeros = std::vector<unsigned char>(1024 * 1024, 0);
+        auto noise = random_bytes(64 * 1024, 131);
+        std::vector<unsigned char> small(noise.size() - 1);
+        return compress(zeros).size() < 8 * 1024 &&
+               cio::lz77::compress(noise.data(), noise.size(), small.data(), small.size()) == 0;
+    } catch (...) {
+        return false;
+    }
+}
+
+bool cio_test::lz77_rejects_corrupt_input() noexcept {
+    try {
+        auto input = text_bytes(200 * 1024, 137);
+        auto compressed = compress(input);
+        std::vector<unsigned char> output(input.size());
+
+        // No truncation decodes to the whole input
+        for (std::size_t size = 0; size < compressed.size(); size += 1 + size / 64) {
+            if (cio::lz77::decompress(compressed.data(), size, output.data(), output.size()) == input.size()) {
+                return false;
+            }
+        }
+
+        // Damaged input decodes to something or is refused, but never reads or writes out of bounds
+        std::mt19937 rng{139};
+        for (int i = 0; i < 2000; ++i) {
+            auto damaged = compressed;
+            for (int j = 0; j < 1 + i % 4; ++j) {
+                damaged[rng() % damaged.size()] = static_cast<unsigned char>(rng());
+            }
+            auto n = cio::lz77::decompress(damaged.data(), damaged.size(), output.data(), output.size());
+            if (n != cio::lz77::error && n > output.size()) {
+                return false;
+            }
+        }
+
+        // A match reaching before the start of the output is refused
+        const unsigned char bad_offset[] = {0x14, 'a', 0x05, 0x00};
+        return cio::lz77::decompress(bad_offset, sizeof bad_offset, output.data(), output.size()) == cio::lz77::error;
+    } catch (...) {
+        return false;
+    }
+}
@@ -0,0 +1,111 @@
+//
+// SPDX-FileCopyrightText: 2024 Stephen F. Booth <contact@sbooth.dev>
+// SPDX-License-Identifier: MIT
+//
+// Part of https://github.com/sbooth/cio
+//
+
+#import <cstdio>
+#import <cstring>
+
+#import "cioTestSupport.hpp"
+#import "mapped_file.hpp"
+#import "test_support.hpp"
+
+bool cio_test::mapped_file_reads_back() noexcept {
+    temp_file file;
+    auto bytes = random_bytes(3 * 1024 * 1024 + 123, 51);
+    if (!write_file(file.path(), bytes)) {
+        return false;
+    }
+
+    cio::mapped_file::options opts;
+    opts.prefetch.read_ahead = 256 * 1024;
+    opts.prefetch.retain_behind = 64 * 1024;
+    opts.prefetch.release = cio::mapped_file::release_advice::dontneed;
+    cio::mapped_file mapped;
+    if (!mapped.open(file.path(), opts) || !mapped || mapped.size() != bytes.size() ||
+        std::memcmp(mapped.data(), bytes.data(), bytes.size()) != 0) {
+        return false;
+    }
+
+    // Released pages are refaulted from the file, so reads behind the window still see the contents
+    if (read_all(mapped) != bytes || !mapped.feof() || mapped.fgetc() != EOF) {
+        return false;
+    }
+
+    for (long offset : {0L, 1L, 4095L, 4096L, 2 * 1024 * 1024L + 7, static_cast<long>(bytes.size()) - 1}) {
+        if (mapped.fseek(offset, SEEK_SET) != 0 || mapped.ftell() != offset ||
+            mapped.fgetc() != bytes[static_cast<std::size_t>(offset)]) {
+            return false;
+        }
+    }
+    unsigned char tail[16];
+    if (mapped.fseek(-10, SEEK_END) != 0 || mapped.fread(tail, 1, sizeof tail) != 10 ||
+        std::memcmp(tail, bytes.data() + bytes.size() - 10, 10) != 0) {
+        return false;
+    }
+
+    mapped.close();
+    return !mapped && !cio::mapped_file{"/nonexistent/cio-test"};
+}
+
+bool cio_test::mapped_file_counts_faults() noexcept {
+    temp_file file;
+    auto bytes = random_bytes(8 * 1024 * 1024, 53);
+    if (!write_file(file.path(), bytes)) {
+        return false;
+    }
+
+    // Touches one byte in each page and returns the page faults taken, or -1 if the contents differ
+    auto scan = [&](const cio::mapped_file::options &opts) -> long {
+        cio::mapped_file mapped{file.path(), opts};
+        if (!mapped || mapped.size() != bytes.size()) {
+            return -1;
+        }
+        mapped.reset_faults();
+        unsigned sum = 0, expected = 0;
+        for (std::size_t i = 0; i < bytes.size(); i += 4096) {
+            sum += *static_cast<const volatile unsigned char *>(mapped.data() + i);
+            expected += bytes[i];
+        }
+        auto faults = mapped.faults();
+        if (sum != expected || faults.minor < 0 || faults.major < 0) {
+            return -1;
+        }
+        return faults.minor + faults.major;
+    };
+
+    // Without read-ahead every page is faulted in by the scan
+    cio::mapped_file::options lazy;
+    lazy.prefetch.read_ahead = 0;
+    auto lazy_faults = scan(lazy);
+    if (lazy_faults <= 0) {
+        return false;
+    }
+
+    // A populated mapping is faulted in before the scan, so the scan takes fewer faults
+    auto populated = lazy;
+    populated.populate = true;
+    auto populated_faults = scan(populated);
+#if defined(MAP_POPULATE)
+    if (populated_faults < 0 || populated_faults >= lazy_faults) {
+        return false;
+    }
+#else
+    if (populated_faults < 0) {
+        return false;
+    }
+#endif
+
+    // Huge pages are only a hint, and the contents are the same either way
+    auto huge = populated;
+    huge.huge_pages = true;
+    if (scan(huge) < 0) {
+        return false;
+    }
+    cio::mapped_file::options huge_default;
+    huge_default.huge_pages = true;
+    cio::mapped_file mapped{file.path(), huge_default};
+    return mapped && read_all(mapped) == bytes;
+}
@@ -0,0 +1,301 @@
+//
+// SPDX-FileCopyrightText: 2024 Stephen F. Booth <contact@sbooth.dev>
+// SPDX-License-Identifier: MIT
+//
+// Part of https://github.com/sbooth/cio
+//
+
+#import <chrono>
+#import <numeric>
+#import <random>
+#import <string>
+#import <string_view>
+#import <thread>
+#import <vector>
+
+#import "cdc_chunker.hpp"
+#import "cioTestSupport.hpp"
+#import "columnar.hpp"
+#import "compressed_stream.hpp"
+#import "csv_reader.hpp"
+#import "line_index.hpp"
+#import "memory_governor.hpp"
+#import "ndjson_splitter.hpp"
+#import "record_reader.hpp"
+#import "search.hpp"
+#import "seekable_compressed.hpp"
+#import "test_support.hpp"
+#import "timeseries.hpp"
+#import "unicode.hpp"
+
+namespace {
+
+constexpr std::size_t block_size = 64 * 1024;
+
+/// Returns a compressed stream of `bytes`.
+cio::cstream compress(const std::vector<unsigned char> &bytes, bool seekable) {
+    auto stream = cio::cstream::memfd("cio-test");
+    if (seekable) {
+        cio::seekable_compressed_writer writer{stream, block_size};
+        writer.fwrite(bytes.data(), 1, bytes.size());
+        writer.finish();
+    } else {
+        cio::compressed_writer writer{stream, block_size};
+        writer.fwrite(bytes.data(), 1, bytes.size());
+        writer.finish();
+    }
+    stream.rewind();
+    return stream;
+}
+
+/// Returns the sizes of the chunks found by `chunker`.
+std::vector<std::size_t> chunk_sizes(cio::cdc_chunker &chunker) {
+    std::vector<std::size_t> sizes;
+    for (cio::cdc_chunker::chunk c; chunker.next(c);) {
+        sizes.push_back(c.size);
+    }
+    return sizes;
+}
+
+} /* namespace */
+
+bool cio_test::memory_governor_limits_readers() noexcept {
+    return in_child_process([] {
+        auto &governor = cio::memory_governor::shared();
+        // Memory reserved before the check, such as buffers cached by the pool, is left alone
+        auto baseline = governor.current();
+        auto bytes = text_bytes(20 * block_size + 99, 97);
+        auto plain = compress(bytes, false);
+        auto seekable = compress(bytes, true);
+        auto data = random_bytes(3 * 1024 * 1024, 101);
+        std::vector<std::size_t> expected_chunks;
+        {
+            auto stream = scratch_stream(data);
+            cio::cdc_chunker chunker{stream};
+            expected_chunks = chunk_sizes(chunker);
+        }
+        // Every buffer has been returned to the budget
+        if (governor.current() != baseline) {
+            return false;
+        }
+
+        // Room for one block besides the decoding scratch space, so nothing is read ahead
+        governor.set_budget(baseline + cio::lz77::compress_bound(block_size) + block_size + block_size / 2);
+        {
+            cio::compressed_reader reader{plain, true};
+            if (!reader || read_all(reader) != bytes || !reader.feof()) {
+                return false;
+            }
+        }
+        if (governor.current() != baseline) {
+            return false;
+        }
+
+        // Room for one cached block, so random reads evict it but still succeed
+        {
+            cio::seekable_compressed_reader reader{seekable, 8};
+            std::mt19937 rng{103};
+            for (int i = 0; i < 50; ++i) {
+                auto position = rng() % bytes.size();
+                unsigned char buffer[300];
+                reader.fseek(static_cast<long>(position), SEEK_SET);
+                auto n = reader.fread(buffer, 1, sizeof buffer);
+                if (n != std::min(sizeof buffer, bytes.size() - position) ||
+                    !std::equal(buffer, buffer + n, bytes.begin() + static_cast<long>(position))) {
+                    return false;
+                }
+            }
+            if (governor.current() > governor.budget()) {
+                return false;
+            }
+        }
+
+        // The chunker falls back to reading one maximum chunk at a time and finds the same boundaries
+        governor.set_budget(baseline + 256 * 1024);
+        {
+            auto stream = scratch_stream(data);
+            cio::cdc_chunker chunker{stream};
+            if (!chunker || chunk_sizes(chunker) != expected_chunks) {
+                return false;
+            }
+        }
+
+        // Readers whose buffers do not fit at all are invalid
+        governor.set_budget(baseline + 1024);
+        auto text = scratch_stream(std::string("a,b\n{}\n"));
+        cio::csv_reader csv{text};
+        cio::ndjson_splitter ndjson{text};
+        std::vector<std::string_view> fields;
+        std::string_view record;
+        cio::compressed_reader reader{plain, false};
+        if (csv || csv.next(fields) || ndjson || ndjson.next(record) || reader) {
+            return false;
+        }
+        governor.set_budget(0);
+        return governor.current() == baseline && governor.refusals() > 0;
+    });
+}
+
+bool cio_test::memory_governor_throttles_writers() noexcept {
+    return in_child_process([] {
+        auto &governor = cio::memory_governor::shared();
+        auto baseline = governor.current();
+        governor.set_budget(baseline + 1024 * 1024);
+        cio::memory_reservation held;
+        if (!held.resize(1024 * 1024)) {
+            return false;
+        }
+
+        // A writer waits for the held memory to be released
+        auto stream = cio::cstream::memfd("cio-test");
+        scoped_thread releaser{[&] {
+            std::this_thread::sleep_for(std::chrono::milliseconds{100});
+            held.reset();
+        }};
+        auto start = std::chrono::steady_clock::now();
+        cio::compressed_writer writer{stream, block_size};
+        if (!writer || std::chrono::steady_clock::now() - start < std::chrono::milliseconds{50}) {
+            return false;
+        }
+        releaser.join();
+        auto bytes = text_bytes(3 * block_size, 107);
+        if (writer.fwrite(bytes.data(), 1, bytes.size()) != bytes.size() || !writer.finish() ||
+            governor.current() != baseline) {
+            return false;
+        }
+
+        // A writer that is never admitted gives up
+        if (!held.resize(1024 * 1024)) {
+            return false;
+        }
+        auto other = cio::cstream::memfd("cio-test");
+        cio::compressed_writer refused{other, block_size};
+        return !refused && refused.fwrite(bytes.data(), 1, 1) == 0;
+    });
+}
+
+bool cio_test::memory_governor_limits_remaining_buffers() noexcept {
+    return in_child_process([] {
+        auto &governor = cio::memory_governor::shared();
+        auto baseline = governor.current();
+        constexpr std::size_t rows = 20000;
+        std::vector<std::uint64_t> a(rows), b(rows);
+        std::mt19937_64 rng{109};
+        for (std::size_t i = 0; i < rows; ++i) {
+            a[i] = rng();
+            b[i] = i;
+        }
+        auto series = cio::cstream::memfd("cio-test");
+        {
+            cio::timeseries_writer writer{series};
+            for (std::int64_t i = 0; i < 5000; ++i) {
+                writer.append(&i, reinterpret_cast<const double *>(&a[static_cast<std::size_t>(i)]), 1);
+            }
+            if (!writer.finish()) {
+                return false;
+            }
+        }
+        series.rewind();
+        auto text = text_bytes(300 * 1024 + 17, 113);
+        std::string haystack(text.begin(), text.end());
+        haystack += "needle";
+
+        // Room for 64 KiB of buffers, so row groups are written early and larger blocks are read in smaller ones
+        governor.set_budget(baseline + 64 * 1024);
+        auto table = cio::cstream::memfd("cio-test");
+        {
+            cio::column_writer writer{table, {8, 8}};
+            for (std::size_t i = 0; i < rows; ++i) {
+                if (!writer.append_row({a[i], b[i]})) {
+                    return false;
+                }
+            }
+            const void *columns[] = {a.data(), b.data()};
+            if (!writer.write_row_group(rows, columns) || !writer.finish()) {
+                return false;
+            }
+        }
+        if (governor.current() != baseline) {
+            return false;
+        }
+        governor.set_budget(0);
+        {
+            cio::column_reader reader{table};
+            std::vector<std::size_t> groups(reader.row_group_count());
+            std::iota(groups.begin(), groups.end(), std::size_t{0});
+            std::vector<std::uint64_t> ra, rb;
+            // Both the appended and the written rows span several row groups
+            if (!reader || reader.row_group_count() < 4 || reader.row_count() != 2 * rows ||
+                !reader.read_column(groups, 0, ra) || !reader.read_column(groups, 1, rb) ||
+                !std::equal(a.begin(), a.end(), ra.begin()) || !std::equal(a.begin(), a.end(), ra.begin() + rows) ||
+                !std::equal(b.begin(), b.end(), rb.begin()) || !std::equal(b.begin(), b.end(), rb.begin() + rows)) {
+                return false;
+            }
+        }
+        governor.set_budget(baseline + 64 * 1024);
+        {
+            auto stream = scratch_stream(text);
+            cio::utf8_reader reader{stream};
+            if (!reader || read_all(reader) != text || reader.ferror()) {
+                return false;
+            }
+        }
+        {
+            auto stream = scratch_stream(haystack);
+            cio::line_index index;
+            if (!index.build(stream) || index.size() != haystack.size()) {
+                return false;
+            }
+        }
+        {
+            auto stream = scratch_stream(haystack);
+            if (cio::find(stream, "needle") != text.size()) {
+                return false;
+            }
+            stream.rewind();
+            cio::pattern_matcher matcher{{"needle"}};
+            std::uint64_t found = 0;
+            if (!matcher.scan(stream, [&](const cio::pattern_matcher::match &m) {
+                    found = m.offset;
+                    return true;
+                }) ||
+                found != text.size()) {
+                return false;
+            }
+        }
+        {
+            auto stream = scratch_stream(std::vector<unsigned char>(
+                    reinterpret_cast<const unsigned char *>(a.data()),
+                    reinterpret_cast<const unsigned char *>(a.data() + rows)));
+            cio::record_reader<cio::field<std::uint64_t>> reader{rows};
+            std::vector<std::uint64_t> values(rows);
+            if (reader.read(stream, rows, values.data()) != rows || values != a) {
+                return false;
+            }
+        }
+        if (governor.current() != baseline) {
+            return false;
+        }
+
+        // Buffers that do not fit at all are refused
+        governor.set_budget(baseline + 1);
+        cio::timeseries_reader series_reader{series};
+        auto other = cio::cstream::memfd("cio-test");
+        cio::timeseries_writer series_writer{other};
+        cio::column_writer column_writer{other, {8}};
+        auto stream = scratch_stream(haystack);
+        cio::utf8_reader utf8{stream};
+        cio::utf16_reader utf16{stream};
+        cio::line_index index;
+        cio::pattern_matcher matcher{{"needle"}};
+        cio::record_reader<cio::field<std::uint64_t>> records;
+        std::uint64_t value;
+        if (series_reader || series_writer || column_writer.append_row({1}) || utf8 || utf16 || index.build(stream) ||
+            cio::find(stream, "needle") || matcher.scan(stream, [](const auto &) { return true; }) ||
+            records.read(stream, 1, &value) != 0) {
+            return false;
+        }
+        governor.set_budget(0);
+        return governor.current() == baseline;
+    });
+}
@@ -0,0 +1,51 @@
+//
+// SPDX-FileCopyrightText: 2024 Stephen F. Booth <contact@sbooth.dev>
+// SPDX-License-Identifier: MIT
+//
+// Part of https://github.com/sbooth/cio
+//
+
+#import <cstdio>
+#import <cstring>
+
+#import <fcntl.h>
+
+#import "cioTestSupport.hpp"
+#import "memory_map.hpp"
+#import "test_support.hpp"
+
+bool cio_test::memory_map_shares_scratch_stream() noexcept {
+    auto bytes = random_bytes(100000, 52);
+    auto stream = cio::cstream::memfd("cio-test", bytes.size(), true);
+    if (!stream || stream.fwrite(bytes.data(), 1, bytes.size()) != bytes.size()) {
+        return false;
+    }
+
+    // Mapping flushes the stream, so everything written is visible
+    cio::memory_map map{stream, true};
+    if (!map || map.size() != bytes.size() || std::memcmp(map.data(), bytes.data(), bytes.size()) != 0) {
+        return false;
+    }
+
+    // Writes through the mapping are visible to reads through the stream
+    static_cast<unsigned char *>(map.data())[1234] ^= 0xff;
+    bytes[1234] ^= 0xff;
+    stream.rewind();
+    if (read_all(stream) != bytes) {
+        return false;
+    }
+
+    map.reset();
+    if (map) {
+        return false;
+    }
+
+#if defined(F_SEAL_WRITE)
+    if (stream.add_seals(F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE) != 0 ||
+        (stream.seals() & F_SEAL_WRITE) == 0 || cio::memory_map{stream, true} || !cio::memory_map{stream, false}) {
+        return false;
+    }
+#endif
+
+    return !cio::memory_map{stream.fileno(), 0, false};
+}
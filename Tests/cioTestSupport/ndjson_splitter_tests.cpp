@@ -0,0 +1,167 @@
+//
+// SPDX-FileCopyrightText: 2024 Stephen F. Booth <contact@sbooth.dev>
+// SPDX-License-Identifier: MIT
+//
+// Part of https://github.com/sbooth/cio
+//
+
+#import <atomic>
+#import <random>
+#import <stdexcept>
+#import <string>
+#import <string_view>
+#import <vector>
+
+#import "cioTestSupport.hpp"
+#import "ndjson_splitter.hpp"
+#import "test_support.hpp"
+
+namespace {
+
+/// Splits `text` one byte at a time: a newline ends a record unless it is inside a string, a quote opens or closes a
+/// string unless escaped, and a backslash escapes the next byte. Trailing carriage returns and empty records are
+/// dropped.
+std::vector<std::string> naive_split(const std::string &text) {
+    std::vector<std::string> records;
+    std::string record;
+    bool in_string = false, escaped = false;
+    auto finish = [&] {
+        if (!record.empty() && record.back() == '\r') {
+            record.pop_back();
+        }
+        if (!record.empty()) {
+            records.push_back(record);
+        }
+        record.clear();
+    };
+    for (auto c : text) {
+        if (escaped) {
+            escaped = false;
+        } else if (c == '\\') {
+            escaped = true;
+        } else if (c == '"') {
+            in_string = !in_string;
+        } else if (c == '\n' && !in_string) {
+            finish();
+            continue;
+        }
+        record += c;
+    }
+    finish();
+    return records;
+}
+
+/// Returns records with escaped quotes, runs of backslashes, newlines inside strings and CRLF line endings.
+std::string random_ndjson(std::size_t records, std::mt19937 &rng) {
+    const std::string pieces[] = {"abc", " ", "\\\"", "\\\\", "\\\\\\\"", "\\n", "\n", "\r\n", "{}", ":", ","};
+    std::string text;
+    for (std::size_t i = 0; i < records; ++i) {
+        text += "{\"id\":" + std::to_string(i) + ",\"s\":\"";
+        for (auto n = rng() % 8; n > 0; --n) {
+            text += pieces[rng() % std::size(pieces)];
+        }
+        // Runs of backslashes of every length, at every offset within the 64-byte blocks
+        text += std::string(rng() % 64, 'p') + std::string(1 + rng() % 9, '\\');
+        if (text.back() == '\\' && (text.size() - text.find_last_not_of('\\') - 1) % 2 == 1) {
+            text += '"';
+        }
+        text += "\"}";
+        text += rng() % 3 == 0 ? "\r\n" : rng() % 5 == 0 ? "\n\n" : "\n";
+    }
+    return text;
+}
+
+/// Returns `true` if `splitter` reads exactly `expected`.
+bool splits_to(cio::ndjson_splitter &splitter, const std::vector<std::string> &expected) {
+    std::size_t i = 0;
+    for (std::string_view record; splitter.next(record); ++i) {
+        if (i == expected.size() || record != expected[i]) {
+            return false;
+        }
+    }
+    return i == expected.size() && splitter.record_count() == expected.size() && splitter.feof() &&
+           !splitter.ferror();
+}
+
+} /* namespace */
+
+bool cio_test::ndjson_splitter_respects_strings() noexcept {
+    try {
+        std::mt19937 rng{271};
+        for (int round = 0; round < 8; ++round) {
+            auto text = random_ndjson(3000, rng);
+            if (round % 2 == 1) {
+                // A final record without a newline
+                text.resize(text.find_last_not_of("\r\n") + 1);
+            }
+            auto expected = naive_split(text);
+            for (std::size_t block_size : {std::size_t{64}, std::size_t{100}, std::size_t{4096}}) {
+                auto stream = scratch_stream(text);
+                cio::ndjson_splitter splitter{stream, block_size};
+                if (!splits_to(splitter, expected)) {
+                    return false;
+                }
+            }
+        }
+
+        // A run of backslashes ending each 64-byte block, escaping the quote that begins the next one or not
+        for (std::size_t run = 1; run <= 70; ++run) {
+            for (std::size_t offset = 50; offset < 64; ++offset) {
+                std::string text = "{\"k\":\"" + std::string(offset - 6, 'x') + std::string(run, '\\') + "\"\n\"}\n" +
+                                   "{\"next\":1}\n";
+                auto stream = scratch_stream(text);
+                cio::ndjson_splitter splitter{stream, 64};
+                if (!splits_to(splitter, naive_split(text))) {
+                    return false;
+                }
+            }
+        }
+
+        // Only empty lines and carriage returns give no records
+        auto stream = scratch_stream(std::string{"\n\r\n\n"});
+        cio::ndjson_splitter splitter{stream};
+        return splits_to(splitter, {});
+    } catch (...) {
+        return false;
+    }
+}
+
+bool cio_test::ndjson_splitter_dispatches_every_record() noexcept {
+    try {
+        std::mt19937 rng{277};
+        auto text = random_ndjson(20000, rng);
+        auto expected = naive_split(text);
+
+        // Each batch holds the records at its index, and together the batches hold every record once
+        auto stream = scratch_stream(text);
+        cio::ndjson_splitter splitter{stream, 64 * 1024};
+        std::atomic<std::size_t> total{0}, mismatches{0};
+        std::vector<std::atomic<int>> seen(expected.size());
+        auto dispatched = splitter.dispatch(
+                [&](const cio::ndjson_splitter::batch &b) {
+                    for (std::size_t i = 0; i < b.count; ++i) {
+                        if (b.first + i >= expected.size() || b.records[i] != expected[b.first + i] ||
+                            seen[b.first + i]++ != 0) {
+                            ++mismatches;
+                        }
+                    }
+                    total += b.count;
+                },
+                4, 100);
+        if (!dispatched || total != expected.size() || mismatches != 0 || splitter.record_count() != expected.size()) {
+            return false;
+        }
+
+        // An exception thrown by the worker stops the split and is rethrown
+        auto again = scratch_stream(text);
+        cio::ndjson_splitter failing{again, 64 * 1024};
+        try {
+            failing.dispatch([](const cio::ndjson_splitter::batch &) { throw std::runtime_error{"stop"}; }, 4);
+        } catch (const std::runtime_error &) {
+            return true;
+        }
+        return false;
+    } catch (...) {
+        return false;
+    }
+}
@@ -0,0 +1,125 @@
+//
+// SPDX-FileCopyrightText: 2024 Stephen F. Booth <contact@sbooth.dev>
+// SPDX-License-Identifier: MIT
+//
+// Part of https://github.com/sbooth/cio
+//
+
+#import <algorithm>
+#import <atomic>
+#import <cstdio>
+#import <random>
+#import <thread>
+#import <vector>
+
+#import "buffer_pool.hpp"
+#import "cioTestSupport.hpp"
+#import "pooled_stream.hpp"
+#import "test_support.hpp"
+
+bool cio_test::pooled_stream_round_trips() noexcept {
+    try {
+        constexpr std::size_t buffer_size = 4096;
+        auto bytes = random_bytes(300 * 1024, 79);
+        cio::pooled_stream stream{cio::cstream::memfd("cio-test"), buffer_size};
+        if (!stream || stream.holds_buffer()) {
+            return false;
+        }
+
+        // Writes smaller and larger than the buffer
+        std::mt19937 rng{83};
+        std::size_t written = 0;
+        while (written < bytes.size()) {
+            auto size = rng() % 3 == 0 ? 1 + rng() % 10000 : 1 + rng() % 100;
+            auto n = std::min<std::size_t>(bytes.size() - written, size);
+            if (stream.fwrite(bytes.data() + written, 1, n) != n) {
+                return false;
+            }
+            written += n;
+            if (stream.ftell() != static_cast<long>(written)) {
+                return false;
+            }
+        }
+        if (stream.fflush() != 0 || stream.holds_buffer()) {
+            return false;
+        }
+
+        // Reads smaller and larger than the buffer
+        stream.rewind();
+        if (read_all(stream, 89) != bytes || !stream.feof() || stream.holds_buffer()) {
+            return false;
+        }
+
+        // Relative seeks account for buffered input
+        stream.rewind();
+        unsigned char head[10];
+        if (stream.fread(head, 1, sizeof head) != sizeof head || !stream.holds_buffer() ||
+            stream.fseek(1000, SEEK_CUR) != 0 || stream.ftell() != 1010 || stream.fgetc() != bytes[1010]) {
+            return false;
+        }
+
+        // Switching to writing puts back unread input, and the write lands at the logical position
+        if (stream.fputc(bytes[1011] ^ 0xff) == EOF || stream.ftell() != 1012 || stream.fflush() != 0) {
+            return false;
+        }
+        bytes[1011] ^= 0xff;
+        stream.rewind();
+        return read_all(stream) == bytes;
+    } catch (...) {
+        return false;
+    }
+}
+
+bool cio_test::buffer_pool_counts_thread_caches() noexcept {
+    // The pool is shared by the process, so its counters are only exact away from other checks
+    return in_child_process([] {
+        auto &pool = cio::buffer_pool::shared();
+        pool.trim();
+        auto baseline = pool.stats().thread_cached_bytes;
+
+        // Returned buffers stay in the calling thread's cache and are counted
+        {
+            auto a = pool.acquire(8 * 1024), b = pool.acquire(8 * 1024);
+            if (!a || !b || a.size() != 8 * 1024) {
+                return false;
+            }
+        }
+        if (pool.stats().thread_cached_bytes != baseline + 16 * 1024) {
+            return false;
+        }
+        pool.trim();
+        if (pool.stats().thread_cached_bytes != baseline) {
+            return false;
+        }
+
+        // Another thread's cache is counted, freed on the thread's next use after a trim, and returned to the shared
+        // cache when the thread exits
+        std::atomic<int> step{0};
+        auto wait_for = [&](int value) {
+            while (step.load() != value) {
+                std::this_thread::yield();
+            }
+        };
+        bool cached = false;
+        scoped_thread other{[&] {
+            pool.acquire(32 * 1024).reset();
+            step = 1;
+            wait_for(2);
+            pool.acquire(4 * 1024).reset();
+            step = 3;
+            wait_for(4);
+        }};
+        wait_for(1);
+        cached = pool.stats().thread_cached_bytes == baseline + 32 * 1024;
+        pool.trim();
+        cached = cached && pool.stats().thread_cached_bytes == baseline + 32 * 1024;
+        step = 2;
+        wait_for(3);
+        cached = cached && pool.stats().thread_cached_bytes == baseline + 4 * 1024;
+        auto shared_before = pool.stats().cached_bytes;
+        step = 4;
+        other.join();
+        auto stats = pool.stats();
+        return cached && stats.thread_cached_bytes == baseline && stats.cached_bytes == shared_before + 4 * 1024;
+    });
+}
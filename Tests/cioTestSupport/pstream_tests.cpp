@@ -0,0 +1,181 @@
+//
+// SPDX-FileCopyrightText: 2024 Stephen F. Booth <contact@sbooth.dev>
+// SPDX-License-Identifier: MIT
+//
+// Part of https://github.com/sbooth/cio
+//
+
+#import <cerrno>
+#import <cstdlib>
+#import <cstring>
+#import <memory>
+#import <string>
+#import <vector>
+
+#import <fcntl.h>
+#import <sys/wait.h>
+#import <unistd.h>
+
+#import "cioTestSupport.hpp"
+#import "pstream.hpp"
+#import "test_support.hpp"
+
+bool cio_test::pstream_reads_and_writes_processes() noexcept {
+    try {
+        // Reading a command's output
+        cio::pstream reader{"printf 'one\\ntwo\\n'", "r"};
+        if (!reader) {
+            return false;
+        }
+        auto output = read_all(reader.stream());
+        if (std::string(output.begin(), output.end()) != "one\ntwo\n") {
+            return false;
+        }
+        auto status = reader.pclose();
+        if (status == -1 || !WIFEXITED(status) || WEXITSTATUS(status) != 0 || reader || reader.pclose() != -1) {
+            return false;
+        }
+
+        // Writing a command's input
+        temp_file file;
+        auto bytes = random_bytes(256 * 1024, 61);
+        cio::pstream writer{(std::string("cat > ") + file.path()).c_str(), "w"};
+        if (!writer || writer.stream().fwrite(bytes.data(), 1, bytes.size()) != bytes.size()) {
+            return false;
+        }
+        status = writer.pclose();
+        if (status == -1 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            return false;
+        }
+        cio::cstream copy{file.path(), "rb"};
+        if (!copy || read_all(copy) != bytes) {
+            return false;
+        }
+
+        // The exit status is reported
+        cio::pstream failing{"exit 3", "r"};
+        status = failing.pclose();
+        return status != -1 && WIFEXITED(status) && WEXITSTATUS(status) == 3;
+    } catch (...) {
+        return false;
+    }
+}
+
+bool cio_test::cstream_pipe_is_close_on_exec() noexcept {
+    try {
+        auto [read_end, write_end] = cio::cstream::pipe();
+        if (!read_end || !write_end) {
+            return false;
+        }
+        for (auto fd : {read_end.fileno(), write_end.fileno()}) {
+            auto flags = ::fcntl(fd, F_GETFD);
+            if (flags == -1 || !(flags & FD_CLOEXEC)) {
+                return false;
+            }
+        }
+        auto bytes = random_bytes(1000, 67);
+        if (write_end.fwrite(bytes.data(), 1, bytes.size()) != bytes.size()) {
+            return false;
+        }
+        write_end.reset();
+        return read_all(read_end) == bytes;
+    } catch (...) {
+        return false;
+    }
+}
+
+bool cio_test::cstream_pipe_capacity_can_grow() noexcept {
+    try {
+        constexpr std::size_t capacity = 256 * 1024;
+        auto [read_end, write_end] = cio::cstream::pipe();
+        if (!read_end || !write_end) {
+            return false;
+        }
+#if defined(F_SETPIPE_SZ)
+        // The capacity is rounded up to a power of two pages, and both ends report it
+        auto initial = write_end.pipe_capacity();
+        auto raised = write_end.set_pipe_capacity(capacity);
+        if (initial <= 0 || raised < static_cast<long>(capacity) || write_end.pipe_capacity() != raised ||
+            read_end.pipe_capacity() != raised) {
+            return false;
+        }
+
+        // pipe() and pstream request a capacity at creation
+        auto [sized_read, sized_write] = cio::cstream::pipe(capacity);
+        cio::pstream process{"cat /dev/null", "r", capacity};
+        return sized_read.pipe_capacity() >= static_cast<long>(capacity) && process &&
+               process.stream().pipe_capacity() >= static_cast<long>(capacity);
+#else
+        // Elsewhere the capacity calls fail with EINVAL
+        errno = 0;
+        return write_end.set_pipe_capacity(capacity) == -1 && errno == EINVAL && write_end.pipe_capacity() == -1;
+#endif
+    } catch (...) {
+        return false;
+    }
+}
+
+bool cio_test::cstream_pipe_splices_pages() noexcept {
+    try {
+        // A page-aligned buffer larger than the pipe, so the writer blocks until the pages are spliced out
+        const auto page = static_cast<std::size_t>(::sysconf(_SC_PAGESIZE));
+        const std::size_t size = 64 * page + 4 * 1024 * 1024;
+        std::unique_ptr<unsigned char, decltype(&std::free)> pages{
+                static_cast<unsigned char *>(std::aligned_alloc(page, size)), &std::free};
+        if (!pages) {
+            return false;
+        }
+        auto bytes = random_bytes(size, 71);
+        std::memcpy(pages.get(), bytes.data(), size);
+
+        auto [read_end, write_end] = cio::cstream::pipe(64 * 1024);
+        auto copy = cio::cstream::memfd("cio-test");
+        if (!read_end || !write_end || !copy) {
+            return false;
+        }
+        std::size_t written = 0;
+        {
+            scoped_thread writer{[&, &write_end = write_end] {
+                written = write_end.write_pages(pages.get(), size);
+                write_end.reset();
+            }};
+            if (read_end.splice_to(copy, size) != size) {
+                return false;
+            }
+        }
+        // The writer has closed the pipe, so nothing more is moved
+        if (written != size || read_end.splice_to(copy, page) != 0) {
+            return false;
+        }
+        copy.rewind();
+        return read_all(copy) == bytes;
+    } catch (...) {
+        return false;
+    }
+}
+
+bool cio_test::cstream_sets_nonblocking() noexcept {
+    try {
+        auto [read_end, write_end] = cio::cstream::pipe();
+        if (!read_end || !write_end || read_end.set_nonblocking() != 0 ||
+            !(::fcntl(read_end.fileno(), F_GETFL) & O_NONBLOCK)) {
+            return false;
+        }
+
+        // Reading an empty pipe fails at once instead of waiting for the writer
+        unsigned char byte;
+        errno = 0;
+        if (::read(read_end.fileno(), &byte, 1) != -1 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+            return false;
+        }
+
+        if (read_end.set_nonblocking(false) != 0 || (::fcntl(read_end.fileno(), F_GETFL) & O_NONBLOCK)) {
+            return false;
+        }
+        write_end.fputc('x');
+        write_end.reset();
+        return read_end.fgetc() == 'x' && read_end.fgetc() == EOF;
+    } catch (...) {
+        return false;
+    }
+}
@@ -0,0 +1,98 @@
+//
+// SPDX-FileCopyrightText: 2024 Stephen F. Booth <contact@sbooth.dev>
+// SPDX-License-Identifier: MIT
+//
+// Part of https://github.com/sbooth/cio
+//
+
+#import <algorithm>
+#import <cstdint>
+#import <cstring>
+#import <random>
+
+#import "cioTestSupport.hpp"
+#import "record_reader.hpp"
+#import "test_support.hpp"
+
+namespace {
+
+using byte_order = cio::cstream::byte_order;
+
+/// Appends `value` to `out` in byte order `order`.
+template <typename T> void put(std::vector<unsigned char> &out, T value, byte_order order) {
+    unsigned char bytes[sizeof(T)];
+    std::memcpy(bytes, &value, sizeof(T));
+    if (cio::byte_order_needs_swap(order)) {
+        std::reverse(bytes, bytes + sizeof(T));
+    }
+    out.insert(out.end(), bytes, bytes + sizeof(T));
+}
+
+/// Checks a reader of four-byte fields, which uses the vector transpose.
+bool transposes_uniform_records() {
+    constexpr std::size_t count = 1003;
+    std::mt19937 rng{56};
+    std::vector<std::uint32_t> a(count), b(count);
+    std::vector<float> c(count);
+    std::vector<unsigned char> packed;
+    for (std::size_t i = 0; i < count; ++i) {
+        a[i] = rng();
+        b[i] = rng();
+        c[i] = static_cast<float>(rng()) / 7.0f;
+        put(packed, a[i], byte_order::big_endian);
+        put(packed, b[i], byte_order::little_endian);
+        put(packed, c[i], byte_order::host);
+    }
+    auto stream = cio_test::scratch_stream(packed);
+    cio::record_reader<cio::field<std::uint32_t, byte_order::big_endian>,
+                       cio::field<std::uint32_t, byte_order::little_endian>, cio::field<float>>
+            reader{100};
+    std::vector<std::uint32_t> ra(count), rb(count);
+    std::vector<float> rc(count);
+    // Ask for more than remains so the final batch is short
+    return reader.read(stream, count + 10, ra.data(), rb.data(), rc.data()) == count && ra == a && rb == b &&
+           std::memcmp(rc.data(), c.data(), count * sizeof(float)) == 0;
+}
+
+/// Checks a reader of mixed-width fields appending to vectors of different lengths.
+bool appends_to_unequal_columns() {
+    constexpr std::size_t count = 777;
+    std::mt19937 rng{57};
+    std::vector<std::uint8_t> a;
+    std::vector<std::uint16_t> b;
+    std::vector<std::int64_t> c;
+    std::vector<unsigned char> packed;
+    for (std::size_t i = 0; i < count; ++i) {
+        a.push_back(static_cast<std::uint8_t>(rng()));
+        b.push_back(static_cast<std::uint16_t>(rng()));
+        c.push_back(static_cast<std::int64_t>(rng()) << 31 | rng());
+        put(packed, a.back(), byte_order::host);
+        put(packed, b.back(), byte_order::big_endian);
+        put(packed, c.back(), byte_order::little_endian);
+    }
+    auto stream = cio_test::scratch_stream(packed);
+    cio::record_reader<cio::field<std::uint8_t>, cio::field<std::uint16_t, byte_order::big_endian>,
+                       cio::field<std::int64_t, byte_order::little_endian>>
+            reader{64};
+
+    // Existing contents are kept and new values are appended after each column's own end
+    std::vector<std::uint8_t> ra{1, 2, 3};
+    std::vector<std::uint16_t> rb;
+    std::vector<std::int64_t> rc{-1};
+    if (reader.read(stream, 500, ra, rb, rc) != 500 || reader.read(stream, 500, ra, rb, rc) != count - 500) {
+        return false;
+    }
+    a.insert(a.begin(), {1, 2, 3});
+    c.insert(c.begin(), -1);
+    return ra == a && rb == b && rc == c && reader.read(stream, 10, ra, rb, rc) == 0 && ra.size() == count + 3;
+}
+
+} /* namespace */
+
+bool cio_test::record_reader_transposes_records() noexcept {
+    try {
+        return transposes_uniform_records() && appends_to_unequal_columns();
+    } catch (...) {
+        return false;
+    }
+}
@@ -0,0 +1,58 @@
+//
+// SPDX-FileCopyrightText: 2024 Stephen F. Booth <contact@sbooth.dev>
+// SPDX-License-Identifier: MIT
+//
+// Part of https://github.com/sbooth/cio
+//
+
+#import <cstdint>
+#import <random>
+
+#import "cioTestSupport.hpp"
+#import "records.hpp"
+#import "spill_stream.hpp"
+#import "test_support.hpp"
+
+bool cio_test::record_range_iterates_values() noexcept {
+    try {
+        std::mt19937 rng{58};
+        std::vector<std::uint32_t> values(10007);
+        std::vector<unsigned char> bytes;
+        for (auto &v : values) {
+            v = rng();
+            // Big-endian
+            for (int shift = 24; shift >= 0; shift -= 8) {
+                bytes.push_back(static_cast<unsigned char>(v >> shift));
+            }
+        }
+        // A partial value at the end is not returned
+        bytes.push_back(0xab);
+
+        for (std::size_t batch_size : {std::size_t{1}, std::size_t{7}, std::size_t{1000}, std::size_t{0}}) {
+            auto stream = scratch_stream(bytes);
+            std::vector<std::uint32_t> read;
+            for (auto v : cio::records<std::uint32_t>(stream, cio::cstream::byte_order::big_endian, batch_size)) {
+                read.push_back(v);
+            }
+            if (read != values) {
+                return false;
+            }
+        }
+
+        // Any stream with a compatible fread can be iterated, and stopping early leaves the rest unread
+        cio::spill_stream spill;
+        if (spill.fwrite(bytes.data(), 1, bytes.size()) != bytes.size()) {
+            return false;
+        }
+        spill.rewind();
+        std::size_t count = 0;
+        for (auto v : cio::records<std::uint8_t>(spill, cio::cstream::byte_order::host, 16)) {
+            if (v != bytes[count] || ++count == 100) {
+                break;
+            }
+        }
+        return count == 100 && spill.ftell() == 112;
+    } catch (...) {
+        return false;
+    }
+}
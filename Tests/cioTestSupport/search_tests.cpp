@@ -0,0 +1,194 @@
+//
+// SPDX-FileCopyrightText: 2024 Stephen F. Booth <contact@sbooth.dev>
+// SPDX-License-Identifier: MIT
+//
+// Part of https://github.com/sbooth/cio
+//
+
+#import <algorithm>
+#import <random>
+#import <string>
+#import <string_view>
+#import <utility>
+#import <vector>
+
+#import "cioTestSupport.hpp"
+#import "search.hpp"
+#import "test_support.hpp"
+
+namespace {
+
+/// Returns `size` random bytes drawn from `alphabet`, so partial matches are frequent.
+std::string random_text(std::size_t size, std::string_view alphabet, std::mt19937 &rng) {
+    std::string s(size, 'a');
+    for (auto &c : s) {
+        c = alphabet[rng() % alphabet.size()];
+    }
+    return s;
+}
+
+/// Returns the offsets of the successive non-overlapping occurrences of `needle` in `haystack`.
+std::vector<std::uint64_t> naive_find_all(const std::string &haystack, const std::string &needle) {
+    std::vector<std::uint64_t> offsets;
+    for (auto i = haystack.find(needle); i != std::string::npos; i = haystack.find(needle, i + needle.size())) {
+        offsets.push_back(i);
+    }
+    return offsets;
+}
+
+/// Returns every match of `patterns` in `text`, in order of the last byte and longest first, reporting a repeated
+/// pattern under its first index.
+std::vector<std::pair<std::uint64_t, std::size_t>> naive_matches(const std::string &text,
+                                                                 const std::vector<std::string> &patterns) {
+    std::vector<std::size_t> order;
+    for (std::size_t i = 0; i < patterns.size(); ++i) {
+        if (!patterns[i].empty() && std::find(patterns.begin(), patterns.begin() + static_cast<long>(i),
+                                              patterns[i]) == patterns.begin() + static_cast<long>(i)) {
+            order.push_back(i);
+        }
+    }
+    std::stable_sort(order.begin(), order.end(),
+                     [&](auto a, auto b) { return patterns[a].size() > patterns[b].size(); });
+    std::vector<std::pair<std::uint64_t, std::size_t>> matches;
+    for (std::size_t end = 1; end <= text.size(); ++end) {
+        for (auto i : order) {
+            auto n = patterns[i].size();
+            if (n <= end && text.compare(end - n, n, patterns[i]) == 0) {
+                matches.emplace_back(end - n, i);
+            }
+        }
+    }
+    return matches;
+}
+
+} /* namespace */
+
+bool cio_test::find_crosses_block_boundaries() noexcept {
+    try {
+        std::mt19937 rng{239};
+        for (int round = 0; round < 60; ++round) {
+            auto haystack = random_text(20000, std::string_view{"abcd", 2 + round % 3u}, rng);
+            // Needles taken from the haystack, longer than the block and absent altogether
+            std::string needle;
+            if (round % 10 == 9) {
+                needle = "zz";
+            } else {
+                auto length = 1 + rng() % (round % 4 == 3 ? 300 : 12);
+                needle = haystack.substr(rng() % (haystack.size() - length), length);
+            }
+            std::size_t block_size = round % 5 == 0 ? 1 : 1 + rng() % 200;
+
+            // Repeated finds return successive non-overlapping occurrences and leave the stream past each one
+            auto expected = naive_find_all(haystack, needle);
+            auto stream = scratch_stream(haystack);
+            for (auto offset : expected) {
+                auto found = cio::find(stream, needle, block_size);
+                if (!found || *found != offset || stream.ftell() != static_cast<long>(offset + needle.size())) {
+                    return false;
+                }
+            }
+            if (cio::find(stream, needle, block_size)) {
+                return false;
+            }
+
+            // Offsets from a position part way through count from the start of the stream
+            if (!expected.empty()) {
+                stream.fseek(static_cast<long>(expected.back()), SEEK_SET);
+                auto found = cio::find(stream, needle, block_size);
+                if (!found || *found != expected.back()) {
+                    return false;
+                }
+            }
+        }
+
+        // A pipe has no position, so offsets count from the start of the search
+        auto [read_end, write_end] = cio::cstream::pipe();
+        std::string data = std::string(5000, 'x') + "needle" + std::string(100, 'x');
+        if (write_end.fwrite(data.data(), 1, data.size()) != data.size() || write_end.fclose() != 0) {
+            return false;
+        }
+        auto found = cio::find(read_end, "needle", 64);
+        return found && *found == 5000 && !cio::find(read_end, "needle", 64) && cio::find(read_end, "", 64) == 0;
+    } catch (...) {
+        return false;
+    }
+}
+
+bool cio_test::pattern_matcher_matches_naive_search() noexcept {
+    try {
+        std::mt19937 rng{241};
+        const std::vector<std::vector<std::string>> fixed = {
+                {"he", "she", "his", "hers"},
+                {"a", "aa", "aaa", "aaaa"},
+                {"ab", "ab", "b", "", "abab", "bab"},
+                {"abcab", "cab", "bca", "c", "abc"},
+                {"a", "b", "c", "d", "e", "ab", "de"},
+        };
+        for (int round = 0; round < 80; ++round) {
+            // Fixed sets of overlapping, nested and duplicate patterns, then random ones
+            std::vector<std::string> patterns;
+            if (round < static_cast<int>(fixed.size())) {
+                patterns = fixed[static_cast<std::size_t>(round)];
+            } else {
+                auto count = 1 + rng() % 12;
+                for (std::size_t i = 0; i < count; ++i) {
+                    patterns.push_back(random_text(1 + rng() % 6, std::string_view{"abcdef", 2 + round % 5u}, rng));
+                }
+                if (round % 3 == 0) {
+                    patterns.push_back(patterns.front());
+                }
+            }
+            std::string alphabet;
+            for (const auto &pattern : patterns) {
+                for (auto c : pattern) {
+                    if (alphabet.find(c) == std::string::npos) {
+                        alphabet += c;
+                    }
+                }
+            }
+            // A byte in no pattern resets partial matches and lets the scanner skip ahead
+            auto text = random_text(3000 + rng() % 3000, alphabet + 'z', rng);
+            auto expected = naive_matches(text, patterns);
+
+            cio::pattern_matcher matcher{patterns};
+            std::vector<std::pair<std::uint64_t, std::size_t>> matches;
+            auto collect = [&](const cio::pattern_matcher::match &m) {
+                matches.emplace_back(m.offset, m.pattern);
+                return true;
+            };
+            matcher.scan(text.data(), text.size(), collect);
+            if (matcher.pattern_count() != patterns.size() || matches != expected) {
+                return false;
+            }
+
+            // Streams read in blocks of any size give the same matches
+            for (std::size_t block_size : {std::size_t{1}, std::size_t{7}, std::size_t{64}, std::size_t{65},
+                                           std::size_t{4096}}) {
+                matches.clear();
+                auto stream = scratch_stream(text);
+                if (!matcher.scan(stream, collect, block_size) || matches != expected) {
+                    return false;
+                }
+            }
+
+            // A callback returning false stops the scan
+            if (expected.size() > 3) {
+                matches.clear();
+                auto stream = scratch_stream(text);
+                matcher.scan(
+                        stream,
+                        [&](const cio::pattern_matcher::match &m) {
+                            matches.emplace_back(m.offset, m.pattern);
+                            return matches.size() < 3;
+                        },
+                        64);
+                if (matches.size() != 3 || !std::equal(matches.begin(), matches.end(), expected.begin())) {
+                    return false;
+                }
+            }
+        }
+        return true;
+    } catch (...) {
+        return false;
+    }
+}
@@ -0,0 +1,129 @@
+//
+// SPDX-FileCopyrightText: 2024 Stephen F. Booth <contact@sbooth.dev>
+// SPDX-License-Identifier: MIT
+//
+// Part of https://github.com/sbooth/cio
+//
+
+#import <cstdio>
+#import <random>
+#import <vector>
+
+#import "cioTestSupport.hpp"
+#import "seekable_compressed.hpp"
+#import "test_support.hpp"
+
+namespace {
+
+/// Writes `input` to a seekable container in blocks of `block_size` bytes.
+std::vector<unsigned char> write_container(const std::vector<unsigned char> &input, std::size_t block_size) {
+    auto stream = cio::cstream::memfd("cio-test");
+    {
+        cio::seekable_compressed_writer writer{stream, block_size};
+        std::mt19937 rng{173};
+        for (std::size_t written = 0; written < input.size();) {
+            auto n = std::min<std::size_t>(input.size() - written, 1 + rng() % (3 * block_size));
+            if (writer.fwrite(input.data() + written, 1, n) != n) {
+                return {};
+            }
+            written += n;
+        }
+        if (!writer.finish()) {
+            return {};
+        }
+    }
+    stream.rewind();
+    return cio_test::read_all(stream);
+}
+
+/// Returns `true` if a reader opened on `container` is invalid.
+bool refuses(const std::vector<unsigned char> &container) {
+    auto stream = cio_test::scratch_stream(container);
+    cio::seekable_compressed_reader reader{stream};
+    unsigned char buffer[16];
+    return !reader && reader.ferror() && reader.fread(buffer, 1, sizeof buffer) == 0;
+}
+
+} /* namespace */
+
+bool cio_test::seekable_compressed_reads_at_random() noexcept {
+    try {
+        constexpr auto block_size = cio::compressed_format::min_block_size;
+        // Mixing text and noise gives both compressed and stored blocks, and the last block is partial
+        auto input = text_bytes(30 * block_size, 179);
+        auto noise = random_bytes(10 * block_size + 77, 181);
+        input.insert(input.begin() + 11 * block_size, noise.begin(), noise.end());
+
+        auto container = write_container(input, block_size);
+        auto stream = scratch_stream(container);
+        cio::seekable_compressed_reader reader{stream, 3};
+        if (!reader || reader.size() != input.size() || reader.block_size() != block_size ||
+            reader.block_count() != (input.size() + block_size - 1) / block_size || read_all(reader) != input ||
+            !reader.feof()) {
+            return false;
+        }
+
+        // Reads at random positions, some crossing blocks and some past the end, match the source
+        std::mt19937 rng{191};
+        std::vector<unsigned char> buffer(3 * block_size);
+        for (int i = 0; i < 2000; ++i) {
+            auto position = static_cast<long>(rng() % (input.size() + 100));
+            auto length = 1 + rng() % (i % 10 == 0 ? buffer.size() : 64);
+            auto origin = i % 3 == 0 ? SEEK_SET : i % 3 == 1 ? SEEK_CUR : SEEK_END;
+            auto offset = origin == SEEK_SET   ? position
+                          : origin == SEEK_CUR ? position - reader.ftell()
+                                               : position - static_cast<long>(input.size());
+            if (reader.fseek(offset, origin) != 0 || reader.ftell() != position) {
+                return false;
+            }
+            auto expected = std::min<std::size_t>(length, input.size() - std::min<std::size_t>(position, input.size()));
+            if (reader.fread(buffer.data(), 1, length) != expected ||
+                !std::equal(buffer.begin(), buffer.begin() + static_cast<long>(expected), input.begin() + position) ||
+                reader.ftell() != position + static_cast<long>(expected) || (expected < length) != !!reader.feof()) {
+                return false;
+            }
+        }
+
+        // Returning to a cached block does not decompress it again, and a position before the start is refused
+        auto decoded = reader.blocks_decoded();
+        reader.fseek(0, SEEK_SET);
+        auto first = reader.fgetc();
+        reader.fseek(1, SEEK_SET);
+        return !reader.ferror() && first == input[0] && reader.fgetc() == input[1] &&
+               reader.blocks_decoded() <= decoded + 1 && reader.fseek(-1, SEEK_SET) == -1 &&
+               reader.blocks_decoded() > reader.block_count();
+    } catch (...) {
+        return false;
+    }
+}
+
+bool cio_test::seekable_compressed_refuses_damaged_trailers() noexcept {
+    try {
+        constexpr auto block_size = cio::compressed_format::min_block_size;
+        auto container = write_container(text_bytes(5 * block_size + 100, 193), block_size);
+        if (container.empty() || refuses(container) || !refuses({})) {
+            return false;
+        }
+
+        // Any truncation removes at least part of the trailer
+        for (std::size_t size = 0; size < container.size(); size += 1 + size / 16) {
+            if (!refuses({container.begin(), container.begin() + static_cast<long>(size)})) {
+                return false;
+            }
+        }
+
+        // Every byte of the trailer is checked
+        for (auto i = container.size() - cio::seekable_compressed_format::trailer_size; i < container.size(); ++i) {
+            for (unsigned char bit = 1; bit != 0; bit <<= 1) {
+                auto damaged = container;
+                damaged[i] ^= bit;
+                if (!refuses(damaged)) {
+                    return false;
+                }
+            }
+        }
+        return true;
+    } catch (...) {
+        return false;
+    }
+}
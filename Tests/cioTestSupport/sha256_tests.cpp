@@ -0,0 +1,121 @@
+//
+// SPDX-FileCopyrightText: 2024 Stephen F. Booth <contact@sbooth.dev>
+// SPDX-License-Identifier: MIT
+//
+// Part of https://github.com/sbooth/cio
+//
+
+#import <algorithm>
+#import <array>
+#import <cstdio>
+#import <string>
+#import <vector>
+
+#import "cioTestSupport.hpp"
+#import "sha256.hpp"
+#import "test_support.hpp"
+
+namespace {
+
+/// A message and its digest from FIPS 180-2.
+struct known_answer {
+    std::string message;
+    const char *digest;
+};
+
+/// Returns the known-answer vectors.
+std::vector<known_answer> known_answers() {
+    return {{"", "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855"},
+            {"abc", "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad"},
+            {"abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq",
+             "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1"},
+            {"abcdefghbcdefghicdefghijdefghijkefghijklfghijklmghijklmnhijklmnoijklmnopjklmnopqklmnopqrlmnopqrsmnopqrs"
+             "tnopqrstu",
+             "cf5b16a778af8380036ce59e7b0492370b249b11e8f07a51afac45037afee9d1"},
+            {std::string(1000000, 'a'), "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0"}};
+}
+
+/// Returns `digest` in hexadecimal.
+std::string hex(const cio::sha256::digest &digest) {
+    std::string s;
+    char byte[3];
+    for (auto b : digest) {
+        std::snprintf(byte, sizeof byte, "%02x", b);
+        s += byte;
+    }
+    return s;
+}
+
+/// Returns the digest of `message` computed by padding it and compressing the blocks with `compress`.
+template <typename Compress> std::string digest_with(Compress compress, const std::string &message) {
+    std::vector<unsigned char> padded(message.begin(), message.end());
+    padded.push_back(0x80);
+    while (padded.size() % 64 != 56) {
+        padded.push_back(0);
+    }
+    auto bits = static_cast<std::uint64_t>(message.size()) * 8;
+    for (int shift = 56; shift >= 0; shift -= 8) {
+        padded.push_back(static_cast<unsigned char>(bits >> shift));
+    }
+    std::array<std::uint32_t, 8> state = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+                                          0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+    compress(state, padded.data(), padded.size() / 64);
+    cio::sha256::digest digest;
+    for (std::size_t i = 0; i < 32; ++i) {
+        digest[i] = static_cast<unsigned char>(state[i / 4] >> (24 - 8 * (i % 4)));
+    }
+    return hex(digest);
+}
+
+} /* namespace */
+
+bool cio_test::sha256_matches_known_answers() noexcept {
+    try {
+        for (const auto &answer : known_answers()) {
+            // Each compression function, whether or not the hash uses it
+            if (digest_with(cio::detail::sha256_compress_portable, answer.message) != answer.digest) {
+                return false;
+            }
+#if defined(__x86_64__) || defined(__i386__)
+            if (cio::detail::sha256_extensions_supported() &&
+                digest_with(cio::detail::sha256_compress_extensions, answer.message) != answer.digest) {
+                return false;
+            }
+#endif
+#if defined(__ARM_FEATURE_SHA2)
+            if (digest_with(cio::detail::sha256_compress_armv8, answer.message) != answer.digest) {
+                return false;
+            }
+#endif
+
+            // The whole message at once, and in updates of odd sizes that straddle blocks
+            if (hex(cio::sha256::hash(answer.message.data(), answer.message.size())) != answer.digest) {
+                return false;
+            }
+            cio::sha256 h;
+            for (std::size_t offset = 0, i = 0; offset < answer.message.size(); ++i) {
+                static constexpr std::size_t sizes[] = {1, 3, 0, 63, 65, 7, 127, 129, 4093};
+                auto n = std::min(sizes[i % std::size(sizes)], answer.message.size() - offset);
+                h.update(answer.message.data() + offset, n);
+                offset += n;
+            }
+            if (hex(h.finish()) != answer.digest) {
+                return false;
+            }
+        }
+
+        // Finishing resets the hash, and every message length around the padding boundary agrees
+        cio::sha256 h;
+        auto bytes = random_bytes(300, 211);
+        std::string message(bytes.begin(), bytes.end());
+        for (std::size_t size = 0; size <= message.size(); ++size) {
+            h.update(message.data(), size);
+            if (hex(h.finish()) != digest_with(cio::detail::sha256_compress_portable, message.substr(0, size))) {
+                return false;
+            }
+        }
+        return true;
+    } catch (...) {
+        return false;
+    }
+}
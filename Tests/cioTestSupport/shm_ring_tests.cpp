@@ -0,0 +1,72 @@
+//
+// SPDX-FileCopyrightText: 2024 Stephen F. Booth <contact@sbooth.dev>
+// SPDX-License-Identifier: MIT
+//
+// Part of https://github.com/sbooth/cio
+//
+
+#import <algorithm>
+#import <cerrno>
+#import <cstdint>
+#import <cstdio>
+
+#import <unistd.h>
+
+#import "cioTestSupport.hpp"
+#import "shm_ring.hpp"
+#import "test_support.hpp"
+
+bool cio_test::shm_ring_streams_between_attachments() noexcept {
+    try {
+        // An empty ring reports nothing to read and can be closed
+        cio::shm_ring empty;
+        empty.close();
+        unsigned char ch;
+        if (empty || empty.capacity() != 0 || empty.readable() != 0 || !empty.closed() || empty.fread(&ch, 1, 1) != 0 ||
+            empty.fwrite(&ch, 1, 1) != 0) {
+            return false;
+        }
+
+        auto writer = cio::shm_ring::create(4096);
+        if (!writer || writer.capacity() != 4096) {
+            return false;
+        }
+        // The reader attaches through its own descriptor for the same file, as a peer process would
+        cio::shm_ring reader{cio::cstream{::fdopen(::dup(writer.stream().fileno()), "r+b")}};
+        if (!reader || reader.capacity() != 4096) {
+            return false;
+        }
+
+        if (!writer.write_uint_big(std::uint32_t{0xdeadbeef}) || reader.readable() != 4) {
+            return false;
+        }
+        std::uint32_t value;
+        if (!reader.read_uint_big(value) || value != 0xdeadbeef) {
+            return false;
+        }
+
+        // Much more than the capacity, so both sides wait for each other
+        auto bytes = random_bytes(1024 * 1024 + 123, 73);
+        scoped_thread producer{[&] {
+            std::size_t written = 0;
+            while (written < bytes.size()) {
+                auto n = std::min<std::size_t>(bytes.size() - written, 1 + (written * 7) % 9000);
+                if (writer.fwrite(bytes.data() + written, 1, n) != n) {
+                    break;
+                }
+                written += n;
+            }
+            writer.close();
+        }};
+        if (read_all(reader) != bytes || !reader.closed()) {
+            return false;
+        }
+        producer.join();
+
+        // Writes fail once the ring is closed
+        errno = 0;
+        return writer.fwrite(bytes.data(), 1, 1) == 0 && errno == EPIPE;
+    } catch (...) {
+        return false;
+    }
+}
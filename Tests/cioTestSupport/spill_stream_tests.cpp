@@ -0,0 +1,65 @@
+//
+// SPDX-FileCopyrightText: 2024 Stephen F. Booth <contact@sbooth.dev>
+// SPDX-License-Identifier: MIT
+//
+// Part of https://github.com/sbooth/cio
+//
+
+#import <cstdio>
+#import <cstring>
+
+#import "cioTestSupport.hpp"
+#import "spill_stream.hpp"
+#import "test_support.hpp"
+
+bool cio_test::spill_stream_round_trips_across_threshold() noexcept {
+    constexpr std::size_t threshold = 64 * 1024;
+    auto bytes = random_bytes(5 * threshold, 53);
+    cio::spill_stream stream{threshold};
+
+    // Below the threshold the contents stay in memory
+    std::size_t written = 0;
+    while (written + 1000 <= threshold) {
+        if (stream.fwrite(bytes.data() + written, 1, 1000) != 1000) {
+            return false;
+        }
+        written += 1000;
+    }
+    if (stream.spilled() || stream.memory_usage() > threshold || stream.ftell() != static_cast<long>(written)) {
+        return false;
+    }
+    stream.rewind();
+    if (read_all(stream) != std::vector<unsigned char>(bytes.begin(), bytes.begin() + written) || !stream.feof()) {
+        return false;
+    }
+
+    // Overwriting in the middle keeps the size
+    if (stream.fseek(100, SEEK_SET) != 0 || stream.fputc(bytes[100] ^ 0xff) == EOF) {
+        return false;
+    }
+    bytes[100] ^= 0xff;
+
+    // Crossing the threshold moves the contents to a temporary file at the same position
+    if (stream.fseek(static_cast<long>(written), SEEK_SET) != 0 ||
+        stream.fwrite(bytes.data() + written, 1, bytes.size() - written) != bytes.size() - written) {
+        return false;
+    }
+    if (!stream.spilled() || stream.memory_usage() != 0 || stream.peak_memory_usage() > threshold ||
+        stream.ftell() != static_cast<long>(bytes.size())) {
+        return false;
+    }
+    stream.rewind();
+    if (read_all(stream) != bytes || stream.ferror()) {
+        return false;
+    }
+
+    // A seek past the end in memory zero-fills like a file
+    cio::spill_stream sparse{threshold};
+    if (sparse.fseek(10, SEEK_SET) != 0 || sparse.fputc('x') != 'x') {
+        return false;
+    }
+    sparse.rewind();
+    std::vector<unsigned char> expected(11, 0);
+    expected[10] = 'x';
+    return read_all(sparse) == expected && !sparse.spilled();
+}
@@ -0,0 +1,151 @@
+//
+// SPDX-FileCopyrightText: 2024 Stephen F. Booth <contact@sbooth.dev>
+// SPDX-License-Identifier: MIT
+//
+// Part of https://github.com/sbooth/cio
+//
+
+#import <map>
+#import <stdexcept>
+#import <string>
+
+#import "cioTestSupport.hpp"
+#import "stream_multiplexer.hpp"
+#import "test_support.hpp"
+
+namespace {
+
+/// Returns the text written to pipe `k`: lines of varying length, the last without a newline.
+std::string pipe_text(std::size_t k) {
+    std::string text;
+    for (std::size_t i = 0; i < 50 + 10 * k; ++i) {
+        text += "pipe " + std::to_string(k) + " line " + std::to_string(i) + std::string(i % 13, '.') + "\n";
+    }
+    return text + "tail " + std::to_string(k);
+}
+
+/// Writes `text` to `stream` and closes it.
+void write_and_close(cio::cstream &stream, const std::string &text) {
+    stream.fwrite(text.data(), 1, text.size());
+    stream.reset();
+}
+
+} /* namespace */
+
+bool cio_test::stream_multiplexer_delivers_lines() noexcept {
+    try {
+        constexpr std::size_t count = 4;
+        // A line several times the read buffer, written from a thread because it exceeds the pipe capacity
+        std::string long_line(3 * cio::stream_multiplexer::default_buffer_size + 17, 'x');
+        long_line += '\n';
+
+        cio::stream_multiplexer mux;
+        std::vector<std::pair<cio::cstream, cio::cstream>> pipes;
+        std::map<std::size_t, std::size_t> pipe_for_id;
+        for (std::size_t k = 0; k <= count; ++k) {
+            pipes.push_back(cio::cstream::pipe());
+            auto id = mux.add(pipes.back().first);
+            if (!pipes.back().first || !id) {
+                return false;
+            }
+            pipe_for_id[*id] = k;
+        }
+        if (!mux || mux.active() != count + 1) {
+            return false;
+        }
+        for (std::size_t k = 0; k < count; ++k) {
+            write_and_close(pipes[k].second, pipe_text(k));
+        }
+        scoped_thread writer{[&] { write_and_close(pipes[count].second, long_line + "after\n"); }};
+
+        std::map<std::size_t, std::string> received;
+        std::map<std::size_t, int> eofs;
+        bool whole_lines = true;
+        auto ok = mux.run([&](std::size_t id, std::string_view data, bool eof) {
+            if (eof) {
+                ++eofs[id];
+                return;
+            }
+            // Every delivery but a final unterminated line ends with its only newline
+            auto newline = data.find('\n');
+            whole_lines = whole_lines && (newline == data.size() - 1 || (newline == std::string_view::npos &&
+                                                                         data.substr(0, 5) == "tail "));
+            received[id].append(data);
+        });
+        writer.join();
+        if (!ok || !whole_lines || mux.active() != 0) {
+            return false;
+        }
+        for (const auto &[id, k] : pipe_for_id) {
+            auto expected = k < count ? pipe_text(k) : long_line + "after\n";
+            if (received[id] != expected || eofs[id] != 1) {
+                return false;
+            }
+        }
+
+        // A descriptor that is not open cannot be added
+        return !mux.add(-1);
+    } catch (...) {
+        return false;
+    }
+}
+
+bool cio_test::stream_multiplexer_allows_handler_changes() noexcept {
+    try {
+        cio::stream_multiplexer mux;
+        auto [first_read, first_write] = cio::cstream::pipe();
+        auto [second_read, second_write] = cio::cstream::pipe();
+        auto first = mux.add(first_read);
+        auto second = mux.add(second_read);
+        if (!first || !second) {
+            return false;
+        }
+
+        // The first pipe's lines span reads, so they are delivered from the pending buffer
+        std::string long_line(cio::stream_multiplexer::default_buffer_size + 100, 'a');
+        long_line += '\n';
+        scoped_thread writer{[&, &w = first_write] { write_and_close(w, long_line + long_line); }};
+        write_and_close(second_write, "one\ntwo\nthree\n");
+
+        // Pipes added by the handler, enough to reallocate the multiplexer's streams several times
+        std::vector<std::pair<cio::cstream, cio::cstream>> added;
+        for (int i = 0; i < 64; ++i) {
+            added.push_back(cio::cstream::pipe());
+            write_and_close(added.back().second, "added\n");
+        }
+
+        std::size_t first_lines = 0, second_lines = 0, added_lines = 0;
+        std::string first_text;
+        bool added_all = false, second_eof = false;
+        auto ok = mux.run([&](std::size_t id, std::string_view data, bool eof) {
+            if (id == *first) {
+                if (!eof) {
+                    ++first_lines;
+                    first_text.append(data);
+                }
+                if (!added_all) {
+                    added_all = true;
+                    for (auto &pipe : added) {
+                        if (!mux.add(pipe.first)) {
+                            throw std::runtime_error("add");
+                        }
+                    }
+                }
+            } else if (id == *second) {
+                // Removing the stream drops the lines already read and the end-of-file notification
+                if (eof) {
+                    second_eof = true;
+                } else if (++second_lines == 1) {
+                    mux.remove(id);
+                }
+            } else if (!eof) {
+                added_lines += data == "added\n";
+            }
+        });
+        writer.join();
+        return ok && first_text == long_line + long_line && first_lines == 2 && second_lines == 1 && !second_eof &&
+               added_lines == added.size() && mux.active() == 0;
+    } catch (...) {
+        return false;
+    }
+}
@@ -0,0 +1,71 @@
+//
+// SPDX-FileCopyrightText: 2024 Stephen F. Booth <contact@sbooth.dev>
+// SPDX-License-Identifier: MIT
+//
+// Part of https://github.com/sbooth/cio
+//
+
+#import <cstdio>
+#import <cstring>
+#import <random>
+
+#import "cioTestSupport.hpp"
+#import "substream.hpp"
+#import "test_support.hpp"
+
+bool cio_test::substream_reads_within_range() noexcept {
+    auto bytes = random_bytes(200000, 55);
+    auto base = scratch_stream(bytes);
+    if (!base || base.fflush() != 0) {
+        return false;
+    }
+
+    for (std::size_t buffer_size : {std::size_t{0}, std::size_t{100}, cio::substream::default_buffer_size}) {
+        constexpr std::uint64_t offset = 12345;
+        constexpr std::uint64_t length = 100000;
+        cio::substream a{base, offset, length, buffer_size};
+        cio::substream b{base, 0, bytes.size(), buffer_size};
+        if (!a || a.offset() != offset || a.size() != length) {
+            return false;
+        }
+
+        // Reads stop at the end of the range even though the file continues
+        auto range = std::vector<unsigned char>(bytes.begin() + offset, bytes.begin() + offset + length);
+        if (read_all(a) != range || !a.feof() || a.fgetc() != EOF) {
+            return false;
+        }
+
+        // Interleaved reads and seeks on two substreams of one descriptor do not disturb each other
+        std::mt19937 rng{55};
+        unsigned char buffer[3000];
+        for (int i = 0; i < 300; ++i) {
+            auto &s = i % 2 ? a : b;
+            auto size = i % 2 ? length : bytes.size();
+            auto data = i % 2 ? range.data() : bytes.data();
+            auto position = rng() % (size + 1);
+            auto want = rng() % sizeof buffer;
+            if (s.fseek(static_cast<long>(position), SEEK_SET) != 0) {
+                return false;
+            }
+            auto expected = std::min<std::size_t>(want, size - position);
+            if (s.fread(buffer, 1, want) != expected || std::memcmp(buffer, data + position, expected) != 0 ||
+                s.ftell() != static_cast<long>(position + expected)) {
+                return false;
+            }
+        }
+
+        // Seeks outside the range fail and leave the position unchanged
+        if (a.fseek(10, SEEK_SET) != 0 || a.fseek(1, SEEK_END) == 0 || a.fseek(-11, SEEK_CUR) == 0 ||
+            a.ftell() != 10 || a.fseek(-1, SEEK_END) != 0 || a.fgetc() != range.back()) {
+            return false;
+        }
+
+        // A subrange is clamped to its parent
+        auto sub = a.subrange(length - 10, 1000);
+        if (sub.offset() != offset + length - 10 || sub.size() != 10 ||
+            read_all(sub) != std::vector<unsigned char>(range.end() - 10, range.end())) {
+            return false;
+        }
+    }
+    return true;
+}
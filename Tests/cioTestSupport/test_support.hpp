@@ -0,0 +1,164 @@
+//
+// SPDX-FileCopyrightText: 2024 Stephen F. Booth <contact@sbooth.dev>
+// SPDX-License-Identifier: MIT
+//
+// Part of https://github.com/sbooth/cio
+//
+
+#pragma once
+
+#import <cstdint>
+#import <cstdlib>
+#import <random>
+#import <string>
+#import <thread>
+#import <utility>
+#import <vector>
+
+#import <sys/wait.h>
+#import <unistd.h>
+
+#import "cstream.hpp"
+
+namespace cio_test {
+
+/// A temporary file removed when the object is destroyed.
+class temp_file {
+  public:
+    temp_file() noexcept {
+        char path[] = "/tmp/cio-test-XXXXXX";
+        if (auto fd = ::mkstemp(path); fd != -1) {
+            ::close(fd);
+            path_ = path;
+        }
+    }
+
+    // This class is non-copyable.
+    temp_file(const temp_file &rhs) = delete;
+
+    // This class is non-assignable.
+    temp_file &operator=(const temp_file &rhs) = delete;
+
+    ~temp_file() noexcept {
+        if (!path_.empty()) {
+            ::unlink(path_.c_str());
+        }
+    }
+
+    /// Returns the path of the file.
+    const char *path() const noexcept { return path_.c_str(); }
+
+  private:
+    std::string path_;
+};
+
+/// A thread joined when the object is destroyed, so a check can return early without terminating.
+class scoped_thread {
+  public:
+    template <typename Function> explicit scoped_thread(Function &&f) : thread_{std::forward<Function>(f)} {}
+
+    // This class is non-copyable.
+    scoped_thread(const scoped_thread &rhs) = delete;
+
+    // This class is non-assignable.
+    scoped_thread &operator=(const scoped_thread &rhs) = delete;
+
+    ~scoped_thread() noexcept { join(); }
+
+    /// Waits for the thread to finish.
+    void join() noexcept {
+        if (thread_.joinable()) {
+            thread_.join();
+        }
+    }
+
+  private:
+    std::thread thread_;
+};
+
+/// Returns `size` pseudo-random bytes.
+inline std::vector<unsigned char> random_bytes(std::size_t size, std::uint32_t seed) {
+    std::mt19937 rng{seed};
+    std::vector<unsigned char> bytes(size);
+    for (auto &b : bytes) {
+        b = static_cast<unsigned char>(rng());
+    }
+    return bytes;
+}
+
+/// Returns `size` bytes of compressible text.
+inline std::vector<unsigned char> text_bytes(std::size_t size, std::uint32_t seed) {
+    static const char *const words[] = {"alpha ", "beta ", "gamma ", "delta ", "epsilon\n", "zeta, ", "eta "};
+    std::mt19937 rng{seed};
+    std::vector<unsigned char> bytes;
+    bytes.reserve(size + 8);
+    while (bytes.size() < size) {
+        for (auto p = words[rng() % 7]; *p; ++p) {
+            bytes.push_back(static_cast<unsigned char>(*p));
+        }
+    }
+    bytes.resize(size);
+    return bytes;
+}
+
+/// Returns a scratch stream containing `size` bytes at `data`, positioned at the start.
+inline cio::cstream scratch_stream(const void *data, std::size_t size) noexcept {
+    auto stream = cio::cstream::memfd("cio-test");
+    if (stream && size > 0 && stream.fwrite(data, 1, size) != size) {
+        stream.reset();
+    }
+    if (stream) {
+        stream.rewind();
+    }
+    return stream;
+}
+
+/// Returns a scratch stream containing `bytes`, positioned at the start.
+inline cio::cstream scratch_stream(const std::vector<unsigned char> &bytes) noexcept {
+    return scratch_stream(bytes.data(), bytes.size());
+}
+
+/// Returns a scratch stream containing `text`, positioned at the start.
+inline cio::cstream scratch_stream(const std::string &text) noexcept {
+    return scratch_stream(text.data(), text.size());
+}
+
+/// Writes `bytes` to the file at `path`.
+inline bool write_file(const char *path, const std::vector<unsigned char> &bytes) noexcept {
+    cio::cstream file{path, "wb"};
+    return file && (bytes.empty() || file.fwrite(bytes.data(), 1, bytes.size()) == bytes.size()) && file.fflush() == 0;
+}
+
+/// Runs `check` in a child process and returns its result.
+///
+/// Checks that change process-wide state, such as the memory budget, run this way so they cannot affect checks
+/// running concurrently.
+template <typename Check> bool in_child_process(Check check) noexcept {
+    auto pid = ::fork();
+    if (pid == 0) {
+        bool ok = false;
+        try {
+            ok = check();
+        } catch (...) {
+        }
+        ::_exit(ok ? 0 : 1);
+    }
+    int status;
+    return pid != -1 && ::waitpid(pid, &status, 0) == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+/// Reads `stream` to the end in reads of varying sizes.
+template <typename Stream> std::vector<unsigned char> read_all(Stream &stream, std::uint32_t seed = 1) {
+    std::mt19937 rng{seed};
+    std::vector<unsigned char> bytes;
+    unsigned char buffer[4096];
+    for (;;) {
+        auto n = stream.fread(buffer, 1, 1 + rng() % sizeof buffer);
+        if (n == 0) {
+            return bytes;
+        }
+        bytes.insert(bytes.end(), buffer, buffer + n);
+    }
+}
+
+} /* namespace cio_test */
@@ -0,0 +1,195 @@
+//
+// SPDX-FileCopyrightText: 2024 Stephen F. Booth <contact@sbooth.dev>
+// SPDX-License-Identifier: MIT
+//
+// Part of https://github.com/sbooth/cio
+//
+
+#import <cmath>
+#import <cstring>
+#import <limits>
+#import <random>
+#import <vector>
+
+#import "cioTestSupport.hpp"
+#import "test_support.hpp"
+#import "timeseries.hpp"
+
+namespace {
+
+/// A series of points in parallel arrays.
+struct series {
+    std::vector<std::int64_t> timestamps;
+    std::vector<double> values;
+};
+
+/// Writes `points` to `stream` in blocks of `block_points`, alternating single and batched appends.
+bool write_series(cio::cstream &stream, const series &points, std::size_t block_points) {
+    cio::timeseries_writer writer{stream, block_points};
+    auto count = points.timestamps.size();
+    for (std::size_t i = 0; i < count;) {
+        auto n = std::min<std::size_t>(count - i, i % 2 ? 1 : 13);
+        if (writer.append(points.timestamps.data() + i, points.values.data() + i, n) != n) {
+            return false;
+        }
+        i += n;
+    }
+    return writer.finish() && writer.points_written() == count;
+}
+
+/// Reads `reader` to the end in reads of varying sizes.
+series read_series(cio::timeseries_reader &reader) {
+    series points;
+    std::int64_t timestamps[17];
+    double values[17];
+    for (std::size_t i = 1;; ++i) {
+        auto n = reader.read(timestamps, values, i % 17 + 1);
+        if (n == 0) {
+            return points;
+        }
+        points.timestamps.insert(points.timestamps.end(), timestamps, timestamps + n);
+        points.values.insert(points.values.end(), values, values + n);
+    }
+}
+
+/// Returns `true` if `lhs` and `rhs` hold the same timestamps and the same value bits, so NaNs and signed zeros match.
+bool identical(const series &lhs, const series &rhs) {
+    return lhs.timestamps == rhs.timestamps && lhs.values.size() == rhs.values.size() &&
+           std::memcmp(lhs.values.data(), rhs.values.data(), lhs.values.size() * sizeof(double)) == 0;
+}
+
+} /* namespace */
+
+bool cio_test::timeseries_round_trips() noexcept {
+    try {
+        using limits = std::numeric_limits<std::int64_t>;
+        auto nan_with_payload = std::numeric_limits<double>::quiet_NaN();
+        std::uint64_t bits;
+        std::memcpy(&bits, &nan_with_payload, sizeof bits);
+        bits |= 0x5a5a5;
+        std::memcpy(&nan_with_payload, &bits, sizeof bits);
+        const double specials[] = {std::numeric_limits<double>::quiet_NaN(), -std::numeric_limits<double>::quiet_NaN(),
+                                   nan_with_payload, -0.0, 0.0, -0.0, std::numeric_limits<double>::infinity(),
+                                   -std::numeric_limits<double>::infinity(), std::numeric_limits<double>::denorm_min(),
+                                   std::numeric_limits<double>::max(), std::numeric_limits<double>::lowest()};
+
+        // Regular and jittered intervals, runs of repeated values, slowly changing values, random values, special
+        // values, and timestamps at and jumping between the extremes of the range
+        series points;
+        std::mt19937_64 rng{197};
+        std::int64_t timestamp = 1700000000000;
+        double value = 20.5;
+        for (int i = 0; i < 3000; ++i) {
+            if (i < 300) {
+                timestamp += 1000;
+            } else if (i < 600) {
+                timestamp += 1000 + static_cast<std::int64_t>(rng() % 7) - 3;
+            } else if (i < 900) {
+                timestamp += static_cast<std::int64_t>(rng() % 5000);
+            } else if (i < 1200) {
+                timestamp = i % 2 ? limits::max() - i : limits::min() + i;
+            } else if (i < 1500) {
+                timestamp = static_cast<std::int64_t>(rng());
+            } else {
+                timestamp += 60000;
+            }
+            if (i % 5 == 0) {
+                value = specials[rng() % std::size(specials)];
+            } else if (i % 5 == 2) {
+                value = std::nearbyint(value * 100 + 1) / 100;
+            } else if (i % 5 == 3) {
+                bits = rng();
+                std::memcpy(&value, &bits, sizeof value);
+            } else if (i % 5 == 4) {
+                value = static_cast<double>(i);
+            }
+            points.timestamps.push_back(timestamp);
+            points.values.push_back(value);
+        }
+        points.timestamps.push_back(limits::min());
+        points.values.push_back(-0.0);
+        points.timestamps.push_back(limits::max());
+        points.values.push_back(std::numeric_limits<double>::quiet_NaN());
+
+        // Blocks of one point, a partial last block, an exact multiple of the block size and the largest blocks
+        for (std::size_t block_points : {std::size_t{1}, std::size_t{7}, points.timestamps.size() / 2,
+                                         cio::timeseries_format::max_block_points}) {
+            auto stream = cio::cstream::memfd("cio-test");
+            if (!write_series(stream, points, block_points)) {
+                return false;
+            }
+            stream.rewind();
+            cio::timeseries_reader reader{stream};
+            std::int64_t t;
+            double v;
+            if (!reader || !identical(read_series(reader), points) || reader.next(t, v) || !reader.feof() ||
+                reader.ferror()) {
+                return false;
+            }
+        }
+
+        // An empty series has only the end marker
+        auto stream = cio::cstream::memfd("cio-test");
+        if (!write_series(stream, {}, 16)) {
+            return false;
+        }
+        stream.rewind();
+        cio::timeseries_reader reader{stream};
+        return reader && read_series(reader).timestamps.empty() && reader.feof() && !reader.ferror();
+    } catch (...) {
+        return false;
+    }
+}
+
+bool cio_test::timeseries_skips_blocks_outside_range() noexcept {
+    try {
+        // 40 blocks of 50 points, one second apart
+        constexpr std::size_t block_points = 50;
+        series points;
+        for (std::int64_t i = 0; i < 40 * static_cast<std::int64_t>(block_points); ++i) {
+            points.timestamps.push_back(i * 1000);
+            points.values.push_back(std::sin(static_cast<double>(i)));
+        }
+        auto stream = cio::cstream::memfd("cio-test");
+        if (!write_series(stream, points, block_points)) {
+            return false;
+        }
+        stream.rewind();
+        auto container = read_all(stream);
+
+        // The range starts inside block 10 and ends inside block 13, so the other 36 blocks are skipped
+        constexpr std::int64_t begin = (10 * 50 + 17) * 1000, end = (13 * 50 + 3) * 1000 + 500;
+        series expected;
+        for (std::size_t i = 0; i < points.timestamps.size(); ++i) {
+            if (points.timestamps[i] >= begin && points.timestamps[i] <= end) {
+                expected.timestamps.push_back(points.timestamps[i]);
+                expected.values.push_back(points.values[i]);
+            }
+        }
+
+        // Skipping seeks in a file and reads past the payload in a pipe
+        auto [read_end, write_end] = cio::cstream::pipe();
+        if (!read_end || write_end.fwrite(container.data(), 1, container.size()) != container.size() ||
+            write_end.fclose() != 0) {
+            return false;
+        }
+        auto file = scratch_stream(container);
+        for (auto *input : {&file, &read_end}) {
+            cio::timeseries_reader reader{*input};
+            reader.set_range(begin, end);
+            if (!reader || !identical(read_series(reader), expected) || reader.blocks_skipped() != 36 ||
+                !reader.feof() || reader.ferror()) {
+                return false;
+            }
+        }
+
+        // A range between two points decompresses only the block containing it and returns nothing
+        file.rewind();
+        cio::timeseries_reader reader{file};
+        reader.set_range(1001, 1999);
+        return read_series(reader).timestamps.empty() && reader.blocks_skipped() == 39 &&
+               reader.feof() && !reader.ferror();
+    } catch (...) {
+        return false;
+    }
+}
@@ -0,0 +1,349 @@
+//
+// SPDX-FileCopyrightText: 2024 Stephen F. Booth <contact@sbooth.dev>
+// SPDX-License-Identifier: MIT
+//
+// Part of https://github.com/sbooth/cio
+//
+
+#import <algorithm>
+#import <cstdint>
+#import <iterator>
+#import <random>
+#import <vector>
+
+#import "cioTestSupport.hpp"
+#import "test_support.hpp"
+#import "unicode.hpp"
+
+namespace {
+
+/// Appends the UTF-8 encoding of the code point `c` to `out`.
+void append_utf8(std::vector<unsigned char> &out, std::uint32_t c) {
+    if (c < 0x80) {
+        out.push_back(static_cast<unsigned char>(c));
+    } else if (c < 0x800) {
+        out.push_back(static_cast<unsigned char>(0xc0 | (c >> 6)));
+        out.push_back(static_cast<unsigned char>(0x80 | (c & 0x3f)));
+    } else if (c < 0x10000) {
+        out.push_back(static_cast<unsigned char>(0xe0 | (c >> 12)));
+        out.push_back(static_cast<unsigned char>(0x80 | ((c >> 6) & 0x3f)));
+        out.push_back(static_cast<unsigned char>(0x80 | (c & 0x3f)));
+    } else {
+        out.push_back(static_cast<unsigned char>(0xf0 | (c >> 18)));
+        out.push_back(static_cast<unsigned char>(0x80 | ((c >> 12) & 0x3f)));
+        out.push_back(static_cast<unsigned char>(0x80 | ((c >> 6) & 0x3f)));
+        out.push_back(static_cast<unsigned char>(0x80 | (c & 0x3f)));
+    }
+}
+
+/// Returns `count` random code points, mostly ASCII with runs of two-, three- and four-byte characters.
+std::vector<std::uint32_t> random_code_points(std::size_t count, std::mt19937 &rng) {
+    std::vector<std::uint32_t> points;
+    points.reserve(count);
+    while (points.size() < count) {
+        switch (rng() % 5) {
+            case 0:
+            case 1:
+                // A run of ASCII long enough for the vector paths
+                for (auto n = rng() % 40; n > 0; --n) {
+                    points.push_back(0x20 + rng() % 0x5f);
+                }
+                break;
+            case 2:
+                points.push_back(0x80 + rng() % 0x780);
+                break;
+            case 3: {
+                auto c = 0x800 + rng() % 0xf800;
+                points.push_back(c >= 0xd800 && c < 0xe000 ? c + 0x800 : c);
+                break;
+            }
+            default:
+                points.push_back(0x10000 + rng() % 0x100000);
+                break;
+        }
+    }
+    points.resize(count);
+    return points;
+}
+
+/// Returns the UTF-8 encoding of `points`.
+std::vector<unsigned char> to_utf8(const std::vector<std::uint32_t> &points) {
+    std::vector<unsigned char> bytes;
+    for (auto c : points) {
+        append_utf8(bytes, c);
+    }
+    return bytes;
+}
+
+/// Returns the UTF-16 code units of `points`.
+std::vector<std::uint16_t> to_utf16(const std::vector<std::uint32_t> &points) {
+    std::vector<std::uint16_t> units;
+    for (auto c : points) {
+        if (c < 0x10000) {
+            units.push_back(static_cast<std::uint16_t>(c));
+        } else {
+            units.push_back(static_cast<std::uint16_t>(0xd800 + ((c - 0x10000) >> 10)));
+            units.push_back(static_cast<std::uint16_t>(0xdc00 + ((c - 0x10000) & 0x3ff)));
+        }
+    }
+    return units;
+}
+
+/// Returns `units` as bytes in `order`, preceded by a byte order mark if `bom` is `true`.
+std::vector<unsigned char> utf16_bytes(const std::vector<std::uint16_t> &units, cio::cstream::byte_order order,
+                                       bool bom) {
+    std::vector<unsigned char> bytes;
+    auto append = [&](std::uint16_t unit) {
+        auto high = static_cast<unsigned char>(unit >> 8), low = static_cast<unsigned char>(unit);
+        if (order == cio::cstream::byte_order::little_endian) {
+            bytes.insert(bytes.end(), {low, high});
+        } else {
+            bytes.insert(bytes.end(), {high, low});
+        }
+    };
+    if (bom) {
+        append(0xfeff);
+    }
+    for (auto unit : units) {
+        append(unit);
+    }
+    return bytes;
+}
+
+/// Returns `true` if both validators agree on `bytes` and the valid prefix found by `utf8_valid_length()` is valid.
+bool validators_agree(const std::vector<unsigned char> &bytes) {
+    auto length = cio::utf8_valid_length(bytes.data(), bytes.size());
+    if (cio::is_valid_utf8(bytes.data(), bytes.size()) != (length == bytes.size())) {
+        return false;
+    }
+    return length <= bytes.size() && cio::is_valid_utf8(bytes.data(), length);
+}
+
+/// Reads `bytes` through a `cio::utf8_reader` and returns `true` if the output and error state are as expected.
+bool utf8_reads_as(const std::vector<unsigned char> &bytes, std::size_t block_size) {
+    auto stream = cio_test::scratch_stream(bytes);
+    cio::utf8_reader reader{stream, block_size};
+    auto output = cio_test::read_all(reader, static_cast<std::uint32_t>(block_size));
+    auto valid = cio::utf8_valid_length(bytes.data(), bytes.size());
+    if (output.size() != valid || !std::equal(output.begin(), output.end(), bytes.begin())) {
+        return false;
+    }
+    if (valid == bytes.size()) {
+        return !reader.invalid() && !reader.ferror() && reader.feof() && static_cast<bool>(reader);
+    }
+    return reader.invalid() && reader.ferror() && !reader && reader.error_offset() == valid;
+}
+
+} /* namespace */
+
+bool cio_test::utf8_validators_agree() noexcept {
+    try {
+        // Known invalid sequences: stray continuations, overlong forms, surrogates, code points above U+10FFFF,
+        // bytes that never appear and truncated characters
+        const std::vector<std::vector<unsigned char>> invalid = {
+                {0x80}, {0xbf}, {0xc0, 0x80}, {0xc1, 0xbf}, {0xe0, 0x80, 0x80}, {0xe0, 0x9f, 0xbf},
+                {0xed, 0xa0, 0x80}, {0xed, 0xbf, 0xbf}, {0xf0, 0x80, 0x80, 0x80}, {0xf0, 0x8f, 0xbf, 0xbf},
+                {0xf4, 0x90, 0x80, 0x80}, {0xf5, 0x80, 0x80, 0x80}, {0xfe}, {0xff}, {0xc2}, {0xe2, 0x82},
+                {0xf0, 0x9f, 0x98}, {0xc2, 0x41}, {0xe2, 0x41, 0x82},
+        };
+        const std::vector<std::vector<unsigned char>> valid = {
+                {0xc2, 0x80}, {0xdf, 0xbf}, {0xe0, 0xa0, 0x80}, {0xed, 0x9f, 0xbf}, {0xee, 0x80, 0x80},
+                {0xef, 0xbf, 0xbf}, {0xf0, 0x90, 0x80, 0x80}, {0xf4, 0x8f, 0xbf, 0xbf},
+        };
+
+        // Each sequence after every length of ASCII prefix around the 64-byte blocks, then followed by ASCII
+        for (std::size_t prefix = 0; prefix < 140; ++prefix) {
+            for (const auto *set : {&invalid, &valid}) {
+                for (const auto &sequence : *set) {
+                    std::vector<unsigned char> bytes(prefix, 'a');
+                    bytes.insert(bytes.end(), sequence.begin(), sequence.end());
+                    if (!validators_agree(bytes) ||
+                        cio::is_valid_utf8(bytes.data(), bytes.size()) != (set == &valid)) {
+                        return false;
+                    }
+                    bytes.insert(bytes.end(), 70, 'b');
+                    if (!validators_agree(bytes) ||
+                        (set == &valid && !cio::is_valid_utf8(bytes.data(), bytes.size()))) {
+                        return false;
+                    }
+                }
+            }
+        }
+
+        // Valid text with random bytes replaced, inserted or removed, truncated at every length
+        std::mt19937 rng{283};
+        for (int round = 0; round < 400; ++round) {
+            auto bytes = to_utf8(random_code_points(1 + rng() % 200, rng));
+            if (!validators_agree(bytes) || !cio::is_valid_utf8(bytes.data(), bytes.size())) {
+                return false;
+            }
+            for (auto n = rng() % 3; n > 0; --n) {
+                auto at = rng() % bytes.size();
+                switch (rng() % 3) {
+                    case 0:
+                        bytes[at] = static_cast<unsigned char>(rng());
+                        break;
+                    case 1:
+                        bytes.insert(bytes.begin() + static_cast<std::ptrdiff_t>(at),
+                                     static_cast<unsigned char>(rng()));
+                        break;
+                    default:
+                        bytes.erase(bytes.begin() + static_cast<std::ptrdiff_t>(at));
+                        break;
+                }
+                if (bytes.empty()) {
+                    break;
+                }
+            }
+            for (std::size_t length = 0; length <= bytes.size(); ++length) {
+                if (!validators_agree({bytes.begin(), bytes.begin() + static_cast<std::ptrdiff_t>(length)})) {
+                    return false;
+                }
+            }
+        }
+
+        // Random bytes, mostly invalid
+        for (std::size_t size = 0; size < 300; ++size) {
+            if (!validators_agree(random_bytes(size, static_cast<std::uint32_t>(size)))) {
+                return false;
+            }
+        }
+        return true;
+    } catch (...) {
+        return false;
+    }
+}
+
+bool cio_test::utf8_reader_reports_error_offsets() noexcept {
+    try {
+        std::mt19937 rng{293};
+        auto text = to_utf8(random_code_points(20000, rng));
+        const std::size_t block_sizes[] = {64, 65, 67, 100, 4096};
+
+        // Valid text reads back unchanged whatever the block size
+        for (auto block_size : block_sizes) {
+            if (!utf8_reads_as(text, block_size)) {
+                return false;
+            }
+        }
+
+        // An invalid byte returns the text before it and reports its offset, including near the block boundaries
+        const unsigned char bad_bytes[] = {0x80, 0xc0, 0xed, 0xf5, 0xff};
+        for (int round = 0; round < 60; ++round) {
+            auto bytes = text;
+            auto at = round < 10 ? 60 + static_cast<std::size_t>(round) : rng() % bytes.size();
+            bytes.insert(bytes.begin() + static_cast<std::ptrdiff_t>(at), bad_bytes[rng() % std::size(bad_bytes)]);
+            for (auto block_size : block_sizes) {
+                if (!utf8_reads_as(bytes, block_size)) {
+                    return false;
+                }
+            }
+        }
+
+        // A character truncated by the end of the stream is invalid
+        std::vector<unsigned char> truncated(100, 'a');
+        truncated.insert(truncated.end(), {0xf0, 0x9f, 0x98});
+        auto stream = scratch_stream(truncated);
+        cio::utf8_reader reader{stream, 64};
+        auto output = read_all(reader);
+        return output.size() == 100 && reader.invalid() && reader.error_offset() == 100;
+    } catch (...) {
+        return false;
+    }
+}
+
+bool cio_test::utf16_reader_converts_surrogates() noexcept {
+    try {
+        using byte_order = cio::cstream::byte_order;
+        std::mt19937 rng{307};
+        auto points = random_code_points(5000, rng);
+        auto units = to_utf16(points);
+        auto expected = to_utf8(points);
+        const std::size_t block_sizes[] = {33, 35, 37, 64, 101, 4096};
+
+        // Both byte orders, with a byte order mark overriding the order given or without one; the odd block sizes
+        // move the surrogate pairs across the block boundaries
+        for (auto order : {byte_order::little_endian, byte_order::big_endian}) {
+            auto other = order == byte_order::little_endian ? byte_order::big_endian : byte_order::little_endian;
+            for (bool bom : {true, false}) {
+                auto bytes = utf16_bytes(units, order, bom);
+                for (auto block_size : block_sizes) {
+                    auto stream = scratch_stream(bytes);
+                    cio::utf16_reader reader{stream, bom ? other : order, block_size};
+                    auto output = read_all(reader, static_cast<std::uint32_t>(block_size));
+                    if (reader.byte_order() != order || output != expected || reader.invalid() || reader.ferror() ||
+                        !reader.feof()) {
+                        return false;
+                    }
+                }
+            }
+        }
+
+        // Surrogate pairs at every offset within the first blocks
+        for (std::size_t offset = 0; offset < 40; ++offset) {
+            std::vector<std::uint32_t> paired(offset, 'a');
+            paired.insert(paired.end(), {0x1f600, 0x10000, 0x10ffff, 'z'});
+            auto bytes = utf16_bytes(to_utf16(paired), byte_order::big_endian, true);
+            for (auto block_size : block_sizes) {
+                auto stream = scratch_stream(bytes);
+                cio::utf16_reader reader{stream, byte_order::little_endian, block_size};
+                if (read_all(reader) != to_utf8(paired) || reader.invalid()) {
+                    return false;
+                }
+            }
+        }
+
+        // An unpaired surrogate returns the text before it and reports its offset, counting the byte order mark
+        for (int round = 0; round < 60; ++round) {
+            auto damaged = units;
+            auto at = rng() % damaged.size();
+            // Skip to the start of a character
+            if ((damaged[at] & 0xfc00) == 0xdc00) {
+                ++at;
+            }
+            auto lone = static_cast<std::uint16_t>(rng() % 2 == 0 ? 0xd800 + rng() % 0x400 : 0xdc00 + rng() % 0x400);
+            damaged.insert(damaged.begin() + static_cast<std::ptrdiff_t>(at), lone);
+            if (lone < 0xdc00 && at + 1 < damaged.size() && (damaged[at + 1] & 0xfc00) == 0xdc00) {
+                // The high surrogate would pair with the low surrogate of the character after it
+                damaged[at] = 0xdc00;
+            }
+            std::vector<unsigned char> before;
+            for (std::size_t i = 0; i < at;) {
+                std::uint32_t c = damaged[i];
+                if ((c & 0xfc00) == 0xd800) {
+                    c = 0x10000 + ((c - 0xd800) << 10) + (damaged[i + 1] - 0xdc00u);
+                    i += 2;
+                } else {
+                    ++i;
+                }
+                append_utf8(before, c);
+            }
+            for (bool bom : {true, false}) {
+                auto bytes = utf16_bytes(damaged, byte_order::big_endian, bom);
+                for (auto block_size : block_sizes) {
+                    auto stream = scratch_stream(bytes);
+                    cio::utf16_reader reader{stream, byte_order::big_endian, block_size};
+                    if (read_all(reader) != before || !reader.invalid() || !reader.ferror() ||
+                        reader.error_offset() != 2 * at + (bom ? 2 : 0)) {
+                        return false;
+                    }
+                }
+            }
+        }
+
+        // A high surrogate ending the stream and a truncated final code unit are invalid
+        for (auto tail : {std::vector<unsigned char>{0xd8, 0x3d}, std::vector<unsigned char>{0x00}}) {
+            auto bytes = utf16_bytes(to_utf16(std::vector<std::uint32_t>(50, 'a')), byte_order::big_endian, true);
+            bytes.insert(bytes.end(), tail.begin(), tail.end());
+            auto stream = scratch_stream(bytes);
+            cio::utf16_reader reader{stream, byte_order::little_endian, 33};
+            if (read_all(reader) != std::vector<unsigned char>(50, 'a') || !reader.invalid() ||
+                reader.error_offset() != 102) {
+                return false;
+            }
+        }
+        return true;
+    } catch (...) {
+        return false;
+    }
+}
@@ -7,9 +7,142 @@
 
 import Testing
 @testable import cio
+import cioTestSupport
 
 @Test func stream_test() async throws {
     let f = cio.cstream()
     let valid = f.__convertToBool()
     #expect(!valid)
 }
+
+@Test func mapped_file_test() async throws {
+    #expect(cio_test.mapped_file_reads_back())
+    #expect(cio_test.mapped_file_counts_faults())
+}
+
+@Test func memory_map_test() async throws {
+    #expect(cio_test.memory_map_shares_scratch_stream())
+}
+
+@Test func spill_stream_test() async throws {
+    #expect(cio_test.spill_stream_round_trips_across_threshold())
+}
+
+@Test func concat_stream_test() async throws {
+    #expect(cio_test.concat_stream_reads_across_segments())
+}
+
+@Test func substream_test() async throws {
+    #expect(cio_test.substream_reads_within_range())
+}
+
+@Test func record_reader_test() async throws {
+    #expect(cio_test.record_reader_transposes_records())
+}
+
+@Test func column_reader_test() async throws {
+    #expect(cio_test.column_reader_reads_what_column_writer_wrote())
+    #expect(cio_test.column_reader_rejects_wrapping_chunk())
+}
+
+@Test func record_range_test() async throws {
+    #expect(cio_test.record_range_iterates_values())
+}
+
+@Test func generator_test() async throws {
+    #expect(cio_test.generator_decodes_records_lazily())
+}
+
+@Test func stream_multiplexer_test() async throws {
+    #expect(cio_test.stream_multiplexer_delivers_lines())
+    #expect(cio_test.stream_multiplexer_allows_handler_changes())
+}
+
+@Test func pstream_test() async throws {
+    #expect(cio_test.pstream_reads_and_writes_processes())
+    #expect(cio_test.cstream_pipe_is_close_on_exec())
+    #expect(cio_test.cstream_pipe_capacity_can_grow())
+    #expect(cio_test.cstream_pipe_splices_pages())
+    #expect(cio_test.cstream_sets_nonblocking())
+}
+
+@Test func local_socket_test() async throws {
+    #expect(cio_test.local_socket_transfers_bytes())
+    #expect(cio_test.local_socket_receives_empty_frames())
+    #expect(cio_test.local_socket_passes_descriptors())
+    #expect(cio_test.local_socket_is_close_on_exec())
+}
+
+@Test func shm_ring_test() async throws {
+    #expect(cio_test.shm_ring_streams_between_attachments())
+}
+
+@Test func pooled_stream_test() async throws {
+    #expect(cio_test.pooled_stream_round_trips())
+    #expect(cio_test.buffer_pool_counts_thread_caches())
+}
+
+@Test func line_index_test() async throws {
+    #expect(cio_test.line_index_seeks_to_lines())
+    #expect(cio_test.line_index_reuses_sidecar())
+}
+
+@Test func memory_governor_test() async throws {
+    #expect(cio_test.memory_governor_limits_readers())
+    #expect(cio_test.memory_governor_throttles_writers())
+    #expect(cio_test.memory_governor_limits_remaining_buffers())
+}
+
+@Test func lz77_test() async throws {
+    #expect(cio_test.lz77_round_trips())
+    #expect(cio_test.lz77_rejects_corrupt_input())
+}
+
+@Test func compressed_stream_test() async throws {
+    #expect(cio_test.compressed_stream_round_trips())
+    #expect(cio_test.compressed_reader_reports_truncation())
+}
+
+@Test func seekable_compressed_test() async throws {
+    #expect(cio_test.seekable_compressed_reads_at_random())
+    #expect(cio_test.seekable_compressed_refuses_damaged_trailers())
+}
+
+@Test func timeseries_test() async throws {
+    #expect(cio_test.timeseries_round_trips())
+    #expect(cio_test.timeseries_skips_blocks_outside_range())
+}
+
+@Test func bitpack_test() async throws {
+    #expect(cio_test.packed_uints_round_trip())
+}
+
+@Test func sha256_test() async throws {
+    #expect(cio_test.sha256_matches_known_answers())
+}
+
+@Test func cdc_chunker_test() async throws {
+    #expect(cio_test.cdc_chunker_respects_bounds())
+    #expect(cio_test.cdc_chunker_boundaries_survive_insertion())
+}
+
+@Test func search_test() async throws {
+    #expect(cio_test.find_crosses_block_boundaries())
+    #expect(cio_test.pattern_matcher_matches_naive_search())
+}
+
+@Test func csv_reader_test() async throws {
+    #expect(cio_test.csv_reader_splits_quoted_fields())
+    #expect(cio_test.csv_reader_parses_in_parallel())
+}
+
+@Test func ndjson_splitter_test() async throws {
+    #expect(cio_test.ndjson_splitter_respects_strings())
+    #expect(cio_test.ndjson_splitter_dispatches_every_record())
+}
+
+@Test func unicode_test() async throws {
+    #expect(cio_test.utf8_validators_agree())
+    #expect(cio_test.utf8_reader_reports_error_offsets())
+    #expect(cio_test.utf16_reader_converts_surrogates())
+}